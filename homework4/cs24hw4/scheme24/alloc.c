@@ -6,15 +6,25 @@
 
 
 #include "alloc.h"
-#include "ptr_vector.h"
+#include "vector.h"
+#include "jit.h"
+#include "constants.h"
+#include "profile.h"
+#include "weak.h"
 
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 
-/*! Change to #define to output garbage-collector statistics. */
+/*!
+ * Change to #define to output garbage-collector statistics.  Compiling with
+ * -DNO_GC_STATS also turns this off, which the benchmark build does.
+ */
+#ifndef NO_GC_STATS
 #define GC_STATS
+#endif
 
 /*!
  * Change to #undef to cause the garbage collector to only run when it has to.
@@ -22,8 +32,11 @@
  *
  * However, while testing GC, it's easiest if you try it all the time, so that
  * the number of objects being manipulated is small and easy to understand.
+ * Compiling with -DNO_ALWAYS_GC also turns this off.
  */
+#ifndef NO_ALWAYS_GC
 #define ALWAYS_GC
+#endif
 
 
 /* Change to #define for other verbose output. */
@@ -33,20 +46,39 @@
 void free_value(Value *v);
 void free_lambda(Lambda *f);
 void free_environment(Environment *env);
+void free_string(String *str);
 
 void mark_environment(Environment *);
 void mark_value(Value *);
 void mark_lambda(Lambda *);
-void mark_eval_stack(PtrStack *);
+void mark_string(String *);
+void mark_eval_stack(EvaluationStack *);
+void mark_ephemerons();
+void clear_weak_references();
 void sweep_values();
 void sweep_lambdas();
 void sweep_environments();
+void sweep_strings();
+void unmark_region_environments();
+
+#ifdef ALLOC_PROFILE
+long value_bytes(const Value *v);
+long environment_bytes(const Environment *env);
+long string_bytes(const String *str);
+#endif
+
+/* The typed vectors that the allocator uses to keep track of objects. */
+DEFINE_VECTOR(ValueVector, vv, Value *, 16)
+DEFINE_VECTOR(LambdaVector, lv, Lambda *, 16)
+DEFINE_VECTOR(EnvironmentVector, ev, Environment *, 16)
+DEFINE_VECTOR(StringVector, sv, String *, 16)
+
 
 /*!
  * A growable vector of pointers to all Value structs that are currently
  * allocated.
  */
-static PtrVector allocated_values;
+static ValueVector allocated_values;
 
 
 /*!
@@ -54,14 +86,83 @@ static PtrVector allocated_values;
  * allocated.  Note that each Lambda struct will only have ONE Value struct that
  * points to it.
  */
-static PtrVector allocated_lambdas;
+static LambdaVector allocated_lambdas;
 
 
 /*!
  * A growable vector of pointers to all Environment structs that are currently
  * allocated.
  */
-static PtrVector allocated_environments;
+static EnvironmentVector allocated_environments;
+
+
+/*!
+ * A growable vector of pointers to all String structs that are currently
+ * allocated.  Strings are shared between values, so they are collected
+ * separately from the values that refer to them.
+ */
+static StringVector allocated_strings;
+
+
+/*!
+ * The number of bytes of characters stored by the allocated strings that own
+ * their characters.  Views share their base string's characters, so they
+ * don't add to this; each string's characters are counted once.
+ */
+static long allocated_string_chars;
+
+
+/*!
+ * Running totals of how many objects have been allocated, and how many
+ * collections have been performed, since the interpreter started.
+ */
+static AllocStats alloc_stats;
+
+
+/*! The size of each chunk of memory the frame region allocates from. */
+#define REGION_CHUNK_SIZE 65536
+
+/*! Allocations from the frame region are rounded up to this alignment. */
+#define REGION_ALIGN sizeof(void *)
+
+
+/*!
+ * The frame region is a stack of chunks that environments which can't escape
+ * their call are allocated from.  Allocation bumps the top of the newest
+ * chunk, and a call releases everything it allocated by going back to the
+ * mark it took on entry.
+ */
+typedef struct RegionChunk {
+    struct RegionChunk *prev;   /*!< The next-older chunk in the region. */
+    size_t size;                /*!< The number of bytes in data[]. */
+    size_t used;                /*!< The number of bytes of data[] in use. */
+    char data[];
+} RegionChunk;
+
+
+/*! The newest chunk of the frame region, or NULL if nothing is allocated. */
+static RegionChunk *region_top;
+
+/*!
+ * One released chunk is kept around for reuse, so that a call sequence that
+ * keeps crossing a chunk boundary doesn't call malloc and free every time.
+ */
+static RegionChunk *region_spare;
+
+/*!
+ * Region environments reached while marking.  They aren't swept, so their
+ * marks are cleared from this list once the collection is done.
+ */
+static EnvironmentVector marked_region_envs;
+
+
+/*!
+ * Weak boxes and ephemeron tables reached while marking.  Marking them
+ * doesn't mark what they refer to; once everything else has been marked,
+ * mark_ephemerons() marks the table entries whose keys are reachable, and
+ * then clear_weak_references() drops the references to anything that wasn't.
+ */
+static ValueVector marked_weak_values;
 
 
 #ifndef ALWAYS_GC
@@ -73,9 +174,12 @@ static long max_allocation_size = 1048576;
 
 
 void init_alloc() {
-    pv_init(&allocated_values);
-    pv_init(&allocated_lambdas);
-    pv_init(&allocated_environments);
+    vv_init(&allocated_values);
+    lv_init(&allocated_lambdas);
+    ev_init(&allocated_environments);
+    sv_init(&allocated_strings);
+    ev_init(&marked_region_envs);
+    vv_init(&marked_weak_values);
 }
 
 
@@ -91,8 +195,19 @@ void print_alloc_stats(FILE *f) {
     fprintf(f, "\tAllocated values:  %u\n", allocated_values.size);
     */
 
-    fprintf(f, "%d vals \t%d lambdas \t%d envs\n", allocated_values.size,
-        allocated_lambdas.size, allocated_environments.size);
+    fprintf(f, "%d vals \t%d lambdas \t%d envs \t%d strings\n",
+        allocated_values.size, allocated_lambdas.size,
+        allocated_environments.size, allocated_strings.size);
+}
+
+
+/*!
+ * Reports the total number of objects of each type allocated so far, and the
+ * number of garbage collections performed and the time they took.
+ */
+void get_alloc_stats(AllocStats *stats) {
+    assert(stats != NULL);
+    *stats = alloc_stats;
 }
 
 
@@ -107,6 +222,8 @@ long allocation_size() {
     size += sizeof(Value) * allocated_values.size;
     size += sizeof(Lambda) * allocated_lambdas.size;
     size += sizeof(Value) * allocated_environments.size;
+    size += sizeof(String) * allocated_strings.size;
+    size += allocated_string_chars;
     
     return size;
 }
@@ -120,7 +237,12 @@ Value * alloc_value(void) {
     Value *v = malloc(sizeof(Value));
     memset(v, 0, sizeof(Value));
 
-    pv_add_elem(&allocated_values, v);
+    vv_push(&allocated_values, v);
+    alloc_stats.num_values++;
+
+#ifdef ALLOC_PROFILE
+    profile_tag(&v->alloc_tag);
+#endif
 
     return v;
 }
@@ -145,9 +267,15 @@ void free_value(Value *v) {
      * unreachable objects.
      */
 
-    if (v->type == T_String || v->type == T_Atom || v->type == T_Error)
+    /* Similarly, a string value's String is freed by free_string(). */
+
+    if (v->type == T_Atom || v->type == T_Error)
         free(v->string_val);
 
+    /* An ephemeron table's entries are owned by the table's value. */
+    if (v->type == T_WeakTable)
+        weak_table_free(v->table_val);
+
     free(v);
 }
 
@@ -161,7 +289,12 @@ Lambda * alloc_lambda(void) {
     Lambda *f = malloc(sizeof(Lambda));
     memset(f, 0, sizeof(Lambda));
 
-    pv_add_elem(&allocated_lambdas, f);
+    lv_push(&allocated_lambdas, f);
+    alloc_stats.num_lambdas++;
+
+#ifdef ALLOC_PROFILE
+    profile_tag(&f->alloc_tag);
+#endif
 
     return f;
 }
@@ -179,9 +312,14 @@ void free_lambda(Lambda *f) {
 
     /* Lambdas typically reference lists of Value objects for the argument-spec
      * and the body, but we don't need to free these here because they are
-     * managed separately.
+     * managed separately.  Any machine code compiled for the lambda is owned
+     * by the lambda though.
      */
 
+#ifdef JIT_ENABLED
+    jit_release(f);
+#endif
+
     free(f);
 }
 
@@ -195,7 +333,109 @@ Environment * alloc_environment(void) {
     Environment *env = malloc(sizeof(Environment));
     memset(env, 0, sizeof(Environment));
 
-    pv_add_elem(&allocated_environments, env);
+    ev_push(&allocated_environments, env);
+    alloc_stats.num_environments++;
+
+#ifdef ALLOC_PROFILE
+    profile_tag(&env->alloc_tag);
+#endif
+
+    return env;
+}
+
+
+/*!
+ * Returns the current top of the frame region, so that everything allocated
+ * after this point can be released with region_release().
+ */
+RegionMark region_mark(void) {
+    RegionMark mark;
+
+    mark.chunk = region_top;
+    mark.used = (region_top != NULL ? region_top->used : 0);
+
+    return mark;
+}
+
+
+/*!
+ * Allocates the specified number of bytes from the frame region.  The memory
+ * is only valid until the region is released to a mark taken before this
+ * call.
+ */
+void * region_alloc(size_t size) {
+    RegionChunk *chunk;
+    void *p;
+
+    size = (size + REGION_ALIGN - 1) & ~(REGION_ALIGN - 1);
+
+    if (region_top == NULL || region_top->used + size > region_top->size) {
+        size_t chunk_size = (size > REGION_CHUNK_SIZE ? size : REGION_CHUNK_SIZE);
+
+        if (region_spare != NULL && region_spare->size >= chunk_size) {
+            chunk = region_spare;
+            region_spare = NULL;
+        }
+        else {
+            chunk = malloc(sizeof(RegionChunk) + chunk_size);
+            chunk->size = chunk_size;
+        }
+
+        chunk->prev = region_top;
+        chunk->used = 0;
+        region_top = chunk;
+    }
+
+    p = region_top->data + region_top->used;
+    region_top->used += size;
+
+    return p;
+}
+
+
+/*!
+ * Releases everything allocated from the frame region since the specified
+ * mark was taken.  Marks must be released in the reverse order that they
+ * were taken.
+ */
+void region_release(RegionMark mark) {
+    while (region_top != mark.chunk) {
+        RegionChunk *chunk = region_top;
+
+        assert(chunk != NULL);
+        region_top = chunk->prev;
+
+        if (region_spare == NULL) {
+            region_spare = chunk;
+        }
+        else {
+            free(chunk);
+        }
+    }
+
+    if (region_top != NULL) {
+        assert(mark.used <= region_top->used);
+        region_top->used = mark.used;
+    }
+}
+
+
+/*!
+ * This function allocates a new Environment struct from the frame region,
+ * with room for the specified number of bindings.  The garbage collector
+ * doesn't track these environments; they are released along with the
+ * region, so they must not be referenced by anything that outlives the
+ * call that allocated them.
+ */
+Environment * alloc_region_environment(int capacity) {
+    Environment *env = region_alloc(sizeof(Environment));
+    memset(env, 0, sizeof(Environment));
+
+    env->in_region = 1;
+    if (capacity > 0) {
+        env->bindings = region_alloc(capacity * sizeof(Binding));
+        env->capacity = capacity;
+    }
 
     return env;
 }
@@ -225,6 +465,84 @@ void free_environment(Environment *env) {
 }
 
 
+/*!
+ * This function heap-allocates a new String struct with room for the
+ * specified number of characters (plus a NUL terminator) stored inline, and
+ * records the struct's pointer in the allocated_strings vector.  The caller
+ * must fill in the characters and the hash.
+ */
+String * alloc_string(int length) {
+    String *str = malloc(sizeof(String) + length + 1);
+    memset(str, 0, sizeof(String));
+
+    str->length = length;
+    str->chars = str->data;
+    str->data[length] = '\0';
+
+    sv_push(&allocated_strings, str);
+    allocated_string_chars += length + 1;
+    alloc_stats.num_strings++;
+
+#ifdef ALLOC_PROFILE
+    profile_tag(&str->alloc_tag);
+#endif
+
+    return str;
+}
+
+
+/*!
+ * This function heap-allocates a new String struct that refers to a range of
+ * another string's characters, rather than storing its own.  The caller must
+ * fill in the hash.
+ */
+String * alloc_string_view(String *base, int offset, int length) {
+    String *str = malloc(sizeof(String));
+    memset(str, 0, sizeof(String));
+
+    assert(base != NULL);
+    assert(offset >= 0 && offset + length <= base->length);
+
+    /* Always refer to the string that actually owns the characters. */
+    if (base->base != NULL) {
+        offset += base->chars - base->base->chars;
+        base = base->base;
+    }
+
+    str->length = length;
+    str->chars = base->chars + offset;
+    str->base = base;
+
+    sv_push(&allocated_strings, str);
+    alloc_stats.num_strings++;
+
+#ifdef ALLOC_PROFILE
+    profile_tag(&str->alloc_tag);
+#endif
+
+    return str;
+}
+
+
+/*!
+ * This function frees a heap-allocated String struct.  A string that owns its
+ * characters stores them inline, so they are freed along with it, and are
+ * taken out of the total that allocation_size() reports.  A view's characters
+ * belong to its base string, and are left alone.
+ *
+ * Note:  It is assumed that the string's pointer has already been removed
+ *        from the allocated_strings vector!
+ */
+void free_string(String *str) {
+    assert(str != NULL);
+
+    if (str->base == NULL)
+        allocated_string_chars -= str->length + 1;
+
+    free(str);
+}
+
+
 /*!
  * This function performs the garbage collection for the Scheme interpreter.
  * It also contains code to track how many objects were collected on each run,
@@ -233,15 +551,17 @@ void free_environment(Environment *env) {
  */
 void collect_garbage() {
     Environment *global_env;
-    PtrStack *eval_stack;
+    EvaluationStack *eval_stack;
+    struct timespec start, end;
 
 #ifdef GC_STATS
-    int vals_before, procs_before, envs_before;
-    int vals_after, procs_after, envs_after;
+    int vals_before, procs_before, envs_before, strs_before;
+    int vals_after, procs_after, envs_after, strs_after;
 
     vals_before = allocated_values.size;
     procs_before = allocated_lambdas.size;
     envs_before = allocated_environments.size;
+    strs_before = allocated_strings.size;
 #endif
 
 #ifndef ALWAYS_GC
@@ -250,19 +570,47 @@ void collect_garbage() {
         return;
 #endif
 
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
     global_env = get_global_environment();
     eval_stack = get_eval_stack();
 
     /* Mark everything reachable from global environment */
     mark_environment(global_env);
 
+    /* Mark the global bindings saved for the eval server to restore */
+    if (get_saved_global_bindings() != NULL)
+        mark_environment(get_saved_global_bindings());
+
     /* Mark everything reachable from evaluation stack */
     mark_eval_stack(eval_stack);
 
+    /* Mark the ephemeron-table entries whose keys are reachable */
+    mark_ephemerons();
+
+    /* Clear weak references to anything that is about to be swept. */
+    clear_weak_references();
+
+    /* The constants table must let go of anything about to be swept. */
+    purge_interned_constants();
+
     /* Sweep */
+#ifdef ALLOC_PROFILE
+    profile_begin_sweep();
+#endif
     sweep_values();
     sweep_lambdas();
     sweep_environments();
+    sweep_strings();
+    unmark_region_environments();
+#ifdef ALLOC_PROFILE
+    profile_end_sweep();
+#endif
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    alloc_stats.num_collections++;
+    alloc_stats.gc_seconds += (end.tv_sec - start.tv_sec) +
+                              (end.tv_nsec - start.tv_nsec) / 1e9;
 
 #ifndef ALWAYS_GC
     /* If we are still above the maximum allocation size, increase it. */
@@ -278,15 +626,16 @@ void collect_garbage() {
     vals_after = allocated_values.size;
     procs_after = allocated_lambdas.size;
     envs_after = allocated_environments.size;
+    strs_after = allocated_strings.size;
 
     printf("GC Results:\n");
-    printf("\tBefore: \t%d vals \t%d lambdas \t%d envs\n",
-            vals_before, procs_before, envs_before);
-    printf("\tAfter:  \t%d vals \t%d lambdas \t%d envs\n",
-            vals_after, procs_after, envs_after);
-    printf("\tChange: \t%d vals \t%d lambdas \t%d envs\n",
+    printf("\tBefore: \t%d vals \t%d lambdas \t%d envs \t%d strings\n",
+            vals_before, procs_before, envs_before, strs_before);
+    printf("\tAfter:  \t%d vals \t%d lambdas \t%d envs \t%d strings\n",
+            vals_after, procs_after, envs_after, strs_after);
+    printf("\tChange: \t%d vals \t%d lambdas \t%d envs \t%d strings\n",
             vals_after - vals_before, procs_after - procs_before,
-            envs_after - envs_before);
+            envs_after - envs_before, strs_after - strs_before);
 #endif
 }
 
@@ -312,6 +661,11 @@ void mark_environment(Environment *env) {
     /* Mark the environment */
     env->marked = 1;
 
+    /* Region environments aren't swept, so remember to unmark them later. */
+    if (env->in_region) {
+        ev_push(&marked_region_envs, env);
+    }
+
     /* Mark each of the environment's values */
     for (i = 0; i < env->num_bindings; i++) {
         mark_value(env->bindings[i].value);
@@ -354,6 +708,35 @@ void mark_value(Value *v) {
         mark_value(v->cons_val.p_cdr);
     }
 
+    /*
+     * If the value is a promise, mark its expression (or value), and the
+     * environment it will be evaluated in if it hasn't been forced yet
+     */
+    if (v->type == T_Promise) {
+        mark_value(v->promise_val.p_expr);
+        if (v->promise_val.p_env != NULL) {
+            mark_environment(v->promise_val.p_env);
+        }
+    }
+
+    /* If the value is multiple values, mark the list of them */
+    if (v->type == T_Values) {
+        mark_value(v->values_val);
+    }
+
+    /* If the value is a string type, mark its string */
+    if (v->type == T_String) {
+        mark_string(v->str_val);
+    }
+
+    /*
+     * Weak boxes and ephemeron tables don't keep their contents alive, so
+     * just remember them until the rest of the heap has been marked
+     */
+    if (v->type == T_WeakBox || v->type == T_WeakTable) {
+        vv_push(&marked_weak_values, v);
+    }
+
 }
 
 
@@ -392,24 +775,44 @@ void mark_lambda(Lambda *f) {
 }
 
 
+/*
+ * mark_string: Marks the passed string, as well as the string that owns its
+ *              characters if it is a view into another string.
+ *
+ * arguments: str: The string to be marked
+ *
+ */
+
+void mark_string(String *str) {
+
+    str->marked = 1;
+
+    if (str->base != NULL) {
+        str->base->marked = 1;
+    }
+
+}
+
+
 /*
  * mark_eval_stack: Marks all things in any context on the evaulation stack.
+ *                  The contexts are stored contiguously, so this is just a
+ *                  linear walk from the bottom of the stack to the top.
  *
  * arguments: eval_stack: A pointer to the evaulation stack
  *
  */
 
-void mark_eval_stack(PtrStack *eval_stack) {
+void mark_eval_stack(EvaluationStack *eval_stack) {
 
-    unsigned int i, j;
+    int j;
 
-    Value **ppv;
-    EvaluationContext *ctx;
+    Value *pv;
+    EvaluationContext *ctx, *end;
 
     /* Iterate through each context on the evaulation stack */
-    for (i = 0; i < eval_stack->size; i++) {
-
-        ctx = (EvaluationContext *) pv_get_elem(eval_stack, i);
+    end = eval_stack->frames + eval_stack->size;
+    for (ctx = eval_stack->frames; ctx < end; ctx++) {
 
         /* 
          * Mark the context's environment, expression,
@@ -426,13 +829,13 @@ void mark_eval_stack(PtrStack *eval_stack) {
         }
 
         /* Iterate through the context's local values */
-        for (j = 0; j < ctx->local_vals.size; j++) {
+        for (j = 0; j < ctx->num_local_vals; j++) {
 
-            ppv = (Value **) pv_get_elem(&ctx->local_vals, j);
+            pv = *(ctx->local_vals[j]);
 
             /* Mark the value if it is not NULL */
-            if (*ppv != NULL) {
-                mark_value(*ppv);
+            if (pv != NULL) {
+                mark_value(pv);
             }
 
         }
@@ -442,42 +845,136 @@ void mark_eval_stack(PtrStack *eval_stack) {
 }
 
 
+/*
+ * mark_ephemerons: Marks the values of the ephemeron-table entries whose keys
+ *                  have been marked, or whose keys are compared by contents.
+ *                  Marking a value can make more keys reachable, and reach
+ *                  more tables, so this repeats until nothing new is marked.
+ *
+ */
+
+void mark_ephemerons() {
+
+    unsigned int i, j;
+    int changed;
+    Value *v, *key, *val;
+    WeakTable *t;
+
+    do {
+        changed = 0;
+
+        /* The vector can grow as values are marked, so check its size
+         * every time around
+         */
+        for (i = 0; i < marked_weak_values.size; i++) {
+
+            v = vv_get(&marked_weak_values, i);
+            if (v->type != T_WeakTable) {
+                continue;
+            }
+
+            t = v->table_val;
+            for (j = 0; j < t->capacity; j++) {
+
+                key = t->keys[j];
+                if (key == NULL) {
+                    continue;
+                }
+
+                val = t->vals[j];
+                if (key->marked && val->marked) {
+                    continue;
+                }
+
+                if (key->marked || weak_key_is_strong(key)) {
+                    mark_value(key);
+                    mark_value(val);
+                    changed = 1;
+                }
+
+            }
+
+        }
+
+    } while (changed);
+
+}
+
+
+/*
+ * clear_weak_references: Clears the weak boxes whose values weren't marked,
+ *                        and removes the ephemeron-table entries whose keys
+ *                        weren't marked, so that nothing refers to them once
+ *                        they are swept.
+ *
+ */
+
+void clear_weak_references() {
+
+    Value *v;
+
+    while (marked_weak_values.size > 0) {
+
+        v = vv_pop(&marked_weak_values);
+
+        if (v->type == T_WeakBox) {
+            if (v->box_val != NULL && !v->box_val->marked) {
+                v->box_val = NULL;
+            }
+        }
+        else {
+            weak_table_remove_dead(v->table_val);
+        }
+
+    }
+
+    vv_truncate(&marked_weak_values, 0);
+
+}
+
+
 /*
  * sweep_values: Frees all values that have not been marked as reachable
  *               and unmarks all values that have been marked as reachable,
- *               then compacts the allocated_values pointer vector.
+ *               then drops the freed ones from allocated_values.
  *
  */
 
 void sweep_values() {
 
-    unsigned int i;
+    unsigned int i, num_kept;
 
-    Value *val_ptr;
+    Value *val_ptr, **elems;
 
-    /* Iterate through all allocated values */
+    /* Iterate through all allocated values, keeping the marked ones */
+    elems = vv_data(&allocated_values);
+    num_kept = 0;
     for (i = 0; i < allocated_values.size; i++) {
 
-        val_ptr = (Value *) pv_get_elem(&allocated_values, i);
+        val_ptr = elems[i];
+#ifdef ALLOC_PROFILE
+        profile_sweep(&val_ptr->alloc_tag, val_ptr->type,
+                      value_bytes(val_ptr), val_ptr->marked);
+        if (!val_ptr->marked)
+            profile_forget(val_ptr);
+#endif
 
         /* 
-         * If the value is not NULL, free it;
-         * otherwise, unmark it 
+         * If the value is not marked, free it;
+         * otherwise, unmark it and keep it
          */
-        if (val_ptr != NULL) {
-            if (!(val_ptr->marked)) {
-                free_value(val_ptr);
-                pv_set_elem(&allocated_values, i, NULL);
-            }
-            else {
-                val_ptr->marked = 0;
-            }
+        if (!(val_ptr->marked)) {
+            free_value(val_ptr);
+        }
+        else {
+            val_ptr->marked = 0;
+            elems[num_kept++] = val_ptr;
         }
 
     }
 
-    /* Compact allocated_values */
-    pv_compact(&allocated_values);
+    /* Drop the freed values from allocated_values */
+    vv_truncate(&allocated_values, num_kept);
 
 }
 
@@ -485,39 +982,43 @@ void sweep_values() {
 /*
  * sweep_lambdas: Frees all lambdas that have not been marked as reachable
  *                and unmarks all lambdas that have been marked as reachable,
- *                then compacts the allocated_lambdas pointer vector.
+ *                then drops the freed ones from allocated_lambdas.
  *
  */
 
 void sweep_lambdas() {
 
-    unsigned int i;
+    unsigned int i, num_kept;
 
-    Lambda *lam_ptr;
+    Lambda *lam_ptr, **elems;
 
-    /* Iterate through all allocated lambdas */
+    /* Iterate through all allocated lambdas, keeping the marked ones */
+    elems = lv_data(&allocated_lambdas);
+    num_kept = 0;
     for (i = 0; i < allocated_lambdas.size; i++) {
 
-        lam_ptr = (Lambda *) pv_get_elem(&allocated_lambdas, i);
+        lam_ptr = elems[i];
+#ifdef ALLOC_PROFILE
+        profile_sweep(&lam_ptr->alloc_tag, PK_Lambda, sizeof(Lambda),
+                      lam_ptr->marked);
+#endif
 
         /* 
-         * If the lambda is not NULL, free it;
-         * otherwise, unmark it
+         * If the lambda is not marked, free it;
+         * otherwise, unmark it and keep it
          */
-        if (lam_ptr != NULL) {
-            if (!(lam_ptr->marked)) {
-                free_lambda(lam_ptr);
-                pv_set_elem(&allocated_lambdas, i, NULL);
-            }
-            else {
-                lam_ptr->marked = 0;
-            }
+        if (!(lam_ptr->marked)) {
+            free_lambda(lam_ptr);
+        }
+        else {
+            lam_ptr->marked = 0;
+            elems[num_kept++] = lam_ptr;
         }
 
     }
 
-    /* Compact allocated_lambdas */
-    pv_compact(&allocated_lambdas);
+    /* Drop the freed lambdas from allocated_lambdas */
+    lv_truncate(&allocated_lambdas, num_kept);
 
 }
 
@@ -525,39 +1026,169 @@ void sweep_lambdas() {
 /*
  * sweep_environments: Frees all environments that have not been marked as
  *                     reachable and unmarks all environments that have
- *                     been marked as reachable, then compacts the
- *                     allocated_environments pointer vector.
+ *                     been marked as reachable, then drops the freed
+ *                     ones from allocated_environments.
  *
  */
 
 void sweep_environments() {
 
-    unsigned int i;
+    unsigned int i, num_kept;
 
-    Environment *env_ptr;
+    Environment *env_ptr, **elems;
 
-    /* Iterate through all allocated environments */
+    /* Iterate through all allocated environments, keeping the marked ones */
+    elems = ev_data(&allocated_environments);
+    num_kept = 0;
     for (i = 0; i < allocated_environments.size; i++) {
 
-        env_ptr = (Environment *) pv_get_elem(&allocated_environments, i);
+        env_ptr = elems[i];
+#ifdef ALLOC_PROFILE
+        profile_sweep(&env_ptr->alloc_tag, PK_Environment,
+                      environment_bytes(env_ptr), env_ptr->marked);
+#endif
 
-        /*
-         * If the environment is not NULL, free it;
-         * otherwise, unmark it
+        /* 
+         * If the environment is not marked, free it;
+         * otherwise, unmark it and keep it
          */
-        if (env_ptr != NULL) {
-            if (!(env_ptr->marked)) {
-                free_environment(env_ptr);
-                pv_set_elem(&allocated_environments, i, NULL);
-            }
-            else {
-                env_ptr->marked = 0;
-            }
+        if (!(env_ptr->marked)) {
+            free_environment(env_ptr);
         }
+        else {
+            env_ptr->marked = 0;
+            elems[num_kept++] = env_ptr;
+        }
+
+    }
+
+    /* Drop the freed environments from allocated_environments */
+    ev_truncate(&allocated_environments, num_kept);
+
+}
+
+
+/*
+ * sweep_strings: Frees all strings that have not been marked as reachable
+ *                and unmarks all strings that have been marked as reachable,
+ *                then drops the freed ones from allocated_strings.
+ *
+ */
+
+void sweep_strings() {
+
+    unsigned int i, num_kept;
+
+    String *str_ptr, **elems;
+
+    /* Iterate through all allocated strings, keeping the marked ones */
+    elems = sv_data(&allocated_strings);
+    num_kept = 0;
+    for (i = 0; i < allocated_strings.size; i++) {
+
+        str_ptr = elems[i];
+#ifdef ALLOC_PROFILE
+        profile_sweep(&str_ptr->alloc_tag, PK_String,
+                      string_bytes(str_ptr), str_ptr->marked);
+#endif
+
+        /* 
+         * If the string is not marked, free it;
+         * otherwise, unmark it and keep it
+         */
+        if (!(str_ptr->marked)) {
+            free_string(str_ptr);
+        }
+        else {
+            str_ptr->marked = 0;
+            elems[num_kept++] = str_ptr;
+        }
+
+    }
+
+    /* Drop the freed strings from allocated_strings */
+    sv_truncate(&allocated_strings, num_kept);
+
+}
+
+
+/*!
+ * This function clears the marks of the region environments that were
+ * reached during the mark phase.  These environments are released by the
+ * calls that allocated them rather than swept, but the next collection must
+ * still find them unmarked.
+ */
+void unmark_region_environments() {
+    Environment *env;
 
+    while (marked_region_envs.size > 0) {
+        env = ev_pop(&marked_region_envs);
+        env->marked = 0;
     }
+}
+
+
+#ifdef ALLOC_PROFILE
+
+/*! The number of bytes the profiler charges for a value. */
+long value_bytes(const Value *v) {
+    long bytes = sizeof(Value);
 
-    /* Compact allocated_environments */
-    pv_compact(&allocated_environments);
+    if ((v->type == T_Atom || v->type == T_Error) && v->string_val != NULL)
+        bytes += strlen(v->string_val) + 1;
 
+    if (v->type == T_WeakTable)
+        bytes += weak_table_bytes(v->table_val);
+
+    return bytes;
 }
+
+
+/*! The number of bytes the profiler charges for an environment. */
+long environment_bytes(const Environment *env) {
+    return sizeof(Environment) + env->capacity * sizeof(Binding);
+}
+
+
+/*! The number of bytes the profiler charges for a string. */
+long string_bytes(const String *str) {
+    return sizeof(String) + (str->base == NULL ? str->length + 1 : 0);
+}
+
+
+/*!
+ * Prints the allocation profile.  Objects that no collection has swept yet
+ * are added to the totals first, without counting them as live.
+ */
+void print_alloc_profile(FILE *f) {
+    unsigned int i;
+    Value *v;
+    Lambda *lam;
+    Environment *env;
+    String *str;
+
+    for (i = 0; i < allocated_values.size; i++) {
+        v = vv_get(&allocated_values, i);
+        profile_sweep(&v->alloc_tag, v->type, value_bytes(v), 0);
+    }
+
+    for (i = 0; i < allocated_lambdas.size; i++) {
+        lam = lv_get(&allocated_lambdas, i);
+        profile_sweep(&lam->alloc_tag, PK_Lambda, sizeof(Lambda), 0);
+    }
+
+    for (i = 0; i < allocated_environments.size; i++) {
+        env = ev_get(&allocated_environments, i);
+        profile_sweep(&env->alloc_tag, PK_Environment,
+                      environment_bytes(env), 0);
+    }
+
+    for (i = 0; i < allocated_strings.size; i++) {
+        str = sv_get(&allocated_strings, i);
+        profile_sweep(&str->alloc_tag, PK_String, string_bytes(str), 0);
+    }
+
+    print_profile(f);
+}
+
+#endif /* ALLOC_PROFILE */
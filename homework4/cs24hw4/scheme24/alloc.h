@@ -5,15 +5,52 @@
 #include "values.h"
 #include "evaluator.h"
 
+/*!
+ * Totals of the allocator's activity since the interpreter started, as
+ * reported by get_alloc_stats().
+ */
+typedef struct AllocStats {
+    long num_values;          /*!< Number of Values allocated. */
+    long num_lambdas;         /*!< Number of Lambdas allocated. */
+    long num_environments;    /*!< Number of Environments allocated. */
+    long num_strings;         /*!< Number of Strings allocated. */
+
+    long num_collections;     /*!< Number of garbage collections performed. */
+    double gc_seconds;        /*!< Total time spent collecting garbage. */
+} AllocStats;
+
+
+/*!
+ * A position in the frame region that non-escaping environments are
+ * allocated from; see region_mark() and region_release().
+ */
+typedef struct RegionMark {
+    struct RegionChunk *chunk;
+    size_t used;
+} RegionMark;
+
+
 void init_alloc(void);
 
 Value * alloc_value(void);
 Lambda * alloc_lambda(void);
 Environment * alloc_environment(void);
+Environment * alloc_region_environment(int capacity);
+String * alloc_string(int length);
+String * alloc_string_view(String *base, int offset, int length);
+
+RegionMark region_mark(void);
+void * region_alloc(size_t size);
+void region_release(RegionMark mark);
 
 void collect_garbage(void);
 
 void print_alloc_stats(FILE *f);
+void get_alloc_stats(AllocStats *stats);
+
+#ifdef ALLOC_PROFILE
+void print_alloc_profile(FILE *f);
+#endif
 
 
 #endif /* ALLOC_H */
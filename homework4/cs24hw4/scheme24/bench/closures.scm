@@ -0,0 +1,24 @@
+;; Chains of map, filter and fold-left over lists, driven by closures.
+(define (one-to n)
+  (if (= n 0)
+      nil
+      (cons n (one-to (- n 1)))))
+
+(define (make-adder n)
+  (lambda (x) (+ x n)))
+
+(define (make-above n)
+  (lambda (x) (> x n)))
+
+(define (round lst n)
+  (fold-left + 0
+    (map (make-adder n)
+         (filter (make-above (* n 10))
+                 (map (lambda (x) (* x 2)) lst)))))
+
+(define (rounds lst n acc)
+  (if (= n 0)
+      acc
+      (rounds lst (- n 1) (+ acc (round lst n)))))
+
+(display (rounds (one-to 500) 40 0))
@@ -0,0 +1,17 @@
+;; Deep, non-tail recursion:  exercises the evaluation-context stack.
+(define (build n)
+  (if (= n 0)
+      nil
+      (cons n (build (- n 1)))))
+
+(define (sum lst)
+  (if (null? lst)
+      0
+      (+ (car lst) (sum (cdr lst)))))
+
+(define (repeat n acc)
+  (if (= n 0)
+      acc
+      (repeat (- n 1) (+ acc (sum (build 2000))))))
+
+(display (repeat 20 0))
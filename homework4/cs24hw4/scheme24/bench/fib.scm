@@ -0,0 +1,7 @@
+;; Doubly-recursive Fibonacci:  procedure calls and arithmetic.
+(define (fib n)
+  (if (< n 2)
+      n
+      (+ (fib (- n 1)) (fib (- n 2)))))
+
+(display (fib 22))
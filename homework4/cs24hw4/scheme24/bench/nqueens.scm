@@ -0,0 +1,26 @@
+;; Counts the solutions to the N-queens problem:  list construction,
+;; append, and boolean special forms.
+(define (one-to n)
+  (if (= n 0)
+      nil
+      (cons n (one-to (- n 1)))))
+
+(define (ok? row dist placed)
+  (if (null? placed)
+      #t
+      (and (not (= (car placed) (+ row dist)))
+           (not (= (car placed) (- row dist)))
+           (ok? row (+ dist 1) (cdr placed)))))
+
+(define (try-it x y z)
+  (if (null? x)
+      (if (null? y) 1 0)
+      (+ (if (ok? (car x) 1 z)
+             (try-it (append (cdr x) y) nil (cons (car x) z))
+             0)
+         (try-it (cdr x) (cons (car x) y) z))))
+
+(define (queens n)
+  (try-it (one-to n) nil nil))
+
+(display (queens 8))
@@ -0,0 +1,148 @@
+#!/bin/sh
+#
+# Runs every benchmark program in this directory with the given interpreter,
+# and writes the results to results.csv and results.json.
+#
+# If a reference interpreter is also given, each benchmark is run with both
+# interpreters in the same run, alternating which one goes first, and the
+# median wall times are compared.  The run fails if any benchmark's median
+# exceeds the reference's median multiplied by BENCH_THRESHOLD (default
+# 1.35; the medians of two identical builds differ by up to about 1.25x on
+# a busy machine).  Timing both interpreters on the same machine at the same time means
+# there is no recorded baseline to go stale, and the medians keep one slow
+# run from deciding the result.  Each interpreter is run from its own
+# directory, so that it loads its own stdlib.scm.
+#
+# Set BENCH_RUNS to the number of runs of each interpreter (default 7).
+#
+# Usage:  bench/run-bench.sh interpreter [reference-interpreter]
+
+SCHEME=${1:-./scheme24-bench}
+REF=$2
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+THRESHOLD=${BENCH_THRESHOLD:-1.35}
+RUNS=${BENCH_RUNS:-7}
+
+CSV=$BENCH_DIR/results.csv
+JSON=$BENCH_DIR/results.json
+
+FIELDS="wall_ms values lambdas envs strings gc_count gc_ms"
+
+for interp in "$SCHEME" $REF; do
+    if [ ! -x "$interp" ]; then
+        echo "Can't run interpreter \"$interp\"." >&2
+        exit 2
+    fi
+done
+
+
+# Runs a benchmark program with an interpreter from the interpreter's
+# directory, and prints the benchmark's CSV row.
+run_one() {
+    interp=$1
+    prog=$2
+    name=$(basename "$prog" .scm)
+
+    # The interpreter writes its statistics line to stderr.
+    if ! errors=$(cd "$(dirname "$interp")" &&
+                  "./$(basename "$interp")" -s "$prog" 2>&1 >/dev/null); then
+        echo "$name: FAILED with $interp" >&2
+        echo "$errors" >&2
+        return 1
+    fi
+    stats=$(echo "$errors" | grep '^STATS ')
+
+    row=$name
+    for field in $FIELDS; do
+        value=$(echo "$stats" | sed -n "s/.* $field=\([^ ]*\).*/\1/p")
+        row="$row,$value"
+    done
+    echo "$row"
+}
+
+
+# Prints the row of a file of CSV rows with the median wall time.
+median_row() {
+    sort -t, -k2,2n "$1" |
+        awk '{ row[NR] = $0 } END { print row[int((NR + 1) / 2)] }'
+}
+
+
+# The rows of the runs of the current benchmark.
+RUN_DIR=$(mktemp -d) || exit 2
+trap 'rm -rf "$RUN_DIR"' EXIT
+
+
+header="benchmark,$(echo $FIELDS | tr ' ' ',')"
+[ -n "$REF" ] && header="$header,ref_wall_ms"
+echo "$header" > "$CSV"
+
+for prog in "$BENCH_DIR"/*.scm; do
+    : > "$RUN_DIR/runs"
+    : > "$RUN_DIR/ref_runs"
+
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        # Alternate the order, so that neither interpreter always runs with
+        # the caches warmed up by the other.
+        if [ -n "$REF" ] && [ $((i % 2)) -eq 1 ]; then
+            run_one "$REF" "$prog" >> "$RUN_DIR/ref_runs" || exit 2
+        fi
+
+        run_one "$SCHEME" "$prog" >> "$RUN_DIR/runs" || exit 2
+
+        if [ -n "$REF" ] && [ $((i % 2)) -eq 0 ]; then
+            run_one "$REF" "$prog" >> "$RUN_DIR/ref_runs" || exit 2
+        fi
+
+        i=$((i + 1))
+    done
+
+    row=$(median_row "$RUN_DIR/runs")
+    if [ -n "$REF" ]; then
+        row="$row,$(median_row "$RUN_DIR/ref_runs" | cut -d, -f2)"
+    fi
+    echo "$row" >> "$CSV"
+done
+
+# Convert the CSV report into a JSON array of objects.
+awk -F, '
+NR == 1 { for (i = 1; i <= NF; i++) key[i] = $i; n = NF; print "["; next }
+{
+    if (NR > 2) print ",";
+    printf "  { \"%s\": \"%s\"", key[1], $1;
+    for (i = 2; i <= n; i++) printf ", \"%s\": %s", key[i], $i;
+    printf " }";
+}
+END { print ""; print "]" }' "$CSV" > "$JSON"
+
+if [ -z "$REF" ]; then
+    cat "$CSV"
+    exit 0
+fi
+
+# Compare the median wall times, and report the ratio of each.
+awk -F, -v threshold="$THRESHOLD" '
+NR == 1 { next }
+{
+    ref = $NF;
+    if (ref <= 0) {
+        printf "%-12s %10.1f ms   (no reference time)\n", $1, $2;
+        next;
+    }
+    ratio = $2 / ref;
+    status = "ok";
+    if (ratio > threshold) {
+        status = "REGRESSION";
+        failed++;
+    }
+    printf "%-12s %10.1f ms  reference %10.1f ms  x%.2f  %s\n",
+           $1, $2, ref, ratio, status;
+}
+END {
+    if (failed) {
+        printf "%d benchmark(s) slower than %.2fx the reference.\n",
+               failed, threshold;
+        exit 1;
+    }
+}' "$CSV"
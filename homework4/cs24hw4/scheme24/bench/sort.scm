@@ -0,0 +1,31 @@
+;; Merge sort of a list of random numbers:  cons-heavy list processing.
+(define (random-list n acc)
+  (if (= n 0)
+      acc
+      (random-list (- n 1) (cons (random 100000) acc))))
+
+(define (split lst a b)
+  (if (null? lst)
+      (cons a b)
+      (split (cdr lst) b (cons (car lst) a))))
+
+(define (merge a b)
+  (cond ((null? a) b)
+        ((null? b) a)
+        ((< (car a) (car b)) (cons (car a) (merge (cdr a) b)))
+        (else (cons (car b) (merge a (cdr b))))))
+
+(define (merge-sort lst)
+  (if (or (null? lst) (null? (cdr lst)))
+      lst
+      (let ((halves (split lst nil nil)))
+        (merge (merge-sort (car halves)) (merge-sort (cdr halves))))))
+
+(define (sorted? lst)
+  (or (null? lst)
+      (null? (cdr lst))
+      (and (not (< (car (cdr lst)) (car lst)))
+           (sorted? (cdr lst)))))
+
+(srandom 24)
+(display (sorted? (merge-sort (random-list 2000 nil))))
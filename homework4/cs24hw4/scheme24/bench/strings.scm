@@ -0,0 +1,14 @@
+;; String building:  string-append, substring and symbol conversion.
+(define (build n acc)
+  (if (= n 0)
+      acc
+      (build (- n 1) (string-append acc (symbol->string 'abc)))))
+
+(define (chop s total)
+  (if (< (string-length s) 2)
+      total
+      (chop (substring s 1 (string-length s)) (+ total (string-length s)))))
+
+(define s (build 3000 ""))
+(display (string-length s))
+(display (chop (substring s 0 2000) 0))
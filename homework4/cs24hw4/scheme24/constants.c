@@ -0,0 +1,324 @@
+/*! \file
+ * This file implements hash-consing of constants:  a table of canonical copies
+ * of the literal data in a program, so that identical constants share one
+ * object instead of each occurrence having its own.
+ *
+ * The parser interns every number, string, atom and Boolean it reads, and the
+ * quote special form interns its datum the first time it is evaluated.  Lists
+ * are interned from the end back to the start, so a pair is only interned
+ * after its car and cdr are; two interned pairs are then equal exactly when
+ * their cars and cdrs are the same objects.  Since all constants of the same
+ * value are the same object, two different interned values are never equal?,
+ * which lets equal? skip comparing their contents.
+ *
+ * Interned values are shared by every part of the program that uses that
+ * constant, so they must never be modified; set-car! and friends report an
+ * error if they are asked to.  That makes quoted data immutable, which
+ * programs written for the plain interpreter may not expect, so hash-consing
+ * is off unless it is turned on with set_hash_consing() (the "-c" option of
+ * the interpreter).  When it is off nothing is interned, and quoted data can
+ * be modified like any other list.
+ *
+ * The table doesn't keep its values alive.  After the garbage collector has
+ * marked everything reachable, purge_interned_constants() drops the values
+ * that weren't marked, before they are swept.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "values.h"
+#include "vector.h"
+
+
+/*!
+ * An open-addressing hash table of interned values.  The hash of each value
+ * is stored next to it, so the table can grow without rehashing values.
+ */
+typedef struct ConstantTable {
+    Value **keys;
+    unsigned int *hashes;
+    unsigned int capacity;    /*!< Always zero or a power of two. */
+    unsigned int size;
+} ConstantTable;
+
+
+/*! The table of all interned constants. */
+static ConstantTable constants;
+
+/*! Nonzero if constants are interned; see set_hash_consing(). */
+static int hash_consing = 0;
+
+
+/* The pairs along a list that is being interned; most lists are short. */
+DEFINE_VECTOR(PairVector, pairv, Value *, 16)
+
+
+unsigned int hash_pointer(const Value *v);
+unsigned int hash_constant(const Value *v);
+int same_constant(const Value *v1, const Value *v2);
+Value * ctab_find(const Value *v, unsigned int hash);
+void ctab_insert(Value *v, unsigned int hash);
+void ctab_rebuild(unsigned int capacity, int live_only);
+Value * intern_value(Value *v);
+Value * intern_list(Value *list);
+
+
+/*! Hashes the address of a value. */
+unsigned int hash_pointer(const Value *v) {
+    return (unsigned int) ((size_t) v >> 3) * 2654435761u;
+}
+
+
+/*!
+ * Computes the hash of a constant, such that constants that are the same
+ * according to same_constant() have the same hash.
+ */
+unsigned int hash_constant(const Value *v) {
+    unsigned int h;
+    float f;
+
+    switch (v->type) {
+    case T_Boolean:
+        h = v->bool_val;
+        break;
+
+    case T_Float:
+        /* 0.0 and -0.0 are the same constant, so they need the same hash. */
+        f = (v->float_val == 0.0f) ? 0.0f : v->float_val;
+        memcpy(&h, &f, sizeof(h));
+        break;
+
+    case T_String:
+        h = v->str_val->hash;
+        break;
+
+    case T_Atom:
+        h = hash_chars(v->string_val, strlen(v->string_val));
+        break;
+
+    case T_ConsPair:
+        h = hash_pointer(v->cons_val.p_car) * 31 +
+            hash_pointer(v->cons_val.p_cdr);
+        break;
+
+    default:
+        h = 0;
+    }
+
+    h = (h ^ ((unsigned int) v->type * 0x9e3779b9u)) * 2654435761u;
+    return h ^ (h >> 16);
+}
+
+
+/*!
+ * Returns nonzero if two values are the same constant.  Pairs are the same if
+ * they have the same car and cdr objects, which is enough since their parts
+ * are interned before they are.
+ */
+int same_constant(const Value *v1, const Value *v2) {
+    if (v1->type != v2->type)
+        return 0;
+
+    switch (v1->type) {
+    case T_Nil:
+        return 1;
+
+    case T_Boolean:
+        return v1->bool_val == v2->bool_val;
+
+    case T_Float:
+        return v1->float_val == v2->float_val;
+
+    case T_String:
+        return string_equals(v1->str_val, v2->str_val);
+
+    case T_Atom:
+        return strcmp(v1->string_val, v2->string_val) == 0;
+
+    case T_ConsPair:
+        return v1->cons_val.p_car == v2->cons_val.p_car &&
+               v1->cons_val.p_cdr == v2->cons_val.p_cdr;
+
+    default:
+        return 0;
+    }
+}
+
+
+/*! Returns the interned constant that is the same as v, or NULL if none is. */
+Value * ctab_find(const Value *v, unsigned int hash) {
+    unsigned int mask, i;
+
+    if (constants.size == 0)
+        return NULL;
+
+    mask = constants.capacity - 1;
+    for (i = hash & mask; constants.keys[i] != NULL; i = (i + 1) & mask) {
+        if (constants.hashes[i] == hash && same_constant(constants.keys[i], v))
+            return constants.keys[i];
+    }
+
+    return NULL;
+}
+
+
+/*! Adds a value to the table; the value must not already be in it. */
+void ctab_insert(Value *v, unsigned int hash) {
+    unsigned int mask, i;
+
+    if (2 * (constants.size + 1) > constants.capacity) {
+        ctab_rebuild(constants.capacity == 0 ? 256 : 2 * constants.capacity,
+                     /* live_only */ 0);
+    }
+
+    mask = constants.capacity - 1;
+    for (i = hash & mask; constants.keys[i] != NULL; i = (i + 1) & mask);
+
+    constants.keys[i] = v;
+    constants.hashes[i] = hash;
+    constants.size++;
+}
+
+
+/*!
+ * Moves the contents of the table into new arrays of the specified capacity.
+ * If live_only is nonzero, only the values that the garbage collector has
+ * marked are kept.
+ */
+void ctab_rebuild(unsigned int capacity, int live_only) {
+    ConstantTable old = constants;
+    unsigned int i;
+
+    constants.capacity = capacity;
+    constants.size = 0;
+    constants.keys = calloc(capacity, sizeof(Value *));
+    constants.hashes = malloc(capacity * sizeof(unsigned int));
+    assert(constants.keys != NULL && constants.hashes != NULL);
+
+    for (i = 0; i < old.capacity; i++) {
+        if (old.keys[i] == NULL)
+            continue;
+
+        if (live_only && !old.keys[i]->marked)
+            old.keys[i]->interned = 0;   /* About to be swept. */
+        else
+            ctab_insert(old.keys[i], old.hashes[i]);
+    }
+
+    free(old.keys);
+    free(old.hashes);
+}
+
+
+/*!
+ * Interns a value that isn't a pair:  returns the interned constant that is
+ * the same as v, or makes v the interned copy if there isn't one.
+ */
+Value * intern_value(Value *v) {
+    Value *canonical;
+    unsigned int hash;
+
+    /* Only data can be constants, and NaN isn't even the same as itself. */
+    if (!(is_nil(v) || is_bool(v) || is_float(v) || is_string(v) ||
+          is_atom(v)) || (is_float(v) && v->float_val != v->float_val)) {
+        return v;
+    }
+
+    hash = hash_constant(v);
+    canonical = ctab_find(v, hash);
+    if (canonical == NULL) {
+        v->interned = 1;
+        ctab_insert(v, hash);
+        canonical = v;
+    }
+
+    return canonical;
+}
+
+
+/*!
+ * Interns a list (or any other structure of pairs).  The pairs along the list
+ * are interned iteratively from the last one back to the first, so that long
+ * lists don't use up the C stack; only nesting in the cars recurses.  The
+ * pairs of the argument are updated to refer to interned values, and reused as
+ * the interned pairs if there aren't any the same already.
+ */
+Value * intern_list(Value *list) {
+    PairVector pairs;
+    Value *rest, *pair, *canonical;
+    unsigned int hash;
+
+    pairv_init(&pairs);
+    for (rest = list; is_cons_pair(rest) && !rest->interned;
+         rest = get_cdr(rest)) {
+        pairv_push(&pairs, rest);
+    }
+
+    rest = intern_constant(rest);
+    while (pairs.size > 0) {
+        pair = pairv_pop(&pairs);
+        set_car(pair, intern_constant(get_car(pair)));
+        set_cdr(pair, rest);
+
+        hash = hash_constant(pair);
+        canonical = ctab_find(pair, hash);
+        if (canonical == NULL) {
+            pair->interned = 1;
+            ctab_insert(pair, hash);
+            canonical = pair;
+        }
+
+        rest = canonical;
+    }
+
+    pairv_uninit(&pairs);
+    return rest;
+}
+
+
+/*!
+ * Turns hash-consing of constants on or off.  This should be done before any
+ * of the program is read; turning it off afterwards leaves the constants
+ * interned so far immutable.
+ */
+void set_hash_consing(int enabled) {
+    hash_consing = enabled;
+}
+
+
+/*!
+ * Returns the interned constant that is equal? to a literal value, interning
+ * the value if no such constant exists yet.  Values that can't be constants,
+ * such as lambdas, are returned unchanged.  The value must not be referred to
+ * by anything but the program it was read from, since its pairs may be
+ * modified or replaced.  If hash-consing is off, the value is returned
+ * unchanged.
+ */
+Value * intern_constant(Value *v) {
+    if (!hash_consing || v == NULL || v->interned)
+        return v;
+
+    if (is_cons_pair(v))
+        return intern_list(v);
+
+    return intern_value(v);
+}
+
+
+/*! Returns nonzero if a value is an interned constant, and so immutable. */
+int is_interned(const Value *v) {
+    return v->interned;
+}
+
+
+/*!
+ * Removes the values that the garbage collector hasn't marked from the table.
+ * This must be called after marking and before sweeping.
+ */
+void purge_interned_constants(void) {
+    if (constants.size > 0)
+        ctab_rebuild(constants.capacity, /* live_only */ 1);
+}
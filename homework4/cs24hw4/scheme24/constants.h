@@ -0,0 +1,12 @@
+#ifndef CONSTANTS_H
+#define CONSTANTS_H
+
+#include "types.h"
+
+
+void set_hash_consing(int enabled);
+Value * intern_constant(Value *v);
+int is_interned(const Value *v);
+void purge_interned_constants(void);
+
+#endif /* CONSTANTS_H */
@@ -6,6 +6,7 @@
 #include "alloc.h"
 #include "native_lambdas.h"
 #include "special_forms.h"
+#include "jit.h"
 
 
 #undef VERBOSE_EVAL
@@ -14,8 +15,31 @@
 /*! This is the global environment used for evaluation of Scheme programs. */
 static Environment *global_env = NULL;
 
+/*!
+ * Incremented every time a binding in the global environment is created or
+ * changed, so that code which depends on what global names are bound to (e.g.
+ * JIT-compiled lambdas) can tell when it needs to check them again.
+ */
+static unsigned long global_binding_epoch = 0;
+
+/*!
+ * A copy of the global environment's bindings made by save_global_bindings(),
+ * or NULL if they haven't been saved.  The garbage collector treats it as a
+ * root, so the saved values stay alive while other values are bound to their
+ * names.
+ */
+static Environment *saved_global_bindings = NULL;
+
+/*!
+ * The number of evaluation contexts that the explicit stack is initially grown
+ * to hold.  This is deep enough for most programs that the stack never has to
+ * be grown at all.
+ */
+#define EVAL_STACK_INITIAL_CAPACITY 4096
+
+
 /*! This is the explicit stack used for evaluation of Scheme programs. */
-static PtrStack evaluation_stack = PTR_VECTOR_STATIC_INIT;
+static EvaluationStack evaluation_stack = { 0, 0, NULL };
 
 
 Value * bind_arguments(Environment *child_env, Lambda *lambda, Value *operands);
@@ -24,11 +48,14 @@ Value * bind_arguments(Environment *child_env, Lambda *lambda, Value *operands);
 /*!
  * This struct is used for representing Scheme functions with native
  * implementations.  The implementation is provided as a function-pointer with
- * the signature NativeLambda.
+ * the signature NativeLambda.  retains_args is nonzero for natives that may
+ * keep their operand list itself, rather than just its elements, after they
+ * return; see the Lambda struct.
  */
 typedef struct NativeLambdaBinding {
     char *name;
     NativeLambda func;
+    int retains_args;
 } NativeLambdaBinding;
 
 
@@ -63,25 +90,76 @@ static NativeLambdaBinding native_lambdas[] = {
     { "*", scheme_mul },
     { "/", scheme_div },
 
+    { "min"    , scheme_min     },
+    { "max"    , scheme_max     },
+    { "sum"    , scheme_sum     },
+    { "product", scheme_product },
+
     /* Functions for cons pairs and lists. */
     { "cons"  , scheme_cons   },
     { "car"   , scheme_car    },
     { "cdr"   , scheme_cdr    },
-    { "list"  , scheme_list   },
+    { "list"  , scheme_list   , /* retains_args */ 1 },
     { "length", scheme_length },
 
     /* In-place mutation functions. */
     { "set-car!", scheme_set_car },
     { "set-cdr!", scheme_set_cdr },
 
+    /* List library. */
+    { "append"   , scheme_append       },
+    { "append!"  , scheme_append_bang  },
+    { "reverse"  , scheme_reverse      },
+    { "reverse!" , scheme_reverse_bang },
+    { "list-tail", scheme_list_tail    },
+    { "list-ref" , scheme_list_ref     },
+    { "list-copy", scheme_list_copy    },
+    { "map"      , scheme_map          },
+    { "for-each" , scheme_for_each     },
+    { "filter"   , scheme_filter       },
+    { "fold-left", scheme_fold_left    },
+    { "assoc"    , scheme_assoc        },
+    { "member"   , scheme_member       },
+
+    /* Procedure application and multiple values. */
+    { "apply"           , scheme_apply            },
+    { "values"          , scheme_values           , /* retains_args */ 1 },
+    { "call-with-values", scheme_call_with_values },
+
+    /* Promises and streams. */
+    { "force"       , scheme_force          },
+    { "make-promise", scheme_make_promise   },
+    { "promise?"    , scheme_is_promise     },
+    { "stream-ref"  , scheme_stream_ref     },
+    { "stream->list", scheme_stream_to_list },
+
+    /* Weak references. */
+    { "make-weak-box"     , scheme_make_weak_box     },
+    { "weak-box-value"    , scheme_weak_box_value    },
+    { "weak-box?"         , scheme_is_weak_box       },
+    { "make-weak-table"   , scheme_make_weak_table   },
+    { "weak-table-ref"    , scheme_weak_table_ref    },
+    { "weak-table-set!"   , scheme_weak_table_set    },
+    { "weak-table-remove!", scheme_weak_table_remove },
+    { "weak-table-count"  , scheme_weak_table_count  },
+
+    /* String functions. */
+    { "string-length" , scheme_string_length    },
+    { "string-append" , scheme_string_append    },
+    { "substring"     , scheme_substring        },
+    { "string=?"      , scheme_string_equals    },
+    { "string->symbol", scheme_string_to_symbol },
+    { "symbol->string", scheme_symbol_to_string },
+
     /* Utility functions. */
-    { "display"  , scheme_display   },
-    { "error"    , scheme_error     },
-    { "srandom"  , scheme_srandom   },
-    { "random"   , scheme_random    },
-    { "time"     , scheme_time      },
-    { "sqrt"     , scheme_sqrt      },
-    { "eval-file", scheme_eval_file },
+    { "display"        , scheme_display         },
+    { "write-to-string", scheme_write_to_string },
+    { "error"          , scheme_error           },
+    { "srandom"        , scheme_srandom         },
+    { "random"         , scheme_random          },
+    { "time"           , scheme_time            },
+    { "sqrt"           , scheme_sqrt            },
+    { "eval-file"      , scheme_eval_file       },
 
     /* Terminator. */
     { NULL, NULL }
@@ -104,6 +182,21 @@ Environment * make_environment(Environment *parent_env) {
 }
 
 
+/*!
+ * Creates and initializes a new environment struct from the frame region,
+ * with room for the specified number of bindings.  The environment is only
+ * valid until the region is released, so this is only used for environments
+ * that no closure can capture:  calls to lambdas whose frames don't escape,
+ * and let blocks inside such calls.
+ */
+Environment * make_region_environment(Environment *parent_env, int capacity) {
+    Environment *env = alloc_region_environment(capacity);
+    env->parent_env = parent_env;
+
+    return env;
+}
+
+
 /*!
  * Creates and initializes a new environment struct for the global environment.
  * The global environment is the root of all other environments, and has a
@@ -120,7 +213,8 @@ Environment * init_global_environment(void) {
     binding = native_lambdas;
     while (binding->name != NULL) {
         create_binding(global_env, binding->name,
-                       make_native_lambda(global_env, binding->func));
+                       make_native_lambda(global_env, binding->func,
+                                          binding->retains_args));
 
         binding++;
     }
@@ -134,6 +228,71 @@ Environment * get_global_environment(void) {
 }
 
 
+/*!
+ * Saves a copy of the global environment's bindings, so that the global
+ * environment can be put back the way it is now with restore_global_bindings().
+ * The eval server does this after loading the standard functions.
+ */
+void save_global_bindings(void) {
+    int i;
+
+    assert(saved_global_bindings == NULL);
+    saved_global_bindings = make_environment(NULL);
+
+    for (i = 0; i < global_env->num_bindings; i++) {
+        create_binding(saved_global_bindings, global_env->bindings[i].name,
+                       global_env->bindings[i].value);
+    }
+}
+
+
+/*!
+ * Puts the global environment back the way it was when save_global_bindings()
+ * was called:  names bound since then are removed, and names that were bound
+ * then get their saved values back.  This relies on bindings never being
+ * removed or reordered, so that the saved names are still the first bindings
+ * of the global environment, in the same order.
+ *
+ * Only the bindings themselves are restored; changes made to the values they
+ * refer to, e.g. with set-car!, are not undone.
+ */
+void restore_global_bindings(void) {
+    Binding *saved;
+    int i;
+
+    assert(saved_global_bindings != NULL);
+    assert(global_env->num_bindings >= saved_global_bindings->num_bindings);
+
+    for (i = saved_global_bindings->num_bindings;
+         i < global_env->num_bindings; i++) {
+        free(global_env->bindings[i].name);
+    }
+    global_env->num_bindings = saved_global_bindings->num_bindings;
+
+    for (i = 0; i < saved_global_bindings->num_bindings; i++) {
+        saved = &saved_global_bindings->bindings[i];
+        assert(strcmp(global_env->bindings[i].name, saved->name) == 0);
+        global_env->bindings[i].value = saved->value;
+    }
+
+    global_binding_epoch++;
+}
+
+
+/*!
+ * Returns the bindings saved by save_global_bindings(), or NULL if they
+ * haven't been saved.
+ */
+Environment * get_saved_global_bindings(void) {
+    return saved_global_bindings;
+}
+
+
+unsigned long get_global_binding_epoch(void) {
+    return global_binding_epoch;
+}
+
+
 /*!
  * Attempts to create a new binding in the specified environment, and returns a
  * status value indicating success or failure.  Success is indicated by a result
@@ -142,6 +301,10 @@ Environment * get_global_environment(void) {
  *
  * The only way this function will fail is if the function can't allocate the
  * necessary memory.
+ *
+ * Environments allocated from the frame region don't copy the name, since the
+ * program text it comes from outlives the environment.  Their bindings are
+ * also grown within the region rather than with realloc().
  */
 int create_binding(Environment *env, char *name, Value *v) {
     int i;
@@ -150,6 +313,9 @@ int create_binding(Environment *env, char *name, Value *v) {
     assert(name != NULL);
     assert(v != NULL);
 
+    if (env == global_env)
+        global_binding_epoch++;
+
     for (i = 0; i < env->num_bindings; i++) {
         if (strcmp(env->bindings[i].name, name) == 0) {
             env->bindings[i].value = v;
@@ -166,9 +332,17 @@ int create_binding(Environment *env, char *name, Value *v) {
         else
             new_capacity = env->capacity * 2;
 
-        new_bindings = realloc(env->bindings, new_capacity * sizeof(Binding));
-        if (!new_bindings)
-            return 0;      /* epic fail. */
+        if (env->in_region) {
+            new_bindings = region_alloc(new_capacity * sizeof(Binding));
+            memcpy(new_bindings, env->bindings,
+                   env->num_bindings * sizeof(Binding));
+        }
+        else {
+            new_bindings = realloc(env->bindings,
+                                   new_capacity * sizeof(Binding));
+            if (!new_bindings)
+                return 0;      /* epic fail. */
+        }
 
         env->capacity = new_capacity;
         env->bindings = new_bindings;
@@ -177,7 +351,7 @@ int create_binding(Environment *env, char *name, Value *v) {
     assert(env->num_bindings < env->capacity);
 
     i = env->num_bindings;
-    env->bindings[i].name = strdup(name);
+    env->bindings[i].name = (env->in_region ? name : strdup(name));
     env->bindings[i].value = v;
     env->num_bindings++;
 
@@ -210,6 +384,9 @@ int update_binding(Environment *env, char *name, Value *v) {
         for (i = 0; i < env->num_bindings; i++) {
             if (strcmp(env->bindings[i].name, name) == 0) {
                 env->bindings[i].value = v;
+                if (env == global_env)
+                    global_binding_epoch++;
+
                 return 1;
             }
         }
@@ -299,27 +476,66 @@ Value * bind_names_values(Environment *env, Value *names, Value *values) {
 
 
 
-PtrStack * get_eval_stack(void) {
+EvaluationStack * get_eval_stack(void) {
     return &evaluation_stack;
 }
 
 
 /*!
+ * This helper function grows the evaluation stack so that it can hold at least
+ * one more context.  The first time it is called, the stack is grown to
+ * EVAL_STACK_INITIAL_CAPACITY contexts; after that, the capacity is doubled.
+ *
+ * The function returns 1 on success, or 0 if the memory couldn't be allocated.
+ */
+int grow_eval_stack(void) {
+    EvaluationContext *new_frames;
+    unsigned int new_capacity;
+
+    new_capacity = 2 * evaluation_stack.capacity;
+    if (new_capacity == 0)
+        new_capacity = EVAL_STACK_INITIAL_CAPACITY;
+
+    new_frames = (EvaluationContext *)
+        realloc(evaluation_stack.frames,
+                new_capacity * sizeof(EvaluationContext));
+
+    if (new_frames == NULL)
+        return 0;
+
+    evaluation_stack.frames = new_frames;
+    evaluation_stack.capacity = new_capacity;
+
+    return 1;
+}
+
+
+/*!
+ * Pushes a new context onto the evaluation stack.  This is just a bump of the
+ * stack's size, unless the evaluation has nested more deeply than ever before.
+ *
+ * Note that the returned pointer is only valid until the next context is
+ * pushed, since pushing may move the stack.
+ *
  * \return The new evaluation-context, or NULL if one could not be created.
  */
 EvaluationContext * push_new_evalctx(Environment *env, Value *expr) {
     EvaluationContext *ctx;
 
-    ctx = (EvaluationContext *) malloc(sizeof(EvaluationContext));
-    if (ctx != NULL) {
-        memset(ctx, 0, sizeof(EvaluationContext));
-        ps_push_elem(&evaluation_stack, ctx);
+    if (evaluation_stack.size == evaluation_stack.capacity) {
+        if (!grow_eval_stack())
+            return NULL;
     }
-    
+
+    ctx = evaluation_stack.frames + evaluation_stack.size;
+    evaluation_stack.size++;
+
     /* Set up the new values for the environment. */
     ctx->current_env = env;
     ctx->expression = expr;
-    
+    ctx->child_eval_result = NULL;
+    ctx->num_local_vals = 0;
+
     return ctx;
 }
 
@@ -328,7 +544,7 @@ EvaluationContext * get_current_evalctx(void) {
     EvaluationContext *ctx = NULL;
 
     if (evaluation_stack.size > 0)
-        ctx = (EvaluationContext *) ps_peek_top(&evaluation_stack);
+        ctx = evaluation_stack.frames + evaluation_stack.size - 1;
 
     return ctx;
 }
@@ -338,13 +554,11 @@ EvaluationContext * reset_current_evalctx(Environment *env, Value *expr) {
     EvaluationContext *ctx = get_current_evalctx();
 
     /* Reset the context! */
-    pv_uninit(&ctx->local_vals);
-    memset(ctx, 0, sizeof(EvaluationContext));
-    
-    /* Set up the new values for the environment. */
     ctx->current_env = env;
     ctx->expression = expr;
-    
+    ctx->child_eval_result = NULL;
+    ctx->num_local_vals = 0;
+
     /* For convenience, return the context pointer. */
     return ctx;
 }
@@ -352,37 +566,38 @@ EvaluationContext * reset_current_evalctx(Environment *env, Value *expr) {
 
 void evalctx_register(Value **v) {
     EvaluationContext *ctx;
-    
+
     assert(v != NULL);
     ctx = get_current_evalctx();
-    pv_add_elem(&ctx->local_vals, v);
-    
+
+    /* If this fails, increase EVALCTX_MAX_LOCALS. */
+    assert(ctx->num_local_vals < EVALCTX_MAX_LOCALS);
+    ctx->local_vals[ctx->num_local_vals] = v;
+    ctx->num_local_vals++;
+
     *v = NULL;
 }
 
 
 /*!
- * This function pops and cleans up the current evaluation context.  The
- * function only releases memory used by the eval-context itself; it doesn't
- * free any Value or Environment objects referenced by the context, since that
- * will be collected by the garbage collector.
+ * This function pops the current evaluation context.  Since contexts are
+ * stored inline in the evaluation stack, no memory is released; the function
+ * also doesn't free any Value or Environment objects referenced by the
+ * context, since that will be collected by the garbage collector.
  *
  * This function will have an assertion-failure if the evaluation stack is
  * empty when this function is called.
  */
 void pop_evalctx(Value *result) {
-    EvaluationContext *ctx, *parent_ctx;
+    EvaluationContext *parent_ctx;
+
+    assert(evaluation_stack.size > 1);
+    evaluation_stack.size--;
 
-    ctx = (EvaluationContext *) ps_pop_elem(&evaluation_stack);
-    
-    /* Clean up the context. */
-    pv_uninit(&ctx->local_vals);
-    free(ctx);
-    
     /* Store the result of the evaluation into the parent context's "child
      * result" slot.
      */
-    parent_ctx = (EvaluationContext *) ps_peek_top(&evaluation_stack);
+    parent_ctx = evaluation_stack.frames + evaluation_stack.size - 1;
     parent_ctx->child_eval_result = result;
 }
 
@@ -516,39 +731,7 @@ Value * evaluate(Environment *env, Value *expr) {
      * Apply the operator to the operands, to generate a result.
      */
 
-    if (operator->lambda_val->native_impl) {
-        /* Native lambdas don't need an environment created for them.  Rather,
-         * we just pass the list of arguments to the native function, and it
-         * processes the arguments as needed.
-         */
-        result = operator->lambda_val->func(num_operands, operands);
-    }
-    else {
-        /* These don't need registered on the explicit stack.  (I hope.) */
-        Environment *child_env;
-        Value *body_iter;
-
-        /* It's an interpreted lambda.  Create a child environment, then
-         * populate it with values based on the lambda's argument-specification
-         * and the input operands.
-         */
-        child_env = make_environment(operator->lambda_val->parent_env);
-        temp = bind_arguments(child_env, operator->lambda_val, operands);
-        if (is_error(temp)) {
-            result = temp;
-            goto Done;
-        }
-
-        /* Evaluate each expression in the lambda, using the child environment.
-         * The result of the last expression is the result of the lambda.
-         */
-        body_iter = operator->lambda_val->body;
-        do {
-            result = evaluate(child_env, get_car(body_iter));
-            body_iter = get_cdr(body_iter);
-        }
-        while (!is_nil(body_iter));
-    }
+    result = apply_procedure(operator, num_operands, operands);
 
 Done:
     
@@ -566,6 +749,84 @@ Done:
 }
 
 
+/*!
+ * Applies a procedure to a list of already-evaluated operands, and returns the
+ * result.  This is used by evaluate(), but native lambdas that take procedures
+ * as arguments (e.g. map) also use it to call back into the evaluator.
+ *
+ * The caller is responsible for making sure that the procedure and the operand
+ * list are visible to the garbage collector, since the procedure's body may be
+ * evaluated (and therefore garbage may be collected) before this returns.
+ */
+Value * apply_procedure(Value *proc, int num_operands, Value *operands) {
+    Lambda *lambda;
+    Environment *child_env;
+    Value *body_iter, *result;
+    RegionMark mark;
+
+    assert(is_lambda(proc));
+    assert(operands != NULL);
+
+    lambda = proc->lambda_val;
+
+    if (lambda->native_impl) {
+        /* Native lambdas don't need an environment created for them.  Rather,
+         * we just pass the list of arguments to the native function, and it
+         * processes the arguments as needed.
+         */
+        return lambda->func(num_operands, operands);
+    }
+
+#ifdef JIT_ENABLED
+    /* If the lambda is hot enough to have been compiled to machine code, and
+     * the compiled code's guards pass, then the interpreter isn't needed.
+     */
+    if (jit_try_call(lambda, num_operands, operands, &result))
+        return result;
+#endif
+
+    /* It's an interpreted lambda.  Create a child environment, then populate
+     * it with values based on the lambda's argument-specification and the
+     * input operands.  The child environment gets its own evaluation context,
+     * so that it stays reachable in between the body's expressions.
+     *
+     * If no closure can capture the child environment, it is allocated from
+     * the frame region and released when the call returns.
+     */
+    if (lambda->frame_escapes) {
+        child_env = make_environment(lambda->parent_env);
+    }
+    else {
+        mark = region_mark();
+        child_env = make_region_environment(lambda->parent_env,
+                                            lambda->frame_size);
+    }
+    push_new_evalctx(child_env, proc);
+    evalctx_register(&result);
+
+    result = bind_arguments(child_env, lambda, operands);
+    if (is_error(result))
+        goto Done;
+
+    /* Evaluate each expression in the lambda, using the child environment.
+     * The result of the last expression is the result of the lambda.
+     */
+    body_iter = lambda->body;
+    do {
+        result = evaluate(child_env, get_car(body_iter));
+        body_iter = get_cdr(body_iter);
+    }
+    while (!is_nil(body_iter));
+
+Done:
+    pop_evalctx(result);
+    if (!lambda->frame_escapes)
+        region_release(mark);
+
+    return result;
+}
+
+
 /*!
  * This helper function takes an interpreted lambda expression, a list of
  * evaluated operands for the lambda, and the environment that the lambda will
@@ -594,6 +855,11 @@ Value * bind_arguments(Environment *child_env, Lambda *lambda, Value *operands)
         /* Entire operand list gets bound under a single name. */
         create_binding(child_env, argname_iter->string_val, operands);
     }
+    else if (is_nil(argname_iter)) {
+        /* The lambda takes no arguments. */
+        if (!is_nil(argval_iter))
+            return make_error("too many arguments for lambda!");
+    }
     else {
         /* Bind each operand under its specified name.
          *
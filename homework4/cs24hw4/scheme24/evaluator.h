@@ -8,20 +8,25 @@
 
 Environment * init_global_environment(void);
 Environment * get_global_environment(void);
+void save_global_bindings(void);
+void restore_global_bindings(void);
+Environment * get_saved_global_bindings(void);
 
 Environment * make_environment(Environment *parent_env);
+Environment * make_region_environment(Environment *parent_env, int capacity);
 
 /* Functions for managing name/value bindings in environments. */
 int create_binding(Environment *env, char *name, Value *v);
 int update_binding(Environment *env, char *name, Value *v);
 Value * resolve_binding(Environment *env, char *name);
+unsigned long get_global_binding_epoch(void);
 Value * bind_names_values(Environment *env, Value *names, Value *values);
 
 /*
  * Functions for managing evaluation contexts, which are used for the explicit
  * stack used in evaluation.
  */
-PtrStack * get_eval_stack(void);
+EvaluationStack * get_eval_stack(void);
 EvaluationContext * push_new_evalctx(Environment *env, Value *expr);
 EvaluationContext * get_current_evalctx(void);
 void evalctx_register(Value **v);
@@ -31,6 +36,9 @@ void pop_evalctx(Value *result);
 /* The main function that drives expression evaluation. */
 Value * evaluate(Environment *env, Value *expr);
 
+/* Applies an already-evaluated procedure to a list of operand values. */
+Value * apply_procedure(Value *proc, int num_operands, Value *operands);
+
 
 #endif /* EVALUATOR_H */
 
@@ -0,0 +1,950 @@
+/*! \file
+ * This file implements a simple template JIT for the CS24 Scheme interpreter.
+ * When an interpreted lambda has been called often enough, the JIT tries to
+ * translate it into x86-64 machine code.  Only a small numeric subset of
+ * Scheme is handled:  number literals, references to the lambda's arguments,
+ * the arithmetic operators + - * /, the comparisons = < > <= >=, if
+ * expressions, and calls from the lambda to itself.  Anything else leaves the
+ * lambda to the interpreter.
+ *
+ * All values in compiled code are single-precision floats, just like the
+ * interpreter's numbers, and every operation is done the same way the
+ * built-in functions do it so that results are identical.  Compiled code has
+ * no side effects, so when it hits something it can't handle (division by
+ * zero, which the interpreter reports as an error) it simply abandons the
+ * call, and the interpreter evaluates the call again from the start.  This is
+ * called "deoptimizing."
+ *
+ * Compiled code relies on the global names it uses (e.g. "+", or the lambda's
+ * own name) still being bound to the same procedures.  These are checked again
+ * before entering the code whenever a global binding has changed since the
+ * last check.
+ */
+
+#include "jit.h"
+
+#ifdef JIT_ENABLED
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "evaluator.h"
+#include "native_lambdas.h"
+#include "special_forms.h"
+
+
+/* Change to #define VERBOSE_JIT to report each lambda the JIT compiles. */
+#undef VERBOSE_JIT
+
+
+/*! How many times a lambda must be called before the JIT compiles it. */
+#define JIT_CALL_THRESHOLD 100
+
+/*!
+ * How many times compiled code may deoptimize before the JIT gives up on it
+ * and leaves the lambda to the interpreter.
+ */
+#define JIT_MAX_DEOPTS 16
+
+/*!
+ * The largest number of arguments a compiled lambda can take.  Arguments are
+ * passed in the registers xmm0 through xmm7.
+ */
+#define JIT_MAX_ARGS 8
+
+/*! The largest number of global names that compiled code can depend on. */
+#define JIT_MAX_DEPS 16
+
+
+/*!
+ * A global name that compiled code depends on, and the procedure it must
+ * still be bound to for the code to be valid.
+ */
+typedef struct JitDependency {
+    /*! The name, which is borrowed from the lambda's body. */
+    const char *name;
+
+    /*!
+     * The built-in function the name must be bound to, or NULL if the name
+     * must be bound to the compiled lambda itself.
+     */
+    NativeLambda func;
+} JitDependency;
+
+
+/*!
+ * The signature of a compiled lambda's entry point.  The arguments are
+ * passed as an array of floats, and the result is stored into *result.  The
+ * return value is 0 on success, or nonzero if the code deoptimized.
+ */
+typedef int (*JitEntry)(const float *args, float *result);
+
+
+/*! The machine code that the JIT has compiled for a lambda. */
+typedef struct JitCode {
+    /*! The executable pages holding the code. */
+    void *pages;
+
+    /*! The size of the mapping in bytes. */
+    size_t pages_size;
+
+    /*! The entry point into the code. */
+    JitEntry entry;
+
+    /*! The number of arguments the lambda takes. */
+    int num_args;
+
+    /*! The global-binding epoch at which the dependencies were last checked. */
+    unsigned long epoch;
+
+    /*! How many times the code has deoptimized. */
+    int num_deopts;
+
+    /*! The global names the code depends on. */
+    int num_deps;
+    JitDependency deps[JIT_MAX_DEPS];
+} JitCode;
+
+
+/*! A growable buffer that machine code is assembled into. */
+typedef struct CodeBuffer {
+    unsigned char *bytes;
+    int size;
+    int capacity;
+} CodeBuffer;
+
+
+/*! The state of the compiler while it compiles a single lambda. */
+typedef struct Compiler {
+    /*! The code being generated. */
+    CodeBuffer code;
+
+    /*! The lambda being compiled. */
+    Lambda *lambda;
+
+    /*! The lambda's argument names, in order. */
+    int num_params;
+    Value *params[JIT_MAX_ARGS];
+
+    /*! The global names the generated code depends on. */
+    int num_deps;
+    JitDependency deps[JIT_MAX_DEPS];
+
+    /*! Offset of the code that abandons the call and deoptimizes. */
+    int bail_offset;
+
+    /*! Offset of the lambda's body, which is the target of self calls. */
+    int body_offset;
+} Compiler;
+
+
+/*! The operations that the JIT knows how to compile. */
+typedef enum JitOp {
+    OP_NONE, OP_ADD, OP_SUB, OP_MUL, OP_DIV,
+    OP_EQ, OP_LT, OP_GT, OP_LE, OP_GE, OP_SELF
+} JitOp;
+
+
+/*!
+ * The built-in functions that the JIT knows how to compile calls to, and the
+ * operation each one corresponds to.
+ */
+static struct {
+    NativeLambda func;
+    JitOp op;
+} jit_natives[] = {
+    { scheme_add                   , OP_ADD },
+    { scheme_sub                   , OP_SUB },
+    { scheme_mul                   , OP_MUL },
+    { scheme_div                   , OP_DIV },
+    { scheme_numeric_equals        , OP_EQ  },
+    { scheme_numeric_less_than     , OP_LT  },
+    { scheme_numeric_greater_than  , OP_GT  },
+    { scheme_numeric_less_equal    , OP_LE  },
+    { scheme_numeric_greater_equal , OP_GE  },
+    { NULL, OP_NONE }
+};
+
+
+/*!
+ * The stack pointer of the compiled code's entry point, so that code deep in
+ * a chain of self calls can deoptimize by going straight back to it.  Compiled
+ * code never calls back into the interpreter, so only one entry is ever
+ * active at a time.
+ */
+static void *jit_saved_rsp;
+
+
+/* Helper functions for generating code. */
+void cb_byte(CodeBuffer *cb, int b);
+void cb_bytes(CodeBuffer *cb, const char *bytes, int n);
+void cb_int32(CodeBuffer *cb, int32_t n);
+void cb_int64(CodeBuffer *cb, int64_t n);
+void cb_patch_rel32(CodeBuffer *cb, int at, int target);
+int emit_jump(CodeBuffer *cb, const char *opcode, int n, int target);
+
+void emit_load_const(Compiler *c, int xmm, float f);
+void emit_load_param(Compiler *c, int xmm, int index);
+void emit_push_xmm0(Compiler *c);
+void emit_pop(Compiler *c, int xmm);
+void emit_zero_check(Compiler *c, int xmm);
+
+/* Helper functions for compiling expressions. */
+int find_param(Compiler *c, Value *atom);
+JitOp resolve_operator(Compiler *c, Value *atom);
+int compile_expr(Compiler *c, Value *expr, int tail);
+int compile_operand(Compiler *c, Value *expr);
+int compile_arith(Compiler *c, JitOp op, Value *args);
+int compile_condition(Compiler *c, Value *expr, int *patches,
+                      int *num_patches);
+int compile_if(Compiler *c, Value *args, int tail);
+int compile_self_call(Compiler *c, Value *args, int tail);
+
+JitCode * jit_compile(Lambda *lambda);
+int check_dependencies(Lambda *lambda, JitCode *code);
+
+
+
+/*============================================================================
+ * CODE GENERATION
+ *
+ * Registers used by the generated code:
+ *
+ *   xmm0     the value of the expression being compiled
+ *   xmm1     the second operand of a binary operation
+ *   xmm2     scratch
+ *   xmm0-7   the arguments of a self call
+ *   rbp      the frame pointer; the arguments are stored at [rbp - 8*(i+1)]
+ *   rax      scratch
+ *
+ * Intermediate values are pushed onto the machine stack, 8 bytes each.
+ *============================================================================*/
+
+
+void cb_byte(CodeBuffer *cb, int b) {
+    if (cb->size == cb->capacity) {
+        cb->capacity = (cb->capacity == 0 ? 256 : cb->capacity * 2);
+        cb->bytes = realloc(cb->bytes, cb->capacity);
+    }
+
+    cb->bytes[cb->size++] = (unsigned char) b;
+}
+
+
+void cb_bytes(CodeBuffer *cb, const char *bytes, int n) {
+    int i;
+
+    for (i = 0; i < n; i++)
+        cb_byte(cb, bytes[i]);
+}
+
+
+void cb_int32(CodeBuffer *cb, int32_t n) {
+    int i;
+
+    for (i = 0; i < 4; i++)
+        cb_byte(cb, (n >> (8 * i)) & 0xFF);
+}
+
+
+void cb_int64(CodeBuffer *cb, int64_t n) {
+    int i;
+
+    for (i = 0; i < 8; i++)
+        cb_byte(cb, (n >> (8 * i)) & 0xFF);
+}
+
+
+/*!
+ * Stores a 32-bit relative displacement at the specified offset, so that the
+ * instruction ending right after it refers to the target offset.
+ */
+void cb_patch_rel32(CodeBuffer *cb, int at, int target) {
+    int32_t rel = target - (at + 4);
+
+    memcpy(cb->bytes + at, &rel, 4);
+}
+
+
+/*!
+ * Emits a jump or call instruction with a 32-bit displacement to the target
+ * offset.  The offset of the displacement is returned, so that forward jumps
+ * can be patched once the target is known.
+ */
+int emit_jump(CodeBuffer *cb, const char *opcode, int n, int target) {
+    int at;
+
+    cb_bytes(cb, opcode, n);
+    at = cb->size;
+    cb_int32(cb, 0);
+    cb_patch_rel32(cb, at, target);
+
+    return at;
+}
+
+
+/*! Loads a float constant into the specified register. */
+void emit_load_const(Compiler *c, int xmm, float f) {
+    int32_t bits;
+
+    memcpy(&bits, &f, 4);
+    cb_byte(&c->code, 0xB8);                        /* mov eax, imm32 */
+    cb_int32(&c->code, bits);
+    cb_bytes(&c->code, "\x66\x0F\x6E", 3);          /* movd xmm, eax */
+    cb_byte(&c->code, 0xC0 | (xmm << 3));
+}
+
+
+/*! Loads one of the lambda's arguments into the specified register. */
+void emit_load_param(Compiler *c, int xmm, int index) {
+    cb_bytes(&c->code, "\xF3\x0F\x10", 3);          /* movss xmm, [rbp+d] */
+    cb_byte(&c->code, 0x85 | (xmm << 3));
+    cb_int32(&c->code, -8 * (index + 1));
+}
+
+
+void emit_push_xmm0(Compiler *c) {
+    cb_bytes(&c->code, "\x48\x83\xEC\x08", 4);      /* sub rsp, 8 */
+    cb_bytes(&c->code, "\xF3\x0F\x11\x04\x24", 5);  /* movss [rsp], xmm0 */
+}
+
+
+void emit_pop(Compiler *c, int xmm) {
+    cb_bytes(&c->code, "\xF3\x0F\x10", 3);          /* movss xmm, [rsp] */
+    cb_byte(&c->code, 0x04 | (xmm << 3));
+    cb_byte(&c->code, 0x24);
+    cb_bytes(&c->code, "\x48\x83\xC4\x08", 4);      /* add rsp, 8 */
+}
+
+
+/*!
+ * Deoptimizes if the specified register holds zero, since the interpreter
+ * reports an error for division by zero.
+ */
+void emit_zero_check(Compiler *c, int xmm) {
+    cb_bytes(&c->code, "\x0F\x57\xD2", 3);          /* xorps xmm2, xmm2 */
+    cb_bytes(&c->code, "\x0F\x2E", 2);              /* ucomiss xmm, xmm2 */
+    cb_byte(&c->code, 0xC2 | (xmm << 3));
+    cb_bytes(&c->code, "\x7A\x06", 2);              /* jp +6 (NaN) */
+    emit_jump(&c->code, "\x0F\x84", 2, c->bail_offset);     /* je bail */
+}
+
+
+
+/*============================================================================
+ * EXPRESSION COMPILATION
+ *
+ * Each of these functions returns 1 if it generated code for its expression,
+ * or 0 if the expression is outside what the JIT can compile.
+ *============================================================================*/
+
+
+/*!
+ * Returns the index of the lambda argument with the specified name, or -1 if
+ * the name isn't one of the arguments.
+ */
+int find_param(Compiler *c, Value *atom) {
+    int i;
+
+    for (i = 0; i < c->num_params; i++) {
+        if (strcmp(c->params[i]->string_val, atom->string_val) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+
+/*!
+ * Works out which operation a call's operator refers to, and records the
+ * dependency on the operator's global binding.  Returns OP_NONE if the
+ * operator isn't something the JIT can compile.
+ */
+JitOp resolve_operator(Compiler *c, Value *atom) {
+    Value *v;
+    NativeLambda func = NULL;
+    JitOp op = OP_NONE;
+    int i;
+
+    if (!is_atom(atom) || find_param(c, atom) != -1 ||
+        is_special_form(atom)) {
+        return OP_NONE;
+    }
+
+    v = resolve_binding(c->lambda->parent_env, atom->string_val);
+    if (v == NULL || !is_lambda(v))
+        return OP_NONE;
+
+    if (v->lambda_val == c->lambda) {
+        op = OP_SELF;
+    }
+    else if (v->lambda_val->native_impl) {
+        for (i = 0; jit_natives[i].func != NULL; i++) {
+            if (jit_natives[i].func == v->lambda_val->func) {
+                func = jit_natives[i].func;
+                op = jit_natives[i].op;
+                break;
+            }
+        }
+    }
+
+    if (op == OP_NONE)
+        return OP_NONE;
+
+    for (i = 0; i < c->num_deps; i++) {
+        if (strcmp(c->deps[i].name, atom->string_val) == 0)
+            return op;
+    }
+
+    if (c->num_deps == JIT_MAX_DEPS)
+        return OP_NONE;
+
+    c->deps[c->num_deps].name = atom->string_val;
+    c->deps[c->num_deps].func = func;
+    c->num_deps++;
+
+    return op;
+}
+
+
+/*!
+ * Generates code that leaves the value of an expression in xmm0.  If tail is
+ * nonzero then the expression's value is the lambda's result, so self calls
+ * can be compiled as jumps.
+ */
+int compile_expr(Compiler *c, Value *expr, int tail) {
+    Value *head, *args;
+    int index;
+    JitOp op;
+
+    if (is_float(expr)) {
+        emit_load_const(c, 0, expr->float_val);
+        return 1;
+    }
+
+    if (is_atom(expr)) {
+        index = find_param(c, expr);
+        if (index == -1)
+            return 0;
+
+        emit_load_param(c, 0, index);
+        return 1;
+    }
+
+    if (!is_cons_pair(expr))
+        return 0;
+
+    head = get_car(expr);
+    args = get_cdr(expr);
+    if (!is_atom(head))
+        return 0;
+
+    if (special_form_evaluator(head) == eval_if)
+        return compile_if(c, args, tail);
+
+    op = resolve_operator(c, head);
+    switch (op) {
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+        return compile_arith(c, op, args);
+
+    case OP_SELF:
+        return compile_self_call(c, args, tail);
+
+    default:
+        /* Comparisons produce booleans, which compiled code only handles as
+         * the test of an if expression.
+         */
+        return 0;
+    }
+}
+
+
+/*!
+ * Generates code that leaves the value of an expression in xmm1, without
+ * disturbing xmm0.
+ */
+int compile_operand(Compiler *c, Value *expr) {
+    int index;
+
+    if (is_float(expr)) {
+        emit_load_const(c, 1, expr->float_val);
+        return 1;
+    }
+
+    if (is_atom(expr)) {
+        index = find_param(c, expr);
+        if (index == -1)
+            return 0;
+
+        emit_load_param(c, 1, index);
+        return 1;
+    }
+
+    emit_push_xmm0(c);
+    if (!compile_expr(c, expr, 0))
+        return 0;
+
+    cb_bytes(&c->code, "\x0F\x28\xC8", 3);          /* movaps xmm1, xmm0 */
+    emit_pop(c, 0);
+
+    return 1;
+}
+
+
+/*!
+ * Compiles a call to one of the arithmetic operators.  The operations are
+ * done in the same order, and with the same starting values, as the built-in
+ * functions.
+ */
+int compile_arith(Compiler *c, JitOp op, Value *args) {
+    /* The opcodes of addss, subss, mulss and divss respectively. */
+    static const unsigned char opcodes[] = { 0x58, 0x5C, 0x59, 0x5E };
+    int opcode = opcodes[op - OP_ADD];
+
+    if (op == OP_ADD || op == OP_MUL) {
+        /* Start with the identity value, then apply each operand. */
+        emit_load_const(c, 0, op == OP_ADD ? 0.0f : 1.0f);
+    }
+    else {
+        if (!is_cons_pair(args))
+            return 0;
+
+        if (!compile_expr(c, get_car(args), 0))
+            return 0;
+
+        args = get_cdr(args);
+        if (is_nil(args)) {
+            if (op == OP_SUB) {
+                /* Unary negation flips the sign bit. */
+                cb_byte(&c->code, 0xB8);            /* mov eax, sign bit */
+                cb_int32(&c->code, (int32_t) 0x80000000);
+                cb_bytes(&c->code, "\x66\x0F\x6E\xC8", 4);  /* movd xmm1, eax */
+                cb_bytes(&c->code, "\x0F\x57\xC1", 3);      /* xorps xmm0, xmm1 */
+            }
+            else {
+                /* Reciprocal, which the built-in computes as 1.0 / x in
+                 * double precision.
+                 */
+                emit_zero_check(c, 0);
+                cb_bytes(&c->code, "\xF3\x0F\x5A\xC0", 4);  /* cvtss2sd xmm0 */
+                cb_bytes(&c->code, "\x48\xB8", 2);          /* mov rax, 1.0 */
+                cb_int64(&c->code, INT64_C(0x3FF0000000000000));
+                cb_bytes(&c->code, "\x66\x48\x0F\x6E\xC8", 5);  /* movq xmm1 */
+                cb_bytes(&c->code, "\xF2\x0F\x5E\xC8", 4);  /* divsd xmm1, xmm0 */
+                cb_bytes(&c->code, "\xF2\x0F\x5A\xC1", 4);  /* cvtsd2ss xmm0 */
+            }
+
+            return 1;
+        }
+    }
+
+    while (is_cons_pair(args)) {
+        if (!compile_operand(c, get_car(args)))
+            return 0;
+
+        if (op == OP_DIV)
+            emit_zero_check(c, 1);
+
+        cb_bytes(&c->code, "\xF3\x0F", 2);          /* op xmm0, xmm1 */
+        cb_byte(&c->code, opcode);
+        cb_byte(&c->code, 0xC1);
+
+        args = get_cdr(args);
+    }
+
+    return is_nil(args);
+}
+
+
+/*!
+ * Compiles the test of an if expression, which must be a comparison between
+ * two values.  The generated code jumps somewhere if the test is false; the
+ * offsets of these jumps' displacements are stored into patches[], so the
+ * caller can point them at the false branch.
+ */
+int compile_condition(Compiler *c, Value *expr, int *patches,
+                      int *num_patches) {
+    Value *args;
+    JitOp op;
+
+    if (!is_cons_pair(expr))
+        return 0;
+
+    op = resolve_operator(c, get_car(expr));
+    if (op < OP_EQ || op > OP_GE)
+        return 0;
+
+    /* Only two-operand comparisons are compiled. */
+    args = get_cdr(expr);
+    if (list_length(args) != 2)
+        return 0;
+
+    if (!compile_expr(c, get_car(args), 0))
+        return 0;
+    if (!compile_operand(c, get_cadr(args)))
+        return 0;
+
+    /* ucomiss sets CF for "below" and ZF for "equal," and sets both (and PF)
+     * when either value is NaN, in which case every comparison is false.
+     * Less-than comparisons are done with the operands swapped so that NaN
+     * always lands on the false side.
+     */
+    *num_patches = 0;
+    switch (op) {
+    case OP_EQ:
+        cb_bytes(&c->code, "\x0F\x2E\xC1", 3);      /* ucomiss xmm0, xmm1 */
+        patches[(*num_patches)++] = emit_jump(&c->code, "\x0F\x85", 2, 0);
+        patches[(*num_patches)++] = emit_jump(&c->code, "\x0F\x8A", 2, 0);
+        break;
+
+    case OP_LT:
+        cb_bytes(&c->code, "\x0F\x2E\xC8", 3);      /* ucomiss xmm1, xmm0 */
+        patches[(*num_patches)++] = emit_jump(&c->code, "\x0F\x86", 2, 0);
+        break;
+
+    case OP_LE:
+        cb_bytes(&c->code, "\x0F\x2E\xC8", 3);      /* ucomiss xmm1, xmm0 */
+        patches[(*num_patches)++] = emit_jump(&c->code, "\x0F\x82", 2, 0);
+        break;
+
+    case OP_GT:
+        cb_bytes(&c->code, "\x0F\x2E\xC1", 3);      /* ucomiss xmm0, xmm1 */
+        patches[(*num_patches)++] = emit_jump(&c->code, "\x0F\x86", 2, 0);
+        break;
+
+    case OP_GE:
+        cb_bytes(&c->code, "\x0F\x2E\xC1", 3);      /* ucomiss xmm0, xmm1 */
+        patches[(*num_patches)++] = emit_jump(&c->code, "\x0F\x82", 2, 0);
+        break;
+
+    default:
+        assert(0);
+    }
+
+    return 1;
+}
+
+
+int compile_if(Compiler *c, Value *args, int tail) {
+    int patches[2], num_patches, end_patch, i;
+
+    /* Both branches are required, since the value must be a number. */
+    if (list_length(args) != 3)
+        return 0;
+
+    if (!compile_condition(c, get_car(args), patches, &num_patches))
+        return 0;
+
+    args = get_cdr(args);
+    if (!compile_expr(c, get_car(args), tail))
+        return 0;
+
+    end_patch = emit_jump(&c->code, "\xE9", 1, 0);  /* jmp end */
+
+    for (i = 0; i < num_patches; i++)
+        cb_patch_rel32(&c->code, patches[i], c->code.size);
+
+    if (!compile_expr(c, get_cadr(args), tail))
+        return 0;
+
+    cb_patch_rel32(&c->code, end_patch, c->code.size);
+
+    return 1;
+}
+
+
+/*!
+ * Compiles a call from the lambda to itself.  The arguments are evaluated and
+ * pushed, then loaded into xmm0 through xmm7.  In tail position the current
+ * frame is discarded and the call becomes a jump.
+ */
+int compile_self_call(Compiler *c, Value *args, int tail) {
+    int i, n = list_length(args);
+
+    if (n != c->num_params)
+        return 0;
+
+    for (i = 0; i < n; i++) {
+        if (!compile_expr(c, get_car(args), 0))
+            return 0;
+
+        emit_push_xmm0(c);
+        args = get_cdr(args);
+    }
+
+    for (i = 0; i < n; i++) {
+        cb_bytes(&c->code, "\xF3\x0F\x10", 3);      /* movss xmm, [rsp+d] */
+        cb_byte(&c->code, 0x44 | (i << 3));
+        cb_byte(&c->code, 0x24);
+        cb_byte(&c->code, 8 * (n - 1 - i));
+    }
+
+    if (n > 0) {
+        cb_bytes(&c->code, "\x48\x83\xC4", 3);      /* add rsp, 8*n */
+        cb_byte(&c->code, 8 * n);
+    }
+
+    if (tail) {
+        cb_byte(&c->code, 0xC9);                    /* leave */
+        emit_jump(&c->code, "\xE9", 1, c->body_offset);
+    }
+    else {
+        emit_jump(&c->code, "\xE8", 1, c->body_offset);
+    }
+
+    return 1;
+}
+
+
+
+/*============================================================================
+ * COMPILED-CODE MANAGEMENT
+ *============================================================================*/
+
+
+/*!
+ * Tries to compile a lambda to machine code, returning NULL if the lambda
+ * uses anything that the JIT can't handle.  The lambda must be defined in the
+ * global environment, take a fixed number of arguments, and have a body that
+ * is a single expression.
+ */
+JitCode * jit_compile(Lambda *lambda) {
+    Compiler c;
+    JitCode *code = NULL;
+    Value *arg_iter;
+    size_t page_size;
+    int i, entry_offset;
+
+    assert(!lambda->native_impl);
+
+    if (lambda->parent_env != get_global_environment())
+        return NULL;
+
+    if (!is_cons_pair(lambda->body) || !is_nil(get_cdr(lambda->body)))
+        return NULL;
+
+    memset(&c, 0, sizeof(Compiler));
+    c.lambda = lambda;
+
+    for (arg_iter = lambda->arg_spec; is_cons_pair(arg_iter);
+         arg_iter = get_cdr(arg_iter)) {
+        Value *param = get_car(arg_iter);
+
+        if (c.num_params == JIT_MAX_ARGS || find_param(&c, param) != -1)
+            return NULL;
+
+        c.params[c.num_params++] = param;
+    }
+    if (!is_nil(arg_iter))
+        return NULL;    /* The lambda takes a variable number of arguments. */
+
+    /*
+     * The deoptimization code comes first, so every jump to it is backward.
+     * It restores the stack pointer saved by the entry point, and returns 1
+     * from the entry point.
+     */
+    c.bail_offset = c.code.size;
+    cb_bytes(&c.code, "\x48\xB8", 2);               /* mov rax, &saved_rsp */
+    cb_int64(&c.code, (int64_t) (intptr_t) &jit_saved_rsp);
+    cb_bytes(&c.code, "\x48\x8B\x20", 3);           /* mov rsp, [rax] */
+    cb_bytes(&c.code, "\x48\x83\xC4\x10", 4);       /* add rsp, 16 */
+    cb_byte(&c.code, 0x5D);                         /* pop rbp */
+    cb_byte(&c.code, 0xB8);                         /* mov eax, 1 */
+    cb_int32(&c.code, 1);
+    cb_byte(&c.code, 0xC3);                         /* ret */
+
+    /*
+     * The body takes its arguments in xmm0 through xmm7, stores them in its
+     * frame, and returns its result in xmm0.
+     */
+    c.body_offset = c.code.size;
+    cb_bytes(&c.code, "\x55\x48\x89\xE5", 4);       /* push rbp; mov rbp, rsp */
+    if (c.num_params > 0) {
+        cb_bytes(&c.code, "\x48\x81\xEC", 3);       /* sub rsp, 8*n */
+        cb_int32(&c.code, 8 * c.num_params);
+    }
+    for (i = 0; i < c.num_params; i++) {
+        cb_bytes(&c.code, "\xF3\x0F\x11", 3);       /* movss [rbp+d], xmm */
+        cb_byte(&c.code, 0x85 | (i << 3));
+        cb_int32(&c.code, -8 * (i + 1));
+    }
+
+    if (!compile_expr(&c, get_car(lambda->body), 1))
+        goto Done;
+
+    cb_bytes(&c.code, "\xC9\xC3", 2);               /* leave; ret */
+
+    /*
+     * The entry point loads the arguments from the array, calls the body, and
+     * stores the result.
+     */
+    entry_offset = c.code.size;
+    cb_bytes(&c.code, "\x55\x48\x89\xE5", 4);       /* push rbp; mov rbp, rsp */
+    cb_bytes(&c.code, "\x56\x56", 2);               /* push rsi; push rsi */
+    cb_bytes(&c.code, "\x48\xB8", 2);               /* mov rax, &saved_rsp */
+    cb_int64(&c.code, (int64_t) (intptr_t) &jit_saved_rsp);
+    cb_bytes(&c.code, "\x48\x89\x20", 3);           /* mov [rax], rsp */
+    for (i = 0; i < c.num_params; i++) {
+        cb_bytes(&c.code, "\xF3\x0F\x10", 3);       /* movss xmm, [rdi+d] */
+        cb_byte(&c.code, 0x47 | (i << 3));
+        cb_byte(&c.code, 4 * i);
+    }
+    emit_jump(&c.code, "\xE8", 1, c.body_offset);   /* call body */
+    cb_bytes(&c.code, "\x48\x8B\x75\xF8", 4);       /* mov rsi, [rbp-8] */
+    cb_bytes(&c.code, "\xF3\x0F\x11\x06", 4);       /* movss [rsi], xmm0 */
+    cb_bytes(&c.code, "\x31\xC0", 2);               /* xor eax, eax */
+    cb_bytes(&c.code, "\xC9\xC3", 2);               /* leave; ret */
+
+    /* Copy the code into its own pages, then make them executable. */
+    code = malloc(sizeof(JitCode));
+    memset(code, 0, sizeof(JitCode));
+
+    page_size = sysconf(_SC_PAGESIZE);
+    code->pages_size = (c.code.size + page_size - 1) & ~(page_size - 1);
+    code->pages = mmap(NULL, code->pages_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code->pages == MAP_FAILED) {
+        free(code);
+        code = NULL;
+        goto Done;
+    }
+
+    memcpy(code->pages, c.code.bytes, c.code.size);
+    mprotect(code->pages, code->pages_size, PROT_READ | PROT_EXEC);
+
+    code->entry = (JitEntry) ((char *) code->pages + entry_offset);
+    code->num_args = c.num_params;
+    code->epoch = get_global_binding_epoch();
+    code->num_deps = c.num_deps;
+    memcpy(code->deps, c.deps, c.num_deps * sizeof(JitDependency));
+
+#ifdef VERBOSE_JIT
+    printf("JIT:  compiled lambda to %d bytes of code:  ", c.code.size);
+    print_value(stdout, get_car(lambda->body));
+    printf("\n");
+#endif
+
+Done:
+    free(c.code.bytes);
+    return code;
+}
+
+
+/*!
+ * Checks that every global name the compiled code depends on is still bound
+ * to the procedure it was bound to when the code was compiled.
+ */
+int check_dependencies(Lambda *lambda, JitCode *code) {
+    Value *v;
+    int i;
+
+    for (i = 0; i < code->num_deps; i++) {
+        v = resolve_binding(lambda->parent_env, (char *) code->deps[i].name);
+        if (v == NULL || !is_lambda(v))
+            return 0;
+
+        if (code->deps[i].func == NULL) {
+            if (v->lambda_val != lambda)
+                return 0;
+        }
+        else if (!v->lambda_val->native_impl ||
+                 v->lambda_val->func != code->deps[i].func) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+/*!
+ * Calls a lambda through its compiled code, if it has any.  Lambdas that
+ * don't have compiled code have their calls counted, and are compiled once
+ * they become hot.
+ *
+ * Returns 1 and stores the lambda's result into *result if the compiled code
+ * ran, or 0 if the interpreter must evaluate the call instead:  because the
+ * lambda isn't compiled, an argument isn't a number, a global name the code
+ * depends on has been rebound, or the code deoptimized.
+ */
+int jit_try_call(Lambda *lambda, int num_operands, Value *operands,
+                 Value **result) {
+    JitCode *code;
+    float args[JIT_MAX_ARGS], value;
+    Value *v;
+    int i;
+
+    code = lambda->jit_code;
+    if (code == NULL) {
+        if (lambda->call_count < JIT_CALL_THRESHOLD &&
+            ++lambda->call_count == JIT_CALL_THRESHOLD) {
+            lambda->jit_code = jit_compile(lambda);
+        }
+
+        code = lambda->jit_code;
+        if (code == NULL)
+            return 0;
+    }
+
+    /* Type guards:  the compiled code only works on numbers. */
+    if (num_operands != code->num_args)
+        return 0;
+
+    for (i = 0; i < num_operands; i++) {
+        v = get_car(operands);
+        if (!is_float(v))
+            return 0;
+
+        args[i] = v->float_val;
+        operands = get_cdr(operands);
+    }
+
+    if (code->epoch != get_global_binding_epoch()) {
+        if (!check_dependencies(lambda, code)) {
+            jit_release(lambda);
+            return 0;
+        }
+
+        code->epoch = get_global_binding_epoch();
+    }
+
+    if (code->entry(args, &value) != 0) {
+        code->num_deopts++;
+        if (code->num_deopts > JIT_MAX_DEOPTS)
+            jit_release(lambda);
+
+        return 0;
+    }
+
+    *result = make_float(value);
+    return 1;
+}
+
+
+/*!
+ * Releases any compiled code for a lambda.  The lambda won't be compiled
+ * again, so it stays with the interpreter from now on.
+ */
+void jit_release(Lambda *lambda) {
+    JitCode *code = lambda->jit_code;
+
+    if (code == NULL)
+        return;
+
+    munmap(code->pages, code->pages_size);
+    free(code);
+
+    lambda->jit_code = NULL;
+}
+
+
+#endif /* JIT_ENABLED */
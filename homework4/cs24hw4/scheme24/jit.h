@@ -0,0 +1,26 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "types.h"
+
+
+/*
+ * The JIT generates x86-64 machine code, so it is only available on 64-bit
+ * Linux builds.  (The default build on 64-bit hosts uses -m32, which leaves it
+ * out.)  Compiling with -DNO_JIT also leaves it out.
+ */
+#if defined(__x86_64__) && defined(__linux__) && !defined(NO_JIT)
+#define JIT_ENABLED
+#endif
+
+
+#ifdef JIT_ENABLED
+
+int jit_try_call(Lambda *lambda, int num_operands, Value *operands,
+                 Value **result);
+void jit_release(Lambda *lambda);
+
+#endif /* JIT_ENABLED */
+
+
+#endif /* JIT_H */
@@ -6,6 +6,11 @@
 
 #include "native_lambdas.h"
 #include "values.h"
+#include "alloc.h"
+#include "evaluator.h"
+#include "special_forms.h"       /* for force_promise */
+#include "constants.h"
+#include "weak.h"
 #include "repl.h"                /* for exec_file */
 
 
@@ -361,6 +366,104 @@ Value * scheme_div(int num_args, Value *args) {
 }
 
 
+/*!
+ * This helper function implements min and max, which return the smallest or
+ * largest of their arguments.  If sign is 1 then the largest argument is
+ * returned, and if it is -1 then the smallest is.  (apply min lst) passes the
+ * list through without copying it, so this also serves for lists.
+ */
+Value * extremum_helper(const char *name, int sign, int num_args, Value *args) {
+    Value *v, *best;
+
+    if (num_args == 0)
+        return make_error("%s requires at least one argument", name);
+
+    best = get_car(args);
+    if (!is_float(best))
+        return make_error("invalid argument to %s", name);
+
+    for (args = get_cdr(args); is_cons_pair(args); args = get_cdr(args)) {
+        v = get_car(args);
+        if (!is_float(v))
+            return make_error("invalid argument to %s", name);
+
+        if (sign * (v->float_val - best->float_val) > 0)
+            best = v;
+    }
+
+    if (!is_nil(args))
+        return make_error("invalid argument to %s", name);
+
+    /* The argument itself is returned, so nothing needs to be allocated. */
+    return best;
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "min".
+ */
+Value * scheme_min(int num_args, Value *args) {
+    return extremum_helper("min", -1, num_args, args);
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "max".
+ */
+Value * scheme_max(int num_args, Value *args) {
+    return extremum_helper("max", 1, num_args, args);
+}
+
+
+/*!
+ * This helper function implements sum and product, which fold + or * over the
+ * numbers in a list.  The total is accumulated in a C float, so only the
+ * result is allocated, however long the list is.
+ */
+Value * fold_numbers_helper(const char *name, int multiply, int num_args,
+                            Value *args) {
+    Value *list, *v;
+    float result = multiply ? 1 : 0;
+
+    if (num_args != 1)
+        return make_error("%s requires exactly one argument", name);
+
+    for (list = get_car(args); is_cons_pair(list); list = get_cdr(list)) {
+        v = get_car(list);
+        if (!is_float(v))
+            return make_error("%s requires a list of numbers", name);
+
+        if (multiply)
+            result *= v->float_val;
+        else
+            result += v->float_val;
+    }
+
+    if (!is_nil(list))
+        return make_error("%s requires a list of numbers", name);
+
+    return make_float(result);
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "sum", which returns
+ * the sum of a list of numbers.
+ */
+Value * scheme_sum(int num_args, Value *args) {
+    return fold_numbers_helper("sum", /* multiply */ 0, num_args, args);
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "product", which
+ * returns the product of a list of numbers.
+ */
+Value * scheme_product(int num_args, Value *args) {
+    return fold_numbers_helper("product", /* multiply */ 1, num_args, args);
+}
+
+
 /*!
  * This function implements the Scheme built-in function "cons", which creates a
  * new cons-pair with the specified contents.
@@ -462,10 +565,13 @@ Value * scheme_eq(int num_args, Value *args) {
         break;
 
     case T_Atom:
-    case T_String:
         result = (strcmp(v1->string_val, v2->string_val) == 0);
         break;
 
+    case T_String:
+        result = string_equals(v1->str_val, v2->str_val);
+        break;
+
     case T_Boolean:
         assert(v1->bool_val == 1 || v1->bool_val == 0);
         assert(v2->bool_val == 1 || v2->bool_val == 0);
@@ -478,6 +584,10 @@ Value * scheme_eq(int num_args, Value *args) {
 
     case T_ConsPair:
     case T_Lambda:
+    case T_Promise:
+    case T_WeakBox:
+    case T_WeakTable:
+    case T_Values:
         result = (v1 == v2);
         break;
     default:
@@ -499,16 +609,25 @@ int fn_value_equality(Value *v1, Value *v2) {
     if (v1->type != v2->type)
         return 0;
 
+    /* Equal constants are interned as the same object, so two different
+     * interned values can't be equal.
+     */
+    if (v1 != v2 && is_interned(v1) && is_interned(v2))
+        return 0;
+
     switch (v1->type) {
     case T_Nil:
         result = 1;
         break;
 
     case T_Atom:
-    case T_String:
         result = (strcmp(v1->string_val, v2->string_val) == 0);
         break;
 
+    case T_String:
+        result = string_equals(v1->str_val, v2->str_val);
+        break;
+
     case T_Boolean:
         assert(v1->bool_val == 1 || v1->bool_val == 0);
         assert(v2->bool_val == 1 || v2->bool_val == 0);
@@ -554,6 +673,25 @@ int fn_value_equality(Value *v1, Value *v2) {
 
         break;
 
+    case T_Promise:
+        /* Comparing promises would mean forcing them, so only the same
+         * promise is equal to itself.
+         */
+        result = (v1 == v2);
+        break;
+
+    case T_WeakBox:
+    case T_WeakTable:
+        /* Their contents can be cleared at any time, so only compare them by
+         * identity too.
+         */
+        result = (v1 == v2);
+        break;
+
+    case T_Values:
+        result = fn_value_equality(v1->values_val, v2->values_val);
+        break;
+
     default:
         result = 0;
     }
@@ -595,6 +733,9 @@ Value * scheme_set_car(int num_args, Value *args) {
     if (!is_cons_pair(target))
         return make_error("first argument to set-car! must be a cons pair");
 
+    if (is_interned(target))
+        return make_error("set-car! cannot modify a constant");
+
     val = get_car(get_cdr(args));
     return_if_error(val);
 
@@ -620,6 +761,9 @@ Value * scheme_set_cdr(int num_args, Value *args) {
     if (!is_cons_pair(target))
         return make_error("first argument to set-cdr! must be a cons pair");
 
+    if (is_interned(target))
+        return make_error("set-cdr! cannot modify a constant");
+
     val = get_car(get_cdr(args));
     return_if_error(val);
 
@@ -629,156 +773,1355 @@ Value * scheme_set_cdr(int num_args, Value *args) {
 }
 
 
-Value * scheme_display(int num_args, Value *args) {
+/*============================================================================
+ * LIST LIBRARY
+ *
+ *   These functions used to be defined in stdlib.scm, but they are used so
+ *   heavily that they are implemented natively.  All of them are iterative,
+ *   and they only allocate the cons pairs that appear in their results.
+ *
+ *   The functions that take a procedure argument call back into the evaluator
+ *   with apply_procedure().  Since that can trigger garbage collection, they
+ *   push their own evaluation context to register their partial results.
+ *============================================================================*/
 
-    if (num_args == 0) {
-        printf("\n");
-    }
-    else {
-        while (!is_nil(args)) {
-            Value *v = get_car(args);
-            print_value(stdout, v);
-            args = get_cdr(args);
-        }
-        printf("\n");
+
+/*!
+ * This helper function returns a copy of the spine of a proper list; the
+ * elements themselves are shared with the original list.  If the argument
+ * isn't a proper list then an error is returned.
+ */
+Value * copy_list(Value *list) {
+    ListBuilder copy;
+
+    init_list_builder(&copy);
+    while (is_cons_pair(list)) {
+        append_value_to_list(&copy, get_car(list));
+        list = get_cdr(list);
     }
-    
-    return NULL;
+
+    if (!is_nil(list))
+        return make_error("argument must be a proper list");
+
+    return copy.head;
 }
 
 
 /*!
- * This function generates an error result from a single string argument
- * specifying the error message.
+ * This helper function reports whether the cons pairs of an argument list can
+ * be shared with the caller, or reused from one call of a procedure to the
+ * next.  This is safe for procedures that only use the elements of the list:
+ * natives that don't retain their operand list, and interpreted lambdas with
+ * a fixed number of arguments, which bind the elements rather than the list.
+ * Lambdas with a rest parameter, and natives such as list, keep the list
+ * itself.
  */
-Value * scheme_error(int num_args, Value *args) {
-    Value *msg;
+int reusable_arg_list(Value *proc) {
+    Value *arg_spec;
 
-    if (num_args != 1)
-        return make_error("error currently only supports one argument");
+    assert(is_lambda(proc));
 
-    msg = get_car(args);
-    return_if_error(msg);
+    if (proc->lambda_val->native_impl)
+        return !proc->lambda_val->retains_args;
 
-    if (!is_string(msg))
-        return make_error("argument to error must be a string");
+    arg_spec = proc->lambda_val->arg_spec;
+    while (is_cons_pair(arg_spec))
+        arg_spec = get_cdr(arg_spec);
 
-    return make_error(msg->string_val);
+    return is_nil(arg_spec);
 }
 
 
 /*!
- * This function seeds the random number generator, either with a single numeric
- * argument, or with the current time value if no argument is provided.  The
- * argument will be a float, but we cast it to an unsigned integer in here.
+ * This helper function builds the argument list for the next step of a
+ * procedure that is being mapped over one or more lists.  The lists argument
+ * is a list of the current positions within each of the input lists; the
+ * i-th argument is the car of the i-th position, and each position is then
+ * advanced to its cdr.
+ *
+ * If args is non-NULL then its cons pairs are overwritten instead of
+ * allocating new ones.  (The first num_skip cars of args are left alone, so
+ * that fold-left can keep its accumulator there.)
+ *
+ * The function returns NULL when any of the lists runs out.
  */
-Value * scheme_srandom(int num_args, Value *args) {
-    Value *seed, *result;
-    unsigned int seed_val;
+Value * next_mapped_args(Value *lists, Value *args, int num_skip) {
+    Value *arg_iter, *curr;
+    ListBuilder builder;
 
-    if (num_args == 0) {
-        seed_val = time(NULL);
-    }
-    else if (num_args == 1) {
-        seed = get_car(args);
-        return_if_error(seed);
+    if (args == NULL)
+        init_list_builder(&builder);
 
-        if (!is_float(seed))
-            return make_error("invalid argument to srandom");
-    
-        seed_val = (unsigned) seed->float_val;
-    }
-    else {
-        return make_error("srandom takes zero or one arguments");
+    arg_iter = args;
+    while (num_skip-- > 0)
+        arg_iter = get_cdr(arg_iter);
+
+    while (is_cons_pair(lists)) {
+        curr = get_car(lists);
+        if (is_nil(curr))
+            return NULL;
+
+        if (!is_cons_pair(curr))
+            return make_error("arguments must be proper lists");
+
+        if (args == NULL) {
+            append_value_to_list(&builder, get_car(curr));
+        }
+        else {
+            set_car(arg_iter, get_car(curr));
+            arg_iter = get_cdr(arg_iter);
+        }
+
+        set_car(lists, get_cdr(curr));
+        lists = get_cdr(lists);
     }
 
-    result = make_float((float) seed_val);
-    return_if_error(result);
+    return (args == NULL) ? builder.head : args;
+}
 
-    srandom(seed_val);
 
+/*!
+ * This helper function implements both map and for-each.  The procedure is
+ * applied to the corresponding elements of each list until the shortest list
+ * runs out.  If collect is nonzero then the results are gathered into a new
+ * list, otherwise they are discarded.
+ */
+Value * map_helper(const char *name, int num_args, Value *args, int collect) {
+    Value *proc, *lists, *call_args, *elem, *result;
+    ListBuilder results;
+    int reuse;
+
+    if (num_args < 2)
+        return make_error("%s requires a procedure and at least one list", name);
+
+    proc = get_car(args);
+    if (!is_lambda(proc))
+        return make_error("first argument to %s must be a procedure", name);
+
+    push_new_evalctx(NULL, NULL);
+    evalctx_register(&lists);
+    evalctx_register(&call_args);
+    evalctx_register(&results.head);
+    evalctx_register(&result);
+
+    /* Copy the list of positions, since we advance them in place. */
+    lists = copy_list(get_cdr(args));
+    reuse = reusable_arg_list(proc);
+    init_list_builder(&results);
+
+    while (1) {
+        call_args = next_mapped_args(lists, reuse ? call_args : NULL, 0);
+        if (call_args == NULL)
+            break;
+        goto_done_if_error(call_args);
+
+        elem = apply_procedure(proc, num_args - 1, call_args);
+        goto_done_if_error(elem);
+
+        if (collect)
+            append_value_to_list(&results, elem != NULL ? elem : make_nil());
+    }
+
+    result = collect ? results.head : make_nil();
+
+Done:
+    pop_evalctx(result);
     return result;
 }
- 
- 
+
+
 /*!
- * This function returns a random number from the random generator.
+ * This function implements the Scheme built-in function "append", which
+ * returns a list containing the elements of each of its arguments.  All but
+ * the last argument are copied; the last argument is shared by the result.
  */
-Value * scheme_random(int num_args, Value *args) {
-    Value *max = NULL;
-    long rand_val;
+Value * scheme_append(int num_args, Value *args) {
+    Value *list, *last;
+    ListBuilder result;
 
-    if (num_args == 1) {
-        max = get_car(args);
-        if (!is_float(max))
-            return make_error("argument to random must be a number");
+    if (num_args == 0)
+        return make_nil();
+
+    init_list_builder(&result);
+
+    while (!is_nil(get_cdr(args))) {
+        list = get_car(args);
+        while (is_cons_pair(list)) {
+            append_value_to_list(&result, get_car(list));
+            list = get_cdr(list);
+        }
+
+        if (!is_nil(list))
+            return make_error("arguments to append must be proper lists");
+
+        args = get_cdr(args);
     }
-    else if (num_args > 1) {
-        return make_error("random takes zero or one arguments");
+
+    /* The last argument is referenced, not copied. */
+    last = get_car(args);
+    if (is_nil(result.head))
+        return last;
+
+    set_cdr(result.tail, last);
+    return result.head;
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "append!", which is
+ * like append, except that the argument lists are spliced together in place
+ * rather than being copied.
+ */
+Value * scheme_append_bang(int num_args, Value *args) {
+    Value *result = NULL, *tail = NULL, *list;
+
+    if (num_args == 0)
+        return make_nil();
+
+    while (is_cons_pair(args)) {
+        list = get_car(args);
+        args = get_cdr(args);
+
+        if (is_nil(list) && !is_nil(args))
+            continue;
+
+        if (tail != NULL) {
+            if (is_interned(tail))
+                return make_error("append! cannot modify a constant");
+
+            set_cdr(tail, list);
+        }
+        else
+            result = list;
+
+        if (is_nil(args))
+            break;
+
+        if (!is_cons_pair(list))
+            return make_error("arguments to append! must be proper lists");
+
+        /* Find the last cons pair of this list, to splice the next one on. */
+        tail = list;
+        while (is_cons_pair(get_cdr(tail)))
+            tail = get_cdr(tail);
+
+        if (!is_nil(get_cdr(tail)))
+            return make_error("arguments to append! must be proper lists");
     }
 
-    rand_val = random();
-    if (max != NULL)
-        rand_val %= (int) max->float_val;
-        
-    return make_float((float) rand_val);
+    return (result != NULL) ? result : make_nil();
 }
 
 
 /*!
- * This function returns the current time in seconds from the epoch, as the C
- * time() function returns.
+ * This function implements the Scheme built-in function "reverse", which
+ * returns a new list with the elements of its argument in reverse order.
  */
-Value * scheme_time(int num_args, Value *args) {
-    Value *result;
+Value * scheme_reverse(int num_args, Value *args) {
+    Value *list, *result;
 
-    if (num_args != 0)
-        return make_error("time takes zero arguments");
+    if (num_args != 1)
+        return make_error("reverse requires exactly one argument");
+
+    list = get_car(args);
+    result = make_nil();
+    while (is_cons_pair(list)) {
+        result = make_cons(get_car(list), result);
+        list = get_cdr(list);
+    }
+
+    if (!is_nil(list))
+        return make_error("argument to reverse must be a proper list");
 
-    result = make_float((float) time(NULL));
     return result;
 }
 
 
 /*!
- * This function computes the square-root of the input argument.
+ * This function implements the Scheme built-in function "reverse!", which
+ * reverses a list in place by redirecting the cdr of each cons pair.  The
+ * result is the cons pair that used to be last in the list.
  */
-Value * scheme_sqrt(int num_args, Value *args) {
-    Value *input, *result;
+Value * scheme_reverse_bang(int num_args, Value *args) {
+    Value *list, *next, *result;
 
-    if (num_args == 1) {
-        input = get_car(args);
-        return_if_error(input);
+    if (num_args != 1)
+        return make_error("reverse! requires exactly one argument");
 
-        if (!is_float(input))
-            return make_error("invalid argument to sqrt");
-    }
-    else {
-        return make_error("sqrt takes one argument");
+    list = get_car(args);
+    if (list_length(list) == -1)
+        return make_error("argument to reverse! must be a proper list");
+
+    if (is_nil(list))
+        return list;
+
+    /* Reuse the nil at the end of the list as the end of the result. */
+    result = list;
+    while (is_cons_pair(result)) {
+        if (is_interned(result))
+            return make_error("reverse! cannot modify a constant");
+
+        result = get_cdr(result);
     }
 
-    result = make_float(sqrtf(input->float_val));
-    return_if_error(result);
+    while (is_cons_pair(list)) {
+        next = get_cdr(list);
+        set_cdr(list, result);
+        result = list;
+        list = next;
+    }
 
     return result;
 }
 
 
 /*!
- * This function evaluates a Scheme file in the context of the global
- * environment.
+ * This helper function implements list-tail and list-ref.  It returns the
+ * portion of the list starting at the k-th element, or an error if the list
+ * is too short.
  */
-Value * scheme_eval_file(int num_args, Value *args) {
-    Value *filename;
+Value * list_tail_helper(const char *name, int num_args, Value *args) {
+    Value *list, *k;
+    int i;
+
+    if (num_args != 2)
+        return make_error("%s requires exactly two arguments", name);
+
+    list = get_car(args);
+    k = get_cadr(args);
+    if (!is_float(k) || k->float_val < 0)
+        return make_error("index argument to %s must be a nonnegative number",
+                          name);
+
+    for (i = (int) k->float_val; i > 0; i--) {
+        if (!is_cons_pair(list))
+            return make_error("index argument to %s is out of range", name);
 
+        list = get_cdr(list);
+    }
+
+    return list;
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "list-tail", which
+ * returns the trailing portion of a list starting with the k-th element.
+ * (list-tail x 0) returns the entire list.
+ */
+Value * scheme_list_tail(int num_args, Value *args) {
+    return list_tail_helper("list-tail", num_args, args);
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "list-ref", which
+ * returns the k-th element of a list.  The first element has index 0.
+ */
+Value * scheme_list_ref(int num_args, Value *args) {
+    Value *tail = list_tail_helper("list-ref", num_args, args);
+    return_if_error(tail);
+
+    if (!is_cons_pair(tail))
+        return make_error("index argument to list-ref is out of range");
+
+    return get_car(tail);
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "list-copy", which
+ * returns a copy of the spine of a list.
+ */
+Value * scheme_list_copy(int num_args, Value *args) {
     if (num_args != 1)
-        return make_error("eval-file takes exactly one string argument");
+        return make_error("list-copy requires exactly one argument");
 
-    filename = get_car(args);
-    if (!is_string(filename))
-        return make_error("eval-file takes exactly one string argument");
+    return copy_list(get_car(args));
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "map", which returns
+ * a list of the results of applying a procedure to the corresponding elements
+ * of one or more lists.
+ */
+Value * scheme_map(int num_args, Value *args) {
+    return map_helper("map", num_args, args, /* collect */ 1);
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "for-each", which
+ * applies a procedure to the corresponding elements of one or more lists for
+ * its side-effects.
+ */
+Value * scheme_for_each(int num_args, Value *args) {
+    return map_helper("for-each", num_args, args, /* collect */ 0);
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "filter", which
+ * returns a list of the elements of a list that satisfy a predicate.
+ *
+ * For compatibility with the original stdlib.scm definition, the arguments
+ * can be given either as (filter pred? x) or as (filter x pred?).
+ */
+Value * scheme_filter(int num_args, Value *args) {
+    Value *pred, *list, *call_args, *keep, *result;
+    ListBuilder results;
+
+    if (num_args != 2)
+        return make_error("filter requires exactly two arguments");
+
+    pred = get_car(args);
+    list = get_cadr(args);
+    if (!is_lambda(pred)) {
+        Value *swap = pred;
+        pred = list;
+        list = swap;
+    }
+
+    if (!is_lambda(pred))
+        return make_error("filter requires a predicate argument");
+
+    push_new_evalctx(NULL, NULL);
+    evalctx_register(&call_args);
+    evalctx_register(&results.head);
+    evalctx_register(&result);
+
+    init_list_builder(&results);
+    while (is_cons_pair(list)) {
+        if (call_args == NULL || !reusable_arg_list(pred))
+            call_args = make_cons(get_car(list), make_nil());
+        else
+            set_car(call_args, get_car(list));
+
+        keep = apply_procedure(pred, 1, call_args);
+        goto_done_if_error(keep);
+
+        if (is_true(keep))
+            append_value_to_list(&results, get_car(list));
+
+        list = get_cdr(list);
+    }
+
+    if (!is_nil(list))
+        result = make_error("argument to filter must be a proper list");
+    else
+        result = results.head;
+
+Done:
+    pop_evalctx(result);
+    return result;
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "fold-left":
+ *     (fold-left f init x1 x2 ...)
+ *
+ * The procedure is applied to the accumulated value and the corresponding
+ * elements of each list, from left to right, and the result becomes the new
+ * accumulated value.
+ */
+Value * scheme_fold_left(int num_args, Value *args) {
+    Value *proc, *lists, *call_args, *acc, *next;
+    int reuse;
+
+    if (num_args < 3) {
+        return make_error("fold-left requires a procedure, an initial value, "
+                          "and at least one list");
+    }
+
+    proc = get_car(args);
+    if (!is_lambda(proc))
+        return make_error("first argument to fold-left must be a procedure");
+
+    push_new_evalctx(NULL, NULL);
+    evalctx_register(&lists);
+    evalctx_register(&call_args);
+    evalctx_register(&acc);
+
+    acc = get_cadr(args);
+    lists = copy_list(get_cdr(get_cdr(args)));
+    reuse = reusable_arg_list(proc);
+
+    while (1) {
+        if (call_args == NULL || !reuse) {
+            next = next_mapped_args(lists, NULL, 0);
+            if (next == NULL || is_error(next)) {
+                if (next != NULL)
+                    acc = next;
+                break;
+            }
+            call_args = make_cons(acc, next);
+        }
+        else {
+            set_car(call_args, acc);
+            next = next_mapped_args(lists, call_args, 1);
+            if (next == NULL || is_error(next)) {
+                if (next != NULL)
+                    acc = next;
+                break;
+            }
+        }
+
+        acc = apply_procedure(proc, num_args - 1, call_args);
+        if (acc == NULL)
+            acc = make_nil();
+        if (is_error(acc))
+            break;
+    }
+
+    pop_evalctx(acc);
+    return acc;
+}
+
+
+/*!
+ * This helper function implements assoc and member.  It walks a list looking
+ * for an element that is equal? to the key, where the element's car is used
+ * if by_car is nonzero.  It returns the list tail starting at the match, or
+ * #f if there is no match.
+ */
+Value * find_equal(const char *name, int num_args, Value *args, int by_car) {
+    Value *key, *list, *elem;
+
+    if (num_args != 2)
+        return make_error("%s requires exactly two arguments", name);
+
+    key = get_car(args);
+    list = get_cadr(args);
+
+    while (is_cons_pair(list)) {
+        elem = get_car(list);
+        if (by_car) {
+            if (!is_cons_pair(elem))
+                return make_error("%s requires a list of pairs", name);
+
+            elem = get_car(elem);
+        }
+
+        if (fn_value_equality(key, elem))
+            return list;
+
+        list = get_cdr(list);
+    }
+
+    if (!is_nil(list))
+        return make_error("argument to %s must be a proper list", name);
+
+    return make_false();
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "assoc", which finds
+ * the first pair in an association list whose car is equal? to the key.
+ */
+Value * scheme_assoc(int num_args, Value *args) {
+    Value *tail = find_equal("assoc", num_args, args, /* by_car */ 1);
+
+    if (is_cons_pair(tail))
+        return get_car(tail);
+
+    return tail;
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "member", which
+ * returns the first tail of a list whose car is equal? to the key, or #f.
+ */
+Value * scheme_member(int num_args, Value *args) {
+    return find_equal("member", num_args, args, /* by_car */ 0);
+}
+
+
+Value * scheme_display(int num_args, Value *args) {
+
+    if (num_args == 0) {
+        printf("\n");
+    }
+    else {
+        while (!is_nil(args)) {
+            Value *v = get_car(args);
+            print_value(stdout, v);
+            args = get_cdr(args);
+        }
+        printf("\n");
+    }
+    
+    return NULL;
+}
+
+
+/*!
+ * This function renders a value into a string, in the same format that the
+ * REPL prints it:  (write-to-string v).  If a second argument is given and it
+ * is true, shared and cyclic structure is written with datum labels.
+ */
+Value * scheme_write_to_string(int num_args, Value *args) {
+    Value *result;
+    char *str;
+    int label_cycles = 0;
+
+    if (num_args == 2)
+        label_cycles = is_true(get_cadr(args));
+    else if (num_args != 1)
+        return make_error("write-to-string takes one or two arguments");
+
+    str = value_to_string(get_car(args), label_cycles);
+    result = make_string(str);
+    free(str);
+
+    return result;
+}
+
+
+/*============================================================================
+ * APPLY AND MULTIPLE VALUES
+ *
+ *   apply passes its last argument to the procedure as the operand list
+ *   itself, so (apply + lst) doesn't copy the list, unless the procedure may
+ *   hold onto its operand list (see reusable_arg_list()); those procedures
+ *   get a copy.  Multiple values are returned as a single T_Values value that
+ *   holds the operand list values was called with; call-with-values hands
+ *   that list straight to the consumer, so returning several values costs one
+ *   allocation.
+ *============================================================================*/
+
+
+/*!
+ * This function implements the Scheme built-in function "apply":
+ *     (apply f arg1 ... args)
+ *
+ * The procedure is called with arg1 ... followed by the elements of the list
+ * args.  The list becomes the tail of the procedure's operands without being
+ * copied, unless the procedure may keep its operand list:  natives such as
+ * list and values, and lambdas with a rest parameter, get a copy of the list,
+ * so that (apply list lst) returns a new list.
+ */
+Value * scheme_apply(int num_args, Value *args) {
+    Value *proc, *last, *operands, *tail, *end, *result;
+    int num_operands;
+
+    if (num_args < 2)
+        return make_error("apply requires a procedure and a list of arguments");
+
+    proc = get_car(args);
+    if (!is_lambda(proc))
+        return make_error("first argument to apply must be a procedure");
+
+    args = get_cdr(args);
+    for (last = args; !is_nil(get_cdr(last)); last = get_cdr(last));
+    if (list_length(get_car(last)) < 0)
+        return make_error("last argument to apply must be a list");
+
+    push_new_evalctx(NULL, NULL);
+    evalctx_register(&operands);
+    evalctx_register(&tail);
+    evalctx_register(&result);
+
+    tail = get_car(last);
+    if (!reusable_arg_list(proc))
+        tail = copy_list(tail);
+
+    if (num_args == 2) {
+        operands = tail;
+    }
+    else {
+        /* Copy the arguments before the list, and attach the list to the end
+         * of the copy.  The copy is made from the operand list apply was
+         * called with, which is still reachable from our caller.
+         */
+        operands = copy_list(args);
+        for (end = operands; !is_nil(get_cdr(get_cdr(end)));
+             end = get_cdr(end));
+        set_cdr(end, tail);
+    }
+
+    num_operands = list_length(operands);
+    result = apply_procedure(proc, num_operands, operands);
+
+    pop_evalctx(result);
+    return result;
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "values", which
+ * returns its arguments as multiple values.  A single argument is returned
+ * as itself.
+ */
+Value * scheme_values(int num_args, Value *args) {
+    if (num_args == 1)
+        return get_car(args);
+
+    return make_values(args);
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "call-with-values":
+ *     (call-with-values producer consumer)
+ *
+ * The producer is called with no arguments, and the consumer is called with
+ * the values it returns as its arguments.
+ */
+Value * scheme_call_with_values(int num_args, Value *args) {
+    Value *producer, *consumer, *operands, *result;
+
+    if (num_args != 2)
+        return make_error("call-with-values requires exactly two arguments");
+
+    producer = get_car(args);
+    consumer = get_cadr(args);
+    if (!is_lambda(producer) || !is_lambda(consumer))
+        return make_error("arguments to call-with-values must be procedures");
+
+    push_new_evalctx(NULL, NULL);
+    evalctx_register(&operands);
+    evalctx_register(&result);
+
+    result = apply_procedure(producer, 0, make_nil());
+    goto_done_if_error(result);
+
+    if (is_values(result))
+        operands = result->values_val;
+    else
+        operands = make_cons(result, make_nil());
+
+    result = apply_procedure(consumer, list_length(operands), operands);
+
+Done:
+    pop_evalctx(result);
+    return result;
+}
+
+
+/*============================================================================
+ * PROMISES AND STREAMS
+ *
+ *   Promises are created by the delay and cons-stream special forms.  A
+ *   stream is a cons pair whose cdr is a promise of the rest of the stream.
+ *   stream-ref and stream->list walk a stream iteratively, so that long
+ *   streams don't use up the C stack the way a recursive Scheme version
+ *   would.
+ *============================================================================*/
+
+
+/*!
+ * This function implements the Scheme built-in function "force", which
+ * returns the value of a promise, evaluating it the first time the promise is
+ * forced.  Values that aren't promises are returned unchanged.
+ */
+Value * scheme_force(int num_args, Value *args) {
+    if (num_args != 1)
+        return make_error("force requires exactly one argument");
+
+    return force_promise(get_car(args));
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "make-promise",
+ * which returns a promise that has already been forced to its argument.  If
+ * the argument is already a promise, it is returned as-is.
+ */
+Value * scheme_make_promise(int num_args, Value *args) {
+    Value *v;
+
+    if (num_args != 1)
+        return make_error("make-promise requires exactly one argument");
+
+    v = get_car(args);
+    if (is_promise(v))
+        return v;
+
+    return make_forced_promise(v);
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "promise?".
+ */
+Value * scheme_is_promise(int num_args, Value *args) {
+    if (num_args != 1)
+        return make_error("promise? requires exactly one argument");
+
+    return make_bool(is_promise(get_car(args)));
+}
+
+
+/*!
+ * This helper function returns the rest of a stream, forcing the promise in
+ * the cdr of the stream's first pair.
+ */
+Value * stream_rest(const char *name, Value *stream) {
+    if (!is_cons_pair(stream))
+        return make_error("argument to %s must be a stream", name);
+
+    return force_promise(get_cdr(stream));
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "stream-ref", which
+ * returns the k-th element of a stream.  The first element has index 0.
+ */
+Value * scheme_stream_ref(int num_args, Value *args) {
+    Value *stream, *k, *result;
+    int i;
+
+    if (num_args != 2)
+        return make_error("stream-ref requires exactly two arguments");
+
+    k = get_cadr(args);
+    if (!is_float(k) || k->float_val < 0)
+        return make_error("index argument to stream-ref must be a "
+                          "nonnegative number");
+
+    /* Forcing the stream can trigger garbage collection, and the parts of the
+     * stream we have already walked past may no longer be reachable.
+     */
+    push_new_evalctx(NULL, NULL);
+    evalctx_register(&stream);
+    evalctx_register(&result);
+
+    stream = get_car(args);
+    for (i = (int) k->float_val; i > 0; i--) {
+        stream = stream_rest("stream-ref", stream);
+        goto_done_if_error(stream);
+    }
+
+    if (is_cons_pair(stream))
+        result = get_car(stream);
+    else
+        result = make_error("index argument to stream-ref is out of range");
+
+Done:
+    pop_evalctx(result);
+    return result;
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "stream->list",
+ * which forces every element of a finite stream and returns them as a list.
+ * An optional second argument limits the number of elements taken.
+ */
+Value * scheme_stream_to_list(int num_args, Value *args) {
+    Value *stream, *limit, *result;
+    ListBuilder results;
+    int count = -1;
+
+    if (num_args == 2) {
+        limit = get_cadr(args);
+        if (!is_float(limit) || limit->float_val < 0)
+            return make_error("limit argument to stream->list must be a "
+                              "nonnegative number");
+        count = (int) limit->float_val;
+    }
+    else if (num_args != 1) {
+        return make_error("stream->list takes one or two arguments");
+    }
+
+    push_new_evalctx(NULL, NULL);
+    evalctx_register(&stream);
+    evalctx_register(&results.head);
+    evalctx_register(&result);
+
+    init_list_builder(&results);
+    stream = get_car(args);
+    while (is_cons_pair(stream) && count != 0) {
+        append_value_to_list(&results, get_car(stream));
+        if (--count == 0)
+            break;
+
+        stream = stream_rest("stream->list", stream);
+        goto_done_if_error(stream);
+    }
+
+    if (!is_nil(stream) && count != 0)
+        result = make_error("argument to stream->list must be a stream");
+    else
+        result = results.head;
+
+Done:
+    pop_evalctx(result);
+    return result;
+}
+
+
+/*============================================================================
+ * WEAK REFERENCES
+ *
+ *   A weak box refers to a value without keeping it alive, and an ephemeron
+ *   table maps keys to values without keeping the keys alive:  each entry's
+ *   value is only kept alive while its key is.  The garbage collector clears
+ *   the boxes and removes the table entries that refer to objects it
+ *   reclaims, which makes these useful for caches.  Table keys are compared
+ *   with eq?, and entries with keys that eq? compares by their contents, like
+ *   numbers and symbols, are never removed.
+ *============================================================================*/
+
+
+/*!
+ * This function implements the Scheme built-in function "make-weak-box",
+ * which returns a weak box referring to its argument.
+ */
+Value * scheme_make_weak_box(int num_args, Value *args) {
+    if (num_args != 1)
+        return make_error("make-weak-box requires exactly one argument");
+
+    return make_weak_box(get_car(args));
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "weak-box-value",
+ * which returns the value a weak box refers to.  If the value has been
+ * garbage-collected, the optional second argument is returned instead, or #f
+ * if there isn't one.
+ */
+Value * scheme_weak_box_value(int num_args, Value *args) {
+    Value *box;
+
+    if (num_args != 1 && num_args != 2)
+        return make_error("weak-box-value takes one or two arguments");
+
+    box = get_car(args);
+    if (!is_weak_box(box))
+        return make_error("first argument to weak-box-value must be a "
+                          "weak box");
+
+    if (box->box_val != NULL)
+        return box->box_val;
+
+    return (num_args == 2) ? get_cadr(args) : make_false();
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "weak-box?".
+ */
+Value * scheme_is_weak_box(int num_args, Value *args) {
+    if (num_args != 1)
+        return make_error("weak-box? requires exactly one argument");
+
+    return make_bool(is_weak_box(get_car(args)));
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "make-weak-table",
+ * which returns a new, empty ephemeron table.
+ */
+Value * scheme_make_weak_table(int num_args, Value *args) {
+    if (num_args != 0)
+        return make_error("make-weak-table takes no arguments");
+
+    return make_weak_table();
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "weak-table-ref",
+ * which returns the value for a key in an ephemeron table.  If the table has
+ * no entry for the key, the optional third argument is returned instead, or
+ * #f if there isn't one.
+ */
+Value * scheme_weak_table_ref(int num_args, Value *args) {
+    Value *table, *val;
+
+    if (num_args != 2 && num_args != 3)
+        return make_error("weak-table-ref takes two or three arguments");
+
+    table = get_car(args);
+    if (!is_weak_table(table))
+        return make_error("first argument to weak-table-ref must be a "
+                          "weak table");
+
+    val = weak_table_get(table->table_val, get_cadr(args));
+    if (val != NULL)
+        return val;
+
+    return (num_args == 3) ? get_car(get_cdr(get_cdr(args))) : make_false();
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "weak-table-set!",
+ * which sets the value for a key in an ephemeron table, and returns the value.
+ */
+Value * scheme_weak_table_set(int num_args, Value *args) {
+    Value *table, *val;
+
+    if (num_args != 3)
+        return make_error("weak-table-set! requires exactly three arguments");
+
+    table = get_car(args);
+    if (!is_weak_table(table))
+        return make_error("first argument to weak-table-set! must be a "
+                          "weak table");
+
+    val = get_car(get_cdr(get_cdr(args)));
+    weak_table_put(table->table_val, get_cadr(args), val);
+
+    return val;
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "weak-table-remove!",
+ * which removes the entry for a key from an ephemeron table.  It returns #t if
+ * there was an entry for the key, or #f if not.
+ */
+Value * scheme_weak_table_remove(int num_args, Value *args) {
+    Value *table;
+
+    if (num_args != 2)
+        return make_error("weak-table-remove! requires exactly two arguments");
+
+    table = get_car(args);
+    if (!is_weak_table(table))
+        return make_error("first argument to weak-table-remove! must be a "
+                          "weak table");
+
+    return make_bool(weak_table_remove(table->table_val, get_cadr(args)));
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "weak-table-count",
+ * which returns the number of entries in an ephemeron table.  Entries whose
+ * keys are unreachable are still counted until the next collection removes
+ * them.
+ */
+Value * scheme_weak_table_count(int num_args, Value *args) {
+    Value *table;
+
+    if (num_args != 1)
+        return make_error("weak-table-count requires exactly one argument");
+
+    table = get_car(args);
+    if (!is_weak_table(table))
+        return make_error("argument to weak-table-count must be a weak table");
+
+    return make_float(table->table_val->size);
+}
+
+
+/*============================================================================
+ * STRINGS
+ *
+ *   Strings are immutable and know their own length, so none of these
+ *   functions needs to scan a string to find its end.  Work is only done in
+ *   proportion to the size of the result.
+ *============================================================================*/
+
+
+/*!
+ * This function implements the Scheme built-in function "string-length",
+ * which returns the number of characters in a string.
+ */
+Value * scheme_string_length(int num_args, Value *args) {
+    Value *str;
+
+    if (num_args != 1)
+        return make_error("string-length takes exactly one argument");
+
+    str = get_car(args);
+    if (!is_string(str))
+        return make_error("argument to string-length must be a string");
+
+    return make_float(str->str_val->length);
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "string-append",
+ * which returns a new string containing the characters of all of its string
+ * arguments.  A single argument is returned without copying it.
+ */
+Value * scheme_string_append(int num_args, Value *args) {
+    Value *iter, *v;
+    String *str;
+    int length = 0;
+    char *dest;
+
+    for (iter = args; is_cons_pair(iter); iter = get_cdr(iter)) {
+        v = get_car(iter);
+        if (!is_string(v))
+            return make_error("arguments to string-append must be strings");
+
+        length += v->str_val->length;
+    }
+
+    if (num_args == 1)
+        return get_car(args);
+
+    str = alloc_string(length);
+    dest = str->data;
+    for (iter = args; is_cons_pair(iter); iter = get_cdr(iter)) {
+        v = get_car(iter);
+        memcpy(dest, v->str_val->chars, v->str_val->length);
+        dest += v->str_val->length;
+    }
+    str->hash = hash_chars(str->chars, length);
+
+    return make_string_value(str);
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "substring":
+ *     (substring str start [end])
+ *
+ * The result contains the characters from index start (inclusive) to index
+ * end (exclusive); end defaults to the length of the string.
+ */
+Value * scheme_substring(int num_args, Value *args) {
+    Value *str, *start, *end;
+    int start_idx, end_idx;
+
+    if (num_args != 2 && num_args != 3)
+        return make_error("substring takes two or three arguments");
+
+    str = get_car(args);
+    if (!is_string(str))
+        return make_error("first argument to substring must be a string");
+
+    start = get_cadr(args);
+    if (!is_float(start))
+        return make_error("start index of substring must be a number");
+    start_idx = (int) start->float_val;
+
+    end_idx = str->str_val->length;
+    if (num_args == 3) {
+        end = get_car(get_cdr(get_cdr(args)));
+        if (!is_float(end))
+            return make_error("end index of substring must be a number");
+        end_idx = (int) end->float_val;
+    }
+
+    if (start_idx < 0 || start_idx > end_idx || end_idx > str->str_val->length)
+        return make_error("substring indexes are out of range");
+
+    return make_substring(str, start_idx, end_idx);
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "string=?", which
+ * reports whether all of its string arguments contain the same characters.
+ */
+Value * scheme_string_equals(int num_args, Value *args) {
+    Value *first, *v;
+
+    if (num_args < 1)
+        return make_error("string=? requires at least one argument");
+
+    first = get_car(args);
+    if (!is_string(first))
+        return make_error("arguments to string=? must be strings");
+
+    for (args = get_cdr(args); is_cons_pair(args); args = get_cdr(args)) {
+        v = get_car(args);
+        if (!is_string(v))
+            return make_error("arguments to string=? must be strings");
+
+        if (!string_equals(first->str_val, v->str_val))
+            return make_false();
+    }
+
+    return make_true();
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "string->symbol",
+ * which returns the symbol whose name is the string's characters.
+ */
+Value * scheme_string_to_symbol(int num_args, Value *args) {
+    Value *str, *result;
+    char *name;
+
+    if (num_args != 1)
+        return make_error("string->symbol takes exactly one argument");
+
+    str = get_car(args);
+    if (!is_string(str))
+        return make_error("argument to string->symbol must be a string");
+
+    name = strndup(str->str_val->chars, str->str_val->length);
+    result = make_atom(name);
+    free(name);
+
+    return result;
+}
+
+
+/*!
+ * This function implements the Scheme built-in function "symbol->string",
+ * which returns the name of a symbol as a string.
+ */
+Value * scheme_symbol_to_string(int num_args, Value *args) {
+    Value *sym;
+
+    if (num_args != 1)
+        return make_error("symbol->string takes exactly one argument");
+
+    sym = get_car(args);
+    if (!is_atom(sym))
+        return make_error("argument to symbol->string must be a symbol");
+
+    return make_string(sym->string_val);
+}
+
+
+/*!
+ * This function generates an error result from a single string argument
+ * specifying the error message.
+ */
+Value * scheme_error(int num_args, Value *args) {
+    Value *msg;
+
+    if (num_args != 1)
+        return make_error("error currently only supports one argument");
+
+    msg = get_car(args);
+    return_if_error(msg);
+
+    if (!is_string(msg))
+        return make_error("argument to error must be a string");
+
+    return make_error("%.*s", msg->str_val->length, msg->str_val->chars);
+}
+
+
+/*!
+ * This function seeds the random number generator, either with a single numeric
+ * argument, or with the current time value if no argument is provided.  The
+ * argument will be a float, but we cast it to an unsigned integer in here.
+ */
+Value * scheme_srandom(int num_args, Value *args) {
+    Value *seed, *result;
+    unsigned int seed_val;
+
+    if (num_args == 0) {
+        seed_val = time(NULL);
+    }
+    else if (num_args == 1) {
+        seed = get_car(args);
+        return_if_error(seed);
+
+        if (!is_float(seed))
+            return make_error("invalid argument to srandom");
+    
+        seed_val = (unsigned) seed->float_val;
+    }
+    else {
+        return make_error("srandom takes zero or one arguments");
+    }
+
+    result = make_float((float) seed_val);
+    return_if_error(result);
+
+    srandom(seed_val);
+
+    return result;
+}
+ 
+ 
+/*!
+ * This function returns a random number from the random generator.
+ */
+Value * scheme_random(int num_args, Value *args) {
+    Value *max = NULL;
+    long rand_val;
+
+    if (num_args == 1) {
+        max = get_car(args);
+        if (!is_float(max))
+            return make_error("argument to random must be a number");
+    }
+    else if (num_args > 1) {
+        return make_error("random takes zero or one arguments");
+    }
+
+    rand_val = random();
+    if (max != NULL)
+        rand_val %= (int) max->float_val;
+        
+    return make_float((float) rand_val);
+}
+
+
+/*!
+ * This function returns the current time in seconds from the epoch, as the C
+ * time() function returns.
+ */
+Value * scheme_time(int num_args, Value *args) {
+    Value *result;
+
+    if (num_args != 0)
+        return make_error("time takes zero arguments");
+
+    result = make_float((float) time(NULL));
+    return result;
+}
+
+
+/*!
+ * This function computes the square-root of the input argument.
+ */
+Value * scheme_sqrt(int num_args, Value *args) {
+    Value *input, *result;
+
+    if (num_args == 1) {
+        input = get_car(args);
+        return_if_error(input);
+
+        if (!is_float(input))
+            return make_error("invalid argument to sqrt");
+    }
+    else {
+        return make_error("sqrt takes one argument");
+    }
+
+    result = make_float(sqrtf(input->float_val));
+    return_if_error(result);
+
+    return result;
+}
+
+
+/*!
+ * This function evaluates a Scheme file in the context of the global
+ * environment.
+ */
+Value * scheme_eval_file(int num_args, Value *args) {
+    Value *filename;
+    char *path;
+    int ok;
+
+    if (num_args != 1)
+        return make_error("eval-file takes exactly one string argument");
+
+    filename = get_car(args);
+    if (!is_string(filename))
+        return make_error("eval-file takes exactly one string argument");
+
+    /* String values aren't NUL-terminated, so make a C string of the name. */
+    path = strndup(filename->str_val->chars, filename->str_val->length);
+    ok = exec_file(path);
+    free(path);
 
-    if (!exec_file(filename->string_val)) {
+    if (!ok) {
         return make_error(
             "eval-file failed for some reason (probably your fault)");
     }
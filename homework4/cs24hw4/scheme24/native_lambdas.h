@@ -25,6 +25,10 @@ Value * scheme_add(int num_args, Value *args);
 Value * scheme_sub(int num_args, Value *args);
 Value * scheme_mul(int num_args, Value *args);
 Value * scheme_div(int num_args, Value *args);
+Value * scheme_min(int num_args, Value *args);
+Value * scheme_max(int num_args, Value *args);
+Value * scheme_sum(int num_args, Value *args);
+Value * scheme_product(int num_args, Value *args);
 
 Value * scheme_cons(int num_args, Value *args);
 Value * scheme_car(int num_args, Value *args);
@@ -35,7 +39,48 @@ Value * scheme_length(int num_args, Value *args);
 Value * scheme_set_car(int num_args, Value *args);
 Value * scheme_set_cdr(int num_args, Value *args);
 
+Value * scheme_append(int num_args, Value *args);
+Value * scheme_append_bang(int num_args, Value *args);
+Value * scheme_reverse(int num_args, Value *args);
+Value * scheme_reverse_bang(int num_args, Value *args);
+Value * scheme_list_tail(int num_args, Value *args);
+Value * scheme_list_ref(int num_args, Value *args);
+Value * scheme_list_copy(int num_args, Value *args);
+Value * scheme_map(int num_args, Value *args);
+Value * scheme_for_each(int num_args, Value *args);
+Value * scheme_filter(int num_args, Value *args);
+Value * scheme_fold_left(int num_args, Value *args);
+Value * scheme_assoc(int num_args, Value *args);
+Value * scheme_member(int num_args, Value *args);
+
+Value * scheme_apply(int num_args, Value *args);
+Value * scheme_values(int num_args, Value *args);
+Value * scheme_call_with_values(int num_args, Value *args);
+
+Value * scheme_force(int num_args, Value *args);
+Value * scheme_make_promise(int num_args, Value *args);
+Value * scheme_is_promise(int num_args, Value *args);
+Value * scheme_stream_ref(int num_args, Value *args);
+Value * scheme_stream_to_list(int num_args, Value *args);
+
+Value * scheme_make_weak_box(int num_args, Value *args);
+Value * scheme_weak_box_value(int num_args, Value *args);
+Value * scheme_is_weak_box(int num_args, Value *args);
+Value * scheme_make_weak_table(int num_args, Value *args);
+Value * scheme_weak_table_ref(int num_args, Value *args);
+Value * scheme_weak_table_set(int num_args, Value *args);
+Value * scheme_weak_table_remove(int num_args, Value *args);
+Value * scheme_weak_table_count(int num_args, Value *args);
+
+Value * scheme_string_length(int num_args, Value *args);
+Value * scheme_string_append(int num_args, Value *args);
+Value * scheme_substring(int num_args, Value *args);
+Value * scheme_string_equals(int num_args, Value *args);
+Value * scheme_string_to_symbol(int num_args, Value *args);
+Value * scheme_symbol_to_string(int num_args, Value *args);
+
 Value * scheme_display(int num_args, Value *args);
+Value * scheme_write_to_string(int num_args, Value *args);
 Value * scheme_error(int num_args, Value *args);
 
 Value * scheme_srandom(int num_args, Value *args);
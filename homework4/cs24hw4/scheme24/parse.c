@@ -1,5 +1,6 @@
 #include "parse.h"
 #include "values.h"
+#include "constants.h"
 
 #include <assert.h>
 #include <ctype.h>
@@ -179,11 +180,11 @@ Value * read_value(FILE *f, int advance) {
         break;
 
     case VALUE:
-        val = read_atom_or_number(&curr_token);
+        val = intern_constant(read_atom_or_number(&curr_token));
         break;
 
     case STRING_VALUE:
-        val = make_string(curr_token.string);
+        val = intern_constant(make_string(curr_token.string));
         break;
 
     case SQUOTE:   /* Handle the sugared quote syntax. */
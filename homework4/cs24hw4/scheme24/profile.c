@@ -0,0 +1,398 @@
+/*! \file
+ * This file implements the allocation profiler, which records which procedure
+ * allocated each garbage-collected object, so that the heap usage of a program
+ * can be broken down by procedure and by the kind of object allocated.
+ *
+ * An allocation "site" is an interpreted procedure:  all the closures made
+ * from the same lambda expression share a site, since they share the same
+ * body.  Objects are attributed to the innermost procedure call on the
+ * evaluation stack when they are allocated, so anything a native function
+ * allocates is charged to the procedure that called it.  Anything allocated
+ * outside of a procedure call is charged to the top level.
+ *
+ * An object's type isn't known until after it has been allocated, so objects
+ * are only added to the totals when the garbage collector first sweeps them,
+ * whether they survive or not, or when the profile is printed.  The number of
+ * bytes of each site's objects that survive each collection is recorded too,
+ * so the profile shows both which procedures churn through the heap and which
+ * ones hold on to it.  Environments allocated from the frame region aren't
+ * part of the heap, so they aren't profiled.
+ *
+ * The profiler is only compiled in with -DALLOC_PROFILE.
+ */
+
+#include "profile.h"
+
+#ifdef ALLOC_PROFILE
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "values.h"
+#include "evaluator.h"
+
+
+/*! The number of sites listed in each part of the printed profile. */
+#define PROFILE_TOP_SITES 20
+
+/*! Descriptions of anonymous lambdas are cut off at this length. */
+#define PROFILE_NAME_LENGTH 48
+
+
+/*! The totals for one kind of object allocated at one site. */
+typedef struct ProfileCounts {
+    long allocs;            /*!< Number of objects allocated. */
+    long bytes;             /*!< Number of bytes allocated. */
+    long live_bytes;        /*!< Bytes that survived the last collection. */
+    long peak_live_bytes;   /*!< The most bytes that survived a collection. */
+} ProfileCounts;
+
+
+/*! An allocation site:  an interpreted procedure, or the top level. */
+typedef struct ProfileSite {
+    /*!
+     * The body of the procedure, or NULL for the top level or once the body
+     * has been collected.
+     */
+    const Value *body;
+
+    /*! The name of the procedure, or a description if it has no name. */
+    char *name;
+
+    ProfileCounts counts[PK_NumKinds];
+} ProfileSite;
+
+
+/*! One line of the printed profile. */
+typedef struct ProfileRow {
+    const ProfileSite *site;
+    int kind;
+} ProfileRow;
+
+
+static const char *kind_names[PK_NumKinds] = {
+    "error", "nil", "atom", "boolean", "string", "float", "lambda", "cons",
+    "promise", "weak box", "weak table", "values", "Lambda struct",
+    "Environment", "String data"
+};
+
+
+/*! All the sites seen so far.  Site 0 is the top level. */
+static ProfileSite *sites;
+static int num_sites, max_sites;
+
+/*!
+ * An open-addressing hash table from the body of a procedure to the index of
+ * its site.  Entries are never removed; when a body is collected its site's
+ * body is set to NULL instead, so that a new body allocated at the same
+ * address gets a new site.
+ */
+static const Value **site_keys;
+static int *site_indexes;
+static unsigned int site_capacity, site_count;
+
+
+int add_site(const Value *body, char *name);
+char * describe_procedure(Value *proc);
+unsigned int site_slot(const Value *body);
+void set_site_index(const Value *body, int index);
+int find_site(Value *proc);
+int current_site(void);
+void print_rows(FILE *f, ProfileRow *rows, int num_rows, const char *title);
+int compare_bytes(const void *a, const void *b);
+int compare_peak_live(const void *a, const void *b);
+
+
+/*! Adds a new site, and returns its index. */
+int add_site(const Value *body, char *name) {
+    if (num_sites == max_sites) {
+        max_sites = (max_sites == 0) ? 64 : 2 * max_sites;
+        sites = realloc(sites, max_sites * sizeof(ProfileSite));
+        assert(sites != NULL);
+    }
+
+    memset(sites + num_sites, 0, sizeof(ProfileSite));
+    sites[num_sites].body = body;
+    sites[num_sites].name = name;
+
+    return num_sites++;
+}
+
+
+/*!
+ * Returns a newly allocated name for an interpreted procedure:  the name it is
+ * bound to in the global environment if there is one, or else a description
+ * of its arguments.
+ */
+char * describe_procedure(Value *proc) {
+    Environment *global_env = get_global_environment();
+    Value *v;
+    char *args, *name;
+    int i;
+
+    for (i = 0; i < global_env->num_bindings; i++) {
+        v = global_env->bindings[i].value;
+        if (v != NULL && is_lambda(v) && !v->lambda_val->native_impl &&
+            v->lambda_val->body == proc->lambda_val->body) {
+            return strdup(global_env->bindings[i].name);
+        }
+    }
+
+    args = value_to_string(proc->lambda_val->arg_spec, 0);
+    name = malloc(PROFILE_NAME_LENGTH + 1);
+    assert(name != NULL);
+    snprintf(name, PROFILE_NAME_LENGTH + 1, "(lambda %s ...)", args);
+    free(args);
+
+    return name;
+}
+
+
+/*! Returns the slot that a body occupies, or the empty slot it would occupy. */
+unsigned int site_slot(const Value *body) {
+    unsigned int mask = site_capacity - 1;
+    unsigned int i = ((unsigned int) ((size_t) body >> 3) * 2654435761u) & mask;
+
+    while (site_keys[i] != NULL && site_keys[i] != body)
+        i = (i + 1) & mask;
+
+    return i;
+}
+
+
+/*! Maps a body to the specified site, replacing any earlier mapping. */
+void set_site_index(const Value *body, int index) {
+    unsigned int i;
+
+    if (2 * (site_count + 1) > site_capacity) {
+        /* Double the size of the table and rehash everything. */
+        const Value **old_keys = site_keys;
+        int *old_indexes = site_indexes;
+        unsigned int old_capacity = site_capacity;
+
+        site_capacity = (old_capacity == 0) ? 256 : 2 * old_capacity;
+        site_count = 0;
+        site_keys = calloc(site_capacity, sizeof(const Value *));
+        site_indexes = malloc(site_capacity * sizeof(int));
+        assert(site_keys != NULL && site_indexes != NULL);
+
+        for (i = 0; i < old_capacity; i++) {
+            if (old_keys[i] != NULL)
+                set_site_index(old_keys[i], old_indexes[i]);
+        }
+
+        free(old_keys);
+        free(old_indexes);
+    }
+
+    i = site_slot(body);
+    if (site_keys[i] == NULL) {
+        site_keys[i] = body;
+        site_count++;
+    }
+    site_indexes[i] = index;
+}
+
+
+/*! Returns the site for an interpreted procedure, adding it if it's new. */
+int find_site(Value *proc) {
+    const Value *body = proc->lambda_val->body;
+    unsigned int i;
+    int index;
+
+    if (site_count > 0) {
+        i = site_slot(body);
+        if (site_keys[i] != NULL && sites[site_indexes[i]].body == body)
+            return site_indexes[i];
+    }
+
+    index = add_site(body, describe_procedure(proc));
+    set_site_index(body, index);
+
+    return index;
+}
+
+
+/*!
+ * Returns the site that is allocating right now:  the innermost call of an
+ * interpreted procedure on the evaluation stack, or the top level.
+ */
+int current_site(void) {
+    EvaluationStack *stack = get_eval_stack();
+    Value *expr;
+    unsigned int i;
+
+    if (num_sites == 0)
+        add_site(NULL, strdup("<top level>"));
+
+    /* apply_procedure() gives each call a context whose expression is the
+     * procedure being called.
+     */
+    for (i = stack->size; i > 0; i--) {
+        expr = stack->frames[i - 1].expression;
+        if (expr != NULL && is_lambda(expr) && !expr->lambda_val->native_impl)
+            return find_site(expr);
+    }
+
+    return 0;
+}
+
+
+/*! Records the current allocation site in a newly allocated object's tag. */
+void profile_tag(AllocTag *tag) {
+    tag->site = current_site();
+    tag->counted = 0;
+}
+
+
+/*! Called before a collection sweeps the heap. */
+void profile_begin_sweep(void) {
+    int i, k;
+
+    for (i = 0; i < num_sites; i++) {
+        for (k = 0; k < PK_NumKinds; k++)
+            sites[i].counts[k].live_bytes = 0;
+    }
+}
+
+
+/*!
+ * Called for each object that a collection sweeps, and for each remaining
+ * object when the profile is printed.  The object is added to its site's
+ * totals the first time, and its bytes are counted as live if it survived.
+ */
+void profile_sweep(AllocTag *tag, int kind, long bytes, int survived) {
+    ProfileCounts *counts;
+
+    assert(tag->site >= 0 && tag->site < num_sites);
+    assert(kind >= 0 && kind < PK_NumKinds);
+
+    counts = &sites[tag->site].counts[kind];
+    if (!tag->counted) {
+        counts->allocs++;
+        counts->bytes += bytes;
+        tag->counted = 1;
+    }
+
+    if (survived)
+        counts->live_bytes += bytes;
+}
+
+
+/*! Called after a collection has swept the heap. */
+void profile_end_sweep(void) {
+    ProfileCounts *counts;
+    int i, k;
+
+    for (i = 0; i < num_sites; i++) {
+        for (k = 0; k < PK_NumKinds; k++) {
+            counts = &sites[i].counts[k];
+            if (counts->live_bytes > counts->peak_live_bytes)
+                counts->peak_live_bytes = counts->live_bytes;
+        }
+    }
+}
+
+
+/*!
+ * Called when a value is freed.  If the value was the body of a procedure,
+ * the procedure's site stops being used for new calls, since another body
+ * could be allocated at the same address.
+ */
+void profile_forget(const Value *v) {
+    unsigned int i;
+
+    if (site_count == 0 || v->type != T_ConsPair)
+        return;
+
+    i = site_slot(v);
+    if (site_keys[i] != NULL && sites[site_indexes[i]].body == v)
+        sites[site_indexes[i]].body = NULL;
+}
+
+
+int compare_bytes(const void *a, const void *b) {
+    const ProfileRow *r1 = a, *r2 = b;
+    long b1 = r1->site->counts[r1->kind].bytes;
+    long b2 = r2->site->counts[r2->kind].bytes;
+
+    return (b1 < b2) - (b1 > b2);
+}
+
+
+int compare_peak_live(const void *a, const void *b) {
+    const ProfileRow *r1 = a, *r2 = b;
+    long b1 = r1->site->counts[r1->kind].peak_live_bytes;
+    long b2 = r2->site->counts[r2->kind].peak_live_bytes;
+
+    return (b1 < b2) - (b1 > b2);
+}
+
+
+/*! Prints the first PROFILE_TOP_SITES rows of the profile. */
+void print_rows(FILE *f, ProfileRow *rows, int num_rows, const char *title) {
+    const ProfileCounts *counts;
+    int i;
+
+    fprintf(f, "%s:\n", title);
+    fprintf(f, "%12s %10s %12s  %-14s %s\n", "bytes", "objects", "peak live",
+            "kind", "procedure");
+
+    for (i = 0; i < num_rows && i < PROFILE_TOP_SITES; i++) {
+        counts = &rows[i].site->counts[rows[i].kind];
+        fprintf(f, "%12ld %10ld %12ld  %-14s %s\n", counts->bytes,
+                counts->allocs, counts->peak_live_bytes,
+                kind_names[rows[i].kind], rows[i].site->name);
+    }
+
+    if (num_rows > PROFILE_TOP_SITES)
+        fprintf(f, "(%d more)\n", num_rows - PROFILE_TOP_SITES);
+    fprintf(f, "\n");
+}
+
+
+/*!
+ * Prints the profile:  the sites that allocated the most bytes, and the sites
+ * whose objects took up the most bytes after a collection.  Objects that the
+ * collector hasn't swept yet must have been passed to profile_sweep() first.
+ */
+void print_profile(FILE *f) {
+    ProfileRow *rows;
+    int num_rows = 0, i, k;
+    long total_bytes = 0, total_allocs = 0;
+
+    rows = malloc((num_sites * PK_NumKinds + 1) * sizeof(ProfileRow));
+    assert(rows != NULL);
+
+    for (i = 0; i < num_sites; i++) {
+        for (k = 0; k < PK_NumKinds; k++) {
+            if (sites[i].counts[k].allocs > 0) {
+                rows[num_rows].site = sites + i;
+                rows[num_rows].kind = k;
+                num_rows++;
+
+                total_bytes += sites[i].counts[k].bytes;
+                total_allocs += sites[i].counts[k].allocs;
+            }
+        }
+    }
+
+    fprintf(f, "\nAllocation profile:  %ld bytes in %ld objects, from %d "
+            "sites.\n\n", total_bytes, total_allocs, num_sites);
+
+    qsort(rows, num_rows, sizeof(ProfileRow), compare_bytes);
+    print_rows(f, rows, num_rows, "Most bytes allocated");
+
+    /* Only the rows that had anything survive a collection. */
+    qsort(rows, num_rows, sizeof(ProfileRow), compare_peak_live);
+    for (i = 0; i < num_rows; i++) {
+        if (rows[i].site->counts[rows[i].kind].peak_live_bytes == 0)
+            break;
+    }
+    print_rows(f, rows, i, "Most bytes live after a collection");
+
+    free(rows);
+}
+
+#endif /* ALLOC_PROFILE */
@@ -0,0 +1,39 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include "types.h"
+
+
+/*
+ * The allocation profiler is only compiled in with -DALLOC_PROFILE, since it
+ * makes every object bigger and every allocation slower.  "make
+ * scheme24-profile" builds an interpreter with it turned on.
+ */
+#ifdef ALLOC_PROFILE
+
+
+/*!
+ * The kinds of objects the profiler reports separately.  Values are reported
+ * by their type, so the Type values come first; the other kinds of object
+ * follow the last Type.
+ */
+typedef enum ProfileKind {
+    PK_Lambda = T_Values + 1,
+    PK_Environment,
+    PK_String,
+
+    PK_NumKinds
+} ProfileKind;
+
+
+void profile_tag(AllocTag *tag);
+void profile_begin_sweep(void);
+void profile_sweep(AllocTag *tag, int kind, long bytes, int survived);
+void profile_end_sweep(void);
+void profile_forget(const Value *v);
+void print_profile(FILE *f);
+
+#endif /* ALLOC_PROFILE */
+
+#endif /* PROFILE_H */
@@ -5,11 +5,17 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "alloc.h"
+#include "constants.h"
 #include "parse.h"
 #include "evaluator.h"
+#include "repl.h"
+#include "server.h"
 
 
 /* Change to #define VERBOSE to see garbage-collection debug output. */
@@ -31,7 +37,7 @@ int read_eval_print_loop(FILE *input, const char *prompt, FILE *output) {
 
         expr = read_value(input, 1);
         if (expr == NULL) {
-            if (output != NULL)
+            if (prompt != NULL && output != NULL)
                 fprintf(output, "EOF\n");
 
             break;
@@ -81,26 +87,110 @@ int exec_file(const char *filename) {
 }
 
 
+/*!
+ * Reports how long a program took to run, along with the allocator's running
+ * totals, as a single line of "key=value" pairs.  The benchmark runner in the
+ * bench directory parses this line.
+ */
+void print_run_stats(FILE *f, double wall_seconds) {
+    AllocStats stats;
+
+    get_alloc_stats(&stats);
+    fprintf(f, "STATS wall_ms=%.3f values=%ld lambdas=%ld envs=%ld "
+            "strings=%ld gc_count=%ld gc_ms=%.3f\n", wall_seconds * 1000.0,
+            stats.num_values, stats.num_lambdas, stats.num_environments,
+            stats.num_strings, stats.num_collections,
+            stats.gc_seconds * 1000.0);
+}
+
+
+void usage(const char *program) {
+    fprintf(stderr, "usage: %s [-c] [-s] [file.scm]\n", program);
+    fprintf(stderr, "       %s [-c] -S socket [-n workers]\n", program);
+    fprintf(stderr, "\t-c\thash-cons constants, making quoted data "
+            "immutable\n");
+    fprintf(stderr, "\t-s\tprint run-time and allocation statistics to "
+            "stderr on exit\n");
+    fprintf(stderr, "\t-S\tserve programs sent to this Unix socket by "
+            "scheme24-client\n");
+    fprintf(stderr, "\t-n\tnumber of server worker processes (default %d)\n",
+            SERVER_DEFAULT_WORKERS);
+    fprintf(stderr, "\tfile.scm\trun this program instead of starting the "
+            "REPL\n");
+}
+
+
 /*!
  * This main function provides a simple Read-Eval-Print Loop (REPL) for the CS24
  * Scheme interpreter.  The first thing it does is to set up the global
  * environment, and the root evaluation context which is always present on the
  * stack so that evaluation can store its results into this root context.
+ *
+ * If a filename is specified then that program is run, and the interpreter
+ * exits afterwards instead of starting the REPL.  The "-s" option reports
+ * statistics on exit; with a filename, the time covers only the program and
+ * not loading the standard functions.  The "-c" option turns on hash-consing
+ * of constants (see constants.c), under which quoted data can't be modified.
+ *
+ * The "-S" option starts the eval server on the specified socket instead; see
+ * server.c.  The standard functions are loaded before the server starts, so
+ * that every request starts from an interpreter that is ready to go.
  */
-int main() {
+int main(int argc, char **argv) {
     Environment *global_env;
     EvaluationContext *root_eval_ctx;
+    int opt, show_stats = 0, status = 0, num_workers = SERVER_DEFAULT_WORKERS;
+    const char *program_file = NULL, *socket_path = NULL;
+    struct timespec start, end;
+
+    while ((opt = getopt(argc, argv, "csS:n:")) != -1) {
+        switch (opt) {
+        case 'c':
+            set_hash_consing(1);
+            break;
+
+        case 's':
+            show_stats = 1;
+            break;
+
+        case 'S':
+            socket_path = optarg;
+            break;
+
+        case 'n':
+            num_workers = atoi(optarg);
+            if (num_workers < 1) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind < argc)
+        program_file = argv[optind++];
+
+    if (optind < argc || (socket_path != NULL && program_file != NULL)) {
+        usage(argv[0]);
+        return 1;
+    }
 
     init_alloc();
     global_env = init_global_environment();
     root_eval_ctx = push_new_evalctx(NULL, NULL);
 
-    fprintf(stdout, "Loading standard functions...");    
+    if (program_file == NULL && socket_path == NULL)
+        fprintf(stdout, "Loading standard functions...");    
     if (!exec_file("stdlib.scm")) {
         fprintf(stdout, "\nError loading standard functions!  Exiting.\n");
         return 2;
     }
-    fprintf(stdout, "  done.\n");
+    if (program_file == NULL && socket_path == NULL)
+        fprintf(stdout, "  done.\n");
     
 #ifdef VERBOSE
     fprintf(stdout, "[Initial] ");
@@ -108,8 +198,34 @@ int main() {
     fprintf(stdout, "\n");
 #endif
 
-    read_eval_print_loop(stdin, "> ", stdout);
+    if (socket_path != NULL)
+        return run_server(socket_path, num_workers) ? 0 : 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (program_file != NULL) {
+        if (!exec_file(program_file)) {
+            fprintf(stderr, "Error running \"%s\"!\n", program_file);
+            status = 1;
+        }
+    }
+    else {
+        read_eval_print_loop(stdin, "> ", stdout);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (show_stats) {
+        fflush(stdout);
+        print_run_stats(stderr, (end.tv_sec - start.tv_sec) +
+                                (end.tv_nsec - start.tv_nsec) / 1e9);
+    }
+
+#ifdef ALLOC_PROFILE
+    fflush(stdout);
+    print_alloc_profile(stderr);
+#endif
 
-    return 0;
+    return status;
 }
 
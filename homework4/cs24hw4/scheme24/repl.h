@@ -1,6 +1,9 @@
 #ifndef REPL_H
 #define REPL_H
 
+#include <stdio.h>
+
+int read_eval_print_loop(FILE *input, const char *prompt, FILE *output);
 int exec_file(const char *filename);
 
 #endif
@@ -0,0 +1,212 @@
+/*! \file
+ * This file implements a tiny client for the scheme24 eval server (see
+ * server.c).  It sends a program to the server, copies the program's output
+ * to stdout as it arrives, and exits with a status reporting how the program
+ * finished:  0 if it ran, 1 if it failed, or 2 if the server couldn't run it.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+
+
+int connect_to_server(const char *socket_path);
+int write_all(int fd, const void *buf, size_t len);
+int send_program(int conn, int program_fd, unsigned char mode);
+int copy_response(int conn);
+void usage(const char *program);
+
+
+/*!
+ * Connects to the server listening on the specified socket.  Returns the
+ * connection's file descriptor, or -1 on failure.
+ */
+int connect_to_server(const char *socket_path) {
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path \"%s\" is too long.\n", socket_path);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        fprintf(stderr, "Couldn't connect to \"%s\":  %s\n", socket_path,
+                strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/*! Writes all of a buffer to a file descriptor.  Returns 1 on success. */
+int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, p, len);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+
+        p += n;
+        len -= n;
+    }
+
+    return 1;
+}
+
+
+/*!
+ * Sends a request:  the mode byte, and then the whole program.  The sending
+ * side of the connection is then shut down, so that the server sees the end
+ * of the program.  Returns 1 on success.
+ *
+ * The program is sent before any output is read, so a program that is larger
+ * than the socket's buffers and also prints a lot could stall; the programs
+ * this is meant for are short scripts.
+ */
+int send_program(int conn, int program_fd, unsigned char mode) {
+    char buf[8192];
+    ssize_t n;
+
+    if (!write_all(conn, &mode, 1))
+        return 0;
+
+    while ((n = read(program_fd, buf, sizeof(buf))) != 0) {
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+
+        if (!write_all(conn, buf, n))
+            return 0;
+    }
+
+    return shutdown(conn, SHUT_WR) == 0;
+}
+
+
+/*!
+ * Copies the server's response to stdout, as it arrives.  The last byte of
+ * the response is the ResponseStatus rather than output, so one byte is
+ * always held back until more arrives.  Returns the response status, or
+ * RESPONSE_CRASHED if the connection closed before the status was sent.
+ */
+int copy_response(int conn) {
+    char buf[8192 + 1];
+    ssize_t n;
+    int have_last = 0;
+
+    while ((n = read(conn, buf + have_last, sizeof(buf) - 1)) != 0) {
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("read");
+            return RESPONSE_CRASHED;
+        }
+
+        n += have_last;
+        write_all(STDOUT_FILENO, buf, n - 1);
+        buf[0] = buf[n - 1];
+        have_last = 1;
+    }
+
+    if (!have_last || (buf[0] != RESPONSE_OK && buf[0] != RESPONSE_ERROR))
+        return RESPONSE_CRASHED;
+
+    return buf[0];
+}
+
+
+void usage(const char *program) {
+    fprintf(stderr, "usage: %s [-S socket] [-p] [file.scm]\n", program);
+    fprintf(stderr, "\t-S\tthe server's socket (default %s)\n",
+            SERVER_DEFAULT_SOCKET);
+    fprintf(stderr, "\t-p\tprint the result of every expression, and keep "
+            "going after errors\n");
+    fprintf(stderr, "\tfile.scm\tthe program to run (default stdin)\n");
+}
+
+
+int main(int argc, char **argv) {
+    const char *socket_path = SERVER_DEFAULT_SOCKET;
+    unsigned char mode = REQUEST_RUN;
+    int opt, conn, program_fd = STDIN_FILENO, status;
+
+    while ((opt = getopt(argc, argv, "S:p")) != -1) {
+        switch (opt) {
+        case 'S':
+            socket_path = optarg;
+            break;
+
+        case 'p':
+            mode = REQUEST_PRINT;
+            break;
+
+        default:
+            usage(argv[0]);
+            return RESPONSE_CRASHED;
+        }
+    }
+
+    if (optind + 1 < argc) {
+        usage(argv[0]);
+        return RESPONSE_CRASHED;
+    }
+
+    if (optind < argc) {
+        program_fd = open(argv[optind], O_RDONLY);
+        if (program_fd == -1) {
+            fprintf(stderr, "Couldn't open file \"%s\"!\n", argv[optind]);
+            return RESPONSE_CRASHED;
+        }
+    }
+
+    /* If the server goes away, report it rather than dying on SIGPIPE. */
+    signal(SIGPIPE, SIG_IGN);
+
+    conn = connect_to_server(socket_path);
+    if (conn == -1)
+        return RESPONSE_CRASHED;
+
+    if (!send_program(conn, program_fd, mode)) {
+        fprintf(stderr, "Couldn't send the program to the server.\n");
+        return RESPONSE_CRASHED;
+    }
+
+    status = copy_response(conn);
+    close(conn);
+
+    if (status == RESPONSE_ERROR)
+        fprintf(stderr, "Error running program!\n");
+    else if (status != RESPONSE_OK)
+        fprintf(stderr, "The server couldn't run the program.\n");
+
+    return status;
+}
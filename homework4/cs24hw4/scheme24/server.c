@@ -0,0 +1,318 @@
+/*! \file
+ * This file implements a server mode for the CS24 Scheme interpreter.  The
+ * server listens on a Unix domain socket, and runs each program that a client
+ * sends it, streaming the program's output back over the connection.
+ *
+ * The point of the server is to avoid paying for interpreter startup, and in
+ * particular for loading stdlib.scm, on every run.  The server loads the
+ * standard functions once, saves the global bindings, and then forks a pool
+ * of worker processes that all accept connections on the same socket.  Each
+ * worker runs requests itself, in its copy of the already-warmed-up
+ * interpreter, and puts the saved global bindings back after every request,
+ * so that requests can't see each other's definitions.  A request that
+ * crashes the interpreter only takes its worker with it; the server starts a
+ * new worker from its own clean copy of the interpreter.  Workers are also
+ * replaced after SERVER_REQUESTS_PER_WORKER requests, which discards anything
+ * a request changed that restoring the bindings doesn't undo, such as data
+ * that belongs to the standard functions.  The workers run requests
+ * concurrently with each other.
+ *
+ * A request is one RequestMode byte followed by the program text; the client
+ * shuts down its end of the connection after sending the program.  The
+ * response is the program's output, followed by one ResponseStatus byte.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "server.h"
+#include "evaluator.h"
+#include "repl.h"
+
+
+/*! Set by the signal handler when the server has been asked to stop. */
+static volatile sig_atomic_t stop_requested;
+
+
+int open_listen_socket(const char *socket_path);
+void handle_stop_signal(int sig);
+pid_t start_worker(int listen_fd);
+void worker_loop(int listen_fd);
+ResponseStatus serve_request(int conn, int stdout_fd);
+ResponseStatus run_request(int conn);
+
+
+/*!
+ * Creates the server's socket, binds it to the specified path and starts
+ * listening on it.  A socket left behind at the path by an earlier server is
+ * removed first, but any other kind of file is left alone.  Returns the
+ * socket's file descriptor, or -1 on failure.
+ */
+int open_listen_socket(const char *socket_path) {
+    struct sockaddr_un addr;
+    struct stat st;
+    int fd;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path \"%s\" is too long.\n", socket_path);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    if (lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(socket_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+        listen(fd, SOMAXCONN) == -1) {
+        fprintf(stderr, "Couldn't listen on \"%s\":  %s\n", socket_path,
+                strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/*! Records that the server should shut down. */
+void handle_stop_signal(int sig) {
+    stop_requested = 1;
+}
+
+
+/*!
+ * Forks a worker process that serves requests from the listening socket until
+ * it is killed, or has served SERVER_REQUESTS_PER_WORKER requests.  Returns
+ * the worker's process ID, or -1 if it couldn't be started.
+ */
+pid_t start_worker(int listen_fd) {
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        /* The server's stop handler is only for the server itself; workers
+         * simply die when they are told to stop.
+         */
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        worker_loop(listen_fd);
+    }
+    else if (pid == -1) {
+        perror("fork");
+    }
+
+    return pid;
+}
+
+
+/*!
+ * The main loop of a worker process.  Each request is run by the worker
+ * itself, and its ResponseStatus is sent to the client as the last byte of
+ * the response.  After SERVER_REQUESTS_PER_WORKER requests the worker exits,
+ * and the server starts another one.  This function never returns.
+ */
+void worker_loop(int listen_fd) {
+    int conn, stdout_fd, num_requests = 0;
+    unsigned char status;
+
+    /* Programs print to stdout, so the worker's own stdout is kept here while
+     * a request's output goes to its connection.
+     */
+    stdout_fd = dup(STDOUT_FILENO);
+    if (stdout_fd == -1) {
+        perror("dup");
+        _exit(1);
+    }
+
+    while (num_requests < SERVER_REQUESTS_PER_WORKER) {
+        conn = accept(listen_fd, NULL, NULL);
+        if (conn == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            perror("accept");
+            _exit(1);
+        }
+
+        status = serve_request(conn, stdout_fd);
+        num_requests++;
+
+        /* If the client has already gone away then this fails, which is
+         * fine; SIGPIPE is ignored so that it doesn't kill the worker.
+         */
+        if (write(conn, &status, 1) != 1) {
+            /* Nothing to do. */
+        }
+        close(conn);
+    }
+
+    _exit(0);
+}
+
+
+/*!
+ * Runs a request in the worker process, sending anything the program prints
+ * to the client, and then puts the interpreter's global bindings back the way
+ * they were before the request.  stdout_fd is where stdout is sent again
+ * afterwards.  Returns the request's ResponseStatus.
+ */
+ResponseStatus serve_request(int conn, int stdout_fd) {
+    ResponseStatus status;
+
+    /* Anything a program prints goes back to the client. */
+    fflush(stdout);
+    if (dup2(conn, STDOUT_FILENO) == -1)
+        return RESPONSE_CRASHED;
+
+    status = run_request(conn);
+
+    /* If the client went away, writing its output failed; the next request
+     * shouldn't see that error.
+     */
+    fflush(stdout);
+    clearerr(stdout);
+    if (dup2(stdout_fd, STDOUT_FILENO) == -1) {
+        perror("dup2");
+        _exit(1);
+    }
+
+    reset_current_evalctx(get_global_environment(), NULL);
+    restore_global_bindings();
+
+    return status;
+}
+
+
+/*!
+ * Reads the mode byte of a request, and then evaluates the program that
+ * follows it in the global environment.  Returns RESPONSE_OK if the program
+ * ran, or RESPONSE_ERROR if the request was malformed or the program failed.
+ * The connection is left open, so that the status can be sent over it.
+ */
+ResponseStatus run_request(int conn) {
+    FILE *input;
+    unsigned char mode;
+    int input_fd, ok;
+
+    if (read(conn, &mode, 1) != 1)
+        return RESPONSE_ERROR;
+
+    /* Closing the stream closes its descriptor, so it gets its own. */
+    input_fd = dup(conn);
+    if (input_fd == -1)
+        return RESPONSE_ERROR;
+
+    input = fdopen(input_fd, "r");
+    if (input == NULL) {
+        close(input_fd);
+        return RESPONSE_ERROR;
+    }
+
+    if (mode == REQUEST_RUN)
+        ok = read_eval_print_loop(input, NULL, NULL);
+    else if (mode == REQUEST_PRINT)
+        ok = read_eval_print_loop(input, NULL, stdout);
+    else
+        ok = 0;
+
+    fclose(input);
+
+    return ok ? RESPONSE_OK : RESPONSE_ERROR;
+}
+
+
+/*!
+ * Runs the eval server on the specified socket with the specified number of
+ * worker processes, until the server receives SIGINT or SIGTERM.  The
+ * interpreter must already be initialized, with the standard functions
+ * loaded, since the workers inherit its state; its global bindings are saved
+ * here, and put back after each request.  Workers that exit are restarted.
+ * Returns 1 if the server shut down cleanly, or 0 if it couldn't be started.
+ */
+int run_server(const char *socket_path, int num_workers) {
+    struct sigaction sa;
+    pid_t *workers, pid;
+    int listen_fd, i, running;
+
+    listen_fd = open_listen_socket(socket_path);
+    if (listen_fd == -1)
+        return 0;
+
+    workers = malloc(num_workers * sizeof(pid_t));
+    if (workers == NULL) {
+        fprintf(stderr, "Couldn't allocate the worker table.\n");
+        close(listen_fd);
+        return 0;
+    }
+
+    /* No SA_RESTART, so that wait() is interrupted when we must stop. */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    save_global_bindings();
+
+    /* Don't let the workers inherit anything still buffered for output. */
+    fflush(stdout);
+    fflush(stderr);
+
+    for (i = 0; i < num_workers; i++)
+        workers[i] = start_worker(listen_fd);
+
+    fprintf(stderr, "Serving on \"%s\" with %d workers.\n", socket_path,
+            num_workers);
+
+    while (!stop_requested) {
+        pid = wait(NULL);
+        if (pid == -1) {
+            if (errno == EINTR)
+                continue;
+
+            /* No workers left to wait for; try to start them again. */
+            sleep(1);
+        }
+
+        for (i = 0; i < num_workers && !stop_requested; i++) {
+            if (workers[i] == pid || workers[i] == -1)
+                workers[i] = start_worker(listen_fd);
+        }
+    }
+
+    fprintf(stderr, "Shutting down.\n");
+
+    running = 0;
+    for (i = 0; i < num_workers; i++) {
+        if (workers[i] != -1) {
+            kill(workers[i], SIGTERM);
+            running++;
+        }
+    }
+    while (running > 0 && wait(NULL) != -1)
+        running--;
+
+    close(listen_fd);
+    unlink(socket_path);
+    free(workers);
+
+    return 1;
+}
@@ -0,0 +1,44 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+
+/*! The default number of worker processes the eval server starts. */
+#define SERVER_DEFAULT_WORKERS 4
+
+/*!
+ * The number of requests a worker process serves before it exits, and the
+ * server starts a fresh one in its place.
+ */
+#define SERVER_REQUESTS_PER_WORKER 1000
+
+/*! The socket the client connects to, if no other path is given. */
+#define SERVER_DEFAULT_SOCKET "/tmp/scheme24.sock"
+
+
+/*!
+ * The first byte of every request says what to do with the program that
+ * follows it.
+ */
+typedef enum RequestMode {
+    /*! Run the program like a file:  stop at the first error. */
+    REQUEST_RUN = 'r',
+
+    /*! Print every result, and keep going after errors, like the REPL. */
+    REQUEST_PRINT = 'p'
+} RequestMode;
+
+
+/*!
+ * The last byte of every response is one of these, reporting how the request
+ * finished.  Everything before it is the program's output.
+ */
+typedef enum ResponseStatus {
+    RESPONSE_OK = 0,
+    RESPONSE_ERROR = 1,
+    RESPONSE_CRASHED = 2
+} ResponseStatus;
+
+
+int run_server(const char *socket_path, int num_workers);
+
+#endif /* SERVER_H */
@@ -1,8 +1,11 @@
 #include "special_forms.h"
 #include "values.h"
 #include "evaluator.h"
+#include "alloc.h"
+#include "constants.h"
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 
 
@@ -13,7 +16,6 @@
 
 Value * eval_begin(Environment *env, Value *expr);
 Value * eval_let(Environment *env, Value *expr);
-Value * eval_if(Environment *env, Value *expr);
 Value * eval_and(Environment *env, Value *expr);
 Value * eval_or(Environment *env, Value *expr);
 Value * eval_cond(Environment *env, Value *expr);
@@ -21,56 +23,81 @@ Value * eval_define(Environment *env, Value *expr);
 Value * eval_lambda(Environment *env, Value *expr);
 Value * eval_quote(Environment *env, Value *expr);
 Value * eval_set_bang(Environment *env, Value *expr);
+Value * eval_delay(Environment *env, Value *expr);
+Value * eval_cons_stream(Environment *env, Value *expr);
 
 /* Helper function for eval_define. */
 Value * eval_sugared_define(Environment *env, Value *expr);
 
 
-/*!
- * This typedef defines a function-pointer type that is used for evaluating
- * special forms.  All the special-form evaluation functions conform to this
- * signature.
- */
-typedef Value * (*SpecialFormEvaluator)(Environment *env, Value *expr);
-
-
 /*!
  * This struct is used to keep track of which atom-name goes with each
  * special-form evaluation function.  It is used in the special_forms variable
- * below, which is used during expression evaluation to identify if an
- * expression is in fact a special form.
+ * below, and in the table that expressions are looked up in during evaluation
+ * to identify if an expression is in fact a special form.
  */
 typedef struct SpecialForm {
     char *name;
     SpecialFormEvaluator func;
+
+    /*!
+     * Nonzero if evaluating the form can create a lambda or promise that
+     * holds onto the environment the form is evaluated in.  make_lambda()
+     * uses this to decide whether a call's environment can escape the call.
+     */
+    int creates_closures;
 } SpecialForm;
 
 
 /*!
- * This array of SpecialForm structs simply lists all the special forms we
- * recognize, along with the evaluation function used for each special form.
- * The array MUST end with a SpecialForm with NULL for both values.
+ * This array of SpecialForm structs simply lists all the special forms built
+ * into the interpreter, along with the evaluation function used for each
+ * special form.  The array MUST end with a SpecialForm with NULL for both
+ * values.  More special forms can be added with register_special_form().
  *
- * If we want to be really spiffy, we can change this into a pointer-vector, and
- * provide support for adding new special forms to the language.  But right now
- * we aren't spiffy at all.
+ * define can create a closure too, but only in its (define (name args...)
+ * body...) form, so make_lambda() checks for that itself.
  */
 SpecialForm special_forms[] = {
-    { "begin" , eval_begin    },
-    { "let"   , eval_let      },
-    { "if"    , eval_if       },
-    { "and"   , eval_and      },
-    { "or"    , eval_or       },
-    { "cond"  , eval_cond     },
-    { "define", eval_define   },
-    { "lambda", eval_lambda   },
-    { "quote" , eval_quote    },
-    { "set!"  , eval_set_bang },
+    { "begin" , eval_begin   , 0 },
+    { "let"   , eval_let     , 0 },
+    { "if"    , eval_if      , 0 },
+    { "and"   , eval_and     , 0 },
+    { "or"    , eval_or      , 0 },
+    { "cond"  , eval_cond    , 0 },
+    { "define", eval_define  , 0 },
+    { "lambda", eval_lambda  , 1 },
+    { "quote" , eval_quote   , 0 },
+    { "set!"  , eval_set_bang, 0 },
+
+    { "delay"       , eval_delay      , 1 },
+    { "cons-stream" , eval_cons_stream, 1 },
     
-    { NULL, NULL }  /* Terminator. */
+    { NULL, NULL, 0 }  /* Terminator. */
 };
 
 
+/*!
+ * The special forms that are currently defined, as an open-addressing hash
+ * table keyed on the name.  The hash of each name is stored with it, so most
+ * names that aren't special forms are rejected without comparing any strings;
+ * this matters because every procedure call is checked against the table.
+ */
+typedef struct SpecialFormTable {
+    SpecialForm *forms;
+    unsigned int *hashes;
+    unsigned int capacity;   /*!< Always zero or a power of two. */
+    unsigned int size;
+} SpecialFormTable;
+
+static SpecialFormTable form_table;
+
+
+void init_special_form_table(void);
+SpecialForm * find_special_form(const char *name, unsigned int hash);
+void add_special_form(const SpecialForm *form, unsigned int hash);
+
+
 
 /*!
  * This function determines if the passed-in expression is a special form that
@@ -84,30 +111,183 @@ SpecialForm special_forms[] = {
  */
 Value * eval_special_form(Environment *env, Value *expr) {
     Value *car;
-    char *string_val;
-    int i;
+    SpecialForm *form;
     Value *result = expr;
 
     if (!is_cons_pair(expr))
         goto Done;
 
+    /*
+     * Atoms are marked when they are created if they name a special form, so
+     * an ordinary procedure call is turned away here without looking up the
+     * name.
+     */
     car = expr->cons_val.p_car;
-    if (!is_atom(car))
+    if (!is_atom(car) || !car->special_form)
         goto Done;
 
-    /*
-     * If we recognize the name, evaluate it as a special form.  If we don't see
-     * the name in our list though, just leave the result unchanged.
-     */
+    form = find_special_form(car->string_val,
+                             hash_chars(car->string_val,
+                                        strlen(car->string_val)));
+    if (form != NULL)
+        result = form->func(env, expr);
+
+Done:
+    return result;
+}
+
+
+/*!
+ * Returns 1 if the specified name is the name of a special form, or 0
+ * otherwise.  An expression whose operator is one of these names is never
+ * evaluated as a procedure call, whatever the name happens to be bound to.
+ */
+int is_special_form_name(const char *name) {
+    return find_special_form(name, hash_chars(name, strlen(name))) != NULL;
+}
+
+
+/*!
+ * Returns 1 if the specified atom is the name of a special form, or 0
+ * otherwise.  Unlike is_special_form_name(), this doesn't look the name up.
+ */
+int is_special_form(Value *atom) {
+    assert(is_atom(atom));
+    return atom->special_form;
+}
+
+
+/*!
+ * Returns the function that evaluates the special form named by the specified
+ * atom, or NULL if the atom isn't the name of a special form.
+ */
+SpecialFormEvaluator special_form_evaluator(Value *atom) {
+    SpecialForm *form;
+
+    if (!is_special_form(atom))
+        return NULL;
+
+    form = find_special_form(atom->string_val,
+                             hash_chars(atom->string_val,
+                                        strlen(atom->string_val)));
+    return form != NULL ? form->func : NULL;
+}
+
+
+/*!
+ * Returns 1 if the specified name is the name of a special form that can
+ * create a lambda or promise holding onto its environment, or 0 otherwise.
+ */
+int special_form_creates_closures(const char *name) {
+    SpecialForm *form = find_special_form(name, hash_chars(name, strlen(name)));
+    return form != NULL && form->creates_closures;
+}
+
+
+/*!
+ * Adds a special form to the language, or replaces an existing one.  If the
+ * form can create a lambda or promise that holds onto the environment it is
+ * evaluated in, creates_closures must be nonzero; otherwise make_lambda() may
+ * allocate that environment from the frame region, and free it while the
+ * closure still refers to it.
+ *
+ * Special forms should be registered before any code that uses them is read,
+ * since atoms are only marked as special-form names when they are created.
+ * Both make_lambda() and the JIT also analyze a lambda's body once, and
+ * assume that the special forms it uses don't change afterwards.
+ */
+void register_special_form(const char *name, SpecialFormEvaluator func,
+                           int creates_closures) {
+    SpecialForm new_form;
+    SpecialForm *form;
+    unsigned int hash;
+
+    assert(name != NULL && func != NULL);
+
+    hash = hash_chars(name, strlen(name));
+    form = find_special_form(name, hash);
+    if (form != NULL) {
+        form->func = func;
+        form->creates_closures = creates_closures;
+    }
+    else {
+        new_form.name = strdup(name);
+        new_form.func = func;
+        new_form.creates_closures = creates_closures;
+        add_special_form(&new_form, hash);
+    }
+}
+
+
+/*! Fills the special-form table with the built-in special forms. */
+void init_special_form_table(void) {
+    int i;
 
-    string_val = car->string_val;
     for (i = 0; special_forms[i].name != NULL; i++) {
-        if (strcmp(string_val, special_forms[i].name) == 0)
-            result = special_forms[i].func(env, expr);
+        add_special_form(&special_forms[i],
+                         hash_chars(special_forms[i].name,
+                                    strlen(special_forms[i].name)));
     }
+}
 
-Done:
-    return result;
+
+/*!
+ * Returns the entry for the special form with the specified name and hash, or
+ * NULL if there is no such special form.
+ */
+SpecialForm * find_special_form(const char *name, unsigned int hash) {
+    unsigned int mask, i;
+
+    if (form_table.capacity == 0)
+        init_special_form_table();
+
+    mask = form_table.capacity - 1;
+    for (i = hash & mask; form_table.forms[i].name != NULL;
+         i = (i + 1) & mask) {
+        if (form_table.hashes[i] == hash &&
+            strcmp(form_table.forms[i].name, name) == 0) {
+            return form_table.forms + i;
+        }
+    }
+
+    return NULL;
+}
+
+
+/*!
+ * Adds a copy of a special form to the table, growing the table if it's more
+ * than half full.  The name must not already be in the table, and it must
+ * stay valid for as long as the interpreter runs.
+ */
+void add_special_form(const SpecialForm *form, unsigned int hash) {
+    unsigned int mask, i;
+
+    if (2 * (form_table.size + 1) > form_table.capacity) {
+        /* Double the size of the table and rehash everything. */
+        SpecialFormTable old = form_table;
+
+        form_table.capacity = (old.capacity == 0) ? 32 : 2 * old.capacity;
+        form_table.size = 0;
+        form_table.forms = calloc(form_table.capacity, sizeof(SpecialForm));
+        form_table.hashes = malloc(form_table.capacity * sizeof(unsigned int));
+        assert(form_table.forms != NULL && form_table.hashes != NULL);
+
+        for (i = 0; i < old.capacity; i++) {
+            if (old.forms[i].name != NULL) {
+                add_special_form(&old.forms[i], old.hashes[i]);
+            }
+        }
+
+        free(old.forms);
+        free(old.hashes);
+    }
+
+    mask = form_table.capacity - 1;
+    for (i = hash & mask; form_table.forms[i].name != NULL; i = (i + 1) & mask);
+
+    form_table.forms[i] = *form;
+    form_table.hashes[i] = hash;
+    form_table.size++;
 }
 
 
@@ -174,9 +354,11 @@ Value * eval_let(Environment *env, Value *expr) {
     Value *bindings, *body, *result;
 
     ListBuilder binding_names, binding_values;
+    int num_bindings = 0;
 
     Environment *child_env;
     EvaluationContext *child_ctx;
+    RegionMark mark;
 
     /* Need to register these so they don't get garbage-collected.  Everything
      * else is just references to stuff that's already registered somewhere.
@@ -187,10 +369,7 @@ Value * eval_let(Environment *env, Value *expr) {
     /* Break apart the S-expression into its component parts. */
 
     bindings = get_cadr(expr);  /* First sublist contains bindings. */
-    if (is_error(bindings)) {
-        result = bindings;
-        goto Done;
-    }
+    return_if_error(bindings);
 
     expr = get_cdr(expr);       /* Remainder of let expression is the body. */
     return_if_error(expr);
@@ -225,6 +404,7 @@ Value * eval_let(Environment *env, Value *expr) {
         return_if_error(binding_value);
 
         append_value_to_list(&binding_values, binding_value);
+        num_bindings++;
 
         bindings = get_cdr(bindings);
     }
@@ -236,9 +416,18 @@ Value * eval_let(Environment *env, Value *expr) {
      * NOTE:  AFTER THIS POINT, DO NOT JUST RETURN if we hit an error!  We need
      *        to make sure we pop the child evaluation context we are about to
      *        create.
+     *
+     * If the let is inside a call whose environment can't escape, then
+     * neither can the let's environment, so it also comes from the region.
      */
 
-    child_env = make_environment(env);
+    if (env->in_region) {
+        mark = region_mark();
+        child_env = make_region_environment(env, num_bindings);
+    }
+    else {
+        child_env = make_environment(env);
+    }
     child_ctx = push_new_evalctx(child_env, body);
     evalctx_register(&result);
 
@@ -267,6 +456,8 @@ Value * eval_let(Environment *env, Value *expr) {
 
 Done:
     pop_evalctx(result);    /* Get rid of the child evaluation context. */
+    if (env->in_region)
+        region_release(mark);
 
     return result;
 }
@@ -526,6 +717,7 @@ Value * eval_define(Environment *env, Value *expr) {
  *     (define (f x y z) body)
  *     (define (f x y z . w) body)
  *     (define (f . x) body)
+ *     (define (f) body)
  */
 Value * eval_sugared_define(Environment *env, Value *expr) {
     Value *func_spec, *body;
@@ -542,7 +734,8 @@ Value * eval_sugared_define(Environment *env, Value *expr) {
 
     func_args = get_cdr(func_spec);
     return_if_error(func_args);
-    if (!(is_atom(func_args) || is_cons_pair(func_args))) {
+    if (!(is_atom(func_args) || is_cons_pair(func_args) ||
+          is_nil(func_args))) {
         return make_error(
             "function arguments in sugared define must be an atom or a list");
     }
@@ -565,6 +758,7 @@ Value * eval_sugared_define(Environment *env, Value *expr) {
  *     (lambda (x y z) body)
  *     (lambda (x y z . w) body)
  *     (lambda x body)
+ *     (lambda () body)
  */
 Value * eval_lambda(Environment *env, Value *expr) {
     Value *arg_spec, *body;
@@ -593,7 +787,9 @@ Value * eval_lambda(Environment *env, Value *expr) {
  * This function handles the quote special form:  (quote expr)
  *
  * The evaluation is very simple; the result is simply the unevaluated
- * expression.
+ * expression.  The first time the form is evaluated, the expression is
+ * replaced with its interned copy, so that identical constants throughout the
+ * program share the same structure.
  */
 Value * eval_quote(Environment *env, Value *expr) {
     Value *result;
@@ -609,6 +805,11 @@ Value * eval_quote(Environment *env, Value *expr) {
     if (!is_nil(get_cdr(expr)))
         return make_error("quote requires only a single argument");
 
+    if (!is_interned(result)) {
+        result = intern_constant(result);
+        set_car(expr, result);
+    }
+
     return result;
 }
 
@@ -650,4 +851,96 @@ Value * eval_set_bang(Environment *env, Value *expr) {
 }
 
 
+/*!
+ * This function handles the delay special form:  (delay expr)
+ *
+ * The expression isn't evaluated; instead, a promise is returned that will
+ * evaluate the expression in the current environment when it is forced.
+ */
+Value * eval_delay(Environment *env, Value *expr) {
+    Value *delayed;
+
+    expr = get_cdr(expr);   /* Skip past the delay atom. */
+    return_if_error(expr);
+
+    delayed = get_car(expr);
+    return_if_error(delayed);
+
+    if (!is_nil(get_cdr(expr)))
+        return make_error("delay requires exactly one argument");
+
+    return make_promise(env, delayed);
+}
+
+
+/*!
+ * This function handles the cons-stream special form:  (cons-stream a b)
+ *
+ * This is the same as (cons a (delay b)).  The first expression is evaluated
+ * right away, but the second is only evaluated when the rest of the stream is
+ * needed.
+ */
+Value * eval_cons_stream(Environment *env, Value *expr) {
+    Value *first, *rest;
+
+    expr = get_cdr(expr);   /* Skip past the cons-stream atom. */
+    return_if_error(expr);
+
+    first = get_car(expr);
+    return_if_error(first);
+
+    expr = get_cdr(expr);
+    return_if_error(expr);
+
+    rest = get_car(expr);
+    return_if_error(rest);
+
+    if (!is_nil(get_cdr(expr)))
+        return make_error("cons-stream requires exactly two arguments");
+
+    first = evaluate(env, first);
+    return_if_error(first);
+
+    return make_cons(first, make_promise(env, rest));
+}
+
+
+/*!
+ * Forces a promise, and returns its value.  The first time a promise is
+ * forced, its expression is evaluated and the result is remembered; after
+ * that, the remembered value is simply returned.  If evaluating the
+ * expression fails, the error is returned and the promise is left unforced.
+ *
+ * Values that aren't promises are returned unchanged.
+ */
+Value * force_promise(Value *promise) {
+    Value *result;
+
+    if (!is_promise(promise) || promise->promise_val.p_env == NULL)
+        return is_promise(promise) ? promise->promise_val.p_expr : promise;
+
+    /* The promise's own evaluation context keeps it (and therefore its
+     * expression and environment) reachable while the expression runs.
+     */
+    push_new_evalctx(NULL, promise);
+    evalctx_register(&result);
+
+    result = evaluate(promise->promise_val.p_env, promise->promise_val.p_expr);
+
+    /* Evaluating the expression may have forced this same promise; if so,
+     * the first value to be computed is the one that sticks.
+     */
+    if (!is_error(result)) {
+        if (promise->promise_val.p_env == NULL) {
+            result = promise->promise_val.p_expr;
+        }
+        else {
+            promise->promise_val.p_expr = result;
+            promise->promise_val.p_env = NULL;
+        }
+    }
+
+    pop_evalctx(result);
 
+    return result;
+}
@@ -3,7 +3,24 @@
 
 #include "types.h"
 
+
+/*!
+ * This typedef defines a function-pointer type that is used for evaluating
+ * special forms.  All the special-form evaluation functions conform to this
+ * signature.
+ */
+typedef Value * (*SpecialFormEvaluator)(Environment *env, Value *expr);
+
+
 Value * eval_special_form(Environment *env, Value *expr);
+int is_special_form_name(const char *name);
+int is_special_form(Value *atom);
+SpecialFormEvaluator special_form_evaluator(Value *atom);
+Value * eval_if(Environment *env, Value *expr);
+int special_form_creates_closures(const char *name);
+void register_special_form(const char *name, SpecialFormEvaluator func,
+                           int creates_closures);
+Value * force_promise(Value *promise);
 
 #endif /* SPECIAL_FORMS_H */
 
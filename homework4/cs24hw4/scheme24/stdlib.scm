@@ -9,43 +9,50 @@
 (define (positive? x) (> x 0))
 (define (negative? x) (< x 0))
 
-;; Returns the trailing portion of the input list x, starting with the k-th
-;; element.  (list-tail x 0) returns the entire list.
-(define (list-tail x k) (if (zero? k) x (list-tail (cdr x) (- k 1))))
-
-;; Returns the k-th element of the list.  The first element has index 0.
-(define (list-ref x k) (car (list-tail x k)))
-
-;; Appends a list onto another list.  The result contains a copy of the
-;; first list, although the second list is referenced by the result.
-(define (append a b)
-  (cond ((null? a) b)
-        ((null? b) a)
-        ((null? (cdr a)) (cons (car a) b))
-        (else (cons (car a) (append (cdr a) b)))))
-
-(define (append! a b)
-  (define (helper a b) (if (null? (cdr a)) (set-cdr! a b) (helper (cdr a) b)))
-
-  (if (null? a)
-      b
-      (begin
-        (helper a b)
-        a
-      )
-  )
-)
-
-;; Reverses a list, returning the result as a separate copy.
-(define (reverse x)
-  (define (helper lst result)
-    (cond ((null? lst) result)
-          (else (helper (cdr lst) (cons (car lst) result)))))
-  (helper x nil))
-
-;; Filters a list using the specified predicate.
-(define (filter x pred?)
-   (cond ((null? x) x)
-         ((pred? (car x)) (cons (car x) (filter (cdr x) pred?)))
-         (else (filter (cdr x) pred?))))
-
+;; list-tail, list-ref, append, append!, reverse and filter are provided as
+;; native functions, along with reverse!, map, for-each, fold-left, assoc,
+;; member and list-copy.
+
+;; Streams.  cons-stream and delay are special forms, and force, stream-ref
+;; and stream->list are provided as native functions.
+
+(define the-empty-stream nil)
+(define (stream-null? s) (null? s))
+
+(define (stream-car s) (car s))
+(define (stream-cdr s) (force (cdr s)))
+
+(define (stream-map f s)
+  (if (stream-null? s)
+      the-empty-stream
+      (cons-stream (f (stream-car s)) (stream-map f (stream-cdr s)))))
+
+(define (stream-filter pred s)
+  (cond ((stream-null? s) the-empty-stream)
+        ((pred (stream-car s))
+         (cons-stream (stream-car s) (stream-filter pred (stream-cdr s))))
+        (else (stream-filter pred (stream-cdr s)))))
+
+;; The first n elements of a stream, as a stream.  The rest of s isn't forced
+;; until the elements after the first are needed.
+(define (stream-take s n)
+  (cond ((or (stream-null? s) (<= n 0)) the-empty-stream)
+        ((= n 1) (cons-stream (stream-car s) the-empty-stream))
+        (else (cons-stream (stream-car s) (stream-take (stream-cdr s) (- n 1))))))
+
+(define (integers-from n)
+  (cons-stream n (integers-from (+ n 1))))
+
+;; Weak references.  Weak boxes and ephemeron tables (make-weak-table and
+;; friends) are provided as native functions.
+
+;; Memoizes a procedure of one argument.  The results are cached in an
+;; ephemeron table, so a result for an object argument is dropped once the
+;; object is garbage-collected; results for numbers and symbols are kept.
+(define (memoize f)
+  (let ((cache (make-weak-table)))
+    (lambda (x)
+      (let ((hit (weak-table-ref cache x cache)))
+        (if (eq? hit cache)
+            (weak-table-set! cache x (f x))
+            hit)))))
@@ -0,0 +1,36 @@
+; apply must not let the procedure share cells with the list it was given.
+(define l (list 1 2 3))
+(define m (apply list l))
+(eq? l m)
+(set-car! m 9)
+l
+(define n (apply list 0 l))
+(eq? (cdr n) l)
+(set-car! (cdr n) 9)
+l
+(define (f . xs) xs)
+(define q (list 7 8))
+(eq? q (apply f q))
+(set-car! (apply f q) 0)
+q
+(define r (call-with-values (lambda () (apply values q)) list))
+(eq? r q)
+(set-car! r 0)
+q
+
+; Ordinary uses of apply.
+(apply + 1 2 (list 3 4))
+(apply (lambda (a b) (+ a b)) (list 1 2))
+(apply max (list 3 9 2))
+(apply + 1 '())
+(apply + 1 '(2 . 3))
+(apply +)
+(apply min (list 4 2 8))
+
+; map reuses the operand list between calls only for procedures that don't
+; keep it.
+(map + '(1 2 3) '(4 5 6))
+(map list '(1 2 3) '(4 5 6))
+(define vs (map values '(1 2) '(3 4)))
+(map (lambda (v) (call-with-values (lambda () v) list)) vs)
+(fold-left + 0 '(1 2 3) '(4 5 6))
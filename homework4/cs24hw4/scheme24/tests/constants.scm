@@ -0,0 +1,14 @@
+; Without -c, quoted data is an ordinary list that can be modified.
+(define a '(1 2 (3 4) "s"))
+(define b '(1 2 (3 4) "s"))
+(eq? a b)
+(equal? a b)
+(set-car! a 5)
+(set-cdr! (cdr a) '(6))
+a
+(reverse! a)
+(append! b '(9))
+b
+(define (f) '(x y))
+(set-car! (f) 'z)
+(f)
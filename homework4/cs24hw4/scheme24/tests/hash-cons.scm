@@ -0,0 +1,24 @@
+; flags: -c
+; With -c, identical constants are one object, and can't be modified.
+(define a '(1 2 (3 4) "s"))
+(define b '(1 2 (3 4) "s"))
+(eq? a b)
+(eq? (car (cdr (cdr a))) '(3 4))
+(equal? a b)
+(equal? a '(1 2 (3 5) "s"))
+(equal? a (list 1 2 (list 3 4) "s"))
+(set-car! a 5)
+(set-cdr! (cdr a) '(6))
+(reverse! a)
+(append! b '(9))
+a
+(define (f) '(x y))
+(set-car! (f) 'z)
+(f)
+
+; Copies of constants are ordinary lists.
+(define c (list-copy a))
+(set-car! c 7)
+c
+a
+(reverse! (cons 0 a))
@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# Runs every test program in this directory through the given interpreter's
+# REPL, and compares what it prints against the matching .out file.  The run
+# fails if any test's output differs from what is expected.  A test that needs
+# interpreter options names them on a line of its own, like "; flags: -c".
+#
+# Set TESTS_UPDATE=1 to record the current output as the expected output
+# instead of comparing.
+#
+# Usage:  tests/run-tests.sh [interpreter]
+
+SCHEME=${1:-./scheme24-bench}
+TESTS_DIR=$(dirname "$0")
+
+if [ ! -x "$SCHEME" ]; then
+    echo "Can't run interpreter \"$SCHEME\"." >&2
+    exit 2
+fi
+
+failed=0
+for prog in "$TESTS_DIR"/*.scm; do
+    name=$(basename "$prog" .scm)
+    expected=$TESTS_DIR/$name.out
+    flags=$(sed -n 's/^; flags: //p' "$prog")
+
+    if [ -n "$TESTS_UPDATE" ]; then
+        "$SCHEME" $flags < "$prog" > "$expected" 2>&1
+        echo "$name: recorded"
+        continue
+    fi
+
+    if "$SCHEME" $flags < "$prog" 2>&1 | diff -u "$expected" - > /dev/null; then
+        echo "$name: ok"
+    else
+        echo "$name: FAILED"
+        "$SCHEME" $flags < "$prog" 2>&1 | diff -u "$expected" -
+        failed=$((failed + 1))
+    fi
+done
+
+if [ $failed -gt 0 ]; then
+    echo "$failed test(s) failed."
+    exit 1
+fi
@@ -7,7 +7,19 @@
 #ifndef TYPES_H
 #define TYPES_H
 
-#include "ptr_vector.h"
+
+/*!
+ * When the interpreter is compiled with -DALLOC_PROFILE, every garbage-
+ * collected object records where it was allocated, for the allocation
+ * profiler in profile.c.
+ */
+typedef struct AllocTag {
+    /*! The profiler's index for the procedure that allocated the object. */
+    int site;
+
+    /*! Nonzero once the object has been added to the profile's totals. */
+    int counted;
+} AllocTag;
 
 
 /*! A struct for tracking variable-bindings within an environment. */
@@ -48,6 +60,18 @@ typedef struct Environment {
      */
     struct Environment *parent_env;
 
+    /*!
+     * Nonzero if the environment was allocated from the frame region rather
+     * than the garbage-collected heap.  Such environments are released when
+     * the call (or let) that created them returns, and their binding names
+     * are borrowed from the program instead of being copied.
+     */
+    int in_region;
+
+#ifdef ALLOC_PROFILE
+    AllocTag alloc_tag;
+#endif
+
     /*! For garbage collection. */
     int marked;
 
@@ -66,7 +90,11 @@ typedef enum Type {
     T_String,
     T_Float,
     T_Lambda,
-    T_ConsPair
+    T_ConsPair,
+    T_Promise,
+    T_WeakBox,
+    T_WeakTable,
+    T_Values
 } Type;
 
 
@@ -81,6 +109,83 @@ typedef struct ConsPair {
 } ConsPair;
 
 
+/*!
+ * A promise is the result of (delay expr):  an expression whose evaluation has
+ * been put off until the promise is forced.  The first time the promise is
+ * forced, the expression is evaluated in the environment the promise was
+ * created in, and the result replaces the expression so that later forces
+ * just return it.
+ */
+typedef struct Promise {
+    /*!
+     * The expression to evaluate if the promise hasn't been forced yet, or
+     * the value of the promise if it has.
+     */
+    struct Value *p_expr;
+
+    /*!
+     * The environment to evaluate the expression in, or NULL once the promise
+     * has been forced.
+     */
+    struct Environment *p_env;
+} Promise;
+
+
+/*!
+ * The table of an ephemeron table value, made by make-weak-table.  Each entry
+ * keeps its value alive only while its key is reachable from somewhere else,
+ * and the garbage collector removes the entries whose keys it reclaims; see
+ * weak.c.  The table is an open-addressing hash table, with the hash of each
+ * key stored next to it.
+ */
+typedef struct WeakTable {
+    struct Value **keys;      /*!< The keys, or NULL for an empty slot. */
+    struct Value **vals;      /*!< The value of each entry. */
+    unsigned int *hashes;     /*!< The hash of each key. */
+    unsigned int capacity;    /*!< Always zero or a power of two. */
+    unsigned int size;        /*!< The number of entries. */
+} WeakTable;
+
+
+/*!
+ * An immutable string, used for the contents of T_String values.  Strings are
+ * garbage-collected objects of their own, so that many values can refer to
+ * the same characters.  The length and hash of the string are computed once,
+ * when the string is created.
+ *
+ * A string either owns its characters, which are then stored inline after the
+ * struct, or it is a view into the characters of a base string.  Since views
+ * can refer to the middle of another string, the characters are NOT
+ * NUL-terminated in general; always use the length.
+ */
+typedef struct String {
+    /*! The number of characters in the string. */
+    int length;
+
+    /*! A hash of the string's characters. */
+    unsigned int hash;
+
+    /*! The characters of the string. */
+    const char *chars;
+
+    /*!
+     * If this string is a view into another string's characters, this is the
+     * string that owns the characters.  Otherwise it is NULL.
+     */
+    struct String *base;
+
+#ifdef ALLOC_PROFILE
+    AllocTag alloc_tag;
+#endif
+
+    /*! For garbage collection. */
+    int marked;
+
+    /*! Inline storage for the characters, if the string owns them. */
+    char data[];
+} String;
+
+
 /*!
  * This is a tagged data type used to represent all the different kinds of
  * values that this Scheme interpreter supports.  The type field indicates the
@@ -97,15 +202,39 @@ typedef struct Value {
      * represented in this union.
      */
     union {
-        char  *string_val;           /* T_Error, T_Atom, T_String */
+        char  *string_val;           /* T_Error, T_Atom */
+        String *str_val;             /* T_String */
         int    bool_val;             /* T_Boolean */
         float  float_val;            /* T_Float */
         struct Lambda *lambda_val;   /* T_Lambda */
         ConsPair cons_val;           /* T_ConsPair */
+        Promise promise_val;         /* T_Promise */
+        struct Value *box_val;       /* T_WeakBox; NULL once cleared */
+        WeakTable *table_val;        /* T_WeakTable */
+        struct Value *values_val;    /* T_Values:  a list of the values */
     };
 
+#ifdef ALLOC_PROFILE
+    AllocTag alloc_tag;
+#endif
+
+    /*!
+     * Nonzero if this value is the canonical copy of a constant in the
+     * hash-consing table (see constants.c).  Interned values are shared by
+     * every use of the constant, so they must never be modified.  The flags
+     * are chars, so that they all fit in one word of the value.
+     */
+    unsigned char interned;
+
+    /*!
+     * For atoms, nonzero if the atom is the name of a special form, so that
+     * the evaluator can tell a procedure call from a special form without
+     * looking the name up.  make_atom() sets this when it creates the atom.
+     */
+    unsigned char special_form;
+
     /*! For garbage collection. */
-    int marked;
+    unsigned char marked;
 
 } Value;
 
@@ -150,12 +279,55 @@ typedef struct Lambda {
     /*! The parent environment of the lambda. */
     struct Environment *parent_env;
 
+    /*!
+     * For interpreted lambdas, nonzero if the environment of a call to the
+     * lambda may outlive the call, because the body can create closures that
+     * capture it.  Calls whose environments can't escape have them allocated
+     * from the frame region, so the garbage collector never sees them.
+     */
+    int frame_escapes;
+
+    /*!
+     * For native lambdas, nonzero if the native may keep its operand list
+     * after it returns, as list and values do.  Other natives only use the
+     * elements of the list, so callers such as apply and map can pass them
+     * a list that is shared or reused.
+     */
+    int retains_args;
+
+    /*!
+     * For interpreted lambdas, the number of bindings to reserve in the
+     * environment of a call:  one per argument, plus one per define.
+     */
+    int frame_size;
+
+    /*!
+     * For interpreted lambdas, the number of times the lambda has been
+     * called, up to the point where the JIT tries to compile it.
+     */
+    int call_count;
+
+    /*! Machine code the JIT has compiled for the lambda, or NULL. */
+    struct JitCode *jit_code;
+
+#ifdef ALLOC_PROFILE
+    AllocTag alloc_tag;
+#endif
+
     /*! For garbage collection. */
     int marked;
 
 } Lambda;
 
 
+/*!
+ * The maximum number of local variables that a single evaluation context can
+ * register with the garbage collector via evalctx_register().  These slots are
+ * stored inline in each context, so registering a local never allocates.
+ */
+#define EVALCTX_MAX_LOCALS 16
+
+
 /*!
  * This struct is used to represent the details of a single expression
  * evaluation, including the environment being used, the expression being
@@ -182,14 +354,40 @@ typedef struct EvaluationContext {
      */
     Value *child_eval_result;
 
+    /*! The number of entries in local_vals that are currently in use. */
+    int num_local_vals;
+
     /*!
-     * Pointer-vector of intermediate results.  Elements are pointers to
-     * Value-struct pointers.
+     * Intermediate results.  Elements are pointers to Value-struct pointers,
+     * i.e. the addresses of local variables in the C function that owns this
+     * context.
      */
-    PtrVector local_vals;
+    Value **local_vals[EVALCTX_MAX_LOCALS];
 
 } EvaluationContext;
 
 
+/*!
+ * The explicit stack of evaluation contexts.  Contexts are stored by value in
+ * one contiguous array, and the size member acts as a bump pointer, so pushing
+ * and popping a context doesn't allocate or free any memory.  The array is
+ * grown (but never shrunk) if the evaluation nests more deeply than it has
+ * ever nested before.
+ *
+ * Since growing the array may move it, a pointer to an EvaluationContext is
+ * only valid until the next context is pushed.
+ */
+typedef struct EvaluationStack {
+    /*! Number of contexts the stack *could* hold. */
+    unsigned int capacity;
+
+    /*! Number of contexts the stack currently holds. */
+    unsigned int size;
+
+    /*! The array of contexts.  The top of the stack is at index size - 1. */
+    EvaluationContext *frames;
+} EvaluationStack;
+
+
 #endif /* TYPES_H */
 
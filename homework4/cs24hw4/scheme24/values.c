@@ -6,11 +6,14 @@
 #include "values.h"
 #include "alloc.h"
 #include "evaluator.h"
+#include "special_forms.h"
+#include "weak.h"
 
 
 static char *value_type_names[] = {
     "T_Error", "T_Nil", "T_Atom", "T_Boolean", "T_String", "T_Float",
-    "T_Lambda", "T_ConsPair"
+    "T_Lambda", "T_ConsPair", "T_Promise", "T_WeakBox", "T_WeakTable",
+    "T_Values"
 };
 
 
@@ -32,10 +35,14 @@ void raw_print_value(const Value *v) {
         break;
 
     case T_Atom:
-    case T_String:
         printf("Value[%s:%s]\n", value_type_names[v->type], v->string_val);
         break;
 
+    case T_String:
+        printf("Value[%s:%.*s]\n", value_type_names[v->type],
+            v->str_val->length, v->str_val->chars);
+        break;
+
     case T_Float:
         printf("Value[%s:%f]\n", value_type_names[v->type], v->float_val);
         break;
@@ -51,93 +58,592 @@ void raw_print_value(const Value *v) {
 }
 
 
-void print_value(FILE *f, const Value *v) {
-    assert(f != NULL);
+/*============================================================================
+ * VALUE PRINTING
+ *
+ *   Values are printed without recursion, using an explicit stack of print
+ *   tasks, so that very long or very deeply nested structures can't overflow
+ *   the C stack.  Output is accumulated in a growable buffer that is written
+ *   out in large chunks (or returned as a string) rather than with many small
+ *   fprintf() calls.
+ *
+ *   Cyclic structures are handled in one of two ways.  Normally, the printer
+ *   keeps track of the cons pairs it is currently in the middle of printing,
+ *   and prints "..." if it runs into one of them again.  In cycle-label mode,
+ *   the printer first finds all cons pairs that are reachable more than once,
+ *   and then prints them with datum labels, e.g. "#0=(1 2 . #0#)".
+ *============================================================================*/
+
+
+/*!
+ * When printing to a file, the print buffer is written out whenever it grows
+ * past this many bytes.
+ */
+#define PRINT_FLUSH_SIZE 65536
+
+
+/*!
+ * A growable buffer that the printer accumulates its output into.  If f is
+ * non-NULL then the buffer is periodically flushed to that file; otherwise
+ * the buffer just grows until the printer is finished.
+ */
+typedef struct PrintBuffer {
+    char *data;        /*!< The buffered output, always NUL-terminated. */
+    int length;        /*!< The number of characters in the buffer. */
+    int capacity;      /*!< The number of bytes allocated for the buffer. */
+    FILE *f;           /*!< The file to flush the buffer to, or NULL. */
+} PrintBuffer;
+
+
+/*!
+ * A simple open-addressing hash table from Value pointers to integers, used by
+ * the printer to keep track of the cons pairs it has seen.
+ */
+typedef struct PointerTable {
+    unsigned int capacity;    /*!< Number of slots; always a power of 2. */
+    unsigned int size;        /*!< Number of slots in use. */
+    const Value **keys;       /*!< The keys; NULL marks an empty slot. */
+    int *vals;                /*!< The value associated with each key. */
+} PointerTable;
+
+
+/*! The different kinds of tasks on the printer's explicit stack. */
+typedef enum PrintTaskType {
+    PRINT_VALUE,      /*!< Print the value v. */
+    PRINT_TEXT,       /*!< Print the literal text. */
+    PRINT_LIST_REST,  /*!< Print the rest of a list, after the pair v. */
+    PRINT_LIST_END,   /*!< Close the list from head to v. */
+    PRINT_VALUES_REST /*!< Print the multiple values in the list v. */
+} PrintTaskType;
+
+
+/*! A single entry on the printer's explicit stack. */
+typedef struct PrintTask {
+    PrintTaskType type;
+    const Value *v;
+    const Value *head;    /*!< First pair of the list, for list tasks. */
+    const char *text;     /*!< Text to output, for PRINT_TEXT tasks. */
+} PrintTask;
+
+
+/*! The state of a single print operation. */
+typedef struct Printer {
+    PrintBuffer out;
+
+    /*! The explicit stack of things that remain to be printed. */
+    PrintTask *tasks;
+    int num_tasks;
+    int max_tasks;
+
+    /*! Nonzero if cycles and shared structure are printed with labels. */
+    int label_cycles;
+
+    /*!
+     * In the normal mode, the set of cons pairs that are currently being
+     * printed.  In cycle-label mode, the cons pairs reachable from the value
+     * being printed:  0 if reachable once, -1 if shared but not yet printed,
+     * and n + 1 if shared and printed with label n.
+     */
+    PointerTable pairs;
+    int next_label;
+} Printer;
+
+
+void pb_reserve(PrintBuffer *pb, int n);
+void pb_append(PrintBuffer *pb, const char *s, int n);
+void pb_puts(PrintBuffer *pb, const char *s);
+void pb_flush(PrintBuffer *pb);
+
+unsigned int ptab_slot(const PointerTable *pt, const Value *key);
+int * ptab_lookup(PointerTable *pt, const Value *key);
+void ptab_insert(PointerTable *pt, const Value *key, int val);
+void ptab_remove(PointerTable *pt, const Value *key);
+
+void printer_push(Printer *p, PrintTaskType type, const Value *v,
+                  const Value *head, const char *text);
+void printer_find_shared(Printer *p, const Value *v);
+void printer_print_atomic(Printer *p, const Value *v);
+void printer_start_pair(Printer *p, const Value *v);
+void printer_list_rest(Printer *p, const Value *pair, const Value *head);
+void printer_list_end(Printer *p, const Value *pair, const Value *head);
+void printer_run(Printer *p, const Value *v);
+
+
+/*!
+ * Makes sure that the print buffer has space for n more characters, plus the
+ * terminating NUL.
+ */
+void pb_reserve(PrintBuffer *pb, int n) {
+    int new_capacity;
+
+    if (pb->length + n + 1 <= pb->capacity)
+        return;
+
+    new_capacity = (pb->capacity == 0) ? 256 : pb->capacity;
+    while (new_capacity < pb->length + n + 1)
+        new_capacity *= 2;
+
+    pb->data = realloc(pb->data, new_capacity);
+    assert(pb->data != NULL);
+    pb->capacity = new_capacity;
+}
+
+
+/*! Appends n characters to the print buffer, flushing it if it's large. */
+void pb_append(PrintBuffer *pb, const char *s, int n) {
+    pb_reserve(pb, n);
+    memcpy(pb->data + pb->length, s, n);
+    pb->length += n;
+    pb->data[pb->length] = '\0';
+
+    if (pb->f != NULL && pb->length >= PRINT_FLUSH_SIZE)
+        pb_flush(pb);
+}
+
+
+void pb_puts(PrintBuffer *pb, const char *s) {
+    pb_append(pb, s, strlen(s));
+}
+
+
+/*! Writes the buffered output to the buffer's file, if it has one. */
+void pb_flush(PrintBuffer *pb) {
+    if (pb->f != NULL && pb->length > 0) {
+        fwrite(pb->data, 1, pb->length, pb->f);
+        pb->length = 0;
+    }
+}
+
+
+/*! Returns the slot that a key occupies, or the empty slot it would occupy. */
+unsigned int ptab_slot(const PointerTable *pt, const Value *key) {
+    unsigned int mask = pt->capacity - 1;
+    unsigned int i = ((unsigned int) ((size_t) key >> 3) * 2654435761u) & mask;
+
+    while (pt->keys[i] != NULL && pt->keys[i] != key)
+        i = (i + 1) & mask;
+
+    return i;
+}
+
+
+/*!
+ * Returns a pointer to the integer associated with the key, or NULL if the key
+ * isn't in the table.
+ */
+int * ptab_lookup(PointerTable *pt, const Value *key) {
+    unsigned int i;
+
+    if (pt->size == 0)
+        return NULL;
+
+    i = ptab_slot(pt, key);
+    return (pt->keys[i] != NULL) ? pt->vals + i : NULL;
+}
+
+
+/*! Adds a key to the table, or updates its value if it's already present. */
+void ptab_insert(PointerTable *pt, const Value *key, int val) {
+    unsigned int i;
+
+    if (2 * (pt->size + 1) > pt->capacity) {
+        /* Double the size of the table and rehash everything. */
+        PointerTable old = *pt;
+
+        pt->capacity = (old.capacity == 0) ? 64 : 2 * old.capacity;
+        pt->size = 0;
+        pt->keys = calloc(pt->capacity, sizeof(const Value *));
+        pt->vals = malloc(pt->capacity * sizeof(int));
+        assert(pt->keys != NULL && pt->vals != NULL);
+
+        for (i = 0; i < old.capacity; i++) {
+            if (old.keys[i] != NULL)
+                ptab_insert(pt, old.keys[i], old.vals[i]);
+        }
+
+        free(old.keys);
+        free(old.vals);
+    }
+
+    i = ptab_slot(pt, key);
+    if (pt->keys[i] == NULL) {
+        pt->keys[i] = key;
+        pt->size++;
+    }
+    pt->vals[i] = val;
+}
+
+
+/*!
+ * Removes a key from the table.  Since the table uses linear probing, the
+ * entries after the removed one are shifted back to fill the hole, so that
+ * lookups never need to skip over deleted entries.
+ */
+void ptab_remove(PointerTable *pt, const Value *key) {
+    unsigned int mask, i, j, home;
+
+    if (pt->size == 0)
+        return;
+
+    mask = pt->capacity - 1;
+    i = ptab_slot(pt, key);
+    if (pt->keys[i] == NULL)
+        return;
+
+    pt->keys[i] = NULL;
+    pt->size--;
+
+    for (j = (i + 1) & mask; pt->keys[j] != NULL; j = (j + 1) & mask) {
+        home = ((unsigned int) ((size_t) pt->keys[j] >> 3) * 2654435761u)
+               & mask;
+
+        /* Move the entry back if the hole lies between its home and it. */
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            pt->keys[i] = pt->keys[j];
+            pt->vals[i] = pt->vals[j];
+            pt->keys[j] = NULL;
+            i = j;
+        }
+    }
+}
+
+
+void printer_push(Printer *p, PrintTaskType type, const Value *v,
+                  const Value *head, const char *text) {
+    PrintTask *task;
+
+    if (p->num_tasks == p->max_tasks) {
+        p->max_tasks = (p->max_tasks == 0) ? 64 : 2 * p->max_tasks;
+        p->tasks = realloc(p->tasks, p->max_tasks * sizeof(PrintTask));
+        assert(p->tasks != NULL);
+    }
+
+    task = p->tasks + p->num_tasks;
+    p->num_tasks++;
+
+    task->type = type;
+    task->v = v;
+    task->head = head;
+    task->text = text;
+}
+
+
+/*!
+ * For cycle-label mode, this function records every cons pair reachable from
+ * the value in the printer's table, and marks the ones that are reachable
+ * more than once as needing a label.  It uses the task stack as a work list.
+ */
+void printer_find_shared(Printer *p, const Value *v) {
+    int *seen;
+
+    printer_push(p, PRINT_VALUE, v, NULL, NULL);
+    while (p->num_tasks > 0) {
+        p->num_tasks--;
+        v = p->tasks[p->num_tasks].v;
+
+        if (v == NULL)
+            continue;
+
+        if (v->type == T_ConsPair) {
+            seen = ptab_lookup(&p->pairs, v);
+            if (seen != NULL) {
+                *seen = -1;
+                continue;
+            }
+
+            ptab_insert(&p->pairs, v, 0);
+            printer_push(p, PRINT_VALUE, v->cons_val.p_cdr, NULL, NULL);
+            printer_push(p, PRINT_VALUE, v->cons_val.p_car, NULL, NULL);
+        }
+        else if (v->type == T_Lambda && !v->lambda_val->native_impl) {
+            printer_push(p, PRINT_VALUE, v->lambda_val->body, NULL, NULL);
+            printer_push(p, PRINT_VALUE, v->lambda_val->arg_spec, NULL, NULL);
+        }
+        else if (v->type == T_Values) {
+            for (v = v->values_val; v->type == T_ConsPair;
+                 v = v->cons_val.p_cdr) {
+                printer_push(p, PRINT_VALUE, v->cons_val.p_car, NULL, NULL);
+            }
+        }
+    }
+}
+
+
+/*! Prints a value that doesn't contain any other values. */
+void printer_print_atomic(Printer *p, const Value *v) {
+    char buf[64];
 
     if (v == NULL) {
-        fprintf(f, "NULL");
+        pb_puts(&p->out, "NULL");
         return;
     }
 
     switch (v->type) {
 
     case T_Nil:
-        fprintf(f, "nil");
+        pb_puts(&p->out, "nil");
         break;
 
     case T_Boolean:
-        fprintf(f, "%s", (v->bool_val ? "#t" : "#f"));
+        pb_puts(&p->out, v->bool_val ? "#t" : "#f");
         break;
 
     case T_Atom:
+        pb_puts(&p->out, v->string_val);
+        break;
+
     case T_String:
-        fprintf(f, "%s", v->string_val);
+        pb_append(&p->out, v->str_val->chars, v->str_val->length);
         break;
 
     case T_Float:
-        fprintf(f, "%g", v->float_val);
+        snprintf(buf, sizeof(buf), "%g", v->float_val);
+        pb_puts(&p->out, buf);
         break;
 
     case T_Lambda:
-        if (!v->lambda_val->native_impl) {
-            fprintf(f, "#lambda[args=");
-            print_value(f, v->lambda_val->arg_spec);
-            fprintf(f, " body=");
-            print_value(f, v->lambda_val->body);
-            fprintf(f, "]");
+        assert(v->lambda_val->native_impl);
+        snprintf(buf, sizeof(buf), "#native_lambda[0x%08x]",
+                 (unsigned int) v->lambda_val->func);
+        pb_puts(&p->out, buf);
+        break;
+
+    case T_Error:
+        pb_puts(&p->out, "ERROR:  ");
+        pb_puts(&p->out, v->string_val);
+        break;
+
+    case T_Promise:
+        /* The promise's value isn't printed, since it may be a stream that
+         * goes on forever.
+         */
+        pb_puts(&p->out, v->promise_val.p_env == NULL ?
+                "#promise[forced]" : "#promise");
+        break;
+
+    case T_WeakBox:
+        pb_puts(&p->out, v->box_val == NULL ?
+                "#weak-box[cleared]" : "#weak-box");
+        break;
+
+    case T_WeakTable:
+        snprintf(buf, sizeof(buf), "#weak-table[%u]", v->table_val->size);
+        pb_puts(&p->out, buf);
+        break;
+
+    default:
+        pb_puts(&p->out, "UNKNOWN");
+    }
+}
+
+
+/*!
+ * Starts printing a list at the cons pair v, or prints a reference to the
+ * pair if it has been printed before.
+ */
+void printer_start_pair(Printer *p, const Value *v) {
+    char buf[32];
+    int *label;
+
+    label = ptab_lookup(&p->pairs, v);
+
+    if (p->label_cycles) {
+        assert(label != NULL);
+        if (*label > 0) {
+            /* Already printed; just refer to it. */
+            snprintf(buf, sizeof(buf), "#%d#", *label - 1);
+            pb_puts(&p->out, buf);
+            return;
         }
-        else {
-            fprintf(f, "#native_lambda[0x%08x]",
-                    (unsigned int) v->lambda_val->func);
+        else if (*label == -1) {
+            /* First time we have printed a shared pair; give it a label. */
+            snprintf(buf, sizeof(buf), "#%d=", p->next_label);
+            pb_puts(&p->out, buf);
+            p->next_label++;
+            *label = p->next_label;
         }
-        break;
+    }
+    else {
+        if (label != NULL) {
+            /* We're already in the middle of printing this pair. */
+            pb_puts(&p->out, "...");
+            return;
+        }
+        ptab_insert(&p->pairs, v, 0);
+    }
 
-    case T_ConsPair:
-        {
-            Value *car;
-            Value *cdr;
-            int first = 1;
+    pb_puts(&p->out, "(");
+    printer_push(p, PRINT_LIST_REST, v, v, NULL);
+    printer_push(p, PRINT_VALUE, v->cons_val.p_car, NULL, NULL);
+}
 
-            fprintf(f, "(");
 
-            while (1) {
-                car = v->cons_val.p_car;
-                cdr = v->cons_val.p_cdr;
+/*!
+ * Continues printing a list after its element in the cons pair "pair" has
+ * been printed.
+ */
+void printer_list_rest(Printer *p, const Value *pair, const Value *head) {
+    const Value *cdr = pair->cons_val.p_cdr;
+    int *label;
 
-                if (!first)
-                    fprintf(f, " ");
-                else
-                    first = 0;
+    if (cdr != NULL && cdr->type == T_Nil) {
+        printer_list_end(p, pair, head);
+        return;
+    }
 
-                print_value(f, car);
+    if (cdr != NULL && cdr->type == T_ConsPair) {
+        /* The list continues, unless the next pair must be printed on its own
+         * because it is shared or is already being printed.
+         */
+        label = ptab_lookup(&p->pairs, cdr);
+        if (p->label_cycles ? (*label == 0) : (label == NULL)) {
+            if (!p->label_cycles)
+                ptab_insert(&p->pairs, cdr, 0);
+
+            pb_puts(&p->out, " ");
+            printer_push(p, PRINT_LIST_REST, cdr, head, NULL);
+            printer_push(p, PRINT_VALUE, cdr->cons_val.p_car, NULL, NULL);
+            return;
+        }
+    }
 
-                if (cdr != NULL && cdr->type == T_ConsPair)
-                    v = cdr;
-                else
-                    break;
-            }
+    /* Improper list, or the list continues with a pair printed separately. */
+    pb_puts(&p->out, " . ");
+    printer_push(p, PRINT_LIST_END, pair, head, NULL);
+    printer_push(p, PRINT_VALUE, cdr, NULL, NULL);
+}
+
+
+/*!
+ * Finishes printing the list whose pairs run from head to pair.  In the
+ * normal mode, these pairs are no longer being printed, so they are removed
+ * from the printer's table.
+ */
+void printer_list_end(Printer *p, const Value *pair, const Value *head) {
+    pb_puts(&p->out, ")");
+
+    if (!p->label_cycles) {
+        while (1) {
+            ptab_remove(&p->pairs, head);
+            if (head == pair)
+                break;
+            head = head->cons_val.p_cdr;
+        }
+    }
+}
+
+
+/*! Prints the value into the printer's buffer. */
+void printer_run(Printer *p, const Value *v) {
+    PrintTask task;
 
-            assert(cdr == NULL || cdr->type != T_ConsPair);
+    if (p->label_cycles)
+        printer_find_shared(p, v);
 
-            if (cdr != NULL && cdr->type == T_Nil) {
-                fprintf(f, ")");
+    printer_push(p, PRINT_VALUE, v, NULL, NULL);
+    while (p->num_tasks > 0) {
+        p->num_tasks--;
+        task = p->tasks[p->num_tasks];
+
+        switch (task.type) {
+
+        case PRINT_VALUE:
+            v = task.v;
+            if (v != NULL && v->type == T_ConsPair) {
+                printer_start_pair(p, v);
+            }
+            else if (v != NULL && v->type == T_Lambda &&
+                     !v->lambda_val->native_impl) {
+                pb_puts(&p->out, "#lambda[args=");
+                printer_push(p, PRINT_TEXT, NULL, NULL, "]");
+                printer_push(p, PRINT_VALUE, v->lambda_val->body, NULL, NULL);
+                printer_push(p, PRINT_TEXT, NULL, NULL, " body=");
+                printer_push(p, PRINT_VALUE, v->lambda_val->arg_spec,
+                             NULL, NULL);
+            }
+            else if (v != NULL && v->type == T_Values) {
+                printer_push(p, PRINT_VALUES_REST, v->values_val, NULL, NULL);
             }
             else {
-                fprintf(f, " . ");
-                print_value(f, cdr);
-                fprintf(f, ")");
+                printer_print_atomic(p, v);
             }
+            break;
+
+        case PRINT_TEXT:
+            pb_puts(&p->out, task.text);
+            break;
+
+        case PRINT_LIST_REST:
+            printer_list_rest(p, task.v, task.head);
+            break;
+
+        case PRINT_LIST_END:
+            printer_list_end(p, task.v, task.head);
+            break;
+
+        case PRINT_VALUES_REST:
+            /* Multiple values are printed one after another. */
+            v = task.v;
+            if (v->type == T_ConsPair) {
+                printer_push(p, PRINT_VALUES_REST, v->cons_val.p_cdr,
+                             NULL, NULL);
+                if (v->cons_val.p_cdr->type == T_ConsPair)
+                    printer_push(p, PRINT_TEXT, NULL, NULL, " ");
+                printer_push(p, PRINT_VALUE, v->cons_val.p_car, NULL, NULL);
+            }
+            break;
         }
-        break;
+    }
 
-    case T_Error:
-        fprintf(f, "ERROR:  %s", v->string_val);
-        break;
+    free(p->tasks);
+    free(p->pairs.keys);
+    free(p->pairs.vals);
+}
 
-    default:
-        fprintf(f, "UNKNOWN");
-    }
 
+/*!
+ * Prints a value to a file.  If label_cycles is nonzero then shared and
+ * cyclic structure is printed with datum labels; otherwise, a cons pair that
+ * contains itself is printed as "...".
+ */
+void write_value(FILE *f, const Value *v, int label_cycles) {
+    Printer p;
+
+    assert(f != NULL);
+
+    memset(&p, 0, sizeof(Printer));
+    p.out.f = f;
+    p.label_cycles = label_cycles;
+
+    printer_run(&p, v);
+
+    pb_flush(&p.out);
+    free(p.out.data);
+}
+
+
+void print_value(FILE *f, const Value *v) {
+    write_value(f, v, /* label_cycles */ 0);
+}
+
+
+/*!
+ * Renders a value into a newly allocated string, using the same format as
+ * write_value(), without using stdio at all.  The caller is responsible for
+ * freeing the result.
+ */
+char * value_to_string(const Value *v, int label_cycles) {
+    Printer p;
+
+    memset(&p, 0, sizeof(Printer));
+    p.label_cycles = label_cycles;
+
+    pb_reserve(&p.out, 0);
+    p.out.data[0] = '\0';
+
+    printer_run(&p, v);
+
+    return p.out.data;
 }
 
 
@@ -186,6 +692,7 @@ Value * make_atom(const char *str) {
 
     v->type = T_Atom;
     v->string_val = strdup(str);
+    v->special_form = is_special_form_name(str);
 
     return v;
 }
@@ -215,21 +722,106 @@ Value * make_false() {
 }
 
 
+/*!
+ * Computes the hash of a run of characters.  This is the FNV-1a hash, which is
+ * simple and spreads short strings out reasonably well.
+ */
+unsigned int hash_chars(const char *chars, int length) {
+    unsigned int hash = 2166136261u;
+    int i;
+
+    for (i = 0; i < length; i++) {
+        hash ^= (unsigned char) chars[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
 /*!
  * Given a string-literal value, this function creates a new Value object of
  * type T_String.  Note that the passed-in string is NOT owned by the
  * new Value object; rather, the input is copied.
  */
 Value * make_string(const char *str) {
+    return make_string_len(str, strlen(str));
+}
+
+
+/*!
+ * Creates a new Value object of type T_String from the specified number of
+ * characters, which are copied into a new String.
+ */
+Value * make_string_len(const char *chars, int length) {
+    String *str = alloc_string(length);
+
+    memcpy(str->data, chars, length);
+    str->hash = hash_chars(chars, length);
+
+    return make_string_value(str);
+}
+
+
+/*!
+ * Creates a new Value object of type T_String that refers to an existing
+ * String.  Since strings are immutable, any number of values can share the
+ * same String.
+ */
+Value * make_string_value(String *str) {
     Value *v = alloc_value();
 
+    assert(str != NULL);
+
     v->type = T_String;
-    v->string_val = strdup(str);
+    v->str_val = str;
 
     return v;
 }
 
 
+/*!
+ * Creates a new Value object of type T_String containing the characters of
+ * the string value from index start (inclusive) to end (exclusive).
+ *
+ * If the substring is a large enough part of the original string, the result
+ * simply refers to the original string's characters.  Otherwise the
+ * characters are copied, so that a short substring doesn't keep a much longer
+ * string from being garbage-collected.
+ */
+Value * make_substring(Value *v, int start, int end) {
+    String *str, *sub;
+
+    assert(is_string(v));
+    str = v->str_val;
+    assert(0 <= start && start <= end && end <= str->length);
+
+    if (start == 0 && end == str->length)
+        return make_string_value(str);
+
+    if (end - start < SUBSTRING_SHARE_MIN || 4 * (end - start) < str->length)
+        return make_string_len(str->chars + start, end - start);
+
+    sub = alloc_string_view(str, start, end - start);
+    sub->hash = hash_chars(sub->chars, sub->length);
+
+    return make_string_value(sub);
+}
+
+
+/*!
+ * Returns nonzero if the two strings contain the same characters.  Strings of
+ * different lengths or hashes are rejected without looking at the characters.
+ */
+int string_equals(const String *s1, const String *s2) {
+    if (s1 == s2)
+        return 1;
+
+    return s1->length == s2->length && s1->hash == s2->hash &&
+           memcmp(s1->chars, s2->chars, s1->length) == 0;
+}
+
+
 Value * make_float(float f) {
     Value *v = alloc_value();
 
@@ -251,20 +843,148 @@ Value * make_cons(Value *car, Value *cdr) {
 }
 
 
+/*!
+ * This helper function performs the escape analysis for make_lambda().  It
+ * scans an expression for anything that could create a closure capturing the
+ * environment the expression is evaluated in:  a special form that is marked
+ * as creating closures, such as lambda, delay or cons-stream (promises hold
+ * onto their environment too), or a define of the form (define (name args...)
+ * body...).  Quoted data is scanned too, which is conservative but harmless.
+ * The number of define forms seen is added to *num_defines, so that the
+ * caller can size the environment.
+ *
+ * Returns 1 if the expression might create a closure, or 0 if it can't.
+ */
+int expr_creates_closure(Value *expr, int *num_defines) {
+    while (is_cons_pair(expr)) {
+        Value *elem = get_car(expr);
+
+        if (is_atom(elem) && is_special_form(elem)) {
+            if (special_form_creates_closures(elem->string_val))
+                return 1;
+
+            if (strcmp(elem->string_val, "define") == 0) {
+                Value *rest = get_cdr(expr);
+
+                if (is_cons_pair(rest) && is_cons_pair(get_car(rest)))
+                    return 1;
+
+                (*num_defines)++;
+            }
+        }
+        else if (expr_creates_closure(elem, num_defines)) {
+            return 1;
+        }
+
+        expr = get_cdr(expr);
+    }
+
+    return 0;
+}
+
+
+/*!
+ * Creates a promise to evaluate the specified expression in the specified
+ * environment, once the promise is forced.
+ */
+Value * make_promise(Environment *env, Value *expr) {
+    Value *v;
+
+    assert(env != NULL);
+    assert(expr != NULL);
+
+    v = alloc_value();
+    v->type = T_Promise;
+    v->promise_val.p_expr = expr;
+    v->promise_val.p_env = env;
+
+    return v;
+}
+
+
+/*! Creates a promise that has already been forced to the specified value. */
+Value * make_forced_promise(Value *value) {
+    Value *v;
+
+    assert(value != NULL);
+
+    v = alloc_value();
+    v->type = T_Promise;
+    v->promise_val.p_expr = value;
+    v->promise_val.p_env = NULL;
+
+    return v;
+}
+
+
+/*!
+ * Creates a weak box referring to the specified value.  The box doesn't keep
+ * the value alive; once the value is garbage-collected, the box is cleared.
+ */
+Value * make_weak_box(Value *value) {
+    Value *v;
+
+    assert(value != NULL);
+
+    v = alloc_value();
+    v->type = T_WeakBox;
+    v->box_val = value;
+
+    return v;
+}
+
+
+/*!
+ * Creates a value that represents multiple values being returned at once.  The
+ * argument is the list of values, which is used without copying it.
+ */
+Value * make_values(Value *list) {
+    Value *v;
+
+    assert(list != NULL);
+
+    v = alloc_value();
+    v->type = T_Values;
+    v->values_val = list;
+
+    return v;
+}
+
+
+/*! Creates a new, empty ephemeron table. */
+Value * make_weak_table(void) {
+    Value *v;
+
+    v = alloc_value();
+    v->type = T_WeakTable;
+    v->table_val = weak_table_create();
+
+    return v;
+}
+
+
+/*!
+ * Creates an interpreted lambda.  The lambda's body is analyzed to see whether
+ * the environment of a call to the lambda can escape the call; if the body
+ * can't create any closures then nothing can refer to that environment once
+ * the call returns, so the evaluator allocates it from the frame region.
+ */
 Value * make_lambda(Environment *parent_env, Value *arg_spec, Value *body) {
     Value *v;
     Lambda *f;
+    Value *arg_iter;
+    int num_args = 0, num_defines = 0;
 
     /* Every lambda expression MUST have a parent environment. */
     assert(parent_env != NULL);
     assert(arg_spec != NULL);
     assert(body != NULL);
 
-    /* The argument-spec must either be an atom, a list of atoms, or an
-     * improper list of atoms.  Otherwise the spec is invalid.
+    /* The argument-spec must either be an atom, an empty list, a list of
+     * atoms, or an improper list of atoms.  Otherwise the spec is invalid.
      */
-    if (!is_atom(arg_spec)) {
-        Value *arg_iter = arg_spec;
+    if (!is_atom(arg_spec) && !is_nil(arg_spec)) {
+        arg_iter = arg_spec;
 
         do {
             if (!is_cons_pair(arg_iter) || !is_atom(get_car(arg_iter))) {
@@ -285,6 +1005,17 @@ Value * make_lambda(Environment *parent_env, Value *arg_spec, Value *body) {
     f->native_impl = 0;       /* Interpreted lambda. */
     f->body = body;
 
+    /* Count the argument names, including the name for any "rest" values. */
+    for (arg_iter = arg_spec; is_cons_pair(arg_iter);
+         arg_iter = get_cdr(arg_iter)) {
+        num_args++;
+    }
+    if (is_atom(arg_iter))
+        num_args++;
+
+    f->frame_escapes = expr_creates_closure(body, &num_defines);
+    f->frame_size = num_args + num_defines;
+
     v->type = T_Lambda;
     v->lambda_val = f;
 
@@ -292,7 +1023,8 @@ Value * make_lambda(Environment *parent_env, Value *arg_spec, Value *body) {
 }
 
 
-Value * make_native_lambda(Environment *parent_env, NativeLambda func) {
+Value * make_native_lambda(Environment *parent_env, NativeLambda func,
+                           int retains_args) {
     Value *v;
     Lambda *f;
 
@@ -307,6 +1039,7 @@ Value * make_native_lambda(Environment *parent_env, NativeLambda func) {
     /* f->arg_spec = arg_spec; */
     f->native_impl = 1;       /* Native lambda. */
     f->func = func;
+    f->retains_args = retains_args;
 
     v->type = T_Lambda;
     v->lambda_val = f;
@@ -363,6 +1096,26 @@ int is_nil(Value *v) {
 }
 
 
+int is_promise(Value *v) {
+    return (v != NULL && v->type == T_Promise);
+}
+
+
+int is_weak_box(Value *v) {
+    return (v != NULL && v->type == T_WeakBox);
+}
+
+
+int is_weak_table(Value *v) {
+    return (v != NULL && v->type == T_WeakTable);
+}
+
+
+int is_values(Value *v) {
+    return (v != NULL && v->type == T_Values);
+}
+
+
 int is_lambda(Value *v) {
     return (v != NULL && v->type == T_Lambda);
 }
@@ -466,6 +1219,7 @@ void append_value_to_list(ListBuilder *builder, Value *v) {
 
         new_cons = make_cons(v, nil_val);
         set_cdr(builder->tail, new_cons);
+        builder->tail = new_cons;
     }
 }
 
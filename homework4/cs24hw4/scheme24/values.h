@@ -9,6 +9,8 @@
 void raw_print_value(const Value *v);
 
 void print_value(FILE *f, const Value *v);
+void write_value(FILE *f, const Value *v, int label_cycles);
+char * value_to_string(const Value *v, int label_cycles);
 
 
 Value * make_error(const char *str, ...) __attribute__((format (printf, 1, 2)));
@@ -19,14 +21,32 @@ Value * make_bool(int b);
 Value * make_true(void);
 Value * make_false(void);
 
+/*!
+ * Substrings shorter than this many characters are always copied, rather than
+ * sharing the characters of the original string.
+ */
+#define SUBSTRING_SHARE_MIN 32
+
+unsigned int hash_chars(const char *chars, int length);
+
 Value * make_string(const char *str);
+Value * make_string_len(const char *chars, int length);
+Value * make_string_value(String *str);
+Value * make_substring(Value *v, int start, int end);
+int string_equals(const String *s1, const String *s2);
 Value * make_float(float f);
 
 Value * make_nil(void);
 Value * make_cons(Value *car, Value *cdr);
 
 Value * make_lambda(struct Environment *parent_env, Value *arg_spec, Value *body);
-Value * make_native_lambda(struct Environment *parent_env, NativeLambda func);
+Value * make_native_lambda(struct Environment *parent_env, NativeLambda func,
+                           int retains_args);
+Value * make_promise(struct Environment *env, Value *expr);
+Value * make_forced_promise(Value *value);
+Value * make_weak_box(Value *value);
+Value * make_weak_table(void);
+Value * make_values(Value *list);
 
 int is_atom(Value *v);
 
@@ -45,6 +65,10 @@ int is_cons_pair(Value *v);
 int is_nil(Value *v);
 
 int is_lambda(Value *v);
+int is_promise(Value *v);
+int is_weak_box(Value *v);
+int is_weak_table(Value *v);
+int is_values(Value *v);
 
 
 Value * get_car(Value *cons);
@@ -0,0 +1,165 @@
+/*! \file
+ * This file provides growable vectors whose element type is chosen at compile
+ * time.  DEFINE_VECTOR(Name, prefix, T, N) defines a struct type Name holding
+ * elements of type T, along with static inline functions prefix_init(),
+ * prefix_push() and so on to manipulate it.  Since each vector type has its
+ * own functions, elements are stored and returned as T directly, with no
+ * casting to and from void-pointers, and the compiler can inline the common
+ * operations into their callers.
+ *
+ * The first N elements are stored inline in the struct itself, so a vector
+ * that never grows beyond N elements never allocates any memory.  When it does
+ * need more room, the vector grows by a factor of VECTOR_GROWTH_NUM /
+ * VECTOR_GROWTH_DEN.  Vectors only shrink when prefix_truncate() leaves them
+ * at most a quarter full, and then they keep twice as much room as they need,
+ * so that a vector whose size goes up and down repeatedly doesn't keep
+ * reallocating its storage.
+ *
+ * Since the elements may be stored inside the struct, a vector must not be
+ * copied by assignment; pass it around by pointer.  Pointers returned by
+ * prefix_data() are only valid until the vector is next grown or truncated.
+ */
+
+#ifndef VECTOR_H
+#define VECTOR_H
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * The growth factor for all vectors, as a fraction.  These can be overridden
+ * on the compiler command-line; the factor must be greater than 1.
+ */
+#ifndef VECTOR_GROWTH_NUM
+#define VECTOR_GROWTH_NUM 2
+#endif
+
+#ifndef VECTOR_GROWTH_DEN
+#define VECTOR_GROWTH_DEN 1
+#endif
+
+
+/*!
+ * Statically initializes a vector with N inline elements, for vectors that
+ * are global variables.
+ */
+#define VECTOR_STATIC_INIT(N) { 0, (N), NULL, { 0 } }
+
+
+#define DEFINE_VECTOR(Name, prefix, T, N)                                     \
+                                                                              \
+typedef struct Name {                                                         \
+    /*! Number of elements the vector currently holds. */                     \
+    unsigned int size;                                                        \
+                                                                              \
+    /*! Number of elements the vector can hold without growing. */            \
+    unsigned int capacity;                                                    \
+                                                                              \
+    /*! The elements, once there are too many to store inline. */             \
+    T *heap;                                                                  \
+                                                                              \
+    /*! The elements, while there are few enough of them. */                  \
+    T inline_elems[N];                                                        \
+} Name;                                                                       \
+                                                                              \
+                                                                              \
+static inline void prefix##_init(Name *v) {                                   \
+    v->size = 0;                                                              \
+    v->capacity = (N);                                                        \
+    v->heap = NULL;                                                           \
+}                                                                             \
+                                                                              \
+static inline void prefix##_uninit(Name *v) {                                 \
+    free(v->heap);                                                            \
+    prefix##_init(v);                                                         \
+}                                                                             \
+                                                                              \
+/*! Returns the vector's array of elements. */                                \
+static inline T * prefix##_data(Name *v) {                                    \
+    return (v->heap != NULL) ? v->heap : v->inline_elems;                     \
+}                                                                             \
+                                                                              \
+/*! Moves the elements into storage with room for the specified number. */    \
+static inline int prefix##_resize(Name *v, unsigned int capacity) {           \
+    T *heap;                                                                  \
+                                                                              \
+    assert(capacity >= v->size);                                              \
+                                                                              \
+    if (capacity <= (N)) {                                                    \
+        if (v->heap != NULL) {                                                \
+            memcpy(v->inline_elems, v->heap, v->size * sizeof(T));            \
+            free(v->heap);                                                    \
+            v->heap = NULL;                                                   \
+        }                                                                     \
+        v->capacity = (N);                                                    \
+        return 1;                                                             \
+    }                                                                         \
+                                                                              \
+    heap = realloc(v->heap, capacity * sizeof(T));                            \
+    if (heap == NULL)                                                         \
+        return 0;                                                             \
+                                                                              \
+    if (v->heap == NULL)                                                      \
+        memcpy(heap, v->inline_elems, v->size * sizeof(T));                   \
+                                                                              \
+    v->heap = heap;                                                           \
+    v->capacity = capacity;                                                   \
+    return 1;                                                                 \
+}                                                                             \
+                                                                              \
+/*!                                                                           \
+ * Adds an element to the end of the vector.  Returns 1 on success, or 0 if  \
+ * the vector needed to grow but couldn't.                                    \
+ */                                                                           \
+static inline int prefix##_push(Name *v, T elem) {                            \
+    if (v->size == v->capacity) {                                             \
+        unsigned int capacity = v->capacity * VECTOR_GROWTH_NUM /             \
+                                VECTOR_GROWTH_DEN;                            \
+        if (capacity <= v->capacity)                                          \
+            capacity = v->capacity + 1;                                       \
+        if (!prefix##_resize(v, capacity))                                    \
+            return 0;                                                         \
+    }                                                                         \
+                                                                              \
+    prefix##_data(v)[v->size++] = elem;                                       \
+    return 1;                                                                 \
+}                                                                             \
+                                                                              \
+/*! Removes and returns the last element; the vector never shrinks here. */   \
+static inline T prefix##_pop(Name *v) {                                       \
+    assert(v->size > 0);                                                      \
+    return prefix##_data(v)[--v->size];                                       \
+}                                                                             \
+                                                                              \
+static inline T prefix##_get(Name *v, unsigned int index) {                   \
+    assert(index < v->size);                                                  \
+    return prefix##_data(v)[index];                                           \
+}                                                                             \
+                                                                              \
+static inline void prefix##_set(Name *v, unsigned int index, T elem) {        \
+    assert(index < v->size);                                                  \
+    prefix##_data(v)[index] = elem;                                           \
+}                                                                             \
+                                                                              \
+/*!                                                                           \
+ * Drops the elements from the specified index onward.  If that leaves the    \
+ * vector at most a quarter full, its storage is reduced, but to no less than \
+ * twice what it now holds.                                                   \
+ */                                                                           \
+static inline void prefix##_truncate(Name *v, unsigned int size) {            \
+    unsigned int capacity = v->capacity;                                      \
+                                                                              \
+    assert(size <= v->size);                                                  \
+    v->size = size;                                                           \
+                                                                              \
+    while (capacity / 2 >= (N) && size <= capacity / 4)                       \
+        capacity /= 2;                                                        \
+                                                                              \
+    if (capacity < v->capacity)                                               \
+        prefix##_resize(v, capacity);                                         \
+}
+
+
+#endif /* VECTOR_H */
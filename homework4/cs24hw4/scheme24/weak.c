@@ -0,0 +1,295 @@
+/*! \file
+ * This file implements the hash tables behind ephemeron tables, the T_WeakTable
+ * values made by make-weak-table.  An ephemeron table maps keys to values the
+ * way an association list would, except that the table doesn't keep its keys
+ * alive:  an entry's value is only kept alive for as long as its key is
+ * reachable from outside the entry, and once the garbage collector reclaims
+ * the key, the entry is removed.  This makes ephemeron tables useful as caches
+ * that are keyed on objects, since the cache never holds onto an object that
+ * the rest of the program has finished with.
+ *
+ * Keys are compared the way eq? compares them.  eq? compares numbers, atoms,
+ * strings, Booleans and nil by their contents, so a key like that can always
+ * be made again, and an entry whose key is one of them is never removed.
+ *
+ * The garbage collector does the marking itself (see mark_ephemerons() in
+ * alloc.c); this file just maintains the tables, and removes the entries
+ * whose keys the collector didn't mark.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "weak.h"
+#include "values.h"
+
+
+unsigned int hash_key(const Value *key);
+int same_key(const Value *k1, const Value *k2);
+unsigned int wtab_slot(const WeakTable *t, const Value *key,
+                       unsigned int hash);
+void wtab_insert(WeakTable *t, Value *key, Value *val, unsigned int hash);
+void wtab_rebuild(WeakTable *t, unsigned int capacity, int live_only);
+
+
+/*!
+ * Computes the hash of a key, such that keys that are the same according to
+ * same_key() have the same hash.
+ */
+unsigned int hash_key(const Value *key) {
+    unsigned int h;
+    float f;
+
+    switch (key->type) {
+    case T_Nil:
+        h = 0;
+        break;
+
+    case T_Boolean:
+        h = key->bool_val;
+        break;
+
+    case T_Float:
+        /* 0.0 and -0.0 are eq?, so they need the same hash. */
+        f = (key->float_val == 0.0f) ? 0.0f : key->float_val;
+        memcpy(&h, &f, sizeof(h));
+        break;
+
+    case T_String:
+        h = key->str_val->hash;
+        break;
+
+    case T_Atom:
+        h = hash_chars(key->string_val, strlen(key->string_val));
+        break;
+
+    default:
+        h = (unsigned int) ((size_t) key >> 3);
+    }
+
+    h = (h ^ ((unsigned int) key->type * 0x9e3779b9u)) * 2654435761u;
+    return h ^ (h >> 16);
+}
+
+
+/*! Returns nonzero if two keys are eq?. */
+int same_key(const Value *k1, const Value *k2) {
+    if (k1 == k2)
+        return 1;
+
+    if (k1->type != k2->type)
+        return 0;
+
+    switch (k1->type) {
+    case T_Nil:
+        return 1;
+
+    case T_Boolean:
+        return k1->bool_val == k2->bool_val;
+
+    case T_Float:
+        return k1->float_val == k2->float_val;
+
+    case T_String:
+        return string_equals(k1->str_val, k2->str_val);
+
+    case T_Atom:
+        return strcmp(k1->string_val, k2->string_val) == 0;
+
+    default:
+        return 0;
+    }
+}
+
+
+/*!
+ * Returns nonzero if a key is compared by its contents rather than by its
+ * identity.  Entries with these keys keep their values alive like an ordinary
+ * table would, since an equal key can be made again at any time.
+ */
+int weak_key_is_strong(const Value *key) {
+    switch (key->type) {
+    case T_Nil:
+    case T_Boolean:
+    case T_Float:
+    case T_String:
+    case T_Atom:
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+
+/*! Returns the slot that a key occupies, or the empty slot it would occupy. */
+unsigned int wtab_slot(const WeakTable *t, const Value *key,
+                       unsigned int hash) {
+    unsigned int mask = t->capacity - 1;
+    unsigned int i;
+
+    for (i = hash & mask; t->keys[i] != NULL; i = (i + 1) & mask) {
+        if (t->hashes[i] == hash && same_key(t->keys[i], key))
+            break;
+    }
+
+    return i;
+}
+
+
+/*! Adds an entry to the table; the key must not already be in it. */
+void wtab_insert(WeakTable *t, Value *key, Value *val, unsigned int hash) {
+    unsigned int i;
+
+    if (2 * (t->size + 1) > t->capacity)
+        wtab_rebuild(t, t->capacity == 0 ? 16 : 2 * t->capacity, 0);
+
+    i = wtab_slot(t, key, hash);
+    assert(t->keys[i] == NULL);
+
+    t->keys[i] = key;
+    t->vals[i] = val;
+    t->hashes[i] = hash;
+    t->size++;
+}
+
+
+/*!
+ * Moves the entries of a table into new arrays of the specified capacity.  If
+ * live_only is nonzero, only the entries whose keys the garbage collector has
+ * marked are kept.
+ */
+void wtab_rebuild(WeakTable *t, unsigned int capacity, int live_only) {
+    WeakTable old = *t;
+    unsigned int i;
+
+    t->capacity = capacity;
+    t->size = 0;
+    t->keys = calloc(capacity, sizeof(Value *));
+    t->vals = malloc(capacity * sizeof(Value *));
+    t->hashes = malloc(capacity * sizeof(unsigned int));
+    assert(t->keys != NULL && t->vals != NULL && t->hashes != NULL);
+
+    for (i = 0; i < old.capacity; i++) {
+        if (old.keys[i] == NULL || (live_only && !old.keys[i]->marked))
+            continue;
+
+        wtab_insert(t, old.keys[i], old.vals[i], old.hashes[i]);
+    }
+
+    free(old.keys);
+    free(old.vals);
+    free(old.hashes);
+}
+
+
+/*! Creates a new, empty table. */
+WeakTable * weak_table_create(void) {
+    WeakTable *t = malloc(sizeof(WeakTable));
+    assert(t != NULL);
+
+    memset(t, 0, sizeof(WeakTable));
+    return t;
+}
+
+
+/*! Frees a table.  The keys and values are garbage-collected separately. */
+void weak_table_free(WeakTable *t) {
+    assert(t != NULL);
+
+    free(t->keys);
+    free(t->vals);
+    free(t->hashes);
+    free(t);
+}
+
+
+/*! The number of bytes a table takes up, for the allocation profiler. */
+long weak_table_bytes(const WeakTable *t) {
+    return sizeof(WeakTable) +
+           t->capacity * (2 * sizeof(Value *) + sizeof(unsigned int));
+}
+
+
+/*! Returns the value of the entry for a key, or NULL if there isn't one. */
+Value * weak_table_get(WeakTable *t, Value *key) {
+    unsigned int i;
+
+    if (t->size == 0)
+        return NULL;
+
+    i = wtab_slot(t, key, hash_key(key));
+    return (t->keys[i] != NULL) ? t->vals[i] : NULL;
+}
+
+
+/*! Sets the value of the entry for a key, adding the entry if it's new. */
+void weak_table_put(WeakTable *t, Value *key, Value *val) {
+    unsigned int hash = hash_key(key);
+    unsigned int i;
+
+    assert(val != NULL);
+
+    if (t->size > 0) {
+        i = wtab_slot(t, key, hash);
+        if (t->keys[i] != NULL) {
+            t->vals[i] = val;
+            return;
+        }
+    }
+
+    wtab_insert(t, key, val, hash);
+}
+
+
+/*!
+ * Removes the entry for a key.  Returns 1 if there was one, or 0 if not.  The
+ * entries after it in its cluster are moved back, so that lookups never need
+ * to skip over deleted slots.
+ */
+int weak_table_remove(WeakTable *t, Value *key) {
+    unsigned int mask, i, j, home;
+
+    if (t->size == 0)
+        return 0;
+
+    i = wtab_slot(t, key, hash_key(key));
+    if (t->keys[i] == NULL)
+        return 0;
+
+    mask = t->capacity - 1;
+    for (j = (i + 1) & mask; t->keys[j] != NULL; j = (j + 1) & mask) {
+        /* An entry can fill the hole at i if i lies cyclically between the
+         * entry's home slot and the slot it is in now.
+         */
+        home = t->hashes[j] & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            t->keys[i] = t->keys[j];
+            t->vals[i] = t->vals[j];
+            t->hashes[i] = t->hashes[j];
+            i = j;
+        }
+    }
+
+    t->keys[i] = NULL;
+    t->size--;
+    return 1;
+}
+
+
+/*!
+ * Removes the entries whose keys the garbage collector hasn't marked.  This
+ * must be called after marking and before sweeping.
+ */
+void weak_table_remove_dead(WeakTable *t) {
+    unsigned int i;
+
+    for (i = 0; i < t->capacity; i++) {
+        if (t->keys[i] != NULL && !t->keys[i]->marked)
+            break;
+    }
+
+    if (i < t->capacity)
+        wtab_rebuild(t, t->capacity, /* live_only */ 1);
+}
@@ -0,0 +1,18 @@
+#ifndef WEAK_H
+#define WEAK_H
+
+#include "types.h"
+
+
+WeakTable * weak_table_create(void);
+void weak_table_free(WeakTable *t);
+long weak_table_bytes(const WeakTable *t);
+
+int weak_key_is_strong(const Value *key);
+
+Value * weak_table_get(WeakTable *t, Value *key);
+void weak_table_put(WeakTable *t, Value *key, Value *val);
+int weak_table_remove(WeakTable *t, Value *key);
+void weak_table_remove_dead(WeakTable *t);
+
+#endif /* WEAK_H */
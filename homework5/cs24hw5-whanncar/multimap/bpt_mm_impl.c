@@ -0,0 +1,838 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "multimap.h"
+#include "mm_frozen.h"
+#include "mm_sort.h"
+#include "mm_util.h"
+#include "mm_values.h"
+
+
+/*============================================================================
+ * TYPES
+ *
+ *   These types are defined in the implementation file so that they can
+ *   be kept hidden to code outside this source file.  This is not for any
+ *   security reason, but rather just so we can enforce that our testing
+ *   programs are generic and don't have any access to implementation details.
+ *
+ *   The keys are kept in a B+tree whose nodes are a whole number of cache
+ *   lines, and are allocated on cache-line boundaries.  Each node stores its
+ *   keys contiguously at the start of the node, so searching a node touches as
+ *   few cache lines as possible, and the search is a branch-free count that
+ *   the compiler can vectorize.  All the keys live in the leaves, which are
+ *   linked together in key order so that mm_traverse() is a linear walk.
+ *
+ *   The nodes and values are all allocated from an arena owned by the
+ *   multimap, so clearing the multimap frees a few large slabs instead of
+ *   every node and chunk.
+ *
+ *   A frozen multimap has no tree at all; its pairs are kept in the flat
+ *   arrays of mm_frozen.c instead, also allocated from the arena.
+ *============================================================================*/
+
+/* The size of a cache line on the machines we care about (see questions.txt),
+ * and the number of cache lines in each node of the tree.
+ */
+#define CACHE_LINE_SIZE 64
+#define NODE_LINES 4
+#define NODE_SIZE (NODE_LINES * CACHE_LINE_SIZE)
+
+/* The number of probes that mm_contains_pairs() runs together. */
+#define PROBE_GROUP_SIZE 16
+
+/* The most keys an inner node can hold.  An inner node with n keys has n + 1
+ * children.
+ */
+#define INNER_KEYS ((int) ((NODE_SIZE - sizeof(int) - sizeof(void *)) / \
+                            (sizeof(int) + sizeof(void *))))
+
+/* The most keys a leaf can hold.  Each key in a leaf has a list of values. */
+#define LEAF_KEYS ((int) ((NODE_SIZE - sizeof(int) - sizeof(void *)) / \
+                           (sizeof(int) + sizeof(value_list))))
+
+
+/* An inner node of the tree.  keys[i] is the smallest key in the subtree
+ * children[i + 1], so every key in children[i] is less than keys[i].
+ */
+typedef struct inner_node {
+    int keys[INNER_KEYS];
+    int num_keys;
+    void *children[INNER_KEYS + 1];
+} inner_node;
+
+
+/* A leaf of the tree, holding keys in increasing order and the values of
+ * each key.
+ */
+typedef struct leaf_node {
+    int keys[LEAF_KEYS];
+    int num_keys;
+
+    /* The next leaf in key order, or NULL for the last leaf. */
+    struct leaf_node *next;
+
+    /* The values associated with each key, in the order they were added. */
+    value_list values[LEAF_KEYS];
+} leaf_node;
+
+
+/* Fails to compile if a node doesn't fit in NODE_SIZE bytes. */
+typedef char inner_node_fits[sizeof(inner_node) <= NODE_SIZE ? 1 : -1];
+typedef char leaf_node_fits[sizeof(leaf_node) <= NODE_SIZE ? 1 : -1];
+
+
+/* The entry-point of the multimap data structure. */
+struct multimap {
+    /* The root of the tree:  a leaf if height is 1, an inner node if it is
+     * more than that, or NULL if the multimap is empty.
+     */
+    void *root;
+
+    /* The number of levels in the tree, including the leaves. */
+    int height;
+
+    /* The leaf with the smallest keys, where traversals start. */
+    leaf_node *first_leaf;
+
+    /* The pairs of the multimap if it is frozen, in which case the tree is
+     * empty, or NULL if it isn't.
+     */
+    frozen_multimap *frozen;
+
+    /* The arena that the nodes and values are allocated from. */
+    mm_arena arena;
+};
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *
+ *   Declarations of helper functions that are local to this module.  Again,
+ *   these are not visible outside of this module.
+ *============================================================================*/
+
+void * alloc_node(multimap *mm);
+
+int count_keys_less(const int *keys, int num_keys, int key);
+int count_keys_less_equal(const int *keys, int num_keys, int key);
+
+leaf_node * find_leaf(multimap *mm, int key);
+int find_in_leaf(leaf_node *leaf, int key);
+leaf_node * find_next_key(multimap *mm, int key, int *slot);
+
+void * insert_key(multimap *mm, void *node, int level, int key,
+                  leaf_node **leaf, int *index, int *split_key);
+leaf_node * insert_into_leaf(multimap *mm, leaf_node *node, int key,
+                             leaf_node **leaf, int *index);
+inner_node * insert_into_inner(multimap *mm, inner_node *node, int pos,
+                               int key, void *child, int *split_key);
+
+int build_leaves(multimap *mm, const int *keys, const int *values, int n,
+                 void **nodes, int *min_keys);
+int build_inner_level(multimap *mm, void **nodes, int *min_keys,
+                      int num_nodes);
+int share_of(int total, int num_parts, int part);
+
+void prefetch_node(const void *node);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Allocates a node on a cache-line boundary from the multimap's arena, and
+ * zeros out its contents so that we know what the initial value of everything
+ * will be.
+ */
+void * alloc_node(multimap *mm) {
+    void *node = arena_alloc(&mm->arena, NODE_SIZE, CACHE_LINE_SIZE);
+    bzero(node, NODE_SIZE);
+
+    return node;
+}
+
+
+/* Returns the number of keys in a node that are less than the specified key.
+ * The loop has no branches that depend on the keys, so the compiler can turn
+ * it into SIMD compares.
+ */
+int count_keys_less(const int *keys, int num_keys, int key) {
+    int i, count = 0;
+
+    for (i = 0; i < num_keys; i++)
+        count += (keys[i] < key);
+
+    return count;
+}
+
+
+/* Returns the number of keys in a node that are less than or equal to the
+ * specified key, which is the index of the child to descend into.
+ */
+int count_keys_less_equal(const int *keys, int num_keys, int key) {
+    int i, count = 0;
+
+    for (i = 0; i < num_keys; i++)
+        count += (keys[i] <= key);
+
+    return count;
+}
+
+
+/* Returns the leaf that the specified key is in, or would be added to. */
+leaf_node * find_leaf(multimap *mm, int key) {
+    void *node = mm->root;
+    int level;
+
+    for (level = mm->height; level > 1; level--) {
+        inner_node *inner = node;
+        node = inner->children[count_keys_less_equal(inner->keys,
+                                                     inner->num_keys, key)];
+    }
+
+    return node;
+}
+
+
+/* Returns the index of the specified key in a leaf, or -1 if it isn't there. */
+int find_in_leaf(leaf_node *leaf, int key) {
+    int pos = count_keys_less(leaf->keys, leaf->num_keys, key);
+
+    if (pos < leaf->num_keys && leaf->keys[pos] == key)
+        return pos;
+
+    return -1;
+}
+
+
+/* Returns the leaf holding the smallest key that is at least the specified
+ * key, and stores the index of that key in the leaf into *slot.  NULL is
+ * returned if every key is smaller.
+ */
+leaf_node * find_next_key(multimap *mm, int key, int *slot) {
+    leaf_node *leaf = find_leaf(mm, key);
+    int pos = 0;
+
+    if (leaf != NULL)
+        pos = count_keys_less(leaf->keys, leaf->num_keys, key);
+
+    /* If every key in the leaf is smaller, the next key starts the next
+     * leaf.
+     */
+    while (leaf != NULL && pos >= leaf->num_keys) {
+        leaf = leaf->next;
+        pos = 0;
+    }
+
+    *slot = pos;
+    return leaf;
+}
+
+
+/* Adds a key to the subtree rooted at node, which is at the specified level
+ * (leaves are level 1), if it isn't there already.  The leaf and index that
+ * the key ends up at are stored into *leaf and *index.  If the node had to
+ * be split, the new right half of the node is returned and the smallest key
+ * in it is stored into *split_key; otherwise NULL is returned.
+ */
+void * insert_key(multimap *mm, void *node, int level, int key,
+                  leaf_node **leaf, int *index, int *split_key) {
+    inner_node *inner;
+    void *new_child;
+    int pos;
+
+    if (level == 1) {
+        new_child = insert_into_leaf(mm, node, key, leaf, index);
+        if (new_child != NULL)
+            *split_key = ((leaf_node *) new_child)->keys[0];
+        return new_child;
+    }
+
+    inner = node;
+    pos = count_keys_less_equal(inner->keys, inner->num_keys, key);
+
+    new_child = insert_key(mm, inner->children[pos], level - 1, key, leaf,
+                           index, split_key);
+    if (new_child == NULL)
+        return NULL;
+
+    /* The child split, so its new sibling needs to go in this node. */
+    return insert_into_inner(mm, inner, pos, *split_key, new_child,
+                             split_key);
+}
+
+
+/* Adds a key to a leaf if it isn't there already, splitting the leaf in half
+ * if it is full.  Returns the new right half if the leaf was split, or NULL.
+ */
+leaf_node * insert_into_leaf(multimap *mm, leaf_node *node, int key,
+                             leaf_node **leaf, int *index) {
+    leaf_node *new = NULL;
+    int pos, half;
+
+    pos = count_keys_less(node->keys, node->num_keys, key);
+    if (pos < node->num_keys && node->keys[pos] == key) {
+        *leaf = node;
+        *index = pos;
+        return NULL;
+    }
+
+    if (node->num_keys == LEAF_KEYS) {
+        /* Move the upper half of the keys into a new leaf. */
+        new = alloc_node(mm);
+        half = LEAF_KEYS / 2;
+        new->num_keys = LEAF_KEYS - half;
+        memcpy(new->keys, node->keys + half, new->num_keys * sizeof(int));
+        memcpy(new->values, node->values + half,
+               new->num_keys * sizeof(value_list));
+        node->num_keys = half;
+
+        new->next = node->next;
+        node->next = new;
+
+        if (pos > half) {
+            node = new;
+            pos -= half;
+        }
+    }
+
+    memmove(node->keys + pos + 1, node->keys + pos,
+            (node->num_keys - pos) * sizeof(int));
+    memmove(node->values + pos + 1, node->values + pos,
+            (node->num_keys - pos) * sizeof(value_list));
+
+    node->keys[pos] = key;
+    bzero(&node->values[pos], sizeof(value_list));
+    node->num_keys++;
+
+    *leaf = node;
+    *index = pos;
+    return new;
+}
+
+
+/* Adds a key and the child to its right to an inner node, at position pos.
+ * If the node is full it is split in half, the middle key moves up to the
+ * parent via *split_key, and the new right half is returned; otherwise NULL
+ * is returned.
+ */
+inner_node * insert_into_inner(multimap *mm, inner_node *node, int pos,
+                               int key, void *child, int *split_key) {
+    int keys[INNER_KEYS + 1];
+    void *children[INNER_KEYS + 2];
+    inner_node *new;
+    int n = node->num_keys, half;
+
+    if (n < INNER_KEYS) {
+        memmove(node->keys + pos + 1, node->keys + pos,
+                (n - pos) * sizeof(int));
+        memmove(node->children + pos + 2, node->children + pos + 1,
+                (n - pos) * sizeof(void *));
+        node->keys[pos] = key;
+        node->children[pos + 1] = child;
+        node->num_keys++;
+        return NULL;
+    }
+
+    /* Lay out all the keys and children in order, then deal them out to the
+     * two halves, with the middle key going up to the parent.
+     */
+    memcpy(keys, node->keys, pos * sizeof(int));
+    keys[pos] = key;
+    memcpy(keys + pos + 1, node->keys + pos, (n - pos) * sizeof(int));
+
+    memcpy(children, node->children, (pos + 1) * sizeof(void *));
+    children[pos + 1] = child;
+    memcpy(children + pos + 2, node->children + pos + 1,
+           (n - pos) * sizeof(void *));
+
+    half = (INNER_KEYS + 1) / 2;
+    new = alloc_node(mm);
+
+    node->num_keys = half;
+    memcpy(node->keys, keys, half * sizeof(int));
+    memcpy(node->children, children, (half + 1) * sizeof(void *));
+
+    *split_key = keys[half];
+
+    new->num_keys = INNER_KEYS - half;
+    memcpy(new->keys, keys + half + 1, new->num_keys * sizeof(int));
+    memcpy(new->children, children + half + 1,
+           (new->num_keys + 1) * sizeof(void *));
+
+    return new;
+}
+
+
+/* Returns the index of the first item of the specified part, when total items
+ * are divided as evenly as possible into num_parts parts.  Part num_parts
+ * "starts" at total.
+ */
+int share_of(int total, int num_parts, int part) {
+    return (int) ((long long) total * part / num_parts);
+}
+
+
+/* Puts n pairs, sorted by key, into new leaves, which are linked together
+ * in order.  The leaves are filled as evenly as possible, and each is as
+ * full as it can be.  The leaves, and the smallest key in each, are stored
+ * into nodes[] and min_keys[], and the number of leaves is returned.
+ */
+int build_leaves(multimap *mm, const int *keys, const int *values, int n,
+                 void **nodes, int *min_keys) {
+    leaf_node *leaf = NULL, *new_leaf;
+    int i, num_keys, num_leaves, key_index, leaf_index, leaf_end;
+
+    num_keys = 0;
+    for (i = 0; i < n; i++) {
+        if (i == 0 || keys[i] != keys[i - 1])
+            num_keys++;
+    }
+    num_leaves = (num_keys + LEAF_KEYS - 1) / LEAF_KEYS;
+
+    key_index = -1;
+    leaf_index = -1;
+    leaf_end = 0;
+    for (i = 0; i < n; i++) {
+        if (i == 0 || keys[i] != keys[i - 1]) {
+            assert(i == 0 || keys[i] > keys[i - 1]);
+
+            key_index++;
+            if (key_index == leaf_end) {
+                /* The current leaf has its share of the keys. */
+                leaf_index++;
+                leaf_end = share_of(num_keys, num_leaves, leaf_index + 1);
+
+                new_leaf = alloc_node(mm);
+                if (leaf != NULL)
+                    leaf->next = new_leaf;
+                else
+                    mm->first_leaf = new_leaf;
+                leaf = new_leaf;
+
+                nodes[leaf_index] = leaf;
+                min_keys[leaf_index] = keys[i];
+            }
+
+            leaf->keys[leaf->num_keys] = keys[i];
+            leaf->num_keys++;
+        }
+
+        add_value_to_value_list(&leaf->values[leaf->num_keys - 1], values[i],
+                                &mm->arena);
+    }
+
+    assert(leaf_index == num_leaves - 1);
+    return num_leaves;
+}
+
+
+/* Builds the level of inner nodes above num_nodes nodes, which are stored
+ * in nodes[] with the smallest key under each in min_keys[].  The children
+ * are divided among the new nodes as evenly as possible.  The new nodes and
+ * their smallest keys replace the old ones at the start of the arrays, and
+ * the number of new nodes is returned.
+ */
+int build_inner_level(multimap *mm, void **nodes, int *min_keys,
+                      int num_nodes) {
+    inner_node *inner;
+    int num_parents, parent, first, last, i;
+
+    num_parents = (num_nodes + INNER_KEYS) / (INNER_KEYS + 1);
+
+    for (parent = 0; parent < num_parents; parent++) {
+        first = share_of(num_nodes, num_parents, parent);
+        last = share_of(num_nodes, num_parents, parent + 1);
+
+        inner = alloc_node(mm);
+        inner->num_keys = last - first - 1;
+        for (i = first; i < last; i++) {
+            inner->children[i - first] = nodes[i];
+            if (i > first)
+                inner->keys[i - first - 1] = min_keys[i];
+        }
+
+        /* parent <= first, so this doesn't overwrite nodes still needed. */
+        nodes[parent] = inner;
+        min_keys[parent] = min_keys[first];
+    }
+
+    return num_parents;
+}
+
+
+/* Starts loading all the cache lines of a node into the cache. */
+void prefetch_node(const void *node) {
+    int i;
+
+    for (i = 0; i < NODE_LINES; i++)
+        __builtin_prefetch((const char *) node + i * CACHE_LINE_SIZE);
+}
+
+
+/* Initialize a multimap data structure. */
+multimap * init_multimap() {
+    multimap *mm = malloc(sizeof(multimap));
+    mm->root = NULL;
+    mm->height = 0;
+    mm->first_leaf = NULL;
+    mm->frozen = NULL;
+    bzero(&mm->arena, sizeof(mm_arena));
+    return mm;
+}
+
+
+/* Release all dynamically allocated memory associated with the multimap
+ * data structure.
+ */
+void clear_multimap(multimap *mm) {
+    assert(mm != NULL);
+
+    clear_arena(&mm->arena);
+
+    mm->root = NULL;
+    mm->height = 0;
+    mm->first_leaf = NULL;
+    mm->frozen = NULL;
+}
+
+
+/* Adds the specified (key, value) pair to the multimap. */
+void mm_add_value(multimap *mm, int key, int value) {
+    leaf_node *leaf;
+    inner_node *new_root;
+    void *new_child;
+    int index, split_key;
+
+    assert(mm != NULL);
+
+    if (mm->frozen != NULL)
+        rebuild_multimap(mm, NULL, NULL);
+
+    if (mm->root == NULL) {
+        mm->root = mm->first_leaf = alloc_node(mm);
+        mm->height = 1;
+    }
+
+    /* Find the key's entry, adding it if it's new.  If the root splits then
+     * the tree grows a level.
+     */
+    new_child = insert_key(mm, mm->root, mm->height, key, &leaf, &index,
+                           &split_key);
+    if (new_child != NULL) {
+        new_root = alloc_node(mm);
+        new_root->num_keys = 1;
+        new_root->keys[0] = split_key;
+        new_root->children[0] = mm->root;
+        new_root->children[1] = new_child;
+
+        mm->root = new_root;
+        mm->height++;
+    }
+
+    assert(leaf->keys[index] == key);
+
+    /* Add the new value to the key's list of values. */
+    add_value_to_value_list(&leaf->values[index], value, &mm->arena);
+}
+
+
+/* Adds n (key, value) pairs to the multimap, where keys[i] goes with
+ * values[i].  The pairs are sorted by key, so that an empty multimap can be
+ * built from the bottom up.
+ */
+void mm_add_values(multimap *mm, const int *keys, const int *values, int n) {
+    int *sorted_keys, *sorted_values;
+
+    if (n <= 0)
+        return;
+
+    sorted_keys = alloc_or_abort(n * sizeof(int));
+    sorted_values = alloc_or_abort(n * sizeof(int));
+    memcpy(sorted_keys, keys, n * sizeof(int));
+    memcpy(sorted_values, values, n * sizeof(int));
+
+    sort_pairs(sorted_keys, sorted_values, n);
+    mm_build_from_sorted(mm, sorted_keys, sorted_values, n);
+
+    free(sorted_keys);
+    free(sorted_values);
+}
+
+
+/* Like mm_add_values(), but the keys must be in nondecreasing order.  If the
+ * multimap is empty, the tree is built from the bottom up:  the keys are put
+ * into leaves in order, then each level of inner nodes is built over the
+ * level below, until there is only one node left to be the root.  Otherwise
+ * the pairs are just added one at a time; in sorted order, each search
+ * follows much the same path as the one before, so that is still faster than
+ * adding them in random order.
+ */
+void mm_build_from_sorted(multimap *mm, const int *keys, const int *values,
+                          int n) {
+    void **nodes;
+    int *min_keys;
+    int i, num_nodes;
+
+    assert(mm != NULL);
+
+    if (mm->frozen != NULL && n > 0)
+        rebuild_multimap(mm, NULL, NULL);
+
+    if (mm->root != NULL) {
+        for (i = 0; i < n; i++)
+            mm_add_value(mm, keys[i], values[i]);
+        return;
+    }
+
+    if (n <= 0)
+        return;
+
+    /* There can't be more leaves than pairs. */
+    nodes = alloc_or_abort(n * sizeof(void *));
+    min_keys = alloc_or_abort(n * sizeof(int));
+
+    num_nodes = build_leaves(mm, keys, values, n, nodes, min_keys);
+    mm->height = 1;
+
+    while (num_nodes > 1) {
+        num_nodes = build_inner_level(mm, nodes, min_keys, num_nodes);
+        mm->height++;
+    }
+
+    mm->root = nodes[0];
+
+    free(nodes);
+    free(min_keys);
+}
+
+
+/* Returns nonzero if the multimap contains the specified key-value, zero
+ * otherwise.
+ */
+int mm_contains_key(multimap *mm, int key) {
+    if (mm->frozen != NULL)
+        return frozen_contains_key(mm->frozen, key);
+
+    if (mm->root == NULL)
+        return 0;
+
+    return find_in_leaf(find_leaf(mm, key), key) != -1;
+}
+
+
+/* Returns nonzero if the multimap contains the specified (key, value) pair,
+ * zero otherwise.
+ */
+int mm_contains_pair(multimap *mm, int key, int value) {
+    leaf_node *leaf;
+    int index;
+
+    if (mm->frozen != NULL)
+        return frozen_contains_pair(mm->frozen, key, value);
+
+    if (mm->root == NULL)
+        return 0;
+
+    leaf = find_leaf(mm, key);
+    index = find_in_leaf(leaf, key);
+    if (index == -1)
+        return 0;
+
+    return value_list_contains_value(&leaf->values[index], value);
+}
+
+
+/* Probes the multimap for n (key, value) pairs at once.  Following a probe
+ * down the tree is a chain of cache misses, each of which has to finish
+ * before the next node is known, so instead the probes are run in groups.
+ * Every leaf is at the same depth, so the probes of a group can move down
+ * the tree in lockstep:  each round moves every probe down one level, and
+ * starts loading its next node into the cache.  The loads of the whole group
+ * then overlap, and by the next round the nodes are (hopefully) in the cache.
+ */
+void mm_contains_pairs(multimap *mm, const int *keys, const int *values,
+                       int *results, int n) {
+    void *nodes[PROBE_GROUP_SIZE];
+    int indexes[PROBE_GROUP_SIZE];
+    inner_node *inner;
+    leaf_node *leaf;
+    int start, size, level, pos, i;
+
+    if (mm->frozen != NULL) {
+        frozen_contains_pairs(mm->frozen, keys, values, results, n);
+        return;
+    }
+
+    if (mm->root == NULL) {
+        for (i = 0; i < n; i++)
+            results[i] = 0;
+        return;
+    }
+
+    for (start = 0; start < n; start += PROBE_GROUP_SIZE) {
+        size = n - start;
+        if (size > PROBE_GROUP_SIZE)
+            size = PROBE_GROUP_SIZE;
+
+        for (i = 0; i < size; i++)
+            nodes[i] = mm->root;
+
+        for (level = mm->height; level > 1; level--) {
+            for (i = 0; i < size; i++) {
+                inner = nodes[i];
+                pos = count_keys_less_equal(inner->keys, inner->num_keys,
+                                            keys[start + i]);
+                nodes[i] = inner->children[pos];
+                prefetch_node(nodes[i]);
+            }
+        }
+
+        for (i = 0; i < size; i++) {
+            leaf = nodes[i];
+            indexes[i] = find_in_leaf(leaf, keys[start + i]);
+            if (indexes[i] != -1)
+                prefetch_value_list(&leaf->values[indexes[i]]);
+        }
+
+        for (i = 0; i < size; i++) {
+            leaf = nodes[i];
+            results[start + i] = indexes[i] != -1 &&
+                value_list_contains_value(&leaf->values[indexes[i]],
+                                          values[start + i]);
+        }
+    }
+}
+
+
+/* Performs an in-order traversal of the multimap, passing each (key, value)
+ * pair to the specified function.  The leaves are linked in key order, so
+ * this doesn't need to recurse through the tree.
+ */
+void mm_traverse(multimap *mm, void (*f)(int key, int value)) {
+    leaf_node *leaf;
+    int i;
+
+    if (mm->frozen != NULL) {
+        frozen_range(mm->frozen, /* all_keys */ 1, 0, 0, f);
+        return;
+    }
+
+    for (leaf = mm->first_leaf; leaf != NULL; leaf = leaf->next) {
+        for (i = 0; i < leaf->num_keys; i++)
+            value_list_traverse(&leaf->values[i], leaf->keys[i], f);
+    }
+}
+
+
+/* Passes each (key, value) pair of the multimap with lo <= key < hi to the
+ * specified function, in key order.  This finds the first key in the range,
+ * and then walks along the leaves.
+ */
+void mm_range(multimap *mm, int lo, int hi, void (*f)(int key, int value)) {
+    leaf_node *leaf;
+    int i;
+
+    if (mm->frozen != NULL) {
+        frozen_range(mm->frozen, /* all_keys */ 0, lo, hi, f);
+        return;
+    }
+
+    leaf = find_next_key(mm, lo, &i);
+    while (leaf != NULL) {
+        for (; i < leaf->num_keys; i++) {
+            if (leaf->keys[i] >= hi)
+                return;
+
+            value_list_traverse(&leaf->values[i], leaf->keys[i], f);
+        }
+
+        leaf = leaf->next;
+        i = 0;
+    }
+}
+
+
+/* Starts a cursor at the first pair of the multimap whose key is at least the
+ * specified key.
+ */
+void mm_iter_seek(multimap *mm, mm_iter *iter, int key) {
+    leaf_node *leaf;
+    int slot;
+
+    bzero(iter, sizeof(mm_iter));
+    iter->mm = mm;
+
+    if (mm->frozen != NULL) {
+        frozen_iter_seek(mm->frozen, iter, key);
+        return;
+    }
+
+    leaf = find_next_key(mm, key, &slot);
+    if (leaf != NULL) {
+        iter->node = leaf;
+        iter->slot = slot;
+        iter->key = leaf->keys[slot];
+        iter->values = leaf->values[slot].first;
+    }
+}
+
+
+/* Stores the pair at a cursor into *key and *value, and moves the cursor to
+ * the next pair.  The cursor holds the leaf and slot of the current key, the
+ * chunk of its next value, and the index of the value within the chunk.
+ */
+int mm_iter_next(mm_iter *iter, int *key, int *value) {
+    leaf_node *leaf = iter->node;
+    const value_chunk *chunk = iter->values;
+    int slot = iter->slot, index = iter->index;
+
+    if (iter->mm->frozen != NULL)
+        return frozen_iter_next(iter, key, value);
+
+    if (leaf == NULL)
+        return 0;
+
+    while (chunk == NULL || index >= chunk->size) {
+        if (chunk != NULL) {
+            chunk = chunk->next;
+        }
+        else {
+            /* The current key has no more values; move on to the next. */
+            slot++;
+            while (slot >= leaf->num_keys) {
+                leaf = leaf->next;
+                slot = 0;
+                if (leaf == NULL) {
+                    iter->node = NULL;
+                    iter->values = NULL;
+                    return 0;
+                }
+            }
+            chunk = leaf->values[slot].first;
+        }
+        index = 0;
+    }
+
+    iter->node = leaf;
+    iter->slot = slot;
+    iter->key = leaf->keys[slot];
+    iter->values = chunk;
+    iter->index = index + 1;
+
+    *key = leaf->keys[slot];
+    *value = chunk->values[index];
+    return 1;
+}
+
+
+/* Freezes the multimap, replacing the tree with the arrays of mm_frozen.c. */
+void mm_freeze(multimap *mm) {
+    assert(mm != NULL);
+
+    if (mm->frozen == NULL)
+        rebuild_multimap(mm, &mm->frozen, &mm->arena);
+}
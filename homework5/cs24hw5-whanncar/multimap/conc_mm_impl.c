@@ -0,0 +1,650 @@
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "multimap.h"
+#include "mm_util.h"
+
+
+/*============================================================================
+ * TYPES
+ *
+ *   These types are defined in the implementation file so that they can
+ *   be kept hidden to code outside this source file.  This is not for any
+ *   security reason, but rather just so we can enforce that our testing
+ *   programs are generic and don't have any access to implementation details.
+ *
+ *   This multimap can be used by many threads at once.  The keys are divided
+ *   among a number of shards by a hash of the key, and each shard is a
+ *   separate multimap with its own reader-writer lock.  Any number of threads
+ *   can probe a shard at once, and a thread adding to a shard only holds up
+ *   the threads using that shard.
+ *
+ *   The shards use one of the other implementations (see SHARD_IMPL in the
+ *   Makefile), compiled with its names changed from multimap, init_multimap
+ *   and so on to shard_multimap, shard_init_multimap, etc., so that it can be
+ *   linked into the same program as this file.
+ *
+ *   A cursor walks through one shard at a time, taking the shard's lock only
+ *   while it moves, so threads may add pairs while other threads are using
+ *   cursors.  Each shard counts the changes made to it, and a cursor that
+ *   finds its shard has changed since it last moved finds its place again by
+ *   key.  Moving from one key to the next has to look for the next key in
+ *   every shard, so mm_range() is much faster than a cursor for big ranges.
+ *============================================================================*/
+
+/* The number of shards, which must be a power of two.  The more shards there
+ * are, the less likely it is that two threads want the same one.
+ */
+#define SHARD_BITS 6
+#define NUM_SHARDS (1 << SHARD_BITS)
+
+/* The size of a cache line.  Each shard gets cache lines of its own, so that
+ * threads using different shards don't slow each other down by writing to
+ * the same cache line when they take the locks.
+ */
+#define CACHE_LINE_SIZE 64
+
+
+/* The multimap that each shard uses. */
+typedef struct shard_multimap shard_multimap;
+
+
+/* One shard of the multimap:  the multimap holding the keys that hash to
+ * this shard, and the lock protecting it.  The shard's multimap is only made
+ * when a pair is first added to the shard, and is freed again when the
+ * multimap is cleared, so until then it is NULL.
+ */
+typedef struct mm_shard {
+    pthread_rwlock_t lock;
+    shard_multimap *mm;
+
+    /* The number of times the shard has been changed, so that cursors can
+     * tell whether the position they saved in the shard is still good.
+     */
+    unsigned int version;
+} __attribute__((aligned(CACHE_LINE_SIZE))) mm_shard;
+
+
+/* The entry-point of the multimap data structure. */
+struct multimap {
+    mm_shard shards[NUM_SHARDS];
+};
+
+
+/* The pairs collected from the shards by mm_traverse() and mm_range(). */
+typedef struct pair_buffer {
+    int *keys;
+    int *values;
+    int size;
+    int capacity;
+} pair_buffer;
+
+
+/*============================================================================
+ * SHARD MULTIMAP FUNCTIONS
+ *
+ *   The multimap API of the implementation that the shards use, under the
+ *   names it is compiled with.
+ *============================================================================*/
+
+shard_multimap * shard_init_multimap();
+void shard_clear_multimap(shard_multimap *mm);
+void shard_mm_add_value(shard_multimap *mm, int key, int value);
+void shard_mm_add_values(shard_multimap *mm, const int *keys,
+                         const int *values, int n);
+void shard_mm_build_from_sorted(shard_multimap *mm, const int *keys,
+                                const int *values, int n);
+void shard_mm_freeze(shard_multimap *mm);
+int shard_mm_contains_key(shard_multimap *mm, int key);
+int shard_mm_contains_pair(shard_multimap *mm, int key, int value);
+void shard_mm_contains_pairs(shard_multimap *mm, const int *keys,
+                             const int *values, int *results, int n);
+void shard_mm_traverse(shard_multimap *mm, void (*f)(int key, int value));
+void shard_mm_range(shard_multimap *mm, int lo, int hi,
+                    void (*f)(int key, int value));
+
+/* The shard implementation is compiled from the same header as this file, so
+ * its cursors are laid out just like ours, except that the mm member points
+ * to a shard_multimap.
+ */
+void shard_mm_iter_seek(shard_multimap *mm, mm_iter *iter, int key);
+int shard_mm_iter_next(mm_iter *iter, int *key, int *value);
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *
+ *   Declarations of helper functions that are local to this module.  Again,
+ *   these are not visible outside of this module.
+ *============================================================================*/
+
+int shard_of_key(int key);
+shard_multimap * writable_shard(mm_shard *shard);
+int * partition_by_shard(const int *keys, const int *values, int n,
+                         int *part_keys, int *part_values, int *order);
+void add_partitioned_values(multimap *mm, const int *keys,
+                            const int *values, int n, int sorted);
+void collect_pair(int key, int value);
+void collect_shard_pairs(multimap *mm, int all_keys, int lo, int hi,
+                         pair_buffer *buf, int *starts);
+void merge_shard_pairs(const pair_buffer *buf, const int *starts,
+                       void (*f)(int key, int value));
+int seek_next_key(multimap *mm, mm_iter *iter, int key);
+int next_value_in_shard(mm_shard *shard, mm_iter *iter, int *value);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* The buffer that collect_pair() adds pairs to.  Each thread has its own,
+ * so that threads can traverse the multimap at the same time.
+ */
+static __thread pair_buffer *collected_pairs;
+
+
+/* Returns the shard that a key belongs to.  The key is hashed first, so that
+ * keys that are close together are spread over all the shards.
+ */
+int shard_of_key(int key) {
+    return ((unsigned int) key * 2654435761u) >> (32 - SHARD_BITS);
+}
+
+
+/* Returns the multimap of a shard so that it can be changed, making it if
+ * the shard doesn't have one yet, and counts the change.  The caller must
+ * hold the shard's lock for writing.
+ */
+shard_multimap * writable_shard(mm_shard *shard) {
+    if (shard->mm == NULL)
+        shard->mm = shard_init_multimap();
+
+    shard->version++;
+
+    return shard->mm;
+}
+
+
+/* Copies n pairs into part_keys[] and part_values[], grouped by shard, and
+ * stores into order[] the position each pair was copied to.  The pairs of a
+ * shard stay in the same order.  Returns a newly allocated array of
+ * NUM_SHARDS + 1 positions, where the pairs of shard s are at positions
+ * starts[s] up to starts[s + 1].
+ */
+int * partition_by_shard(const int *keys, const int *values, int n,
+                         int *part_keys, int *part_values, int *order) {
+    int *starts = alloc_or_abort((NUM_SHARDS + 1) * sizeof(int));
+    int next[NUM_SHARDS];
+    int i, s;
+
+    bzero(starts, (NUM_SHARDS + 1) * sizeof(int));
+    for (i = 0; i < n; i++) {
+        order[i] = shard_of_key(keys[i]);
+        starts[order[i] + 1]++;
+    }
+
+    for (s = 0; s < NUM_SHARDS; s++) {
+        starts[s + 1] += starts[s];
+        next[s] = starts[s];
+    }
+
+    for (i = 0; i < n; i++) {
+        s = order[i];
+        order[i] = next[s]++;
+        part_keys[order[i]] = keys[i];
+        part_values[order[i]] = values[i];
+    }
+
+    return starts;
+}
+
+
+/* Adds n pairs to the multimap, one shard at a time.  If sorted is nonzero,
+ * the keys are in nondecreasing order, and so are the keys of each shard.
+ */
+void add_partitioned_values(multimap *mm, const int *keys,
+                            const int *values, int n, int sorted) {
+    int *part_keys, *part_values, *order, *starts;
+    mm_shard *shard;
+    int s, first, num;
+
+    if (n <= 0)
+        return;
+
+    part_keys = alloc_or_abort(n * sizeof(int));
+    part_values = alloc_or_abort(n * sizeof(int));
+    order = alloc_or_abort(n * sizeof(int));
+    starts = partition_by_shard(keys, values, n, part_keys, part_values,
+                                order);
+
+    for (s = 0; s < NUM_SHARDS; s++) {
+        first = starts[s];
+        num = starts[s + 1] - first;
+        if (num == 0)
+            continue;
+
+        shard = &mm->shards[s];
+        pthread_rwlock_wrlock(&shard->lock);
+        if (sorted) {
+            shard_mm_build_from_sorted(writable_shard(shard), part_keys + first,
+                                       part_values + first, num);
+        }
+        else {
+            shard_mm_add_values(writable_shard(shard), part_keys + first,
+                                part_values + first, num);
+        }
+        pthread_rwlock_unlock(&shard->lock);
+    }
+
+    free(part_keys);
+    free(part_values);
+    free(order);
+    free(starts);
+}
+
+
+/* Adds a pair to the calling thread's collected_pairs buffer. */
+void collect_pair(int key, int value) {
+    pair_buffer *buf = collected_pairs;
+
+    if (buf->size == buf->capacity) {
+        buf->capacity = (buf->capacity == 0) ? 1024 : 2 * buf->capacity;
+        buf->keys = realloc_or_abort(buf->keys,
+                                     buf->capacity * sizeof(int));
+        buf->values = realloc_or_abort(buf->values,
+                                       buf->capacity * sizeof(int));
+    }
+
+    buf->keys[buf->size] = key;
+    buf->values[buf->size] = value;
+    buf->size++;
+}
+
+
+/* Copies pairs out of every shard into a buffer:  all of them if all_keys is
+ * nonzero, and otherwise the ones with lo <= key < hi.  The pairs of shard s
+ * end up at positions starts[s] up to starts[s + 1] of the buffer, in key
+ * order.  All the shards are locked while their pairs are copied, so the
+ * pairs are from one moment.
+ */
+void collect_shard_pairs(multimap *mm, int all_keys, int lo, int hi,
+                         pair_buffer *buf, int *starts) {
+    shard_multimap *shard_mm;
+    int s;
+
+    collected_pairs = buf;
+
+    for (s = 0; s < NUM_SHARDS; s++)
+        pthread_rwlock_rdlock(&mm->shards[s].lock);
+
+    for (s = 0; s < NUM_SHARDS; s++) {
+        starts[s] = buf->size;
+        shard_mm = mm->shards[s].mm;
+        if (shard_mm != NULL && all_keys)
+            shard_mm_traverse(shard_mm, collect_pair);
+        else if (shard_mm != NULL)
+            shard_mm_range(shard_mm, lo, hi, collect_pair);
+    }
+    starts[NUM_SHARDS] = buf->size;
+
+    for (s = NUM_SHARDS - 1; s >= 0; s--)
+        pthread_rwlock_unlock(&mm->shards[s].lock);
+
+    collected_pairs = NULL;
+}
+
+
+/* Passes the pairs collected by collect_shard_pairs() to the specified
+ * function in key order.  All the values of a key are in the same shard, so
+ * merging the shards by key keeps each key's values in order.
+ */
+void merge_shard_pairs(const pair_buffer *buf, const int *starts,
+                       void (*f)(int key, int value)) {
+    int next[NUM_SHARDS];
+    int s, best, key, i;
+
+    for (s = 0; s < NUM_SHARDS; s++)
+        next[s] = starts[s];
+
+    while (1) {
+        /* Find the shard with the smallest key that hasn't been passed to
+         * f yet, and pass all of that key's pairs to f.
+         */
+        best = -1;
+        for (s = 0; s < NUM_SHARDS; s++) {
+            if (next[s] < starts[s + 1] &&
+                (best == -1 || buf->keys[next[s]] < buf->keys[next[best]])) {
+                best = s;
+            }
+        }
+        if (best == -1)
+            break;
+
+        key = buf->keys[next[best]];
+        for (i = next[best]; i < starts[best + 1] && buf->keys[i] == key; i++)
+            f(key, buf->values[i]);
+        next[best] = i;
+    }
+}
+
+
+/* Starts a cursor at the smallest key that is at least the specified key,
+ * looking in every shard, and returns nonzero.  If there is no such key, the
+ * cursor is left past the end and zero is returned.
+ */
+int seek_next_key(multimap *mm, mm_iter *iter, int key) {
+    mm_iter cursor, peek;
+    mm_shard *shard;
+    int s, next_key, value, found = 0;
+
+    for (s = 0; s < NUM_SHARDS; s++) {
+        shard = &mm->shards[s];
+        pthread_rwlock_rdlock(&shard->lock);
+        if (shard->mm != NULL) {
+            shard_mm_iter_seek(shard->mm, &cursor, key);
+
+            /* Look at the shard's first key without moving the cursor. */
+            peek = cursor;
+            if (shard_mm_iter_next(&peek, &next_key, &value) &&
+                (!found || next_key < iter->key)) {
+                *iter = cursor;
+                iter->key = next_key;
+                iter->part = s;
+                iter->version = shard->version;
+                found = 1;
+            }
+        }
+        pthread_rwlock_unlock(&shard->lock);
+    }
+
+    iter->mm = mm;
+    iter->count = 0;
+    if (!found)
+        iter->part = -1;
+
+    return found;
+}
+
+
+/* Moves a cursor to the next value of its current key within its shard,
+ * storing the value into *value and returning nonzero, or returns zero if
+ * the key has no more values.  The caller must hold the shard's lock.
+ */
+int next_value_in_shard(mm_shard *shard, mm_iter *iter, int *value) {
+    mm_iter cursor;
+    int key, i;
+
+    if (shard->mm == NULL)
+        return 0;
+
+    if (iter->version == shard->version) {
+        cursor = *iter;
+        cursor.mm = (multimap *) shard->mm;
+    }
+    else {
+        /* The shard has changed since the cursor last moved, so find the
+         * key again and skip the values that have already been returned.
+         * Values are only ever added after a key's other values, so these
+         * are the same values as before.
+         */
+        shard_mm_iter_seek(shard->mm, &cursor, iter->key);
+        for (i = 0; i < iter->count; i++) {
+            if (!shard_mm_iter_next(&cursor, &key, value) || key != iter->key)
+                return 0;
+        }
+    }
+
+    if (!shard_mm_iter_next(&cursor, &key, value) || key != iter->key)
+        return 0;
+
+    iter->node = cursor.node;
+    iter->slot = cursor.slot;
+    iter->values = cursor.values;
+    iter->index = cursor.index;
+    iter->version = shard->version;
+    iter->count++;
+
+    return 1;
+}
+
+
+/* Initialize a multimap data structure. */
+multimap * init_multimap() {
+    multimap *mm;
+    int s;
+
+    if (posix_memalign((void **) &mm, CACHE_LINE_SIZE, sizeof(multimap)) != 0)
+        return NULL;
+
+    for (s = 0; s < NUM_SHARDS; s++) {
+        pthread_rwlock_init(&mm->shards[s].lock, NULL);
+        mm->shards[s].mm = NULL;
+        mm->shards[s].version = 0;
+    }
+
+    return mm;
+}
+
+
+/* Release all dynamically allocated memory associated with the multimap
+ * data structure.  The shards' locks are destroyed as well, so after this the
+ * multimap can only be freed; no other thread may still be using it.
+ */
+void clear_multimap(multimap *mm) {
+    mm_shard *shard;
+    int s;
+
+    assert(mm != NULL);
+
+    for (s = 0; s < NUM_SHARDS; s++) {
+        shard = &mm->shards[s];
+        if (shard->mm != NULL) {
+            shard_clear_multimap(shard->mm);
+            free(shard->mm);
+            shard->mm = NULL;
+        }
+        pthread_rwlock_destroy(&shard->lock);
+    }
+}
+
+
+/* Adds the specified (key, value) pair to the multimap. */
+void mm_add_value(multimap *mm, int key, int value) {
+    mm_shard *shard = &mm->shards[shard_of_key(key)];
+
+    pthread_rwlock_wrlock(&shard->lock);
+    shard_mm_add_value(writable_shard(shard), key, value);
+    pthread_rwlock_unlock(&shard->lock);
+}
+
+
+/* Adds n (key, value) pairs to the multimap, where keys[i] goes with
+ * values[i].  The pairs are divided up by shard, and each shard's pairs are
+ * added with one call while holding its lock once.
+ */
+void mm_add_values(multimap *mm, const int *keys, const int *values, int n) {
+    add_partitioned_values(mm, keys, values, n, /* sorted */ 0);
+}
+
+
+/* Like mm_add_values(), but the keys must be in nondecreasing order. */
+void mm_build_from_sorted(multimap *mm, const int *keys, const int *values,
+                          int n) {
+    add_partitioned_values(mm, keys, values, n, /* sorted */ 1);
+}
+
+
+/* Freezes each shard in turn.  A shard is locked for writing only while it
+ * is being frozen, so the other shards can still be used meanwhile.
+ */
+void mm_freeze(multimap *mm) {
+    mm_shard *shard;
+    int s;
+
+    for (s = 0; s < NUM_SHARDS; s++) {
+        shard = &mm->shards[s];
+        pthread_rwlock_wrlock(&shard->lock);
+        if (shard->mm != NULL) {
+            shard_mm_freeze(shard->mm);
+            shard->version++;
+        }
+        pthread_rwlock_unlock(&shard->lock);
+    }
+}
+
+
+/* Returns nonzero if the multimap contains the specified key-value, zero
+ * otherwise.
+ */
+int mm_contains_key(multimap *mm, int key) {
+    mm_shard *shard = &mm->shards[shard_of_key(key)];
+    int result;
+
+    pthread_rwlock_rdlock(&shard->lock);
+    result = shard->mm != NULL && shard_mm_contains_key(shard->mm, key);
+    pthread_rwlock_unlock(&shard->lock);
+
+    return result;
+}
+
+
+/* Returns nonzero if the multimap contains the specified (key, value) pair,
+ * zero otherwise.
+ */
+int mm_contains_pair(multimap *mm, int key, int value) {
+    mm_shard *shard = &mm->shards[shard_of_key(key)];
+    int result;
+
+    pthread_rwlock_rdlock(&shard->lock);
+    result = shard->mm != NULL &&
+             shard_mm_contains_pair(shard->mm, key, value);
+    pthread_rwlock_unlock(&shard->lock);
+
+    return result;
+}
+
+
+/* Probes the multimap for n (key, value) pairs at once.  The probes are
+ * divided up by shard, and each shard's probes are done with one batched
+ * call while holding its lock once.
+ */
+void mm_contains_pairs(multimap *mm, const int *keys, const int *values,
+                       int *results, int n) {
+    int *part_keys, *part_values, *part_results, *order, *starts;
+    mm_shard *shard;
+    int s, i, first, num;
+
+    if (n <= 0)
+        return;
+
+    part_keys = alloc_or_abort(n * sizeof(int));
+    part_values = alloc_or_abort(n * sizeof(int));
+    part_results = alloc_or_abort(n * sizeof(int));
+    order = alloc_or_abort(n * sizeof(int));
+    starts = partition_by_shard(keys, values, n, part_keys, part_values,
+                                order);
+
+    for (s = 0; s < NUM_SHARDS; s++) {
+        first = starts[s];
+        num = starts[s + 1] - first;
+        if (num == 0)
+            continue;
+
+        shard = &mm->shards[s];
+        pthread_rwlock_rdlock(&shard->lock);
+        if (shard->mm != NULL) {
+            shard_mm_contains_pairs(shard->mm, part_keys + first,
+                                    part_values + first, part_results + first,
+                                    num);
+        }
+        else {
+            bzero(part_results + first, num * sizeof(int));
+        }
+        pthread_rwlock_unlock(&shard->lock);
+    }
+
+    for (i = 0; i < n; i++)
+        results[i] = part_results[order[i]];
+
+    free(part_keys);
+    free(part_values);
+    free(part_results);
+    free(order);
+    free(starts);
+}
+
+
+/* Performs an in-order traversal of the multimap, passing each (key, value)
+ * pair to the specified function.
+ *
+ * Each shard's pairs are in key order, but the shards have to be merged.  The
+ * locks are released before f is called, so f may use the multimap too.
+ */
+void mm_traverse(multimap *mm, void (*f)(int key, int value)) {
+    pair_buffer buf;
+    int starts[NUM_SHARDS + 1];
+
+    bzero(&buf, sizeof(pair_buffer));
+    collect_shard_pairs(mm, /* all_keys */ 1, 0, 0, &buf, starts);
+    merge_shard_pairs(&buf, starts, f);
+
+    free(buf.keys);
+    free(buf.values);
+}
+
+
+/* Passes each (key, value) pair of the multimap with lo <= key < hi to the
+ * specified function, in key order.  Like mm_traverse(), this copies the
+ * pairs out of every shard and merges them, but only the pairs in the range.
+ */
+void mm_range(multimap *mm, int lo, int hi, void (*f)(int key, int value)) {
+    pair_buffer buf;
+    int starts[NUM_SHARDS + 1];
+
+    bzero(&buf, sizeof(pair_buffer));
+    collect_shard_pairs(mm, /* all_keys */ 0, lo, hi, &buf, starts);
+    merge_shard_pairs(&buf, starts, f);
+
+    free(buf.keys);
+    free(buf.values);
+}
+
+
+/* Starts a cursor at the first pair of the multimap whose key is at least the
+ * specified key.
+ */
+void mm_iter_seek(multimap *mm, mm_iter *iter, int key) {
+    seek_next_key(mm, iter, key);
+}
+
+
+/* Stores the pair at a cursor into *key and *value, and moves the cursor to
+ * the next pair.  The cursor stays within the shard of its current key until
+ * the key has no more values, and then looks for the next key.
+ */
+int mm_iter_next(mm_iter *iter, int *key, int *value) {
+    mm_shard *shard;
+    int found;
+
+    while (iter->part != -1) {
+        shard = &iter->mm->shards[iter->part];
+        pthread_rwlock_rdlock(&shard->lock);
+        found = next_value_in_shard(shard, iter, value);
+        pthread_rwlock_unlock(&shard->lock);
+
+        if (found) {
+            *key = iter->key;
+            return 1;
+        }
+
+        if (iter->key == INT_MAX)
+            iter->part = -1;
+        else
+            seek_next_key(iter->mm, iter, iter->key + 1);
+    }
+
+    return 0;
+}
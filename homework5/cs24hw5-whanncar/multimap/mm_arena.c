@@ -0,0 +1,138 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mm_arena.h"
+
+
+/* The size of a cache line; slabs are allocated on cache-line boundaries, so
+ * that allocations from them can be too.
+ */
+#define CACHE_LINE_SIZE 64
+
+/* The size of the first slab of an arena, and the largest size that slabs
+ * grow to.  Each slab is twice as big as the one before it, so small
+ * multimaps don't use much memory, and large ones don't need many slabs.
+ */
+#define MIN_SLAB_SIZE (16 * 1024)
+#define MAX_SLAB_SIZE (1024 * 1024)
+
+
+/*============================================================================
+ * TYPES
+ *============================================================================*/
+
+/* The header at the start of each slab. */
+struct arena_slab {
+    /* The next slab in the arena's list of slabs. */
+    struct arena_slab *next;
+
+    /* The size of the slab, including this header. */
+    size_t size;
+};
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *============================================================================*/
+
+arena_slab * alloc_slab(mm_arena *arena, size_t size);
+char * align_pointer(char *p, size_t align);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Allocates a slab of the specified size on a cache-line boundary, and adds
+ * it to the arena's list of slabs.
+ */
+arena_slab * alloc_slab(mm_arena *arena, size_t size) {
+    arena_slab *slab;
+
+    if (posix_memalign((void **) &slab, CACHE_LINE_SIZE, size) != 0) {
+        fprintf(stderr, "Out of memory allocating a multimap slab.\n");
+        abort();
+    }
+
+    slab->next = arena->slabs;
+    slab->size = size;
+    arena->slabs = slab;
+    arena->num_slabs++;
+
+    return slab;
+}
+
+
+/* Rounds a pointer up to a multiple of the alignment, a power of two. */
+char * align_pointer(char *p, size_t align) {
+    return (char *) (((uintptr_t) p + align - 1) & ~(uintptr_t) (align - 1));
+}
+
+
+/* Allocates memory of the specified size from an arena, aligned to the
+ * specified alignment, which must be a power of two no larger than a cache
+ * line.  The program exits if there is no memory left.
+ */
+void * arena_alloc(mm_arena *arena, size_t size, size_t align) {
+    arena_slab *slab;
+    size_t slab_size, header_size;
+    char *p;
+    int i;
+
+    assert(align > 0 && align <= CACHE_LINE_SIZE);
+    assert((align & (align - 1)) == 0);
+
+    if (arena->next != NULL) {
+        p = align_pointer(arena->next, align);
+        if (p <= arena->end && size <= (size_t) (arena->end - p)) {
+            arena->next = p + size;
+            return p;
+        }
+    }
+
+    /* The current slab is full.  Slabs start on a cache line, so making
+     * room for the header a cache line's worth aligns the first allocation.
+     */
+    header_size = CACHE_LINE_SIZE;
+    assert(sizeof(arena_slab) <= header_size);
+
+    slab_size = MIN_SLAB_SIZE;
+    for (i = 0; i < arena->num_slabs && slab_size < MAX_SLAB_SIZE; i++)
+        slab_size *= 2;
+
+    if (header_size + size > slab_size / 4) {
+        /* Large allocations get a slab of their own, so the rest of the
+         * current slab isn't wasted.
+         */
+        slab = alloc_slab(arena, header_size + size);
+        return (char *) slab + header_size;
+    }
+
+    slab = alloc_slab(arena, slab_size);
+    p = (char *) slab + header_size;
+    arena->next = p + size;
+    arena->end = (char *) slab + slab_size;
+
+    return p;
+}
+
+
+/* Releases all the memory allocated from an arena, leaving the arena empty. */
+void clear_arena(mm_arena *arena) {
+    arena_slab *slab = arena->slabs;
+
+    while (slab != NULL) {
+        arena_slab *next = slab->next;
+#ifdef DEBUG_ZERO
+        /* Clear out what we are about to free, to expose issues quickly. */
+        bzero(slab, slab->size);
+#endif
+        free(slab);
+        slab = next;
+    }
+
+    bzero(arena, sizeof(mm_arena));
+}
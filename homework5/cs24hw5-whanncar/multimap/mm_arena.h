@@ -0,0 +1,46 @@
+/* This file declares a simple arena allocator for the optimized multimaps.
+ * An arena hands out memory from large slabs with a bump pointer, so that
+ * the nodes and values of a multimap are packed together in memory in the
+ * order they were allocated, and allocating them is cheap.  Memory from an
+ * arena can't be freed piece by piece; instead the whole arena is cleared at
+ * once, which frees each slab rather than each allocation.
+ */
+
+#ifndef MM_ARENA_H
+#define MM_ARENA_H
+
+#include <stddef.h>
+
+
+/* A slab of memory that allocations are carved out of; see mm_arena.c. */
+typedef struct arena_slab arena_slab;
+
+
+/* An arena.  An arena whose members are all zero is empty, so a zeroed-out
+ * arena needs no further initialization.
+ */
+typedef struct mm_arena {
+    /* All the slabs of the arena, most recently allocated first. */
+    arena_slab *slabs;
+
+    /* The free space at the end of the slab being allocated from. */
+    char *next;
+    char *end;
+
+    /* The number of slabs the arena has allocated, which determines the size
+     * of the next one.
+     */
+    int num_slabs;
+} mm_arena;
+
+
+/* Allocates memory of the specified size from an arena, aligned to the
+ * specified alignment, which must be a power of two no larger than a cache
+ * line.  The program exits if there is no memory left.
+ */
+void * arena_alloc(mm_arena *arena, size_t size, size_t align);
+
+/* Releases all the memory allocated from an arena, leaving the arena empty. */
+void clear_arena(mm_arena *arena);
+
+#endif
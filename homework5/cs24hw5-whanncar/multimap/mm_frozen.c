@@ -0,0 +1,480 @@
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mm_frozen.h"
+#include "mm_util.h"
+#include "mm_values.h"
+
+
+/* The size of a cache line, and the number of keys in one. */
+#define CACHE_LINE_SIZE 64
+#define KEYS_PER_LINE ((int) (CACHE_LINE_SIZE / sizeof(int)))
+
+/* Keys with more values than this also get an index of their distinct
+ * values.  Shorter lists are faster to scan than to index.
+ */
+#define MAX_SCANNED_VALUES 32
+
+/* A key's index is a bitmap if that takes at most this many bits for each
+ * distinct value, which is no more space than a sorted array of the values.
+ */
+#define MAX_BITS_PER_VALUE 32
+
+/* The number of probes that frozen_contains_pairs() runs together. */
+#define PROBE_GROUP_SIZE 16
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *============================================================================*/
+
+int compare_ints(const void *a, const void *b);
+int sort_distinct_values(int *values, int num_values);
+int first_key_position(int num_keys);
+void choose_key_index(frozen_key *fk, const int *distinct, int num_distinct);
+int index_length(const frozen_key *fk);
+void store_key_index(const frozen_key *fk, int *index, const int *distinct,
+                     int num_distinct);
+int key_contains_value(const frozen_multimap *fm, const frozen_key *fk,
+                       int value);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Compares two ints for qsort(). */
+int compare_ints(const void *a, const void *b) {
+    int x = *(const int *) a, y = *(const int *) b;
+    return (x > y) - (x < y);
+}
+
+
+/* Sorts an array of values and removes the duplicates, returning the number
+ * of distinct values left at the start of the array.
+ */
+int sort_distinct_values(int *values, int num_values) {
+    int i, num_distinct = 0;
+
+    qsort(values, num_values, sizeof(int), compare_ints);
+    for (i = 0; i < num_values; i++) {
+        if (i == 0 || values[i] != values[num_distinct - 1])
+            values[num_distinct++] = values[i];
+    }
+
+    return num_distinct;
+}
+
+
+/* Returns the position of the smallest of num_keys keys, which is the
+ * leftmost position of the tree, or 0 if there are no keys.
+ */
+int first_key_position(int num_keys) {
+    int pos = 1;
+
+    if (num_keys == 0)
+        return 0;
+
+    while (2 * pos <= num_keys)
+        pos *= 2;
+
+    return pos;
+}
+
+
+/* Chooses the form of a key's index from its distinct values, which are in
+ * increasing order.
+ */
+void choose_key_index(frozen_key *fk, const int *distinct, int num_distinct) {
+    long long range;
+
+    range = (long long) distinct[num_distinct - 1] - distinct[0] + 1;
+    if (range <= (long long) MAX_BITS_PER_VALUE * num_distinct &&
+        range <= INT_MAX) {
+        fk->index_kind = FROZEN_BITMAP;
+        fk->index_size = range;
+        fk->min_value = distinct[0];
+    }
+    else {
+        fk->index_kind = FROZEN_SORTED;
+        fk->index_size = num_distinct;
+    }
+}
+
+
+/* Returns the number of ints taken up by a key's index. */
+int index_length(const frozen_key *fk) {
+    switch (fk->index_kind) {
+    case FROZEN_SCAN:
+        return 0;
+
+    case FROZEN_SORTED:
+        return fk->index_size;
+
+    case FROZEN_BITMAP:
+        return (fk->index_size + 31) / 32;
+    }
+
+    assert(0);
+    return 0;
+}
+
+
+/* Stores a key's index, made from its distinct values in increasing order. */
+void store_key_index(const frozen_key *fk, int *index, const int *distinct,
+                     int num_distinct) {
+    unsigned int *bits = (unsigned int *) index;
+    unsigned int offset;
+    int i;
+
+    switch (fk->index_kind) {
+    case FROZEN_SCAN:
+        break;
+
+    case FROZEN_SORTED:
+        memcpy(index, distinct, num_distinct * sizeof(int));
+        break;
+
+    case FROZEN_BITMAP:
+        bzero(bits, index_length(fk) * sizeof(int));
+        for (i = 0; i < num_distinct; i++) {
+            offset = (unsigned int) distinct[i] - (unsigned int) fk->min_value;
+            bits[offset / 32] |= 1u << (offset % 32);
+        }
+        break;
+    }
+}
+
+
+/* Returns the position of the next larger key after the key at the specified
+ * position, or 0 if it is the largest key.  This is the leftmost position in
+ * the right subtree if there is one, and otherwise the first ancestor whose
+ * left subtree holds the position.
+ */
+int frozen_next_key(const frozen_multimap *fm, int pos) {
+    if (2 * pos + 1 <= fm->num_keys) {
+        pos = 2 * pos + 1;
+        while (2 * pos <= fm->num_keys)
+            pos *= 2;
+
+        return pos;
+    }
+
+    /* Odd positions are right children. */
+    while (pos & 1)
+        pos >>= 1;
+
+    return pos >> 1;
+}
+
+
+/* Builds a frozen multimap from n (key, value) pairs whose keys are in
+ * nondecreasing order, allocating it from an arena.
+ *
+ * The values are stored in key order.  The keys are stored by walking the
+ * positions of the tree in order, which puts the sorted keys into the
+ * Eytzinger layout.
+ */
+frozen_multimap * freeze_pairs(const int *keys, const int *values, int n,
+                               mm_arena *arena) {
+    frozen_multimap *fm;
+    frozen_key *sorted_keys;
+    int *distinct, *indexes;
+    int num_keys, num_stored, num_distinct, first, i, k, pos;
+
+    fm = arena_alloc(arena, sizeof(frozen_multimap), sizeof(void *));
+
+    num_keys = 0;
+    for (i = 0; i < n; i++) {
+        assert(i == 0 || keys[i] >= keys[i - 1]);
+        if (i == 0 || keys[i] != keys[i - 1])
+            num_keys++;
+    }
+
+    /* Find where each key's values start in the pairs, and build the
+     * indexes of the keys that have many values.  An index takes no more
+     * space than the key's values, so it can be built in the same place in
+     * a buffer as big as the pairs.
+     */
+    sorted_keys = alloc_or_abort((num_keys + 1) * sizeof(frozen_key));
+    distinct = alloc_or_abort((n + 1) * sizeof(int));
+    indexes = alloc_or_abort((n + 1) * sizeof(int));
+
+    num_stored = 0;
+    first = 0;
+    for (k = 0; k < num_keys; k++) {
+        for (i = first + 1; i < n && keys[i] == keys[first]; i++)
+            ;
+
+        bzero(&sorted_keys[k], sizeof(frozen_key));
+        sorted_keys[k].first = first;
+        sorted_keys[k].num_values = i - first;
+
+        if (i - first > MAX_SCANNED_VALUES) {
+            memcpy(distinct + first, values + first, (i - first) * sizeof(int));
+            num_distinct = sort_distinct_values(distinct + first, i - first);
+
+            choose_key_index(&sorted_keys[k], distinct + first, num_distinct);
+            assert(index_length(&sorted_keys[k]) <= i - first);
+            store_key_index(&sorted_keys[k], indexes + first, distinct + first,
+                            num_distinct);
+        }
+
+        num_stored += i - first + index_length(&sorted_keys[k]);
+        first = i;
+    }
+
+    fm->num_keys = num_keys;
+    fm->keys = arena_alloc(arena, (num_keys + 1) * sizeof(int),
+                           CACHE_LINE_SIZE);
+    fm->key_values = arena_alloc(arena, (num_keys + 1) * sizeof(frozen_key),
+                                 sizeof(int));
+    fm->values = arena_alloc(arena, (num_stored + 1) * sizeof(int),
+                             CACHE_LINE_SIZE);
+
+    fm->keys[0] = 0;
+    bzero(&fm->key_values[0], sizeof(frozen_key));
+
+    /* Store the keys in order into the positions of the tree, in order. */
+    num_stored = 0;
+    pos = first_key_position(num_keys);
+    for (k = 0; k < num_keys; k++) {
+        first = sorted_keys[k].first;
+
+        fm->keys[pos] = keys[first];
+        fm->key_values[pos] = sorted_keys[k];
+        fm->key_values[pos].first = num_stored;
+
+        memcpy(fm->values + num_stored, values + first,
+               sorted_keys[k].num_values * sizeof(int));
+        num_stored += sorted_keys[k].num_values;
+
+        memcpy(fm->values + num_stored, indexes + first,
+               index_length(&sorted_keys[k]) * sizeof(int));
+        num_stored += index_length(&sorted_keys[k]);
+
+        pos = frozen_next_key(fm, pos);
+    }
+    assert(pos == 0);
+
+    free(sorted_keys);
+    free(distinct);
+    free(indexes);
+
+    return fm;
+}
+
+
+/* Returns the position of the smallest key that is at least the specified
+ * key, or 0 if every key is smaller.
+ *
+ * The search goes left or right at each level by adding the result of the
+ * compare to the position, so there is no branch to mispredict.  Since the
+ * keys four levels below a position share a cache line, that line is
+ * prefetched at every level, so the loads of four levels are in flight at
+ * once.  At the end, the position records every turn the search made, and
+ * the answer is the last key the search went left at:  dropping the trailing
+ * right turns, and then the left turn, gives its position.
+ */
+int frozen_lower_bound(const frozen_multimap *fm, int key) {
+    const int *keys = fm->keys;
+    unsigned int pos = 1, num_keys = fm->num_keys;
+
+    while (pos <= num_keys) {
+        __builtin_prefetch(keys + KEYS_PER_LINE * pos);
+        pos = 2 * pos + (keys[pos] < key);
+    }
+
+    return pos >> __builtin_ffs(~pos);
+}
+
+
+/* Returns nonzero if a frozen multimap contains the specified key. */
+int frozen_contains_key(const frozen_multimap *fm, int key) {
+    int pos = frozen_lower_bound(fm, key);
+    return pos != 0 && fm->keys[pos] == key;
+}
+
+
+/* Returns nonzero if the specified key's values include the value.  Sorted
+ * distinct values are binary searched without branching on the values,
+ * halving the part of the array left to search each time.
+ */
+int key_contains_value(const frozen_multimap *fm, const frozen_key *fk,
+                       int value) {
+    const int *index = fm->values + fk->first + fk->num_values;
+    const unsigned int *bits;
+    const int *base;
+    unsigned int offset;
+    int size, half;
+
+    switch (fk->index_kind) {
+    case FROZEN_SCAN:
+        return chunk_contains_value(fm->values + fk->first, fk->num_values,
+                                    value);
+
+    case FROZEN_SORTED:
+        base = index;
+        size = fk->index_size;
+        while (size > 1) {
+            half = size / 2;
+            base = (base[half] < value) ? base + half : base;
+            size -= half;
+        }
+
+        base += (*base < value);
+        return base < index + fk->index_size && *base == value;
+
+    case FROZEN_BITMAP:
+        /* Values below the smallest one wrap around to large offsets. */
+        bits = (const unsigned int *) index;
+        offset = (unsigned int) value - (unsigned int) fk->min_value;
+        return offset < (unsigned int) fk->index_size &&
+               ((bits[offset / 32] >> (offset % 32)) & 1);
+    }
+
+    assert(0);
+    return 0;
+}
+
+
+/* Returns nonzero if a frozen multimap contains the specified pair. */
+int frozen_contains_pair(const frozen_multimap *fm, int key, int value) {
+    int pos = frozen_lower_bound(fm, key);
+
+    if (pos == 0 || fm->keys[pos] != key)
+        return 0;
+
+    return key_contains_value(fm, &fm->key_values[pos], value);
+}
+
+
+/* Probes a frozen multimap for n pairs at once.  The probes are run in
+ * groups, moving down the tree in lockstep like the B+tree's batched probes,
+ * so that the cache misses of a whole group overlap.  Positions in the last
+ * level can be reached one step before the others, so probes that are
+ * already past the bottom of the tree stay where they are.
+ */
+void frozen_contains_pairs(const frozen_multimap *fm, const int *keys,
+                           const int *values, int *results, int n) {
+    unsigned int positions[PROBE_GROUP_SIZE];
+    unsigned int pos, num_keys = fm->num_keys;
+    int start, size, height, level, i;
+
+    height = 0;
+    while ((num_keys >> height) != 0)
+        height++;
+
+    for (start = 0; start < n; start += PROBE_GROUP_SIZE) {
+        size = n - start;
+        if (size > PROBE_GROUP_SIZE)
+            size = PROBE_GROUP_SIZE;
+
+        for (i = 0; i < size; i++)
+            positions[i] = 1;
+
+        for (level = 0; level < height; level++) {
+            for (i = 0; i < size; i++) {
+                pos = positions[i];
+                if (pos <= num_keys)
+                    pos = 2 * pos + (fm->keys[pos] < keys[start + i]);
+                positions[i] = pos;
+                __builtin_prefetch(fm->keys + pos);
+            }
+        }
+
+        for (i = 0; i < size; i++) {
+            pos = positions[i] >> __builtin_ffs(~positions[i]);
+            if (pos != 0 && fm->keys[pos] != keys[start + i])
+                pos = 0;
+            positions[i] = pos;
+            __builtin_prefetch(&fm->key_values[pos]);
+        }
+
+        for (i = 0; i < size; i++) {
+            if (positions[i] != 0) {
+                __builtin_prefetch(fm->values +
+                                   fm->key_values[positions[i]].first);
+            }
+        }
+
+        for (i = 0; i < size; i++) {
+            pos = positions[i];
+            results[start + i] = pos != 0 &&
+                key_contains_value(fm, &fm->key_values[pos],
+                                   values[start + i]);
+        }
+    }
+}
+
+
+/* Passes each pair of a frozen multimap with lo <= key < hi to the specified
+ * function, in key order.  If all_keys is nonzero, lo and hi are ignored and
+ * every pair is passed.
+ */
+void frozen_range(const frozen_multimap *fm, int all_keys, int lo, int hi,
+                  void (*f)(int key, int value)) {
+    const frozen_key *fk;
+    int pos, i;
+
+    pos = frozen_lower_bound(fm, all_keys ? INT_MIN : lo);
+    while (pos != 0 && (all_keys || fm->keys[pos] < hi)) {
+        fk = &fm->key_values[pos];
+        for (i = 0; i < fk->num_values; i++)
+            f(fm->keys[pos], fm->values[fk->first + i]);
+
+        pos = frozen_next_key(fm, pos);
+    }
+}
+
+
+/* Moves a cursor to the first pair of a frozen multimap whose key is at least
+ * the specified key.  The cursor holds the frozen multimap, the position of
+ * the current key, and the position of its next value in the value array.
+ */
+void frozen_iter_seek(frozen_multimap *fm, mm_iter *iter, int key) {
+    int pos = frozen_lower_bound(fm, key);
+
+    iter->node = NULL;
+    if (pos != 0) {
+        iter->node = fm;
+        iter->slot = pos;
+        iter->key = fm->keys[pos];
+        iter->values = NULL;
+        iter->index = fm->key_values[pos].first;
+    }
+}
+
+
+/* Moves a cursor started by frozen_iter_seek() on, like mm_iter_next(). */
+int frozen_iter_next(mm_iter *iter, int *key, int *value) {
+    const frozen_multimap *fm = iter->node;
+    const frozen_key *fk;
+    int pos = iter->slot;
+
+    if (fm == NULL)
+        return 0;
+
+    fk = &fm->key_values[pos];
+    while (iter->index >= fk->first + fk->num_values) {
+        /* The current key has no more values; move on to the next. */
+        pos = frozen_next_key(fm, pos);
+        if (pos == 0) {
+            iter->node = NULL;
+            return 0;
+        }
+
+        fk = &fm->key_values[pos];
+        iter->index = fk->first;
+    }
+
+    iter->slot = pos;
+    iter->key = fm->keys[pos];
+
+    *key = fm->keys[pos];
+    *value = fm->values[iter->index];
+    iter->index++;
+    return 1;
+}
@@ -0,0 +1,112 @@
+/* This file declares the read-only form that the optimized multimaps take
+ * when they are frozen.  A frozen multimap is a few flat arrays instead of a
+ * tree of nodes:  the keys are in an array laid out in the order of a
+ * breadth-first walk of a balanced search tree (the Eytzinger layout), and
+ * all the values are in one array, with the values of each key together.
+ * Searching the key array touches the same cache lines at the top of the
+ * tree for every search, needs no pointers, and can be done without any
+ * branches that depend on the keys.
+ *
+ * The keys are numbered by their position in the key array, starting from 1;
+ * position 0 means "no key".  All the memory of a frozen multimap is
+ * allocated from the multimap's arena.
+ */
+
+#ifndef MM_FROZEN_H
+#define MM_FROZEN_H
+
+#include "multimap.h"
+#include "mm_arena.h"
+
+
+/* The ways of searching the values of a key; see frozen_key. */
+typedef enum frozen_index_kind {
+    FROZEN_SCAN = 0,
+    FROZEN_SORTED = 1,
+    FROZEN_BITMAP = 2
+} frozen_index_kind;
+
+
+/* Where the values of a key are in the array of values. */
+typedef struct frozen_key {
+    /* The position of the key's first value, and the number of values, in
+     * the order they were added.
+     */
+    int first;
+    int num_values;
+
+    /* Keys with many values also have an index of their distinct values
+     * straight after the values themselves, so that they can be searched
+     * without looking at every value:  either the distinct values in
+     * increasing order, or a bitmap with a bit for each value from min_value
+     * on, whichever is smaller.  index_size is the number of sorted values or
+     * bits.  The values of other keys are just scanned.
+     */
+    frozen_index_kind index_kind;
+    int index_size;
+    int min_value;
+} frozen_key;
+
+
+/* A frozen multimap. */
+typedef struct frozen_multimap {
+    /* The number of distinct keys. */
+    int num_keys;
+
+    /* The keys, in positions 1 to num_keys; the children of the key at
+     * position i are at positions 2i and 2i + 1.  The array starts on a
+     * cache line, so the descendants of a key four levels down share a
+     * cache line.
+     */
+    int *keys;
+
+    /* Where the values of the key at each position are. */
+    frozen_key *key_values;
+
+    /* The values of all the keys. */
+    int *values;
+} frozen_multimap;
+
+
+/* Builds a frozen multimap from n (key, value) pairs whose keys are in
+ * nondecreasing order, allocating it from an arena.
+ */
+frozen_multimap * freeze_pairs(const int *keys, const int *values, int n,
+                               mm_arena *arena);
+
+/* Returns the position of the smallest key that is at least the specified
+ * key, or 0 if every key is smaller.
+ */
+int frozen_lower_bound(const frozen_multimap *fm, int key);
+
+/* Returns the position of the next larger key after the key at the specified
+ * position, or 0 if it is the largest key.
+ */
+int frozen_next_key(const frozen_multimap *fm, int pos);
+
+/* Returns nonzero if a frozen multimap contains the specified key. */
+int frozen_contains_key(const frozen_multimap *fm, int key);
+
+/* Returns nonzero if a frozen multimap contains the specified pair. */
+int frozen_contains_pair(const frozen_multimap *fm, int key, int value);
+
+/* Probes a frozen multimap for n pairs at once, like mm_contains_pairs(). */
+void frozen_contains_pairs(const frozen_multimap *fm, const int *keys,
+                           const int *values, int *results, int n);
+
+/* Passes each pair of a frozen multimap with lo <= key < hi to the specified
+ * function, in key order.  If all_keys is nonzero, lo and hi are ignored and
+ * every pair is passed.
+ */
+void frozen_range(const frozen_multimap *fm, int all_keys, int lo, int hi,
+                  void (*f)(int key, int value));
+
+/* Moves a cursor to the first pair of a frozen multimap whose key is at least
+ * the specified key.  The caller sets the cursor's mm member.
+ */
+void frozen_iter_seek(frozen_multimap *fm, mm_iter *iter, int key);
+
+/* Moves a cursor started by frozen_iter_seek() on, like mm_iter_next(). */
+int frozen_iter_next(mm_iter *iter, int *key, int *value);
+
+#endif
@@ -4,6 +4,9 @@
 #include <string.h>
 
 #include "multimap.h"
+#include "mm_arena.h"
+#include "mm_frozen.h"
+#include "mm_util.h"
 
 
 /*============================================================================
@@ -51,6 +54,13 @@ typedef struct multimap_node {
 /* The entry-point of the multimap data structure. */
 struct multimap {
     multimap_node *root;
+
+    /* The pairs of the multimap if it is frozen, in which case the tree is
+     * empty, or NULL if it isn't.  A frozen multimap is kept in the flat
+     * arrays of mm_frozen.c, which are allocated from the arena.
+     */
+    frozen_multimap *frozen;
+    mm_arena arena;
 };
 
 
@@ -65,10 +75,15 @@ multimap_node * alloc_mm_node();
 
 multimap_node * find_mm_node(multimap_node *root, int key,
                              int create_if_not_found);
+multimap_node * find_next_mm_node(multimap_node *root, int key,
+                                  int inclusive);
 
 void free_multimap_values(multimap_value *values);
 void free_multimap_node(multimap_node *node);
 
+void add_sorted_runs(multimap *mm, const int *keys, const int *values,
+                     const int *starts, int first, int last);
+
 
 /*============================================================================
  * FUNCTION IMPLEMENTATIONS
@@ -139,6 +154,31 @@ multimap_node * find_mm_node(multimap_node *root, int key,
 }
 
 
+/* This helper function returns the node with the smallest key that is after
+ * the specified key, or NULL if there isn't one.  If inclusive is nonzero, a
+ * node with the key itself counts as being after it.
+ */
+multimap_node * find_next_mm_node(multimap_node *root, int key,
+                                  int inclusive) {
+    multimap_node *node = root, *next = NULL;
+
+    while (node != NULL) {
+        if (node->key > key || (inclusive && node->key == key)) {
+            /* This node is after the key, but there may be a closer one in
+             * its left subtree.
+             */
+            next = node;
+            node = node->left_child;
+        }
+        else {
+            node = node->right_child;
+        }
+    }
+
+    return next;
+}
+
+
 /* This helper function frees all values in a multimap node's value-list. */
 void free_multimap_values(multimap_value *values) {
     while (values != NULL) {
@@ -179,6 +219,8 @@ void free_multimap_node(multimap_node *node) {
 multimap * init_multimap() {
     multimap *mm = malloc(sizeof(multimap));
     mm->root = NULL;
+    mm->frozen = NULL;
+    bzero(&mm->arena, sizeof(mm_arena));
     return mm;
 }
 
@@ -189,7 +231,9 @@ multimap * init_multimap() {
 void clear_multimap(multimap *mm) {
     assert(mm != NULL);
     free_multimap_node(mm->root);
+    clear_arena(&mm->arena);
     mm->root = NULL;
+    mm->frozen = NULL;
 }
 
 
@@ -200,6 +244,9 @@ void mm_add_value(multimap *mm, int key, int value) {
 
     assert(mm != NULL);
 
+    if (mm->frozen != NULL)
+        rebuild_multimap(mm, NULL, NULL);
+
     /* Look up the node with the specified key.  Create if not found. */
     node = find_mm_node(mm->root, key, /* create */ 1);
     if (mm->root == NULL)
@@ -223,10 +270,93 @@ void mm_add_value(multimap *mm, int key, int value) {
 }
 
 
+/* Adds n (key, value) pairs to the multimap, where keys[i] goes with
+ * values[i].
+ */
+void mm_add_values(multimap *mm, const int *keys, const int *values, int n) {
+    int i;
+
+    for (i = 0; i < n; i++)
+        mm_add_value(mm, keys[i], values[i]);
+}
+
+
+/* This helper function is used by mm_build_from_sorted() to add the runs of
+ * pairs first through last, where run r is the pairs from starts[r] up to
+ * starts[r + 1] that share a key.  The middle run is added first, and then
+ * the runs on either side of it, so that the keys go into the tree in the
+ * order of a balanced tree instead of in increasing order.
+ */
+void add_sorted_runs(multimap *mm, const int *keys, const int *values,
+                     const int *starts, int first, int last) {
+    int mid, i;
+
+    if (first > last)
+        return;
+
+    mid = first + (last - first) / 2;
+    for (i = starts[mid]; i < starts[mid + 1]; i++)
+        mm_add_value(mm, keys[i], values[i]);
+
+    add_sorted_runs(mm, keys, values, starts, first, mid - 1);
+    add_sorted_runs(mm, keys, values, starts, mid + 1, last);
+}
+
+
+/* Like mm_add_values(), but the keys must be in nondecreasing order.  This
+ * tree doesn't rebalance itself, so adding sorted keys one after another
+ * would make it a linked list.  Instead, if the multimap is empty, the keys
+ * are added middle first, which builds a balanced tree.
+ */
+void mm_build_from_sorted(multimap *mm, const int *keys, const int *values,
+                          int n) {
+    int *starts;
+    int i, num_runs;
+
+    assert(mm != NULL);
+
+    if (mm->frozen != NULL && n > 0)
+        rebuild_multimap(mm, NULL, NULL);
+
+    if (mm->root != NULL || n <= 0) {
+        mm_add_values(mm, keys, values, n);
+        return;
+    }
+
+    starts = alloc_or_abort((n + 1) * sizeof(int));
+    num_runs = 0;
+    for (i = 0; i < n; i++) {
+        assert(i == 0 || keys[i] >= keys[i - 1]);
+        if (i == 0 || keys[i] != keys[i - 1])
+            starts[num_runs++] = i;
+    }
+    starts[num_runs] = n;
+
+    add_sorted_runs(mm, keys, values, starts, 0, num_runs - 1);
+
+    free(starts);
+}
+
+
+/* Freezes the multimap.  Its pairs are moved into the arrays of mm_frozen.c,
+ * and its tree is freed.  Adding pairs to a frozen multimap thaws it again,
+ * building a balanced tree from the frozen pairs with mm_build_from_sorted().
+ */
+void mm_freeze(multimap *mm) {
+    assert(mm != NULL);
+
+    if (mm->frozen == NULL)
+        rebuild_multimap(mm, &mm->frozen, &mm->arena);
+}
+
+
 /* Returns nonzero if the multimap contains the specified key-value, zero
  * otherwise.
  */
 int mm_contains_key(multimap *mm, int key) {
+    if (mm->frozen != NULL)
+        return frozen_contains_key(mm->frozen, key);
+
     return find_mm_node(mm->root, key, /* create */ 0) != NULL;
 }
 
@@ -238,6 +368,9 @@ int mm_contains_pair(multimap *mm, int key, int value) {
     multimap_node *node;
     multimap_value *curr;
 
+    if (mm->frozen != NULL)
+        return frozen_contains_pair(mm->frozen, key, value);
+
     node = find_mm_node(mm->root, key, /* create */ 0);
     if (node == NULL)
         return 0;
@@ -254,6 +387,21 @@ int mm_contains_pair(multimap *mm, int key, int value) {
 }
 
 
+/* Probes the multimap for n (key, value) pairs at once. */
+void mm_contains_pairs(multimap *mm, const int *keys, const int *values,
+                       int *results, int n) {
+    int i;
+
+    if (mm->frozen != NULL) {
+        frozen_contains_pairs(mm->frozen, keys, values, results, n);
+        return;
+    }
+
+    for (i = 0; i < n; i++)
+        results[i] = mm_contains_pair(mm, keys[i], values[i]);
+}
+
+
 /* This helper function is used by mm_traverse() to traverse every pair within
  * the multimap.
  */
@@ -279,6 +427,101 @@ void mm_traverse_helper(multimap_node *node, void (*f)(int key, int value)) {
  * pair to the specified function.
  */
 void mm_traverse(multimap *mm, void (*f)(int key, int value)) {
-    mm_traverse_helper(mm->root, f);
+    if (mm->frozen != NULL)
+        frozen_range(mm->frozen, /* all_keys */ 1, 0, 0, f);
+    else
+        mm_traverse_helper(mm->root, f);
+}
+
+
+/* This helper function is used by mm_range() to traverse the pairs within
+ * the range, skipping the subtrees that are entirely outside of it.
+ */
+void mm_range_helper(multimap_node *node, int lo, int hi,
+                     void (*f)(int key, int value)) {
+    multimap_value *curr;
+
+    if (node == NULL)
+        return;
+
+    if (node->key > lo)
+        mm_range_helper(node->left_child, lo, hi, f);
+
+    if (node->key >= lo && node->key < hi) {
+        curr = node->values;
+        while (curr != NULL) {
+            f(node->key, curr->value);
+            curr = curr->next;
+        }
+    }
+
+    if (node->key < hi)
+        mm_range_helper(node->right_child, lo, hi, f);
 }
 
+
+/* Passes each (key, value) pair of the multimap with lo <= key < hi to the
+ * specified function, in key order.
+ */
+void mm_range(multimap *mm, int lo, int hi, void (*f)(int key, int value)) {
+    if (mm->frozen != NULL)
+        frozen_range(mm->frozen, /* all_keys */ 0, lo, hi, f);
+    else
+        mm_range_helper(mm->root, lo, hi, f);
+}
+
+
+/* Starts a cursor at the first pair of the multimap whose key is at least the
+ * specified key.
+ */
+void mm_iter_seek(multimap *mm, mm_iter *iter, int key) {
+    multimap_node *node;
+
+    bzero(iter, sizeof(mm_iter));
+    iter->mm = mm;
+
+    if (mm->frozen != NULL) {
+        frozen_iter_seek(mm->frozen, iter, key);
+        return;
+    }
+
+    node = find_next_mm_node(mm->root, key, /* inclusive */ 1);
+    if (node != NULL) {
+        iter->node = node;
+        iter->key = node->key;
+        iter->values = node->values;
+    }
+}
+
+
+/* Stores the pair at a cursor into *key and *value, and moves the cursor to
+ * the next pair.  The nodes don't point back up to their parents, so moving
+ * from one key to the next searches for the next key from the root.
+ */
+int mm_iter_next(mm_iter *iter, int *key, int *value) {
+    multimap_node *node = iter->node;
+    const multimap_value *curr = iter->values;
+
+    if (iter->mm->frozen != NULL)
+        return frozen_iter_next(iter, key, value);
+
+    while (node != NULL && curr == NULL) {
+        node = find_next_mm_node(iter->mm->root, node->key,
+                                 /* inclusive */ 0);
+        if (node != NULL)
+            curr = node->values;
+    }
+
+    iter->node = node;
+    if (node == NULL) {
+        iter->values = NULL;
+        return 0;
+    }
+
+    iter->key = node->key;
+    iter->values = curr->next;
+
+    *key = node->key;
+    *value = curr->value;
+    return 1;
+}
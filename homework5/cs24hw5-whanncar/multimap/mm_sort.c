@@ -0,0 +1,100 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mm_sort.h"
+#include "mm_util.h"
+
+
+/* The keys are sorted one byte at a time, starting with the lowest byte. */
+#define RADIX_BITS 8
+#define RADIX_SIZE (1 << RADIX_BITS)
+#define NUM_PASSES ((int) (8 * sizeof(int) / RADIX_BITS))
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *============================================================================*/
+
+unsigned int radix_digit(int key, int pass);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Returns the digit of a key that the specified pass sorts on.  The sign bit
+ * is flipped, so that negative keys sort before positive ones.
+ */
+unsigned int radix_digit(int key, int pass) {
+    unsigned int bits = (unsigned int) key ^ 0x80000000u;
+    return (bits >> (pass * RADIX_BITS)) & (RADIX_SIZE - 1);
+}
+
+
+/* Sorts n (key, value) pairs by key, where keys[i] goes with values[i].  The
+ * sort is stable, so the values of each key stay in the order they were in.
+ *
+ * This is a least-significant-digit radix sort, which takes a fixed number of
+ * linear passes over the pairs rather than O(n log n) comparisons.  The counts
+ * for every pass are taken in one pass up front, and passes in which all the
+ * keys have the same digit (such as the high bytes of small keys) are
+ * skipped.
+ */
+void sort_pairs(int *keys, int *values, int n) {
+    int counts[NUM_PASSES][RADIX_SIZE];
+    int *from_keys = keys, *from_values = values;
+    int *to_keys, *to_values, *tmp;
+    int *buf_keys, *buf_values;
+    int i, pass, pos, count;
+    unsigned int digit;
+
+    if (n < 2)
+        return;
+
+    bzero(counts, sizeof(counts));
+    for (i = 0; i < n; i++) {
+        for (pass = 0; pass < NUM_PASSES; pass++)
+            counts[pass][radix_digit(keys[i], pass)]++;
+    }
+
+    buf_keys = to_keys = alloc_or_abort(n * sizeof(int));
+    buf_values = to_values = alloc_or_abort(n * sizeof(int));
+
+    for (pass = 0; pass < NUM_PASSES; pass++) {
+        if (counts[pass][radix_digit(from_keys[0], pass)] == n)
+            continue;
+
+        /* Turn the counts into the position of the first pair with each
+         * digit.
+         */
+        for (digit = 0, pos = 0; digit < RADIX_SIZE; digit++) {
+            count = counts[pass][digit];
+            counts[pass][digit] = pos;
+            pos += count;
+        }
+
+        for (i = 0; i < n; i++) {
+            pos = counts[pass][radix_digit(from_keys[i], pass)]++;
+            to_keys[pos] = from_keys[i];
+            to_values[pos] = from_values[i];
+        }
+
+        tmp = from_keys;
+        from_keys = to_keys;
+        to_keys = tmp;
+
+        tmp = from_values;
+        from_values = to_values;
+        to_values = tmp;
+    }
+
+    /* An odd number of passes leaves the sorted pairs in the buffers. */
+    if (from_keys != keys) {
+        memcpy(keys, from_keys, n * sizeof(int));
+        memcpy(values, from_values, n * sizeof(int));
+    }
+
+    free(buf_keys);
+    free(buf_values);
+}
@@ -0,0 +1,15 @@
+/* This file declares the sort used by the optimized multimaps to load many
+ * (key, value) pairs at once.  Sorting the pairs by key first lets the tree
+ * be built from the bottom up, instead of searching it for every pair.
+ */
+
+#ifndef MM_SORT_H
+#define MM_SORT_H
+
+
+/* Sorts n (key, value) pairs by key, where keys[i] goes with values[i].  The
+ * sort is stable, so the values of each key stay in the order they were in.
+ */
+void sort_pairs(int *keys, int *values, int n);
+
+#endif
@@ -0,0 +1,69 @@
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mm_util.h"
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Allocates memory with malloc(), exiting the program if there isn't any. */
+void * alloc_or_abort(size_t size) {
+    return realloc_or_abort(NULL, size);
+}
+
+
+/* Resizes memory with realloc(), exiting the program if there isn't enough.
+ * If p is NULL, new memory is allocated.
+ */
+void * realloc_or_abort(void *p, size_t size) {
+    p = realloc(p, size);
+
+    if (p == NULL) {
+        fprintf(stderr, "Out of memory in multimap.\n");
+        abort();
+    }
+
+    return p;
+}
+
+
+/* Replaces the contents of the multimap with the same pairs, frozen into
+ * memory from the arena if frozen is not NULL, and added back with
+ * mm_build_from_sorted() otherwise.  frozen and arena are normally members of
+ * the multimap, which clear_multimap() resets before the pairs are stored
+ * again.  The pairs are copied out with a cursor, which gives them in key
+ * order, so that they can be stored again without sorting them.
+ */
+void rebuild_multimap(multimap *mm, frozen_multimap **frozen,
+                      mm_arena *arena) {
+    mm_iter iter;
+    int *keys, *values;
+    int n, i, key, value;
+
+    assert(frozen == NULL || arena != NULL);
+
+    n = 0;
+    mm_iter_seek(mm, &iter, INT_MIN);
+    while (mm_iter_next(&iter, &key, &value))
+        n++;
+
+    keys = alloc_or_abort((n + 1) * sizeof(int));
+    values = alloc_or_abort((n + 1) * sizeof(int));
+
+    mm_iter_seek(mm, &iter, INT_MIN);
+    for (i = 0; i < n; i++)
+        mm_iter_next(&iter, &keys[i], &values[i]);
+
+    clear_multimap(mm);
+    if (frozen != NULL)
+        *frozen = freeze_pairs(keys, values, n, arena);
+    else
+        mm_build_from_sorted(mm, keys, values, n);
+
+    free(keys);
+    free(values);
+}
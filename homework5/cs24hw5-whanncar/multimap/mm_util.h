@@ -0,0 +1,33 @@
+/* This file declares helpers shared by the optimized multimap
+ * implementations:  allocating temporary memory, and storing the pairs of a
+ * multimap again in a different form.
+ *
+ * The helpers use the multimap API, so the concurrent multimap's shards link
+ * with a copy of them compiled with the shards' names for the API.
+ */
+
+#ifndef MM_UTIL_H
+#define MM_UTIL_H
+
+#include <stddef.h>
+
+#include "multimap.h"
+#include "mm_arena.h"
+#include "mm_frozen.h"
+
+
+/* Allocates memory with malloc(), exiting the program if there isn't any. */
+void * alloc_or_abort(size_t size);
+
+/* Resizes memory with realloc(), exiting the program if there isn't enough. */
+void * realloc_or_abort(void *p, size_t size);
+
+/* Replaces the contents of a multimap with the same pairs.  If frozen is not
+ * NULL, the pairs are frozen into memory from the specified arena, and
+ * *frozen is set to the frozen multimap; otherwise they are added back with
+ * mm_build_from_sorted().
+ */
+void rebuild_multimap(multimap *mm, frozen_multimap **frozen,
+                      mm_arena *arena);
+
+#endif
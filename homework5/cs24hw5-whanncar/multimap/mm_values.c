@@ -0,0 +1,552 @@
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "mm_util.h"
+#include "mm_values.h"
+
+
+/* The number of values in the first chunk of a list, and the most values any
+ * chunk can hold.  Both must be multiples of 4, so that chunks hold whole
+ * SSE registers' worth of values.
+ */
+#define FIRST_CHUNK_SIZE 4
+#define MAX_CHUNK_SIZE 1024
+
+/* A list builds its index when it starts a chunk of this size; since chunk
+ * sizes double from FIRST_CHUNK_SIZE, the list holds 28 values at that point.
+ * Shorter lists are faster to scan than to index.
+ */
+#define INDEX_CHUNK_SIZE 32
+
+/* The most distinct values a sorted index holds.  Adding a value to a sorted
+ * index moves half the array on average, so large sets use another form.
+ */
+#define MAX_SORTED_VALUES 64
+
+/* A bitmap index is used when it needs no more than this many bits per
+ * distinct value, which is no more space than a sorted array of the values.
+ * Sparser values go into a hash set.
+ */
+#define MAX_BITS_PER_VALUE 32
+
+/* The value that marks empty slots in a hash set.  Whether the set contains
+ * this value itself is recorded separately.
+ */
+#define EMPTY_SLOT INT_MIN
+
+
+/*============================================================================
+ * TYPES
+ *============================================================================*/
+
+/* The forms an index can take. */
+typedef enum index_kind {
+    /* A sorted array of the values, searched with a binary search. */
+    SORTED_INDEX,
+
+    /* A bitmap with one bit for each value in a range of values. */
+    BITMAP_INDEX,
+
+    /* A hash set of the values, using open addressing. */
+    HASH_INDEX
+} index_kind;
+
+
+/* The index of the distinct values in a list.  Duplicate values are only
+ * indexed once, so the size of the index can be much less than the length of
+ * the list.
+ */
+struct value_index {
+    index_kind kind;
+
+    /* The number of distinct values in the index, and the smallest and
+     * largest of them.
+     */
+    unsigned int size;
+    int min_value;
+    int max_value;
+
+    /* For a sorted index, the length of the values array; for a hash set,
+     * the number of slots, which is a power of two; and for a bitmap, the
+     * number of bits, which is a multiple of 32.
+     */
+    unsigned int capacity;
+
+    /* The sorted array or hash set slots. */
+    int *values;
+
+    /* For a hash set, nonzero if the set contains EMPTY_SLOT. */
+    int contains_empty_slot;
+
+    /* For a bitmap, the bits, and the value that bit 0 stands for. */
+    unsigned int *bits;
+    int base;
+
+    /* The arena that the index's arrays are allocated from.  When the index
+     * outgrows an array, the old array stays in the arena until the arena is
+     * cleared; since arrays at least double when they grow, this wastes at
+     * most as much memory as the index uses.
+     */
+    mm_arena *arena;
+};
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *============================================================================*/
+
+value_chunk * alloc_value_chunk(int max_size, mm_arena *arena);
+
+value_index * build_value_index(const value_list *list, mm_arena *arena);
+int index_contains_value(const value_index *index, int value);
+void add_value_to_index(value_index *index, int value);
+int * get_index_values(const value_index *index);
+
+unsigned int find_sorted_position(const int *values, unsigned int size,
+                                  int value);
+void add_value_to_sorted(value_index *index, int value);
+unsigned int hash_value(int value);
+void add_value_to_hash(value_index *index, int value);
+void make_hash_index(value_index *index, const int *values, int num_values,
+                     unsigned int capacity);
+void make_bitmap_index(value_index *index, const int *values, int num_values,
+                       long long first, long long last);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Allocates an empty chunk with room for the specified number of values from
+ * an arena.
+ */
+value_chunk * alloc_value_chunk(int max_size, mm_arena *arena) {
+    value_chunk *chunk;
+
+    chunk = arena_alloc(arena, sizeof(value_chunk) + max_size * sizeof(int),
+                        sizeof(void *));
+    chunk->next = NULL;
+    chunk->size = 0;
+    chunk->max_size = max_size;
+
+    return chunk;
+}
+
+
+/* Returns nonzero if the specified value is among the first size values of
+ * the array.  With SSE2, the values are compared 16 at a time; the compares
+ * are combined before testing the result, so there is only one branch per 16
+ * values.
+ */
+int chunk_contains_value(const int *values, int size, int value) {
+    int i = 0;
+
+#ifdef __SSE2__
+    __m128i target = _mm_set1_epi32(value);
+    const __m128i *p;
+    __m128i a, b, c, d;
+
+    for (; i + 16 <= size; i += 16) {
+        p = (const __m128i *) (values + i);
+        a = _mm_cmpeq_epi32(_mm_loadu_si128(p), target);
+        b = _mm_cmpeq_epi32(_mm_loadu_si128(p + 1), target);
+        c = _mm_cmpeq_epi32(_mm_loadu_si128(p + 2), target);
+        d = _mm_cmpeq_epi32(_mm_loadu_si128(p + 3), target);
+
+        a = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+        if (_mm_movemask_epi8(a) != 0)
+            return 1;
+    }
+
+    for (; i + 4 <= size; i += 4) {
+        p = (const __m128i *) (values + i);
+        a = _mm_cmpeq_epi32(_mm_loadu_si128(p), target);
+        if (_mm_movemask_epi8(a) != 0)
+            return 1;
+    }
+#endif
+
+    for (; i < size; i++) {
+        if (values[i] == value)
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/* Builds the index of the values in a list, allocating it from an arena. */
+value_index * build_value_index(const value_list *list, mm_arena *arena) {
+    value_index *index;
+    const value_chunk *chunk;
+    int i;
+
+    index = arena_alloc(arena, sizeof(value_index), sizeof(void *));
+    bzero(index, sizeof(value_index));
+    index->kind = SORTED_INDEX;
+    index->arena = arena;
+
+    for (chunk = list->first; chunk != NULL; chunk = chunk->next) {
+        for (i = 0; i < chunk->size; i++)
+            add_value_to_index(index, chunk->values[i]);
+    }
+
+    return index;
+}
+
+
+/* Returns nonzero if an index contains the specified value. */
+int index_contains_value(const value_index *index, int value) {
+    unsigned int offset, mask, i, pos;
+
+    switch (index->kind) {
+    case SORTED_INDEX:
+        pos = find_sorted_position(index->values, index->size, value);
+        return pos < index->size && index->values[pos] == value;
+
+    case BITMAP_INDEX:
+        /* Values below the base wrap around to large offsets. */
+        offset = (unsigned int) value - (unsigned int) index->base;
+        return offset < index->capacity &&
+               ((index->bits[offset / 32] >> (offset % 32)) & 1);
+
+    case HASH_INDEX:
+        if (value == EMPTY_SLOT)
+            return index->contains_empty_slot;
+
+        mask = index->capacity - 1;
+        for (i = hash_value(value) & mask; index->values[i] != EMPTY_SLOT;
+             i = (i + 1) & mask) {
+            if (index->values[i] == value)
+                return 1;
+        }
+        return 0;
+    }
+
+    assert(0);
+    return 0;
+}
+
+
+/* Adds a value to an index, if it isn't already in it.  The index changes
+ * form when a sorted index is full, or when a value falls outside a bitmap's
+ * range:  it becomes a bitmap if the values are dense enough, and a hash set
+ * otherwise.
+ */
+void add_value_to_index(value_index *index, int value) {
+    unsigned int offset;
+    long long first, last;
+    int *values, num_values;
+
+    if (index_contains_value(index, value))
+        return;
+
+    if (index->size == 0 || value < index->min_value)
+        index->min_value = value;
+    if (index->size == 0 || value > index->max_value)
+        index->max_value = value;
+
+    switch (index->kind) {
+    case SORTED_INDEX:
+        if (index->size < MAX_SORTED_VALUES) {
+            add_value_to_sorted(index, value);
+            return;
+        }
+        break;
+
+    case BITMAP_INDEX:
+        offset = (unsigned int) value - (unsigned int) index->base;
+        if (offset < index->capacity) {
+            index->bits[offset / 32] |= 1u << (offset % 32);
+            index->size++;
+            return;
+        }
+        break;
+
+    case HASH_INDEX:
+        add_value_to_hash(index, value);
+        return;
+    }
+
+    /* The index has to be rebuilt in a new form. */
+    values = get_index_values(index);
+    num_values = index->size + 1;
+    values[index->size] = value;
+
+    first = index->min_value;
+    last = index->max_value;
+    if (last - first + 1 <= (long long) MAX_BITS_PER_VALUE * num_values) {
+        /* If a bitmap is being outgrown, at least double it, in the direction
+         * it was outgrown in; otherwise adding increasing or decreasing values
+         * would rebuild it every time.
+         */
+        if (index->kind == BITMAP_INDEX) {
+            if (value < index->base) {
+                if (first > last - 2LL * index->capacity + 1)
+                    first = last - 2LL * index->capacity + 1;
+                if (first < INT_MIN)
+                    first = INT_MIN;
+            }
+            else {
+                if (last < first + 2LL * index->capacity - 1)
+                    last = first + 2LL * index->capacity - 1;
+                if (last > INT_MAX)
+                    last = INT_MAX;
+            }
+        }
+
+        make_bitmap_index(index, values, num_values, first, last);
+    }
+    else {
+        make_hash_index(index, values, num_values, 4 * MAX_SORTED_VALUES);
+    }
+
+    free(values);
+}
+
+
+/* Returns a newly allocated array of the distinct values in an index, in no
+ * particular order.  The array has room for one more value at the end.
+ */
+int * get_index_values(const value_index *index) {
+    int *values = alloc_or_abort((index->size + 1) * sizeof(int));
+    unsigned int i, n = 0;
+
+    switch (index->kind) {
+    case SORTED_INDEX:
+        memcpy(values, index->values, index->size * sizeof(int));
+        n = index->size;
+        break;
+
+    case BITMAP_INDEX:
+        for (i = 0; i < index->capacity; i++) {
+            if ((index->bits[i / 32] >> (i % 32)) & 1)
+                values[n++] = (int) ((unsigned int) index->base + i);
+        }
+        break;
+
+    case HASH_INDEX:
+        for (i = 0; i < index->capacity; i++) {
+            if (index->values[i] != EMPTY_SLOT)
+                values[n++] = index->values[i];
+        }
+        if (index->contains_empty_slot)
+            values[n++] = EMPTY_SLOT;
+        break;
+    }
+
+    assert(n == index->size);
+    return values;
+}
+
+
+/* Returns the position of the first value in a sorted array that is not less
+ * than the specified value, or size if there isn't one.
+ */
+unsigned int find_sorted_position(const int *values, unsigned int size,
+                                  int value) {
+    unsigned int low = 0, high = size, mid;
+
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (values[mid] < value)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+
+/* Adds a value that isn't already in a sorted index to it. */
+void add_value_to_sorted(value_index *index, int value) {
+    unsigned int pos;
+    int *values;
+
+    if (index->size == index->capacity) {
+        index->capacity = (index->capacity == 0) ? 8 : 2 * index->capacity;
+        values = arena_alloc(index->arena, index->capacity * sizeof(int),
+                             sizeof(int));
+        if (index->size > 0)
+            memcpy(values, index->values, index->size * sizeof(int));
+        index->values = values;
+    }
+
+    pos = find_sorted_position(index->values, index->size, value);
+    memmove(index->values + pos + 1, index->values + pos,
+            (index->size - pos) * sizeof(int));
+    index->values[pos] = value;
+    index->size++;
+}
+
+
+/* Hashes a value for the hash set.  Nearby values are common, so the bits
+ * are mixed well enough that they don't land in runs of adjacent slots.
+ */
+unsigned int hash_value(int value) {
+    unsigned int h = (unsigned int) value * 2654435761u;
+    return h ^ (h >> 16);
+}
+
+
+/* Adds a value that isn't already in a hash set to it, growing the set so
+ * that it is never more than half full.
+ */
+void add_value_to_hash(value_index *index, int value) {
+    unsigned int mask, i;
+    int *values;
+
+    if (value == EMPTY_SLOT) {
+        index->contains_empty_slot = 1;
+        index->size++;
+        return;
+    }
+
+    if (2 * (index->size + 1) > index->capacity) {
+        values = get_index_values(index);
+        make_hash_index(index, values, index->size, 2 * index->capacity);
+        free(values);
+    }
+
+    mask = index->capacity - 1;
+    for (i = hash_value(value) & mask; index->values[i] != EMPTY_SLOT;
+         i = (i + 1) & mask);
+
+    index->values[i] = value;
+    index->size++;
+}
+
+
+/* Replaces the contents of an index with a hash set of the specified
+ * distinct values, with at least the specified number of slots.
+ */
+void make_hash_index(value_index *index, const int *values, int num_values,
+                     unsigned int capacity) {
+    unsigned int i;
+    int j;
+
+    while (capacity < 2 * (unsigned int) num_values)
+        capacity *= 2;
+
+    index->kind = HASH_INDEX;
+    index->size = 0;
+    index->capacity = capacity;
+    index->contains_empty_slot = 0;
+    index->bits = NULL;
+    index->values = arena_alloc(index->arena, capacity * sizeof(int),
+                                sizeof(int));
+    for (i = 0; i < capacity; i++)
+        index->values[i] = EMPTY_SLOT;
+
+    for (j = 0; j < num_values; j++)
+        add_value_to_hash(index, values[j]);
+}
+
+
+/* Replaces the contents of an index with a bitmap of the specified distinct
+ * values, covering at least the values from first to last.
+ */
+void make_bitmap_index(value_index *index, const int *values, int num_values,
+                       long long first, long long last) {
+    unsigned int num_words, offset;
+    int i;
+
+    assert(last - first < (long long) UINT_MAX - 31);
+    num_words = (unsigned int) ((last - first + 32) / 32);
+
+    index->kind = BITMAP_INDEX;
+    index->size = num_values;
+    index->base = (int) first;
+    index->capacity = 32 * num_words;
+    index->values = NULL;
+    index->bits = arena_alloc(index->arena, num_words * sizeof(unsigned int),
+                              sizeof(unsigned int));
+    bzero(index->bits, num_words * sizeof(unsigned int));
+
+    for (i = 0; i < num_values; i++) {
+        offset = (unsigned int) values[i] - (unsigned int) index->base;
+        index->bits[offset / 32] |= 1u << (offset % 32);
+    }
+}
+
+
+/* Adds a value to the end of a list of values, allocating any memory the
+ * list needs from an arena.
+ */
+void add_value_to_value_list(value_list *list, int value, mm_arena *arena) {
+    value_chunk *chunk = list->last;
+    int max_size;
+
+    if (chunk == NULL) {
+        chunk = alloc_value_chunk(FIRST_CHUNK_SIZE, arena);
+        list->first = list->last = chunk;
+    }
+    else if (chunk->size == chunk->max_size) {
+        /* Start a new chunk, twice as big as the last one. */
+        max_size = 2 * chunk->max_size;
+        if (max_size > MAX_CHUNK_SIZE)
+            max_size = MAX_CHUNK_SIZE;
+
+        chunk->next = alloc_value_chunk(max_size, arena);
+        chunk = chunk->next;
+        list->last = chunk;
+
+        if (max_size == INDEX_CHUNK_SIZE)
+            list->index = build_value_index(list, arena);
+    }
+
+    chunk->values[chunk->size] = value;
+    chunk->size++;
+
+    if (list->index != NULL)
+        add_value_to_index(list->index, value);
+}
+
+
+/* Returns nonzero if a list of values contains the specified value. */
+int value_list_contains_value(const value_list *list, int value) {
+    const value_chunk *chunk;
+
+    if (list->index != NULL)
+        return index_contains_value(list->index, value);
+
+    for (chunk = list->first; chunk != NULL; chunk = chunk->next) {
+        if (chunk_contains_value(chunk->values, chunk->size, value))
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/* Starts loading the start of a list of values into the cache, so that
+ * searching the list soon after doesn't have to wait for it.
+ */
+void prefetch_value_list(const value_list *list) {
+    if (list->index != NULL)
+        __builtin_prefetch(list->index);
+    else if (list->first != NULL)
+        __builtin_prefetch(list->first);
+}
+
+
+/* Passes each value in a list to the specified function, along with the
+ * specified key, in the order the values were added.
+ */
+void value_list_traverse(const value_list *list, int key,
+                         void (*f)(int key, int value)) {
+    const value_chunk *chunk;
+    int i;
+
+    for (chunk = list->first; chunk != NULL; chunk = chunk->next) {
+        for (i = 0; i < chunk->size; i++)
+            f(key, chunk->values[i]);
+    }
+}
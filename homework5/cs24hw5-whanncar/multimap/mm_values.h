@@ -0,0 +1,81 @@
+/* This file declares the storage for the values associated with each key of
+ * the optimized multimaps.  The values of a key are kept in a list of
+ * contiguous chunks of memory, rather than in one separately allocated node
+ * per value, so that searching them is a linear scan through memory instead
+ * of a chain of pointers.  The values are kept in the order they were added.
+ *
+ * Once a key has more than a few values, scanning them all for every lookup
+ * gets slow, so the list also builds an index of its distinct values.  The
+ * index starts out as a sorted array, and becomes a bitmap or a hash set when
+ * it grows, depending on how spread out the values are.
+ *
+ * All the memory used by the lists is allocated from the multimap's arena,
+ * and is released when the arena is cleared.
+ */
+
+#ifndef MM_VALUES_H
+#define MM_VALUES_H
+
+#include "mm_arena.h"
+
+
+/* A chunk of values.  Each chunk is twice the size of the one before it, up
+ * to a limit, so a key with few values wastes little space and a key with
+ * many values needs few chunks.
+ */
+typedef struct value_chunk {
+    /* The next chunk in the list, or NULL for the last chunk. */
+    struct value_chunk *next;
+
+    /* The number of values in the chunk, and the number it has room for. */
+    int size;
+    int max_size;
+
+    /* The values themselves. */
+    int values[];
+} value_chunk;
+
+
+/* The index of the distinct values in a list; see mm_values.c. */
+typedef struct value_index value_index;
+
+
+/* The values associated with a key.  A list whose members are all NULL is
+ * empty, so a zeroed-out list needs no further initialization.
+ */
+typedef struct value_list {
+    value_chunk *first;
+    value_chunk *last;
+
+    /* The index of the values in the list, or NULL if the list is still
+     * short enough to search directly.
+     */
+    value_index *index;
+} value_list;
+
+
+/* Adds a value to the end of a list of values, allocating any memory the
+ * list needs from an arena.
+ */
+void add_value_to_value_list(value_list *list, int value, mm_arena *arena);
+
+/* Returns nonzero if a list of values contains the specified value. */
+int value_list_contains_value(const value_list *list, int value);
+
+/* Starts loading the start of a list of values into the cache, so that
+ * searching the list soon after doesn't have to wait for it.
+ */
+void prefetch_value_list(const value_list *list);
+
+/* Passes each value in a list to the specified function, along with the
+ * specified key, in the order the values were added.
+ */
+void value_list_traverse(const value_list *list, int key,
+                         void (*f)(int key, int value));
+
+/* Returns nonzero if the specified value is among the first size values of
+ * an array.  This is the scan used to search each chunk of a list.
+ */
+int chunk_contains_value(const int *values, int size, int value);
+
+#endif
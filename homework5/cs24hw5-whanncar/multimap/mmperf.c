@@ -1,6 +1,8 @@
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "multimap.h"
 #include "realtime.h"
@@ -25,13 +27,60 @@
 #define EXCLUDE_SLOW_TESTS 0
 
 
+/* Set by the -b option:  instead of timing the probes one way, time them
+ * with mm_contains_pair() and with mm_contains_pairs(), and report the
+ * speedup of the batched probes.
+ */
+int batch_mode = 0;
+
+/* Set by the -f option:  freeze the multimap with mm_freeze() after it is
+ * populated, and before it is probed.
+ */
+int freeze_mode = 0;
+
+/* Set by the -t option:  if this is more than zero, the probes are run on
+ * 1, 2, 4, ... up to this many threads at once, and the total number of
+ * probes per second is reported for each number of threads.  Only use this
+ * with an implementation that can be probed by several threads at once.
+ */
+int max_threads = 0;
+
+
+/* The work of one thread of probes run by compare_thread_probes(). */
+typedef struct probe_thread {
+    pthread_t thread;
+    multimap *mm;
+    int num_probes;
+    int max_key;
+    int max_val;
+
+    /* The seed of the thread's own random numbers. */
+    unsigned int seed;
+
+    /* The number of probes that found their pair. */
+    int hits;
+} probe_thread;
+
+
+/* Returns the current wall-clock time in microseconds. */
+long long int current_time_us() {
+    struct timespec ts;
+
+    clock_get_realtime(&ts);
+    return (ts.tv_sec * 1000000LL) + (ts.tv_nsec / 1000);
+}
+
+
 /* Populate the multimap with a specific number of key/value pairs.  The keys
  * can be generated in one of three ways, either randomly, incrementing, or
- * decrementing.
+ * decrementing.  The pairs are all generated first, and then added to the
+ * multimap at once with mm_add_values(); the time that takes is reported.
  */
 void populate_multimap(multimap *mm, int num_pairs, int keygen_mode,
                        int max_key, int max_val) {
     int i, key, value;
+    int *keys, *values;
+    long long int start_us, end_us;
 
     assert(mm != NULL);
     assert(num_pairs > 0);
@@ -42,6 +91,10 @@ void populate_multimap(multimap *mm, int num_pairs, int keygen_mode,
     printf("Adding %d pairs to multimap.  Keys in range [0, %d), "
            "values in range [0, %d).\n", num_pairs, max_key, max_val);
 
+    keys = malloc(num_pairs * sizeof(int));
+    values = malloc(num_pairs * sizeof(int));
+    assert(keys != NULL && values != NULL);
+
     /* Add a bunch of (key, value) pairs to the multimap. */
     for (i = 0; i < num_pairs; i++) {
         if (keygen_mode == MODE_RAND) {
@@ -74,8 +127,19 @@ void populate_multimap(multimap *mm, int num_pairs, int keygen_mode,
 #if VERBOSE
         printf("Adding:  (%d, %d)\n", key, value);
 #endif
-        mm_add_value(mm, key, value);
+        keys[i] = key;
+        values[i] = value;
     }
+
+    start_us = current_time_us();
+    mm_add_values(mm, keys, values, num_pairs);
+    end_us = current_time_us();
+
+    printf("Load time:  %.2f seconds\n",
+           (double) (end_us - start_us) / 1000000.0);
+
+    free(keys);
+    free(values);
 }
 
 
@@ -113,6 +177,213 @@ int probe_multimap(multimap *mm, int num_probes, int max_key, int max_val) {
 }
 
 
+/* Fills in a set of random pairs to probe the multimap with. */
+void make_probes(int *keys, int *values, int num_probes, int max_key,
+                 int max_val) {
+    int i;
+
+    for (i = 0; i < num_probes; i++) {
+        keys[i] = rand() % max_key;
+        values[i] = rand() % max_val;
+    }
+}
+
+
+/* Probes the multimap with each of the specified pairs, with one
+ * mm_contains_pair() call per probe.  Returns the time this took in
+ * microseconds, and stores the number of probes that were found in *hits.
+ */
+long long int time_single_probes(multimap *mm, const int *keys,
+                                 const int *values, int num_probes,
+                                 int *hits) {
+    int i, total;
+    long long int start_us;
+
+    start_us = current_time_us();
+    for (i = 0, total = 0; i < num_probes; i++) {
+        if (mm_contains_pair(mm, keys[i], values[i]))
+            total++;
+    }
+
+    *hits = total;
+    return current_time_us() - start_us;
+}
+
+
+/* Probes the multimap with each of the specified pairs, with a single call to
+ * mm_contains_pairs().  Returns the time this took in microseconds.  The
+ * results are then checked against mm_contains_pair(), outside of the timing;
+ * the program exits if they don't match.
+ */
+long long int time_batched_probes(multimap *mm, const int *keys,
+                                  const int *values, int *results,
+                                  int num_probes) {
+    int i;
+    long long int start_us, batch_us;
+
+    start_us = current_time_us();
+    mm_contains_pairs(mm, keys, values, results, num_probes);
+    batch_us = current_time_us() - start_us;
+
+    for (i = 0; i < num_probes; i++) {
+        if (results[i] != mm_contains_pair(mm, keys[i], values[i])) {
+            printf("Batched probe of (%d, %d) found %d, but a single probe "
+                   "found %d!\n", keys[i], values[i], results[i],
+                   mm_contains_pair(mm, keys[i], values[i]));
+            exit(1);
+        }
+    }
+
+    return batch_us;
+}
+
+
+/* Reports the times of one round of compare_batch_probes(). */
+void report_batch_round(const char *order, long long int scalar_us,
+                        long long int batch_us, int num_probes) {
+    printf("%s:\n", order);
+    printf("  Single probes:   %.2f seconds\t\tus per probe:  %.3f us\n",
+           (double) scalar_us / 1000000.0,
+           (double) scalar_us / (double) num_probes);
+    printf("  Batched probes:  %.2f seconds\t\tus per probe:  %.3f us\n",
+           (double) batch_us / 1000000.0,
+           (double) batch_us / (double) num_probes);
+    printf("  Batch speedup:  %.2fx\n", batch_us > 0 ?
+           (double) scalar_us / (double) batch_us : 0.0);
+}
+
+
+/* Times the probes of the multimap with one mm_contains_pair() call per probe,
+ * and with a single call to mm_contains_pairs().  Every pass probes its own
+ * set of random pairs, so that no pass finds the tree nodes for its probes
+ * already in the cache because the pass before it just visited them.  The
+ * two passes are timed twice, single probes first and then batched probes
+ * first, and the speedup of each round is reported, so that going second
+ * doesn't favor either one.  Returns the number of probes found by the first
+ * pass.
+ */
+int compare_batch_probes(multimap *mm, int num_probes, int max_key,
+                         int max_val) {
+    int *keys[4], *values[4], *results;
+    int i, total, hits;
+    long long int scalar_us, batch_us;
+
+    printf("Probing multimap %d times, one at a time and batched.  Keys in "
+           "range [0, %d), values in range [0, %d).\n", num_probes, max_key,
+           max_val);
+
+    for (i = 0; i < 4; i++) {
+        keys[i] = malloc(num_probes * sizeof(int));
+        values[i] = malloc(num_probes * sizeof(int));
+        assert(keys[i] != NULL && values[i] != NULL);
+        make_probes(keys[i], values[i], num_probes, max_key, max_val);
+    }
+    results = malloc(num_probes * sizeof(int));
+    assert(results != NULL);
+
+    scalar_us = time_single_probes(mm, keys[0], values[0], num_probes,
+                                   &total);
+    batch_us = time_batched_probes(mm, keys[1], values[1], results,
+                                   num_probes);
+    report_batch_round("Single, then batched", scalar_us, batch_us,
+                       num_probes);
+
+    batch_us = time_batched_probes(mm, keys[2], values[2], results,
+                                   num_probes);
+    scalar_us = time_single_probes(mm, keys[3], values[3], num_probes, &hits);
+    report_batch_round("Batched, then single", scalar_us, batch_us,
+                       num_probes);
+
+    for (i = 0; i < 4; i++) {
+        free(keys[i]);
+        free(values[i]);
+    }
+    free(results);
+
+    return total;
+}
+
+
+/* The body of each thread run by compare_thread_probes():  probes the
+ * multimap with random pairs, and counts how many are found.
+ */
+void * run_probe_thread(void *arg) {
+    probe_thread *pt = arg;
+    int i, key, value;
+
+    pt->hits = 0;
+    for (i = 0; i < pt->num_probes; i++) {
+        key = rand_r(&pt->seed) % pt->max_key;
+        value = rand_r(&pt->seed) % pt->max_val;
+
+        if (mm_contains_pair(pt->mm, key, value))
+            pt->hits++;
+    }
+
+    return NULL;
+}
+
+
+/* Probes the multimap from 1, 2, 4, ... up to max_threads threads at once,
+ * each doing num_probes probes, and reports the total number of probes per
+ * second for each number of threads, and how that compares to one thread.
+ */
+void compare_thread_probes(multimap *mm, int num_probes, int max_key,
+                           int max_val) {
+    probe_thread threads[max_threads];
+    long long int start_us, elapsed_us;
+    double probes_per_sec, one_thread_rate = 0.0;
+    int num_threads, i, hits;
+
+    printf("Probing multimap %d times on each thread.  Keys in range [0, %d), "
+           "values in range [0, %d).\n", num_probes, max_key, max_val);
+
+    num_threads = 1;
+    while (1) {
+        start_us = current_time_us();
+        for (i = 0; i < num_threads; i++) {
+            threads[i].mm = mm;
+            threads[i].num_probes = num_probes;
+            threads[i].max_key = max_key;
+            threads[i].max_val = max_val;
+            threads[i].seed = 11 + i;
+            if (pthread_create(&threads[i].thread, NULL, run_probe_thread,
+                               &threads[i]) != 0) {
+                fprintf(stderr, "Couldn't start probe thread.\n");
+                exit(1);
+            }
+        }
+
+        hits = 0;
+        for (i = 0; i < num_threads; i++) {
+            pthread_join(threads[i].thread, NULL);
+            hits += threads[i].hits;
+        }
+        elapsed_us = current_time_us() - start_us;
+        if (elapsed_us == 0)
+            elapsed_us = 1;
+
+        probes_per_sec = (double) num_threads * num_probes * 1000000.0 /
+                         (double) elapsed_us;
+        if (num_threads == 1)
+            one_thread_rate = probes_per_sec;
+
+        printf("%2d thread%s:  %.2f seconds\t\tprobes/sec:  %.0f  (%.2fx)  "
+               "hits:  %.1f%%\n", num_threads, num_threads == 1 ? " " : "s",
+               (double) elapsed_us / 1000000.0, probes_per_sec,
+               probes_per_sec / one_thread_rate,
+               (double) hits * 100.0 / ((double) num_threads * num_probes));
+
+        if (num_threads == max_threads)
+            break;
+
+        num_threads *= 2;
+        if (num_threads > max_threads)
+            num_threads = max_threads;
+    }
+}
+
+
 /* Performs a single performance test against the multimap:
  *   1)  Generates key/value pairs to add to the map, using either incrementing,
  *       decrementing, or random key generation, and the specified maximum key
@@ -121,11 +392,15 @@ int probe_multimap(multimap *mm, int num_probes, int max_key, int max_val) {
  *   2)  Performs the specified number of probes, measuring the total wall-clock
  *       time that is required to perform the test.  This is not a particularly
  *       accurate way to measure the performance, but it should work well enough.
+ *       In batch mode, the probes are instead timed both one at a time and
+ *       batched; see compare_batch_probes().  With -t, they are timed on
+ *       different numbers of threads; see compare_thread_probes().  With -f,
+ *       the multimap is frozen before it is probed, and the time taken to
+ *       freeze it is reported.
  */
 void test_multimap_perf(int num_pairs, int num_probes, int keygen_mode,
                         int max_key, int max_val) {
     multimap *mm;
-    struct timespec ts;
     int total_hits;
     long long int start_us, end_us;
     double total_seconds, us_per_probe;
@@ -141,13 +416,35 @@ void test_multimap_perf(int num_pairs, int num_probes, int keygen_mode,
 
     populate_multimap(mm, num_pairs, keygen_mode, max_key, max_val);
 
-    clock_get_realtime(&ts);
-    start_us = (ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+    if (freeze_mode) {
+        start_us = current_time_us();
+        mm_freeze(mm);
+        end_us = current_time_us();
 
-    total_hits = probe_multimap(mm, num_probes, max_key, max_val);
+        printf("Freeze time:  %.2f seconds\n",
+               (double) (end_us - start_us) / 1000000.0);
+    }
 
-    clock_get_realtime(&ts);
-    end_us = (ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+    if (max_threads > 0) {
+        compare_thread_probes(mm, num_probes, max_key, max_val);
+        printf("\n");
+
+        clear_multimap(mm);
+        return;
+    }
+
+    if (batch_mode) {
+        total_hits = compare_batch_probes(mm, num_probes, max_key, max_val);
+        printf("Total hits:  %d/%d (%.1f%%)\n\n", total_hits, num_probes,
+               (double) total_hits * 100.0 / (double) num_probes);
+
+        clear_multimap(mm);
+        return;
+    }
+
+    start_us = current_time_us();
+    total_hits = probe_multimap(mm, num_probes, max_key, max_val);
+    end_us = current_time_us();
 
     printf("Total hits:  %d/%d (%.1f%%)\n", total_hits, num_probes,
            (double) total_hits * 100.0 / (double) num_probes);
@@ -162,7 +459,33 @@ void test_multimap_perf(int num_pairs, int num_probes, int keygen_mode,
 }
 
 
-int main() {
+int main(int argc, char **argv) {
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-b") == 0) {
+            batch_mode = 1;
+        }
+        else if (strcmp(argv[i], "-f") == 0) {
+            freeze_mode = 1;
+        }
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc &&
+                 atoi(argv[i + 1]) > 0) {
+            max_threads = atoi(argv[i + 1]);
+            i++;
+        }
+        else {
+            fprintf(stderr, "usage: %s [-b] [-f] [-t N]\n", argv[0]);
+            fprintf(stderr, "\t-b\tcompare batched probes to single "
+                    "probes\n");
+            fprintf(stderr, "\t-f\tfreeze the multimap before probing "
+                    "it\n");
+            fprintf(stderr, "\t-t N\tprobe from 1, 2, 4, ... N threads at "
+                    "once\n");
+            return 1;
+        }
+    }
+
     srand(11);
 
     /* Arguments:  num_pairs, num_probes, keygen_mode, max_key, max_value */
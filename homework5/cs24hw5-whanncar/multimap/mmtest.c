@@ -1,3 +1,4 @@
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -44,7 +45,27 @@ int probe_keys[] = {
 };
 
 
+/* The number of keys added in order by the sequential-key test. */
+#define NUM_SEQUENTIAL_KEYS 2000
+
+/* The number of values given to each key by the many-values test. */
+#define NUM_MANY_VALUES 5000
+
+/* The number of pairs added by the bulk-load test, and the range of keys. */
+#define NUM_BULK_PAIRS 20000
+#define NUM_BULK_KEYS 3000
+
+/* The number of random ranges looked up by the range test. */
+#define NUM_RANDOM_RANGES 200
+
+/* The number of values given to one key by the freeze test, which is enough
+ * for the frozen multimap to keep a sorted copy of them.
+ */
+#define NUM_FROZEN_VALUES 200
+
+
 int prev_key;
+int num_pairs;
 
 void check_order(int key, int value) {
     printf(" * (%d, %d)", key, value);
@@ -59,6 +80,440 @@ void check_order(int key, int value) {
 }
 
 
+/* Like check_order(), but quiet, since the sequential-key test adds
+ * thousands of pairs.
+ */
+void count_in_order(int key, int value) {
+    if (key < prev_key) {
+        printf(" * (%d, %d) - OUT OF ORDER!\n", key, value);
+        failures++;
+    }
+    prev_key = key;
+    num_pairs++;
+}
+
+
+/* The pairs seen by record_pair(), in the order it saw them. */
+int traversed_keys[NUM_BULK_PAIRS];
+int traversed_values[NUM_BULK_PAIRS];
+
+/* Records each pair of a traversal, so that two traversals can be
+ * compared.  num_pairs must be zeroed first.
+ */
+void record_pair(int key, int value) {
+    if (num_pairs < NUM_BULK_PAIRS) {
+        traversed_keys[num_pairs] = key;
+        traversed_values[num_pairs] = value;
+    }
+    num_pairs++;
+}
+
+
+/* The position in traversed_keys[] and traversed_values[] of the pair that
+ * check_range_pair() expects next, and the number of pairs that weren't the
+ * expected ones.
+ */
+int range_pos;
+int range_mismatches;
+
+/* Checks each pair of a range against a recorded traversal of the whole
+ * multimap.  range_pos must be set to where the range starts first.
+ */
+void check_range_pair(int key, int value) {
+    if (range_pos >= num_pairs || key != traversed_keys[range_pos] ||
+        value != traversed_values[range_pos]) {
+        range_mismatches++;
+    }
+    range_pos++;
+}
+
+
+/* Returns the position of the first pair in the recorded traversal whose key
+ * is at least the specified key.
+ */
+int first_pair_at_least(int key) {
+    int i = 0;
+
+    while (i < num_pairs && traversed_keys[i] < key)
+        i++;
+
+    return i;
+}
+
+
+/* Adds keys in increasing and then decreasing order, which is the worst case
+ * for an unbalanced tree, and checks that every pair can still be found and
+ * is traversed in order.
+ */
+void test_sequential_keys() {
+    multimap *mm;
+    int i, missing = 0;
+
+    printf("\nAdding %d keys in increasing and decreasing order.\n",
+           NUM_SEQUENTIAL_KEYS);
+
+    mm = init_multimap();
+    for (i = 0; i < NUM_SEQUENTIAL_KEYS / 2; i++)
+        mm_add_value(mm, i, i + 1);
+    for (i = NUM_SEQUENTIAL_KEYS - 1; i >= NUM_SEQUENTIAL_KEYS / 2; i--)
+        mm_add_value(mm, i, i + 1);
+
+    for (i = 0; i < NUM_SEQUENTIAL_KEYS; i++) {
+        if (!mm_contains_pair(mm, i, i + 1) || mm_contains_pair(mm, i, i))
+            missing++;
+    }
+    if (mm_contains_key(mm, -1) || mm_contains_key(mm, NUM_SEQUENTIAL_KEYS))
+        missing++;
+
+    printf(" * All pairs present:  %s\n", missing == 0 ? "PASS" : "FAIL");
+    if (missing != 0)
+        failures++;
+
+    prev_key = -1;
+    num_pairs = 0;
+    mm_traverse(mm, count_in_order);
+
+    printf(" * Traversed all pairs in order:  %s\n",
+           num_pairs == NUM_SEQUENTIAL_KEYS ? "PASS" : "FAIL");
+    if (num_pairs != NUM_SEQUENTIAL_KEYS)
+        failures++;
+
+    clear_multimap(mm);
+    free(mm);
+}
+
+
+/* Gives a few keys thousands of values each:  a dense range of values added
+ * twice, widely spread values, and decreasing values.  Implementations that
+ * change how they store a key's values as it gets more of them should find
+ * every value in each case.
+ */
+void test_many_values() {
+    multimap *mm;
+    int i, missing = 0;
+
+    printf("\nAdding %d values to each of 3 keys.\n", NUM_MANY_VALUES);
+
+    mm = init_multimap();
+    for (i = 0; i < NUM_MANY_VALUES; i++) {
+        mm_add_value(mm, 0, i / 2);
+        mm_add_value(mm, 1, i * 100003);
+        mm_add_value(mm, 2, -i);
+    }
+
+    for (i = 0; i < NUM_MANY_VALUES; i++) {
+        if (!mm_contains_pair(mm, 1, i * 100003) ||
+            mm_contains_pair(mm, 1, i * 100003 + 1) ||
+            !mm_contains_pair(mm, 2, -i) || mm_contains_pair(mm, 2, i + 1)) {
+            missing++;
+        }
+    }
+    for (i = 0; i < NUM_MANY_VALUES / 2; i++) {
+        if (!mm_contains_pair(mm, 0, i) ||
+            mm_contains_pair(mm, 0, i + NUM_MANY_VALUES / 2)) {
+            missing++;
+        }
+    }
+
+    printf(" * All pairs present:  %s\n", missing == 0 ? "PASS" : "FAIL");
+    if (missing != 0)
+        failures++;
+
+    prev_key = -1;
+    num_pairs = 0;
+    mm_traverse(mm, count_in_order);
+
+    printf(" * Traversed all pairs in order:  %s\n",
+           num_pairs == 3 * NUM_MANY_VALUES ? "PASS" : "FAIL");
+    if (num_pairs != 3 * NUM_MANY_VALUES)
+        failures++;
+
+    clear_multimap(mm);
+    free(mm);
+}
+
+
+/* Adds random pairs to one multimap with mm_add_value(), and to another with
+ * two calls to mm_add_values(), the first to an empty multimap and the
+ * second to a full one.  Traversing the two multimaps should give the same
+ * pairs in the same order.  The pairs are also probed for in batches with
+ * mm_contains_pairs().
+ */
+void test_bulk_load() {
+    multimap *mm, *bulk_mm;
+    int keys[NUM_BULK_PAIRS], values[NUM_BULK_PAIRS], results[NUM_BULK_PAIRS];
+    int i, half = NUM_BULK_PAIRS / 2, mismatches = 0;
+
+    printf("\nAdding %d pairs at once.\n", NUM_BULK_PAIRS);
+
+    mm = init_multimap();
+    for (i = 0; i < NUM_BULK_PAIRS; i++) {
+        keys[i] = rand() % NUM_BULK_KEYS - NUM_BULK_KEYS / 2;
+        values[i] = rand();
+        mm_add_value(mm, keys[i], values[i]);
+    }
+
+    bulk_mm = init_multimap();
+    mm_add_values(bulk_mm, keys, values, half);
+    mm_add_values(bulk_mm, keys + half, values + half, NUM_BULK_PAIRS - half);
+
+    for (i = 0; i < NUM_BULK_PAIRS; i++) {
+        if (!mm_contains_pair(bulk_mm, keys[i], values[i]))
+            mismatches++;
+    }
+    if (mm_contains_key(bulk_mm, NUM_BULK_KEYS))
+        mismatches++;
+
+    printf(" * All pairs present:  %s\n", mismatches == 0 ? "PASS" : "FAIL");
+    if (mismatches != 0)
+        failures++;
+
+    /* Probe for all the pairs in one batch, and then for the same values
+     * with keys that aren't in the multimap.
+     */
+    mm_contains_pairs(bulk_mm, keys, values, results, NUM_BULK_PAIRS);
+    for (i = 0; i < NUM_BULK_PAIRS; i++) {
+        if (!results[i])
+            mismatches++;
+        keys[i] += NUM_BULK_KEYS;
+    }
+
+    mm_contains_pairs(bulk_mm, keys, values, results, NUM_BULK_PAIRS);
+    for (i = 0; i < NUM_BULK_PAIRS; i++) {
+        if (results[i])
+            mismatches++;
+    }
+
+    printf(" * All pairs found by batched probes:  %s\n",
+           mismatches == 0 ? "PASS" : "FAIL");
+    if (mismatches != 0)
+        failures++;
+
+    /* Record one traversal, then check the other against it. */
+    num_pairs = 0;
+    mm_traverse(mm, record_pair);
+    for (i = 0; i < NUM_BULK_PAIRS; i++) {
+        keys[i] = traversed_keys[i];
+        values[i] = traversed_values[i];
+    }
+
+    num_pairs = 0;
+    mm_traverse(bulk_mm, record_pair);
+    for (i = 0; i < NUM_BULK_PAIRS; i++) {
+        if (keys[i] != traversed_keys[i] || values[i] != traversed_values[i])
+            mismatches++;
+    }
+
+    printf(" * Traversed the same pairs in the same order:  %s\n",
+           num_pairs == NUM_BULK_PAIRS && mismatches == 0 ? "PASS" : "FAIL");
+    if (num_pairs != NUM_BULK_PAIRS || mismatches != 0)
+        failures++;
+
+    clear_multimap(mm);
+    free(mm);
+    clear_multimap(bulk_mm);
+    free(bulk_mm);
+}
+
+
+/* Looks up ranges of keys with mm_range() and with a cursor, and checks that
+ * each gives the same pairs as the matching part of a traversal of the whole
+ * multimap.  The ranges start and end between keys and outside of them.  If
+ * freeze is nonzero, the multimap is frozen before the ranges are looked up.
+ */
+void test_ranges(int freeze) {
+    multimap *mm;
+    mm_iter iter;
+    int ranges[] = {
+        INT_MIN, INT_MAX,  /* lo, hi */
+        -100, 100,
+        0, 1,
+        5, 5,
+        10, -10,
+        INT_MIN, -NUM_BULK_KEYS / 2 + 1,
+        NUM_BULK_KEYS / 2 - 1, INT_MAX,
+        NUM_BULK_KEYS, INT_MAX
+    };
+    int num_ranges = sizeof(ranges) / sizeof(int) / 2;
+    int i, lo, hi, first, last, key, value, bad_ranges = 0;
+
+    printf("\nLooking up %d ranges of keys%s.\n",
+           num_ranges + NUM_RANDOM_RANGES, freeze ? " after freezing" : "");
+
+    mm = init_multimap();
+
+    mm_iter_seek(mm, &iter, INT_MIN);
+    if (mm_iter_next(&iter, &key, &value))
+        bad_ranges++;
+
+    for (i = 0; i < NUM_BULK_PAIRS; i++) {
+        mm_add_value(mm, rand() % NUM_BULK_KEYS - NUM_BULK_KEYS / 2,
+                     rand() % 100);
+    }
+
+    num_pairs = 0;
+    mm_traverse(mm, record_pair);
+
+    if (freeze)
+        mm_freeze(mm);
+
+    for (i = 0; i < num_ranges + NUM_RANDOM_RANGES; i++) {
+        if (i < num_ranges) {
+            lo = ranges[2 * i];
+            hi = ranges[2 * i + 1];
+        }
+        else {
+            lo = rand() % (2 * NUM_BULK_KEYS) - NUM_BULK_KEYS;
+            hi = lo + rand() % (NUM_BULK_KEYS / 4);
+        }
+
+        first = first_pair_at_least(lo);
+        last = first_pair_at_least(hi);
+        if (last < first)
+            last = first;
+
+        range_mismatches = 0;
+        range_pos = first;
+        mm_range(mm, lo, hi, check_range_pair);
+        if (range_pos != last)
+            range_mismatches++;
+
+        range_pos = first;
+        mm_iter_seek(mm, &iter, lo);
+        while (mm_iter_next(&iter, &key, &value) && key < hi)
+            check_range_pair(key, value);
+        if (range_pos != last)
+            range_mismatches++;
+
+        if (range_mismatches != 0) {
+            printf(" * [%d, %d) - WRONG PAIRS!\n", lo, hi);
+            bad_ranges++;
+        }
+    }
+
+    /* A cursor started before every key should see every pair. */
+    range_mismatches = 0;
+    range_pos = 0;
+    mm_iter_seek(mm, &iter, INT_MIN);
+    while (mm_iter_next(&iter, &key, &value))
+        check_range_pair(key, value);
+    if (range_pos != num_pairs || range_mismatches != 0 ||
+        mm_iter_next(&iter, &key, &value)) {
+        bad_ranges++;
+    }
+
+    printf(" * Found the same pairs as a traversal:  %s\n",
+           bad_ranges == 0 ? "PASS" : "FAIL");
+    if (bad_ranges != 0)
+        failures++;
+
+    clear_multimap(mm);
+    free(mm);
+}
+
+
+/* Freezes a multimap, and checks that it still has the same pairs, probed
+ * one at a time and in batches, and traversed in the same order.  Adding a
+ * pair afterwards thaws the multimap, which should then still have them all.
+ */
+void test_freeze() {
+    multimap *mm;
+    int keys[NUM_BULK_PAIRS], values[NUM_BULK_PAIRS], results[NUM_BULK_PAIRS];
+    int i, n, mismatches = 0;
+
+    printf("\nFreezing a multimap.\n");
+
+    mm = init_multimap();
+    n = NUM_BULK_PAIRS - NUM_FROZEN_VALUES;
+    for (i = 0; i < n; i++) {
+        mm_add_value(mm, rand() % NUM_BULK_KEYS - NUM_BULK_KEYS / 2,
+                     rand() % 100);
+    }
+    for (i = 0; i < NUM_FROZEN_VALUES; i++)
+        mm_add_value(mm, NUM_BULK_KEYS, (i * 37) % (NUM_FROZEN_VALUES / 2));
+
+    num_pairs = 0;
+    mm_traverse(mm, record_pair);
+    for (i = 0; i < NUM_BULK_PAIRS; i++) {
+        keys[i] = traversed_keys[i];
+        values[i] = traversed_values[i];
+    }
+
+    mm_freeze(mm);
+    mm_freeze(mm);
+
+    /* Probe for every pair, and for pairs that aren't there:  keys that
+     * aren't in the multimap, and values that no key has.
+     */
+    for (i = 0; i < NUM_BULK_PAIRS; i++) {
+        if (!mm_contains_pair(mm, keys[i], values[i]) ||
+            !mm_contains_key(mm, keys[i]) ||
+            mm_contains_pair(mm, keys[i], values[i] + 100)) {
+            mismatches++;
+        }
+    }
+    if (mm_contains_key(mm, NUM_BULK_KEYS + 1) ||
+        mm_contains_key(mm, -NUM_BULK_KEYS)) {
+        mismatches++;
+    }
+
+    mm_contains_pairs(mm, keys, values, results, NUM_BULK_PAIRS);
+    for (i = 0; i < NUM_BULK_PAIRS; i++) {
+        if (!results[i])
+            mismatches++;
+        values[i] += 100;
+    }
+
+    mm_contains_pairs(mm, keys, values, results, NUM_BULK_PAIRS);
+    for (i = 0; i < NUM_BULK_PAIRS; i++) {
+        if (results[i])
+            mismatches++;
+        values[i] -= 100;
+    }
+
+    printf(" * All pairs found after freezing:  %s\n",
+           mismatches == 0 ? "PASS" : "FAIL");
+    if (mismatches != 0)
+        failures++;
+
+    num_pairs = 0;
+    mm_traverse(mm, record_pair);
+    for (i = 0; i < NUM_BULK_PAIRS; i++) {
+        if (keys[i] != traversed_keys[i] || values[i] != traversed_values[i])
+            mismatches++;
+    }
+
+    printf(" * Traversed the same pairs in the same order:  %s\n",
+           num_pairs == NUM_BULK_PAIRS && mismatches == 0 ? "PASS" : "FAIL");
+    if (num_pairs != NUM_BULK_PAIRS || mismatches != 0)
+        failures++;
+
+    /* Adding a pair thaws the multimap. */
+    mm_add_value(mm, NUM_BULK_KEYS + 1, 1);
+    for (i = 0; i < NUM_BULK_PAIRS; i++) {
+        if (!mm_contains_pair(mm, keys[i], values[i]))
+            mismatches++;
+    }
+    if (!mm_contains_pair(mm, NUM_BULK_KEYS + 1, 1))
+        mismatches++;
+
+    num_pairs = 0;
+    mm_traverse(mm, record_pair);
+    for (i = 0; i < NUM_BULK_PAIRS; i++) {
+        if (keys[i] != traversed_keys[i] || values[i] != traversed_values[i])
+            mismatches++;
+    }
+
+    printf(" * All pairs kept after adding to the frozen multimap:  %s\n",
+           num_pairs == NUM_BULK_PAIRS + 1 && mismatches == 0 ?
+           "PASS" : "FAIL");
+    if (num_pairs != NUM_BULK_PAIRS + 1 || mismatches != 0)
+        failures++;
+
+    clear_multimap(mm);
+    free(mm);
+}
+
 
 int main() {
     multimap *mm;
@@ -122,6 +577,13 @@ int main() {
     clear_multimap(mm);
     free(mm);
 
+    test_sequential_keys();
+    test_many_values();
+    test_bulk_load();
+    test_ranges(0);
+    test_ranges(1);
+    test_freeze();
+
     printf("\nFinal results:  %d failures\n", failures);
 
     return 0;
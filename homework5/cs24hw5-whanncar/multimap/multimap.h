@@ -13,6 +13,40 @@
 typedef struct multimap multimap;
 
 
+/* A cursor that walks through the (key, value) pairs of a multimap in key
+ * order.  The caller allocates the cursor, usually on the stack, and starts
+ * it with mm_iter_seek(); walking the multimap with a cursor needs no memory
+ * allocation or recursion.  Adding pairs to a multimap invalidates any
+ * cursors over it, unless its implementation says otherwise.
+ *
+ * The members of a cursor belong to the multimap implementation, and what
+ * they mean depends on how the multimap is implemented.
+ */
+typedef struct mm_iter {
+    /* The multimap being walked. */
+    multimap *mm;
+
+    /* Where the cursor is:  the node or leaf holding the current key, the
+     * position of the key within it, the key itself, and the position of the
+     * next value of the key.
+     */
+    void *node;
+    int slot;
+    int key;
+    const void *values;
+    int index;
+
+    /* Used by multimaps that are made up of several smaller multimaps:  which
+     * part the cursor is in, the version of that part the cursor's position
+     * was found in, and how many values of the current key have been
+     * returned.
+     */
+    int part;
+    unsigned int version;
+    int count;
+} mm_iter;
+
+
 /* Allocate and initialize a multimap data structure. */
 multimap * init_multimap();
 
@@ -24,6 +58,26 @@ void clear_multimap(multimap *mm);
 /* Adds the specified (key, value) pair to the multimap. */
 void mm_add_value(multimap *mm, int key, int value);
 
+/* Adds n (key, value) pairs to the multimap, where keys[i] goes with
+ * values[i].  This is the same as calling mm_add_value() on each pair in
+ * turn, but can be much faster.
+ */
+void mm_add_values(multimap *mm, const int *keys, const int *values, int n);
+
+/* Like mm_add_values(), but the keys must be in nondecreasing order.  This is
+ * the fastest way to fill an empty multimap.
+ */
+void mm_build_from_sorted(multimap *mm, const int *keys, const int *values,
+                          int n);
+
+/* Freezes the multimap:  converts it into a read-only form that is faster to
+ * probe and traverse.  This is meant for multimaps that are built once and
+ * then probed many times.  Adding pairs to a frozen multimap thaws it first,
+ * which costs about as much as building it again.  Freezing a multimap
+ * invalidates any cursors over it.
+ */
+void mm_freeze(multimap *mm);
+
 /* Returns nonzero if the multimap contains the specified key-value, zero
  * otherwise.
  */
@@ -34,10 +88,35 @@ int mm_contains_key(multimap *mm, int key);
  */
 int mm_contains_pair(multimap *mm, int key, int value);
 
+/* Probes the multimap for n (key, value) pairs at once, storing nonzero into
+ * results[i] if the pair (keys[i], values[i]) is in the multimap, and zero
+ * otherwise.  This gives the same results as calling mm_contains_pair() for
+ * each pair, but can be much faster.
+ */
+void mm_contains_pairs(multimap *mm, const int *keys, const int *values,
+                       int *results, int n);
+
 /* Performs an in-order traversal of the multimap, passing each (key, value)
  * pair to the specified function.
  */
 void mm_traverse(multimap *mm, void (*f)(int key, int value));
 
+/* Passes each (key, value) pair of the multimap with lo <= key < hi to the
+ * specified function, in key order.  This only visits the part of the
+ * multimap that is in the range.
+ */
+void mm_range(multimap *mm, int lo, int hi, void (*f)(int key, int value));
+
+/* Starts a cursor at the first pair of the multimap whose key is at least the
+ * specified key.
+ */
+void mm_iter_seek(multimap *mm, mm_iter *iter, int key);
+
+/* Stores the pair at a cursor into *key and *value, moves the cursor to the
+ * next pair, and returns nonzero.  If the cursor has passed the last pair,
+ * zero is returned instead.
+ */
+int mm_iter_next(mm_iter *iter, int *key, int *value);
+
 #endif
 
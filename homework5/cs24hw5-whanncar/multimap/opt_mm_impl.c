@@ -4,6 +4,10 @@
 #include <string.h>
 
 #include "multimap.h"
+#include "mm_frozen.h"
+#include "mm_sort.h"
+#include "mm_util.h"
+#include "mm_values.h"
 
 
 /*============================================================================
@@ -13,13 +17,32 @@
  *   be kept hidden to code outside this source file.  This is not for any
  *   security reason, but rather just so we can enforce that our testing
  *   programs are generic and don't have any access to implementation details.
+ *
+ *   The keys are kept in a red-black tree, so that the tree stays balanced no
+ *   matter what order the keys are added in.  A plain binary search tree
+ *   degenerates into a linked list when the keys are added in increasing or
+ *   decreasing order, which makes every lookup O(n); the red-black tree keeps
+ *   the height below 2 lg(n + 1), so lookups and insertions are O(log n).
+ *
+ *   The values of each key are stored in contiguous chunks; see mm_values.c.
+ *   The nodes and values are all allocated from an arena owned by the
+ *   multimap, so clearing the multimap frees a few large slabs instead of
+ *   every node and chunk.
+ *
+ *   A frozen multimap has no tree at all; its pairs are kept in the flat
+ *   arrays of mm_frozen.c instead, also allocated from the arena.
  *============================================================================*/
 
- /* Represents a value that is associated with a given key in the multimap. */
-typedef struct multimap_value {
-    int value;
-    struct multimap_value *next;
-} multimap_value;
+
+/* The number of probes that mm_contains_pairs() runs together. */
+#define PROBE_GROUP_SIZE 16
+
+
+/* The colors of red-black tree nodes. */
+typedef enum node_color {
+    BLACK = 0,
+    RED = 1
+} node_color;
 
 
 /* Represents a key and its associated values in the multimap, as well as
@@ -28,13 +51,13 @@ typedef struct multimap_node {
     /* The key-value that this multimap node represents. */
     int key;
 
-    /* A linked list of the values associated with this key in the multimap. */
-    multimap_value *values;
+    /* The color of the node in the red-black tree. */
+    node_color color;
 
-    /* The tail of the linked list of values, so that we can retain the order
-     * they were added to the list.
+    /* The values associated with this key in the multimap, in the order
+     * they were added.
      */
-    multimap_value *values_tail;
+    value_list values;
 
     /* The left child of the multimap node.  This will reference nodes that
      * hold keys that are strictly less than this node's key.
@@ -46,13 +69,24 @@ typedef struct multimap_node {
      */
     struct multimap_node *right_child;
 
-
+    /* The parent of the multimap node, or NULL for the root.  Rebalancing
+     * after an insertion walks back up the tree from the new node.
+     */
+    struct multimap_node *parent;
 } multimap_node;
 
 
 /* The entry-point of the multimap data structure. */
 struct multimap {
     multimap_node *root;
+
+    /* The pairs of the multimap if it is frozen, in which case the tree is
+     * empty, or NULL if it isn't.
+     */
+    frozen_multimap *frozen;
+
+    /* The arena that the nodes and values are allocated from. */
+    mm_arena arena;
 };
 
 
@@ -63,24 +97,33 @@ struct multimap {
  *   these are not visible outside of this module.
  *============================================================================*/
 
-multimap_node * alloc_mm_node();
+multimap_node * alloc_mm_node(multimap *mm);
 
-multimap_node * find_mm_node(multimap_node *root, int key,
-                             int create_if_not_found);
+multimap_node * find_mm_node(multimap_node *root, int key);
+multimap_node * find_next_mm_node(multimap_node *root, int key,
+                                  int inclusive);
+multimap_node * next_mm_node(multimap_node *node);
+multimap_node * insert_mm_node(multimap *mm, int key);
 
-void free_multimap_values(multimap_value *values);
-void free_multimap_node(multimap_node *node);
+void rotate_left(multimap *mm, multimap_node *node);
+void rotate_right(multimap *mm, multimap_node *node);
+void rebalance_after_insert(multimap *mm, multimap_node *node);
+
+multimap_node * link_subtree(multimap_node **nodes, int first, int last,
+                             int depth, int max_depth, multimap_node *parent);
 
 
 /*============================================================================
  * FUNCTION IMPLEMENTATIONS
  *============================================================================*/
 
-/* Allocates a multimap node, and zeros out its contents so that we know what
- * the initial value of everything will be.
+/* Allocates a multimap node from the multimap's arena, and zeros out its
+ * contents so that we know what the initial value of everything will be.
  */
-multimap_node * alloc_mm_node() {
-    multimap_node *node = malloc(sizeof(multimap_node));
+multimap_node * alloc_mm_node(multimap *mm) {
+    multimap_node *node;
+
+    node = arena_alloc(&mm->arena, sizeof(multimap_node), sizeof(void *));
     bzero(node, sizeof(multimap_node));
 
     return node;
@@ -88,92 +131,247 @@ multimap_node * alloc_mm_node() {
 
 
 /* This helper function searches for the multimap node that contains the
- * specified key.  If such a node doesn't exist, the function can initialize
- * a new node and add this into the structure, or it will simply return NULL.
- * The one exception is the root - if the root is NULL then the function will
- * return a new root node.
+ * specified key, and returns NULL if there isn't one.
  */
-multimap_node * find_mm_node(multimap_node *root, int key,
-                             int create_if_not_found) {
-    multimap_node *node;
+multimap_node * find_mm_node(multimap_node *root, int key) {
+    multimap_node *node = root;
 
-    /* If the entire multimap is empty, the root will be NULL. */
-    if (root == NULL) {
-        if (create_if_not_found) {
-            root = alloc_mm_node();
-            root->key = key;
-        }
-        return root;
+    while (node != NULL && node->key != key) {
+        if (node->key > key)
+            node = node->left_child;
+        else
+            node = node->right_child;
     }
 
-    /* Now we know the multimap has at least a root node, so start there. */
-    node = root;
-    while (1) {
-        if (node->key == key)
-            break;
+    return node;
+}
 
-        if (node->key > key) {   /* Follow left child */
-            if (node->left_child == NULL && create_if_not_found) {
-                /* No left child, but caller wants us to create a new node. */
-                multimap_node *new = alloc_mm_node();
-                new->key = key;
 
-                node->left_child = new;
-            }
+/* This helper function returns the node with the smallest key that is after
+ * the specified key, or NULL if there isn't one.  If inclusive is nonzero, a
+ * node with the key itself counts as being after it.
+ */
+multimap_node * find_next_mm_node(multimap_node *root, int key,
+                                  int inclusive) {
+    multimap_node *node = root, *next = NULL;
+
+    while (node != NULL) {
+        if (node->key > key || (inclusive && node->key == key)) {
+            /* This node is after the key, but there may be a closer one in
+             * its left subtree.
+             */
+            next = node;
             node = node->left_child;
         }
-        else {                   /* Follow right child */
-            if (node->right_child == NULL && create_if_not_found) {
-                /* No right child, but caller wants us to create a new node. */
-                multimap_node *new = alloc_mm_node();
-                new->key = key;
-
-                node->right_child = new;
-            }
+        else {
             node = node->right_child;
         }
+    }
+
+    return next;
+}
+
+
+/* This helper function returns the node with the next larger key after the
+ * specified node, or NULL if it is the last node.  The next node is the
+ * leftmost node of the right subtree if there is one, and otherwise the
+ * first ancestor whose left subtree holds the node, so walking the whole
+ * tree this way follows each link twice.
+ */
+multimap_node * next_mm_node(multimap_node *node) {
+    multimap_node *parent;
 
-        if (node == NULL)
-            break;
+    if (node->right_child != NULL) {
+        node = node->right_child;
+        while (node->left_child != NULL)
+            node = node->left_child;
+
+        return node;
     }
 
-    return node;
+    parent = node->parent;
+    while (parent != NULL && node == parent->right_child) {
+        node = parent;
+        parent = node->parent;
+    }
+
+    return parent;
 }
 
 
-/* This helper function frees all values in a multimap node's value-list. */
-void free_multimap_values(multimap_value *values) {
-    while (values != NULL) {
-        multimap_value *next = values->next;
-#ifdef DEBUG_ZERO
-        /* Clear out what we are about to free, to expose issues quickly. */
-        bzero(values, sizeof(multimap_value));
-#endif
-        free(values);
-        values = next;
+/* This helper function returns the multimap node that contains the specified
+ * key, adding a new node to the tree (and rebalancing it) if there isn't one
+ * already.
+ */
+multimap_node * insert_mm_node(multimap *mm, int key) {
+    multimap_node *parent = NULL, *node = mm->root, *new;
+
+    while (node != NULL) {
+        if (node->key == key)
+            return node;
+
+        parent = node;
+        if (node->key > key)
+            node = node->left_child;
+        else
+            node = node->right_child;
     }
+
+    new = alloc_mm_node(mm);
+    new->key = key;
+    new->color = RED;
+    new->parent = parent;
+
+    if (parent == NULL)
+        mm->root = new;
+    else if (parent->key > key)
+        parent->left_child = new;
+    else
+        parent->right_child = new;
+
+    rebalance_after_insert(mm, new);
+
+    return new;
 }
 
 
-/* This helper function frees a multimap node, including its children and
- * value-list.
+/* Rotates the subtree rooted at node to the left, so that node's right child
+ * takes its place and node becomes that child's left child.
  */
-void free_multimap_node(multimap_node *node) {
-    if (node == NULL)
-        return;
+void rotate_left(multimap *mm, multimap_node *node) {
+    multimap_node *child = node->right_child;
 
-    /* Free the children first. */
-    free_multimap_node(node->left_child);
-    free_multimap_node(node->right_child);
+    assert(child != NULL);
 
-    /* Free the list of values. */
-    free_multimap_values(node->values);
+    node->right_child = child->left_child;
+    if (child->left_child != NULL)
+        child->left_child->parent = node;
 
-#ifdef DEBUG_ZERO
-    /* Clear out what we are about to free, to expose issues quickly. */
-    bzero(node, sizeof(multimap_node));
-#endif
-    free(node);
+    child->parent = node->parent;
+    if (node->parent == NULL)
+        mm->root = child;
+    else if (node == node->parent->left_child)
+        node->parent->left_child = child;
+    else
+        node->parent->right_child = child;
+
+    child->left_child = node;
+    node->parent = child;
+}
+
+
+/* Rotates the subtree rooted at node to the right; the mirror image of
+ * rotate_left().
+ */
+void rotate_right(multimap *mm, multimap_node *node) {
+    multimap_node *child = node->left_child;
+
+    assert(child != NULL);
+
+    node->left_child = child->right_child;
+    if (child->right_child != NULL)
+        child->right_child->parent = node;
+
+    child->parent = node->parent;
+    if (node->parent == NULL)
+        mm->root = child;
+    else if (node == node->parent->right_child)
+        node->parent->right_child = child;
+    else
+        node->parent->left_child = child;
+
+    child->right_child = node;
+    node->parent = child;
+}
+
+
+/* Restores the red-black properties after the red node "node" has been added
+ * as a leaf.  The only property that can be broken is that a red node has no
+ * red children; the violation is either pushed up the tree by recoloring,
+ * when the node's uncle is red, or fixed with one or two rotations.
+ */
+void rebalance_after_insert(multimap *mm, multimap_node *node) {
+    multimap_node *parent, *grandparent, *uncle;
+
+    while ((parent = node->parent) != NULL && parent->color == RED) {
+        /* The root is black, so a red parent always has a parent. */
+        grandparent = parent->parent;
+        assert(grandparent != NULL);
+
+        if (parent == grandparent->left_child) {
+            uncle = grandparent->right_child;
+
+            if (uncle != NULL && uncle->color == RED) {
+                parent->color = BLACK;
+                uncle->color = BLACK;
+                grandparent->color = RED;
+                node = grandparent;
+                continue;
+            }
+
+            if (node == parent->right_child) {
+                rotate_left(mm, parent);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->color = BLACK;
+            grandparent->color = RED;
+            rotate_right(mm, grandparent);
+        }
+        else {
+            uncle = grandparent->left_child;
+
+            if (uncle != NULL && uncle->color == RED) {
+                parent->color = BLACK;
+                uncle->color = BLACK;
+                grandparent->color = RED;
+                node = grandparent;
+                continue;
+            }
+
+            if (node == parent->left_child) {
+                rotate_right(mm, parent);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->color = BLACK;
+            grandparent->color = RED;
+            rotate_left(mm, grandparent);
+        }
+    }
+
+    mm->root->color = BLACK;
+}
+
+
+/* Links the nodes first..last of a sorted array of nodes into a balanced
+ * subtree at the specified depth, and returns its root.  The middle node is
+ * the root and the halves on either side are its subtrees, so every path
+ * from the root of the whole tree to a leaf ends at depth max_depth or
+ * max_depth - 1.  Making just the nodes at max_depth red then gives every
+ * path the same number of black nodes.
+ */
+multimap_node * link_subtree(multimap_node **nodes, int first, int last,
+                             int depth, int max_depth, multimap_node *parent) {
+    multimap_node *node;
+    int mid;
+
+    if (first > last)
+        return NULL;
+
+    mid = first + (last - first) / 2;
+    node = nodes[mid];
+    node->parent = parent;
+    node->color = (depth == max_depth && depth > 0) ? RED : BLACK;
+
+    node->left_child = link_subtree(nodes, first, mid - 1, depth + 1,
+                                    max_depth, node);
+    node->right_child = link_subtree(nodes, mid + 1, last, depth + 1,
+                                     max_depth, node);
+
+    return node;
 }
 
 
@@ -181,6 +379,8 @@ void free_multimap_node(multimap_node *node) {
 multimap * init_multimap() {
     multimap *mm = malloc(sizeof(multimap));
     mm->root = NULL;
+    mm->frozen = NULL;
+    bzero(&mm->arena, sizeof(mm_arena));
     return mm;
 }
 
@@ -190,38 +390,104 @@ multimap * init_multimap() {
  */
 void clear_multimap(multimap *mm) {
     assert(mm != NULL);
-    free_multimap_node(mm->root);
+    clear_arena(&mm->arena);
     mm->root = NULL;
+    mm->frozen = NULL;
 }
 
 
 /* Adds the specified (key, value) pair to the multimap. */
 void mm_add_value(multimap *mm, int key, int value) {
     multimap_node *node;
-    multimap_value *new_value;
 
     assert(mm != NULL);
 
+    if (mm->frozen != NULL)
+        rebuild_multimap(mm, NULL, NULL);
+
     /* Look up the node with the specified key.  Create if not found. */
-    node = find_mm_node(mm->root, key, /* create */ 1);
-    if (mm->root == NULL)
-        mm->root = node;
+    node = insert_mm_node(mm, key);
 
     assert(node != NULL);
     assert(node->key == key);
 
     /* Add the new value to the multimap node. */
+    add_value_to_value_list(&node->values, value, &mm->arena);
+}
 
-    new_value = malloc(sizeof(multimap_value));
-    new_value->value = value;
-    new_value->next = NULL;
 
-    if (node->values_tail != NULL)
-        node->values_tail->next = new_value;
-    else
-        node->values = new_value;
+/* Adds n (key, value) pairs to the multimap, where keys[i] goes with
+ * values[i].  The pairs are sorted by key, so that an empty multimap can be
+ * built from the bottom up.
+ */
+void mm_add_values(multimap *mm, const int *keys, const int *values, int n) {
+    int *sorted_keys, *sorted_values;
+
+    if (n <= 0)
+        return;
 
-    node->values_tail = new_value;
+    sorted_keys = alloc_or_abort(n * sizeof(int));
+    sorted_values = alloc_or_abort(n * sizeof(int));
+    memcpy(sorted_keys, keys, n * sizeof(int));
+    memcpy(sorted_values, values, n * sizeof(int));
+
+    sort_pairs(sorted_keys, sorted_values, n);
+    mm_build_from_sorted(mm, sorted_keys, sorted_values, n);
+
+    free(sorted_keys);
+    free(sorted_values);
+}
+
+
+/* Like mm_add_values(), but the keys must be in nondecreasing order.  If the
+ * multimap is empty, a node is made for each key in order, and the nodes are
+ * then linked into a balanced tree without any searching or rotations.
+ * Otherwise the pairs are just added one at a time; in sorted order, each
+ * search follows much the same path as the one before, so that is still
+ * faster than adding them in random order.
+ */
+void mm_build_from_sorted(multimap *mm, const int *keys, const int *values,
+                          int n) {
+    multimap_node **nodes, *node = NULL;
+    int i, num_keys, max_depth;
+
+    assert(mm != NULL);
+
+    if (mm->frozen != NULL && n > 0)
+        rebuild_multimap(mm, NULL, NULL);
+
+    if (mm->root != NULL) {
+        for (i = 0; i < n; i++)
+            mm_add_value(mm, keys[i], values[i]);
+        return;
+    }
+
+    if (n <= 0)
+        return;
+
+    nodes = alloc_or_abort(n * sizeof(multimap_node *));
+    num_keys = 0;
+    for (i = 0; i < n; i++) {
+        if (i == 0 || keys[i] != keys[i - 1]) {
+            assert(i == 0 || keys[i] > keys[i - 1]);
+
+            node = alloc_mm_node(mm);
+            node->key = keys[i];
+            nodes[num_keys] = node;
+            num_keys++;
+        }
+
+        add_value_to_value_list(&node->values, values[i], &mm->arena);
+    }
+
+    /* The depth of the deepest nodes is floor(lg(num_keys)). */
+    max_depth = 0;
+    while (num_keys >> (max_depth + 1) != 0)
+        max_depth++;
+
+    mm->root = link_subtree(nodes, 0, num_keys - 1, 0, max_depth, NULL);
+
+    free(nodes);
 }
 
 
@@ -229,7 +495,10 @@ void mm_add_value(multimap *mm, int key, int value) {
  * otherwise.
  */
 int mm_contains_key(multimap *mm, int key) {
-    return find_mm_node(mm->root, key, /* create */ 0) != NULL;
+    if (mm->frozen != NULL)
+        return frozen_contains_key(mm->frozen, key);
+
+    return find_mm_node(mm->root, key) != NULL;
 }
 
 
@@ -238,21 +507,77 @@ int mm_contains_key(multimap *mm, int key) {
  */
 int mm_contains_pair(multimap *mm, int key, int value) {
     multimap_node *node;
-    multimap_value *curr;
 
-    node = find_mm_node(mm->root, key, /* create */ 0);
+    if (mm->frozen != NULL)
+        return frozen_contains_pair(mm->frozen, key, value);
+
+    node = find_mm_node(mm->root, key);
     if (node == NULL)
         return 0;
 
-    curr = node->values;
-    while (curr != NULL) {
-        if (curr->value == value)
-            return 1;
+    return value_list_contains_value(&node->values, value);
+}
+
+
+/* Probes the multimap for n (key, value) pairs at once.  Following a probe
+ * down the tree is a chain of cache misses, each of which has to finish
+ * before the next node is known, so instead the probes are run in groups:
+ * each round moves every probe in the group down one level, and starts
+ * loading its next node into the cache.  The loads of the whole group then
+ * overlap, and by the next round the nodes are (hopefully) in the cache.
+ */
+void mm_contains_pairs(multimap *mm, const int *keys, const int *values,
+                       int *results, int n) {
+    multimap_node *nodes[PROBE_GROUP_SIZE], *node;
+    int start, size, i, active;
 
-        curr = curr->next;
+    if (mm->frozen != NULL) {
+        frozen_contains_pairs(mm->frozen, keys, values, results, n);
+        return;
     }
 
-    return 0;
+    for (start = 0; start < n; start += PROBE_GROUP_SIZE) {
+        size = n - start;
+        if (size > PROBE_GROUP_SIZE)
+            size = PROBE_GROUP_SIZE;
+
+        for (i = 0; i < size; i++)
+            nodes[i] = mm->root;
+
+        /* Keep going until every probe has found its key or fallen off the
+         * bottom of the tree.
+         */
+        do {
+            active = 0;
+            for (i = 0; i < size; i++) {
+                node = nodes[i];
+                if (node == NULL || node->key == keys[start + i])
+                    continue;
+
+                if (node->key > keys[start + i])
+                    node = node->left_child;
+                else
+                    node = node->right_child;
+
+                if (node != NULL) {
+                    __builtin_prefetch(node);
+                    active = 1;
+                }
+                nodes[i] = node;
+            }
+        } while (active);
+
+        for (i = 0; i < size; i++) {
+            if (nodes[i] != NULL)
+                prefetch_value_list(&nodes[i]->values);
+        }
+
+        for (i = 0; i < size; i++) {
+            results[start + i] = nodes[i] != NULL &&
+                value_list_contains_value(&nodes[i]->values,
+                                          values[start + i]);
+        }
+    }
 }
 
 
@@ -260,18 +585,12 @@ int mm_contains_pair(multimap *mm, int key, int value) {
  * the multimap.
  */
 void mm_traverse_helper(multimap_node *node, void (*f)(int key, int value)) {
-    multimap_value *curr;
-
     if (node == NULL)
         return;
 
     mm_traverse_helper(node->left_child, f);
 
-    curr = node->values;
-    while (curr != NULL) {
-        f(node->key, curr->value);
-        curr = curr->next;
-    }
+    value_list_traverse(&node->values, node->key, f);
 
     mm_traverse_helper(node->right_child, f);
 }
@@ -281,19 +600,103 @@ void mm_traverse_helper(multimap_node *node, void (*f)(int key, int value)) {
  * pair to the specified function.
  */
 void mm_traverse(multimap *mm, void (*f)(int key, int value)) {
-    mm_traverse_helper(mm->root, f);
+    if (mm->frozen != NULL)
+        frozen_range(mm->frozen, /* all_keys */ 1, 0, 0, f);
+    else
+        mm_traverse_helper(mm->root, f);
 }
 
 
+/* Passes each (key, value) pair of the multimap with lo <= key < hi to the
+ * specified function, in key order.  This finds the first key in the range,
+ * and then walks from node to node through the parent links.
+ */
+void mm_range(multimap *mm, int lo, int hi, void (*f)(int key, int value)) {
+    multimap_node *node;
 
-/*
+    if (mm->frozen != NULL) {
+        frozen_range(mm->frozen, /* all_keys */ 0, lo, hi, f);
+        return;
+    }
 
+    node = find_next_mm_node(mm->root, lo, /* inclusive */ 1);
+    while (node != NULL && node->key < hi) {
+        value_list_traverse(&node->values, node->key, f);
+        node = next_mm_node(node);
+    }
+}
 
-structs:
 
-  value_list
-  mini_tree
-  tree
+/* Starts a cursor at the first pair of the multimap whose key is at least the
+ * specified key.
+ */
+void mm_iter_seek(multimap *mm, mm_iter *iter, int key) {
+    multimap_node *node;
+
+    bzero(iter, sizeof(mm_iter));
+    iter->mm = mm;
 
+    if (mm->frozen != NULL) {
+        frozen_iter_seek(mm->frozen, iter, key);
+        return;
+    }
 
-*/
+    node = find_next_mm_node(mm->root, key, /* inclusive */ 1);
+    if (node != NULL) {
+        iter->node = node;
+        iter->key = node->key;
+        iter->values = node->values.first;
+    }
+}
+
+
+/* Stores the pair at a cursor into *key and *value, and moves the cursor to
+ * the next pair.  The cursor holds the chunk of the next value, and the
+ * index of the value within the chunk.
+ */
+int mm_iter_next(mm_iter *iter, int *key, int *value) {
+    multimap_node *node = iter->node;
+    const value_chunk *chunk = iter->values;
+    int index = iter->index;
+
+    if (iter->mm->frozen != NULL)
+        return frozen_iter_next(iter, key, value);
+
+    if (node == NULL)
+        return 0;
+
+    while (chunk == NULL || index >= chunk->size) {
+        if (chunk != NULL) {
+            chunk = chunk->next;
+        }
+        else {
+            /* The current key has no more values; move on to the next. */
+            node = next_mm_node(node);
+            if (node == NULL) {
+                iter->node = NULL;
+                iter->values = NULL;
+                return 0;
+            }
+            chunk = node->values.first;
+        }
+        index = 0;
+    }
+
+    iter->node = node;
+    iter->key = node->key;
+    iter->values = chunk;
+    iter->index = index + 1;
+
+    *key = node->key;
+    *value = chunk->values[index];
+    return 1;
+}
+
+
+/* Freezes the multimap, replacing the tree with the arrays of mm_frozen.c. */
+void mm_freeze(multimap *mm) {
+    assert(mm != NULL);
+
+    if (mm->frozen == NULL)
+        rebuild_multimap(mm, &mm->frozen, &mm->arena);
+}